@@ -0,0 +1,54 @@
+#!/bin/sh
+# Shuffle volume with and without worker-side aggregation across chunks.
+#
+# Runs the same job twice on localhost: once with `worker -F 1`, which
+# sends the counts of every committed chunk to the reducer straight away
+# (the old behaviour), and once with the default, where each worker adds
+# up all its chunks and sends once at the end of the job. Reports the
+# bytes and result frames the workers shipped, the entries the reducer
+# merged, and checks the final counts against a reference count.
+#
+# Run from the repository root after `make`.
+# USAGE: bench/aggregate_bench.sh [workers] [copies] [chunk_size]
+
+WORKERS=${1:-4}
+COPIES=${2:-20}
+CHUNK=${3:-4K}
+BASE_PORT=9300
+REDUCER_PORT=5700
+TMP=${TMPDIR:-/tmp}/aggregate_bench.$$
+
+. bench/common.sh
+mkdir -p "$TMP"
+sample_input "$COPIES" "$TMP/input.txt"
+reference_counts "$TMP/input.txt" "$TMP/expected"
+
+run() {
+  label=$1
+  shift
+  # -v: the merged entries are read from the per-frame log lines
+  ./reducer -v $REDUCER_PORT > "$TMP/reducer.out" 2>&1 &
+  rpid=$!
+
+  start_workers "$WORKERS" $BASE_PORT -r 127.0.0.1:$REDUCER_PORT "$@"
+
+  ./driver -c "$CHUNK" -w "$wlist" "$TMP/input.txt" "$WORKERS" > "$TMP/driver.out" 2>&1
+  kill -TSTP $rpid
+  sleep 0.5
+  kill $wpids 2>/dev/null
+
+  reducer_counts "$TMP/reducer.out" > "$TMP/got"
+  if cmp -s "$TMP/expected" "$TMP/got"; then check=ok; else check=MISMATCH; fi
+
+  kill $rpid 2>/dev/null
+  wait 2>/dev/null
+  shipped=$(cat "$TMP"/worker.*.out | awk '/^Shipped/ { b += $2; f += $5 } END { printf "%d bytes in %d frames", b, f }')
+  merged=$(awk '/^Received/ { e += substr($4, 2) } END { print e + 0 }' "$TMP/reducer.out")
+  printf '%-18s %s, reducer merged %s entries, counts %s\n' "$label" "$shipped" "$merged" "$check"
+}
+
+echo "aggregate_bench: $WORKERS workers, $(wc -c < "$TMP/input.txt") bytes in $CHUNK chunks"
+run "ship every chunk" -F 1
+run "aggregate per job"
+
+rm -rf "$TMP"
@@ -0,0 +1,142 @@
+/* Driver -> worker throughput as a function of chunk size.
+ *
+ * Starts ./reducer on port 5555 (where the worker sends its results)
+ * and one ./worker on WORKER_PORT, then streams the same volume of text
+ * to the worker over one persistent connection for each chunk size and
+ * reports MB/s. Timing stops when the worker acknowledges FRAME_END,
+ * so it covers counting and shipping results, not just socket buffering.
+ *
+ * Run from the repository root after `make`.
+ * USAGE: chunk_bench [text_file] [total_mb] */
+
+#include "../proto.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define WORKER_PORT "9888"
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static pid_t
+spawn(char *const argv[])
+{
+    pid_t pid = fork();
+
+    if(pid == 0) {
+        /* keep the per-chunk logging out of the measurement output */
+        freopen("/dev/null", "w", stdout);
+        execv(argv[0], argv);
+        perror(argv[0]);
+        _exit(1);
+    }
+    return pid;
+}
+
+static int
+connect_retry(const char *ip, const char *port)
+{
+    int sock, i;
+
+    for(i = 0; i < 100; i++) {
+        if((sock = ConnectTo(ip, port)) >= 0) return sock;
+        usleep(20000);
+    }
+    return -1;
+}
+
+/* fill buf with copies of text, so every chunk looks like the input */
+static void
+fill(char *buf, size_t size, const char *text, size_t text_len)
+{
+    size_t off, n;
+
+    for(off = 0; off < size; off += n) {
+        n = size - off < text_len ? size - off : text_len;
+        memcpy(buf + off, text, n);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *path = argc > 1 ? argv[1] : "data/large_text.txt";
+    size_t total = (argc > 2 ? atol(argv[2]) : 64) << 20;
+    static const size_t sizes[] = { 64 << 10, 256 << 10, 1 << 20, 4 << 20, 16 << 20, 64 << 20 };
+    char *reducer_argv[] = { "./reducer", "5555", 0 };
+    char *worker_argv[] = { "./worker", WORKER_PORT, 0 };
+    struct frame_header header;
+    pid_t reducer, worker;
+    char *text, *chunk;
+    size_t text_len, sent, n;
+    uint32_t seq;
+    unsigned i;
+    double t0, t;
+    FILE *fp;
+    int sock;
+
+    if((fp = fopen(path, "rb")) == 0) {
+        perror(path);
+        return 1;
+    }
+    text = malloc(1 << 20);
+    assert(text != 0);
+    text_len = fread(text, 1, 1 << 20, fp);
+    fclose(fp);
+
+    reducer = spawn(reducer_argv);
+    worker = spawn(worker_argv);
+
+    chunk = malloc(sizes[sizeof(sizes) / sizeof(sizes[0]) - 1]);
+    assert(chunk != 0);
+
+    printf("chunk_bench: %s, %zu MB per chunk size, 1 worker\n", path, total >> 20);
+    printf("  %10s %8s %10s\n", "chunk", "chunks", "MB/s");
+
+    for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        fill(chunk, sizes[i], text, text_len);
+
+        if((sock = connect_retry("127.0.0.1", WORKER_PORT)) < 0) {
+            perror("connect to worker");
+            break;
+        }
+
+        t0 = now_sec();
+        for(sent = 0, seq = 0; sent < total; sent += n, seq++) {
+            n = total - sent < sizes[i] ? total - sent : sizes[i];
+            if(SendFrame(sock, FRAME_CHUNK, seq, chunk, n) < 1) break;
+        }
+        if(SendFrame(sock, FRAME_END, 0, 0, 0) < 1 ||
+           RecvFrameHeader(sock, &header) < 1 || header.type != FRAME_END) {
+            fprintf(stderr, "worker did not acknowledge end of job\n");
+            close(sock);
+            break;
+        }
+        t = now_sec() - t0;
+        close(sock);
+
+        printf("  %9zuK %8u %10.1f\n", sizes[i] >> 10, seq, (total / 1048576.0) / t);
+    }
+
+    kill(worker, SIGTERM);
+    kill(reducer, SIGTERM);
+    waitpid(worker, 0, 0);
+    waitpid(reducer, 0, 0);
+
+    free(chunk);
+    free(text);
+    return 0;
+}
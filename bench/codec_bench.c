@@ -0,0 +1,212 @@
+/* Text vs binary encoding of worker results.
+ *
+ * Compares the old "word:count," text format (encoded the way the worker
+ * used to, decoded with strtok/atoi the way the reducer used to) against the varint
+ * format in codec.c, unsorted and sorted with shared-prefix compression.
+ * Reports encoded bytes and encode/decode time, and checks that every
+ * format round-trips to the same dictionary.
+ *
+ * USAGE: codec_bench [text_file] [rounds] [synthetic_keys] */
+
+#include "../dict.c"
+#include "../codec.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static Dict
+count_file(const char *path)
+{
+    FILE *fp;
+    char *text, *p;
+    long size;
+    Dict d = DictCreate();
+
+    if((fp = fopen(path, "rb")) == 0) {
+        perror(path);
+        exit(1);
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    text = malloc(size + 1);
+    assert(text != 0);
+    size = fread(text, 1, size, fp);
+    text[size] = '\0';
+    fclose(fp);
+
+    /* normalize like the worker, so keys never contain ':' or ',' */
+    for(p = text; *p; p++) *p = ispunct((unsigned char) *p) ? ' ' : tolower((unsigned char) *p);
+    for(p = strtok(text, " \t\r\n"); p != 0; p = strtok(0, " \t\r\n")) DictIncrement(d, p, 1);
+
+    free(text);
+    return d;
+}
+
+static Dict
+synthetic(int n)
+{
+    char key[32];
+    int i;
+    Dict d = DictCreate();
+
+    /* URL-like keys with long shared prefixes and skewed counts; */
+    /* no ':' or ',' since the text format cannot carry them */
+    for(i = 0; i < n; i++) {
+        snprintf(key, sizeof(key), "www.host%d.com/p/%d", i % 97, i);
+        DictInsert(d, key, 1 + (i % 1000 == 0 ? 50000 : i % 7));
+    }
+    return d;
+}
+
+struct text {
+    char *buf;
+    long length;
+};
+
+static void
+text_entry(const char *key, unsigned int len, int value, void *arg)
+{
+    struct text *t = arg;
+    char item_value[15];
+    int item_len;
+
+    sprintf(item_value, "%d", value);
+    item_len = len + strlen(item_value) + 2;
+
+    /* grown by every item, as it was */
+    t->buf = realloc(t->buf, t->length + item_len + 1);
+    assert(t->buf != 0);
+    t->length += sprintf(t->buf + t->length, "%.*s:%s,", (int) len, key, item_value);
+}
+
+/* the worker's former text encoder */
+static char *
+text_encode(Dict d)
+{
+    struct text t = { 0, 0 };
+
+    DictForEach(d, text_entry, &t);
+    return t.buf;
+}
+
+/* the reducer's former text decoder */
+static void
+text_merge(Dict d, char *enc)
+{
+    char *word, *count;
+
+    for(word = strtok(enc, ",:"); word != 0; word = strtok(0, ",:")) {
+        if((count = strtok(0, ",:")) == 0) break;
+        DictIncrement(d, word, atoi(count));
+    }
+}
+
+struct check {
+    Dict other;
+    int bad;
+};
+
+static void
+check_entry(const char *key, unsigned int len, int value, void *arg)
+{
+    struct check *c = arg;
+
+    if(DictSearch(c->other, key) != value) c->bad++;
+}
+
+static int
+same(Dict a, Dict b)
+{
+    struct check c;
+
+    c.other = b;
+    c.bad = 0;
+    DictForEach(a, check_entry, &c);
+
+    return c.bad == 0 && DictSize(a) == DictSize(b);
+}
+
+static void
+bench(const char *label, Dict d, int rounds)
+{
+    char *enc = 0, *copy;
+    size_t len = 0, text_len = 0;
+    double t0, te, td;
+    int r, flags, ok;
+    Dict out = 0;
+
+    printf("%s: %d keys\n", label, DictSize(d));
+    printf("  %-10s %10s %12s %12s %s\n", "format", "bytes", "encode ms", "decode ms", "round-trip");
+
+    /* text */
+    te = td = 0;
+    for(r = 0; r < rounds; r++) {
+        t0 = now_sec();
+        enc = text_encode(d);
+        te += now_sec() - t0;
+
+        text_len = strlen(enc);
+        copy = enc;
+        if(out) DictDestroy(out);
+        out = DictCreate();
+        t0 = now_sec();
+        text_merge(out, copy);
+        td += now_sec() - t0;
+        free(enc);
+    }
+    printf("  %-10s %10zu %12.3f %12.3f %s\n", "text", text_len,
+           te * 1e3 / rounds, td * 1e3 / rounds, same(d, out) ? "ok" : "MISMATCH");
+
+    for(flags = 0; flags <= CODEC_SORTED; flags += CODEC_SORTED) {
+        te = td = 0;
+        ok = 1;
+        for(r = 0; r < rounds; r++) {
+            t0 = now_sec();
+            enc = DictEncode(d, flags, &len);
+            te += now_sec() - t0;
+
+            DictDestroy(out);
+            out = DictCreate();
+            t0 = now_sec();
+            if(DictMerge(out, enc, len) != DictSize(d)) ok = 0;
+            td += now_sec() - t0;
+            free(enc);
+        }
+        printf("  %-10s %10zu %12.3f %12.3f %s\n", flags ? "varint-srt" : "varint",
+               len, te * 1e3 / rounds, td * 1e3 / rounds, ok && same(d, out) ? "ok" : "MISMATCH");
+    }
+
+    DictDestroy(out);
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *path = argc > 1 ? argv[1] : "data/large_text.txt";
+    int rounds = argc > 2 ? atoi(argv[2]) : 20;
+    int keys = argc > 3 ? atoi(argv[3]) : 200000;
+    Dict d;
+
+    d = count_file(path);
+    bench(path, d, rounds);
+    DictDestroy(d);
+
+    d = synthetic(keys);
+    bench("synthetic urls", d, rounds);
+    DictDestroy(d);
+
+    return 0;
+}
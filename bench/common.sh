@@ -0,0 +1,46 @@
+# Helpers shared by the bench scripts, sourced from the repository root
+# with `. bench/common.sh`. They write under $TMP, which the script sets.
+
+export LC_ALL=C
+
+# sample_input copies file: that many copies of the sample text
+sample_input() {
+  n=0
+  while [ $n -lt "$1" ]; do
+    cat data/large_text.txt
+    n=$((n + 1))
+  done > "$2"
+}
+
+# reference_counts input expected: "word count" lines in byte order,
+# counted by a single pipeline that tokenizes the way the worker does
+reference_counts() {
+  tr -d '[:punct:]' < "$1" | tr 'A-Z' 'a-z' | tr -s '\000-\040' '\n' |
+    grep -v '^$' | sort | uniq -c | awk '{ print $2, $1 }' | sort > "$2"
+}
+
+# reducer_counts output...: the counts printed by reducers (or by
+# driver -l) as "word count" lines in byte order
+reducer_counts() {
+  sed -n 's/^dict\[\(.*\)\] = \(.*\)$/\1 \2/p' "$@" | sort
+}
+
+# start_workers n base_port [worker options]: n workers on consecutive
+# ports, worker i logging to $TMP/worker.i.out. With WORKER_STATS_PORT
+# set, worker i serves its metrics on that port plus i. Sets wlist, the
+# addresses for driver -w, and wpids.
+start_workers() {
+  wlist=""
+  wpids=""
+  n=0
+  count=$1
+  base=$2
+  shift 2
+  while [ $n -lt "$count" ]; do
+    ./worker ${WORKER_STATS_PORT:+-M $((WORKER_STATS_PORT + n))} "$@" $((base + n)) > "$TMP/worker.$n.out" 2>&1 &
+    wpids="$wpids $!"
+    wlist="$wlist${wlist:+,}127.0.0.1:$((base + n))"
+    n=$((n + 1))
+  done
+  sleep 0.5
+}
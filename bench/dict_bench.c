@@ -0,0 +1,172 @@
+/* Microbenchmark for the Dict implementation.
+ *
+ * Built twice by `make bench`: once against dict.c (open addressing)
+ * and once with -DDICT_CHAINED against bench/dict_chained.c (the
+ * original chained table), so the two can be compared on the same
+ * workloads.
+ *
+ * USAGE: dict_bench [text_file] [rounds] [distinct_keys] */
+
+#ifdef DICT_CHAINED
+#include "dict_chained.c"
+#define DICT_IMPL "chained"
+#else
+#include "../dict.c"
+#define DICT_IMPL "open-addressing"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *
+read_file(const char *path, size_t *len)
+{
+    FILE *fp;
+    char *buf;
+    long size;
+
+    fp = fopen(path, "rb");
+    if(fp == 0) {
+        perror(path);
+        exit(1);
+    }
+
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    buf = malloc(size + 1);
+    assert(buf != 0);
+
+    *len = fread(buf, 1, size, fp);
+    buf[*len] = '\0';
+    fclose(fp);
+
+    return buf;
+}
+
+/* split text into lowercased tokens, returned as an array of pointers */
+static char **
+tokenize(char *text, size_t *ntokens)
+{
+    char **tokens = 0;
+    size_t n = 0, cap = 0;
+    char *p;
+
+    for(p = text; *p; p++) *p = tolower((unsigned char) *p);
+
+    for(p = strtok(text, " \t\r\n"); p != 0; p = strtok(0, " \t\r\n")) {
+        if(n == cap) {
+            cap = cap ? cap * 2 : 1024;
+            tokens = realloc(tokens, cap * sizeof(*tokens));
+            assert(tokens != 0);
+        }
+        tokens[n++] = p;
+    }
+
+    *ntokens = n;
+    return tokens;
+}
+
+/* the counting pattern used by worker.c and reducer.c */
+static void
+count_token(Dict d, const char *token)
+{
+    int value = DictSearch(d, token);
+
+    if(value == 0) {
+        DictInsert(d, token, 1);
+    } else {
+        DictDelete(d, token);
+        DictInsert(d, token, value + 1);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *path = argc > 1 ? argv[1] : "data/large_text.txt";
+    int rounds = argc > 2 ? atoi(argv[2]) : 20;
+    int distinct = argc > 3 ? atoi(argv[3]) : 1000000;
+    char *text;
+    size_t len, ntokens, i;
+    char **tokens;
+    char (*keys)[16];
+    double t0, t;
+    long sum;
+    int r;
+    Dict d;
+
+    text = read_file(path, &len);
+    tokens = tokenize(text, &ntokens);
+
+    printf("dict_bench [%s]\n", DICT_IMPL);
+
+    /* word count: search + delete + insert per token, fresh dict per round */
+    t0 = now_sec();
+    for(r = 0; r < rounds; r++) {
+        d = DictCreate();
+        for(i = 0; i < ntokens; i++) count_token(d, tokens[i]);
+        DictDestroy(d);
+    }
+    t = now_sec() - t0;
+    printf("  count   %-28s %10zu tokens x %d  %8.1f ns/token  (search+delete+insert)\n",
+           path, ntokens, rounds, t * 1e9 / ((double) ntokens * rounds));
+
+#ifndef DICT_CHAINED
+    /* word count: one DictIncrement per token */
+    t0 = now_sec();
+    for(r = 0; r < rounds; r++) {
+        d = DictCreate();
+        for(i = 0; i < ntokens; i++) DictIncrement(d, tokens[i], 1);
+        DictDestroy(d);
+    }
+    t = now_sec() - t0;
+    printf("  count   %-28s %10zu tokens x %d  %8.1f ns/token  (DictIncrement)\n",
+           path, ntokens, rounds, t * 1e9 / ((double) ntokens * rounds));
+#endif
+
+    keys = malloc(sizeof(*keys) * distinct);
+    assert(keys != 0);
+    for(r = 0; r < distinct; r++) snprintf(keys[r], sizeof(keys[r]), "key%d", r);
+
+    /* distinct inserts: exercises growth */
+    d = DictCreate();
+    t0 = now_sec();
+    for(r = 0; r < distinct; r++) DictInsert(d, keys[r], r + 1);
+    t = now_sec() - t0;
+    printf("  insert  %-28d keys            %8.1f ns/op\n", distinct, t * 1e9 / distinct);
+
+    /* successful lookups */
+    sum = 0;
+    t0 = now_sec();
+    for(r = 0; r < distinct; r++) sum += DictSearch(d, keys[r]);
+    t = now_sec() - t0;
+    printf("  search  %-28d keys            %8.1f ns/op  (checksum %ld)\n",
+           distinct, t * 1e9 / distinct, sum);
+
+    /* deletes */
+    t0 = now_sec();
+    for(r = 0; r < distinct; r++) DictDelete(d, keys[r]);
+    t = now_sec() - t0;
+    printf("  delete  %-28d keys            %8.1f ns/op\n", distinct, t * 1e9 / distinct);
+
+    DictDestroy(d);
+    free(keys);
+    free(tokens);
+    free(text);
+
+    return 0;
+}
@@ -0,0 +1,146 @@
+#!/bin/sh
+# End-to-end job on localhost, reported as JSON.
+#
+# Generates a Zipf-distributed corpus with bench/zipf_corpus (or takes
+# an existing file from $INPUT), starts a reducer and N workers, runs
+# the driver over the corpus and checks the reducer's counts against the
+# generator's exact counts. For a file from $INPUT, the reference is a
+# count by a single tr | sort | uniq pipeline. Every node serves its
+# metrics on a stats port (-M), and the driver prints its own at the end.
+# With LOCAL=1 the same job runs in the driver alone (`driver -l`), on
+# as many threads as there would be workers, as a baseline for the cost
+# of distributing it; "workers" then counts those threads.
+#
+# Prints one JSON object on stdout: the commit, the corpus parameters,
+# wall time and MB/s of the driver, whether the counts matched, and for
+# each process its peak RSS, counters, gauges and per-stage timings.
+# Each stage has its count, mean, p50, p90, p99 and max, and total_ns,
+# the time spent in it summed over all threads. Progress goes to stderr.
+# The exit status is 1 if the counts did not match.
+#
+# Run from the repository root after `make bench/zipf_corpus`.
+# USAGE: bench/e2e_bench.sh [workers] [size] [vocabulary] [exponent] [chunk_size]
+
+WORKERS=${1:-4}
+SIZE=${2:-64M}
+VOCABULARY=${3:-100000}
+EXPONENT=${4:-1.0}
+CHUNK=${5:-1M}
+SEED=${SEED:-1}
+BASE_PORT=9000
+REDUCER_PORT=6000
+STATS_PORT=9050
+TMP=${TMPDIR:-/tmp}/e2e_bench.$$
+
+. bench/common.sh
+mkdir -p "$TMP"
+
+if [ -n "$INPUT" ]; then
+  input=$INPUT
+  echo "e2e_bench: counting $input for reference" >&2
+  reference_counts "$input" "$TMP/expected"
+else
+  input=$TMP/input.txt
+  echo "e2e_bench: generating $SIZE, $VOCABULARY words, exponent $EXPONENT" >&2
+  ./bench/zipf_corpus "$input" "$SIZE" "$VOCABULARY" "$EXPONENT" "$SEED" "$TMP/counts" || exit 1
+  sort "$TMP/counts" > "$TMP/expected"
+fi
+bytes=$(wc -c < "$input")
+
+# a node's metrics, as served on its stats port
+stats() {
+  bash -c 'exec 3<>/dev/tcp/127.0.0.1/$1 && cat <&3' _ "$1"
+}
+
+# metric dump lines as the members of a JSON object: a counter or gauge
+# is a number, a histogram an object of its fields plus total_ns
+to_json() {
+  awk '
+    NF == 2 { line = sprintf("\"%s\": %s", $1, $2) }
+    NF > 2 {
+      line = sprintf("\"%s\": {", $1)
+      for (i = 2; i < NF; i += 2) {
+        line = line sprintf("\"%s\": %s, ", $i, $(i + 1))
+        if ($i == "count") count = $(i + 1)
+        if ($i == "mean") mean = $(i + 1)
+      }
+      line = line sprintf("\"total_ns\": %.0f}", count * mean)
+    }
+    NF >= 2 { printf "%s%s", n++ ? ", " : "", line }
+  ' "$1"
+}
+
+if [ -n "$LOCAL" ]; then
+  mode=local
+  echo "e2e_bench: $bytes bytes in $CHUNK chunks on $WORKERS local threads" >&2
+  start=$(date +%s.%N)
+  ./driver -l -q -M $STATS_PORT -c "$CHUNK" "$input" "$WORKERS" > "$TMP/driver.out" 2> "$TMP/driver.err"
+  status=$?
+  end=$(date +%s.%N)
+
+  # the counts and then the metrics, on the same output
+  grep -v -e '^dict\[' -e '^Final word count:' -e '^$' "$TMP/driver.out" > "$TMP/driver.stats"
+  reducer_counts "$TMP/driver.out" > "$TMP/got"
+else
+  mode=distributed
+  ./reducer -M $STATS_PORT $REDUCER_PORT > "$TMP/reducer.out" 2>&1 &
+  rpid=$!
+  WORKER_STATS_PORT=$((STATS_PORT + 1)) start_workers "$WORKERS" $BASE_PORT -r 127.0.0.1:$REDUCER_PORT
+
+  echo "e2e_bench: $bytes bytes in $CHUNK chunks on $WORKERS workers" >&2
+  start=$(date +%s.%N)
+  ./driver -q -M $((STATS_PORT + 1 + WORKERS)) -c "$CHUNK" -w "$wlist" "$input" "$WORKERS" > "$TMP/driver.stats" 2> "$TMP/driver.err"
+  status=$?
+  end=$(date +%s.%N)
+
+  stats $STATS_PORT > "$TMP/reducer.stats"
+  i=0
+  while [ $i -lt "$WORKERS" ]; do
+    stats $((STATS_PORT + 1 + i)) > "$TMP/worker.$i.stats"
+    i=$((i + 1))
+  done
+  kill -TSTP $rpid
+  sleep 0.5
+  kill $wpids 2>/dev/null
+
+  reducer_counts "$TMP/reducer.out" > "$TMP/got"
+  kill $rpid 2>/dev/null
+  wait 2>/dev/null
+fi
+if [ $status -eq 0 ] && cmp -s "$TMP/expected" "$TMP/got"; then counts_ok=true; else counts_ok=false; fi
+
+wall=$(echo "$start $end" | awk '{ printf "%.3f", $2 - $1 }')
+mbps=$(echo "$bytes $wall" | awk '{ printf "%.1f", $1 / 1048576 / $2 }')
+if [ -n "$INPUT" ]; then
+  corpus="\"file\": \"$INPUT\""
+else
+  corpus="\"size\": \"$SIZE\", \"vocabulary\": $VOCABULARY, \"exponent\": $EXPONENT, \"seed\": $SEED"
+fi
+
+echo "{"
+echo "  \"version\": \"$(git describe --always --dirty 2>/dev/null || echo unknown)\","
+echo "  \"corpus\": {$corpus, \"bytes\": $bytes, \"distinct_words\": $(wc -l < "$TMP/expected")},"
+echo "  \"mode\": \"$mode\", \"workers\": $WORKERS, \"chunk_size\": \"$CHUNK\","
+echo "  \"wall_s\": $wall, \"mb_per_s\": $mbps, \"counts_ok\": $counts_ok,"
+echo "  \"processes\": ["
+if [ $mode = local ]; then
+  echo "    {\"role\": \"driver\", $(to_json "$TMP/driver.stats")}"
+else
+  echo "    {\"role\": \"driver\", $(to_json "$TMP/driver.stats")},"
+  i=0
+  while [ $i -lt "$WORKERS" ]; do
+    echo "    {\"role\": \"worker\", \"port\": $((BASE_PORT + i)), $(to_json "$TMP/worker.$i.stats")},"
+    i=$((i + 1))
+  done
+  echo "    {\"role\": \"reducer\", $(to_json "$TMP/reducer.stats")}"
+fi
+echo "  ]"
+echo "}"
+
+if [ $counts_ok = false ]; then
+  cat "$TMP/driver.err" >&2
+  echo "e2e_bench: counts do not match the reference" >&2
+  rm -rf "$TMP"
+  exit 1
+fi
+rm -rf "$TMP"
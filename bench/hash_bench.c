@@ -0,0 +1,213 @@
+/* Hash function quality and speed.
+ *
+ * For each hash function in dict.c, on the words of a text file and on
+ * a few synthetic key sets (sequential ids, URLs, long keys), reports
+ * the time per key and how evenly the hashes fill a power-of-two table
+ * indexed by masking the low bits: the fraction of empty buckets
+ * against the ideal for a random hash, and the fullest bucket. Then
+ * prints the probe-length histogram of a Dict built with the hash
+ * selected at build time (make HASH=...).
+ *
+ * USAGE: hash_bench [text_file] */
+
+#include "../dict.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+
+#define SYNTHETIC_KEYS (200000)
+#define ROUNDS (20)
+#define HISTOGRAM (10)
+
+#define STRINGIFY(x) #x
+#define NAME_OF(x) STRINGIFY(x)
+
+typedef uint64_t (*hash_fn)(const char *, unsigned int, uint64_t);
+
+struct hash {
+    const char *name;
+    hash_fn fn;
+};
+
+struct keyset {
+    const char *name;
+    char **keys;
+    unsigned int *lens;
+    int n;
+};
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+add_key(struct keyset *ks, const char *key, unsigned int len)
+{
+    ks->keys[ks->n] = malloc(len + 1);
+    assert(ks->keys[ks->n] != 0);
+    memcpy(ks->keys[ks->n], key, len);
+    ks->keys[ks->n][len] = '\0';
+    ks->lens[ks->n] = len;
+    ks->n++;
+}
+
+static void
+keyset_init(struct keyset *ks, const char *name, int capacity)
+{
+    ks->name = name;
+    ks->keys = malloc(capacity * sizeof(char *));
+    ks->lens = malloc(capacity * sizeof(unsigned int));
+    assert(ks->keys != 0 && ks->lens != 0);
+    ks->n = 0;
+}
+
+static void
+collect_key(const char *key, unsigned int len, int value, void *arg)
+{
+    add_key(arg, key, len);
+}
+
+/* distinct lowercased words of a file */
+static void
+load_words(struct keyset *ks, const char *path)
+{
+    FILE *fp;
+    char word[256];
+    unsigned int len = 0;
+    int c;
+    Dict d = DictCreate();
+
+    if((fp = fopen(path, "rb")) == 0) {
+        perror(path);
+        exit(1);
+    }
+    do {
+        c = getc(fp);
+        if(c != EOF && !isspace(c)) {
+            if(len < sizeof(word)) word[len++] = tolower(c);
+        } else if(len > 0) {
+            DictIncrementLen(d, word, len, 1);
+            len = 0;
+        }
+    } while(c != EOF);
+    fclose(fp);
+
+    keyset_init(ks, path, DictSize(d));
+    DictForEach(d, collect_key, ks);
+    DictDestroy(d);
+}
+
+static void
+time_hash(struct hash *h, struct keyset *ks, double *ns_per_key)
+{
+    uint64_t sink = 0;
+    double t0;
+    int r, i;
+
+    t0 = now_sec();
+    for(r = 0; r < ROUNDS; r++) {
+        for(i = 0; i < ks->n; i++) sink += h->fn(ks->keys[i], ks->lens[i], r);
+    }
+    *ns_per_key = (now_sec() - t0) * 1e9 / ((double) ROUNDS * ks->n) + (sink == 1);
+}
+
+/* fill 2^k buckets, at most 3/4 loaded, by the low bits of the hash */
+static void
+bucket_fill(struct hash *h, struct keyset *ks, double *empty, double *ideal, int *fullest)
+{
+    int size = 1, i, n_empty = 0;
+    int *buckets;
+
+    while(size * 3 < ks->n * 4) size <<= 1;
+    buckets = calloc(size, sizeof(int));
+    assert(buckets != 0);
+
+    for(i = 0; i < ks->n; i++) buckets[h->fn(ks->keys[i], ks->lens[i], 0) & (size - 1)]++;
+
+    *fullest = 0;
+    for(i = 0; i < size; i++) {
+        if(buckets[i] == 0) n_empty++;
+        if(buckets[i] > *fullest) *fullest = buckets[i];
+    }
+    *empty = (double) n_empty / size;
+    *ideal = exp(-(double) ks->n / size);
+
+    free(buckets);
+}
+
+static void
+probe_histogram(struct keyset *ks)
+{
+    long counts[HISTOGRAM];
+    int i, longest;
+    Dict d = DictCreate();
+
+    for(i = 0; i < ks->n; i++) DictIncrementLen(d, ks->keys[i], ks->lens[i], 1);
+    longest = DictProbeHistogram(d, counts, HISTOGRAM);
+
+    printf("  %-22s", ks->name);
+    for(i = 0; i < HISTOGRAM; i++) printf(" %6.2f%%", 100.0 * counts[i] / ks->n);
+    printf("   %d\n", longest);
+
+    DictDestroy(d);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct hash hashes[] = {
+        { "mult97", hash_mult97 },
+        { "fnv1a", hash_fnv1a },
+        { "wyhash", hash_wyhash },
+    };
+    struct keyset sets[4];
+    char key[128];
+    double ns, empty, ideal;
+    int i, j, fullest;
+
+    load_words(&sets[0], argc > 1 ? argv[1] : "data/large_text.txt");
+
+    keyset_init(&sets[1], "sequential ids", SYNTHETIC_KEYS);
+    for(i = 0; i < SYNTHETIC_KEYS; i++) add_key(&sets[1], key, sprintf(key, "key%d", i));
+
+    keyset_init(&sets[2], "urls", SYNTHETIC_KEYS);
+    for(i = 0; i < SYNTHETIC_KEYS; i++) {
+        add_key(&sets[2], key, sprintf(key, "www.host%d.com/p/%d", i % 997, i));
+    }
+
+    keyset_init(&sets[3], "64-byte keys", SYNTHETIC_KEYS);
+    for(i = 0; i < SYNTHETIC_KEYS; i++) {
+        add_key(&sets[3], key, sprintf(key, "%055d:%08x", 0, i));
+    }
+
+    printf("hash_bench: masked bucket fill and speed\n");
+    printf("  %-22s %-7s %8s %9s %9s %8s\n", "keys", "hash", "ns/key", "empty", "ideal", "fullest");
+    for(j = 0; j < 4; j++) {
+        for(i = 0; i < (int) (sizeof(hashes) / sizeof(hashes[0])); i++) {
+            time_hash(&hashes[i], &sets[j], &ns);
+            bucket_fill(&hashes[i], &sets[j], &empty, &ideal, &fullest);
+            printf("  %-22s %-7s %8.2f %8.1f%% %8.1f%% %8d\n", i == 0 ? sets[j].name : "",
+                   hashes[i].name, ns, 100 * empty, 100 * ideal, fullest);
+        }
+    }
+
+    printf("  Dict probe lengths (0 .. %d+, longest) with %s\n", HISTOGRAM - 1, NAME_OF(DICT_HASH));
+    for(j = 0; j < 4; j++) probe_histogram(&sets[j]);
+
+    for(j = 0; j < 4; j++) {
+        for(i = 0; i < sets[j].n; i++) free(sets[j].keys[i]);
+        free(sets[j].keys);
+        free(sets[j].lens);
+    }
+
+    return 0;
+}
@@ -0,0 +1,211 @@
+/* Distinct-word estimates against exact counts.
+ *
+ * Spreads a word stream over simulated workers that each fill their own
+ * HyperLogLog registers, as `worker -H` does, then encodes, decodes and
+ * merges the registers as the reducer does and compares the estimate
+ * with the exact number of distinct words from a Dict. Runs the sample
+ * text at several precisions and synthetic streams from ten to ten
+ * million distinct keys, every key repeated and split across workers.
+ * Reports the error in standard errors and the memory each side needs;
+ * exits non-zero if any estimate is off by more than four standard
+ * errors.
+ *
+ * USAGE: hll_bench [text_file] [workers] */
+
+#include "../dict.c"
+#include "../split.c"
+#include "../tokenize.c"
+#include "../hll.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#define MAX_SIGMAS 4.0
+
+struct tokens {
+    const char **key;
+    unsigned int *len;
+    size_t n;
+};
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+push(const char *key, unsigned int len, unsigned long hash, void *arg)
+{
+    struct tokens *t = arg;
+
+    if((t->n & (t->n - 1)) == 0) {
+        t->key = realloc(t->key, (t->n * 2 + 1) * sizeof(char *));
+        t->len = realloc(t->len, (t->n * 2 + 1) * sizeof(unsigned int));
+        assert(t->key != 0 && t->len != 0);
+    }
+    t->key[t->n] = key;
+    t->len[t->n] = len;
+    t->n++;
+}
+
+static void
+file_tokens(const char *path, struct tokens *t)
+{
+    FILE *fp;
+    char *text;
+    long size;
+
+    if((fp = fopen(path, "rb")) == 0) {
+        perror(path);
+        exit(1);
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    text = malloc(size + 1);
+    assert(text != 0);
+    size = fread(text, 1, size, fp);
+    text[size] = '\0';
+    fclose(fp);
+
+    Tokenize(text, size, push, t);
+}
+
+/* n distinct keys, key i occurring 1 + i % 3 times, in an order that */
+/* sends the copies of a key to different workers */
+static void
+synthetic_tokens(size_t n, struct tokens *t)
+{
+    char *names, *p;
+    size_t i, j, copies;
+
+    names = malloc(n * 24);
+    assert(names != 0);
+
+    for(j = 0; j < 3; j++) {
+        for(i = 0; i < n; i++) {
+            copies = 1 + i % 3;
+            if(j >= copies) continue;
+
+            p = names + i * 24;
+            if(j == 0) snprintf(p, 24, "key%zu", i);
+            push(p, strlen(p), 0, t);
+        }
+    }
+}
+
+/* fill one set of registers per worker, ship them and merge; returns */
+/* the merged estimate */
+static double
+estimate(struct tokens *t, int precision, int workers, double *ns_per_word)
+{
+    HyperLogLog merged = 0, h, copy;
+    size_t from, to, i, length;
+    char *buffer;
+    double t0, elapsed = 0, e;
+    int w;
+
+    for(w = 0; w < workers; w++) {
+        from = t->n * w / workers;
+        to = t->n * (w + 1) / workers;
+        h = HllCreate(precision);
+
+        t0 = now_sec();
+        for(i = from; i < to; i++) HllAdd(h, t->key[i], t->len[i]);
+        elapsed += now_sec() - t0;
+
+        if((buffer = HllEncode(h, &length)) == 0 || (copy = HllDecode(buffer, length)) == 0) {
+            fprintf(stderr, "hll_bench: encoding round trip failed\n");
+            exit(1);
+        }
+        free(buffer);
+        HllDestroy(h);
+
+        if(merged == 0) {
+            merged = copy;
+        } else {
+            HllMerge(merged, copy);
+            HllDestroy(copy);
+        }
+    }
+
+    e = HllEstimate(merged);
+    HllDestroy(merged);
+    if(ns_per_word) *ns_per_word = t->n > 0 ? elapsed * 1e9 / t->n : 0;
+
+    return e;
+}
+
+static int
+report(const char *label, struct tokens *t, int precision, int workers, size_t exact, size_t exact_bytes)
+{
+    double e, sigma, off, ns;
+    int bad;
+
+    e = estimate(t, precision, workers, &ns);
+    sigma = 1.04 / sqrt((double) (1 << precision));
+    off = exact > 0 ? (e - exact) / exact : 0;
+    bad = fabs(off) > MAX_SIGMAS * sigma;
+
+    printf("  %-18s %3d %10zu %12.0f %+8.2f%% %7.2f %8dK %9.1fM %7.1f %s\n", label, precision, exact, e,
+           off * 100, off / sigma, (1 << precision) >> 10, exact_bytes / 1e6, ns, bad ? "OFF" : "ok");
+
+    return bad;
+}
+
+static void
+header(void)
+{
+    printf("  %-18s %3s %10s %12s %9s %7s %9s %10s %7s\n", "input", "p", "exact", "estimate", "error",
+           "sigmas", "registers", "exact dict", "ns/word");
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *path = argc > 1 ? argv[1] : "data/large_text.txt";
+    int workers = argc > 2 ? atoi(argv[2]) : 4;
+    size_t n;
+    struct tokens t;
+    char label[32];
+    Dict d;
+    size_t i;
+    int p, bad = 0;
+
+    if(workers < 1) {
+        fprintf(stderr, "USAGE: hll_bench [text_file] [workers]\n");
+        exit(1);
+    }
+
+    printf("distinct words over %d workers:\n", workers);
+    header();
+
+    memset(&t, 0, sizeof(t));
+    file_tokens(path, &t);
+    d = DictCreate();
+    for(i = 0; i < t.n; i++) DictIncrementLen(d, t.key[i], t.len[i], 1);
+    for(p = 10; p <= 16; p += 2) {
+        bad += report("sample text", &t, p, workers, DictSize(d), DictMemory(d));
+    }
+    DictDestroy(d);
+
+    for(n = 10; n <= 10000000; n *= 10) {
+        memset(&t, 0, sizeof(t));
+        synthetic_tokens(n, &t);
+        d = DictCreate();
+        for(i = 0; i < t.n; i++) DictIncrementLen(d, t.key[i], t.len[i], 1);
+
+        snprintf(label, sizeof(label), "synthetic %zu", n);
+        bad += report(label, &t, 14, workers, DictSize(d), DictMemory(d));
+        DictDestroy(d);
+    }
+
+    return bad > 0;
+}
@@ -0,0 +1,53 @@
+#!/bin/sh
+# Builds an inverted index end to end and queries it.
+#
+# Generates a Zipf-distributed corpus with bench/zipf_corpus, runs the
+# job with workers in index mode (worker -I) and two reducers that write
+# their partitions of the index (reducer -o), then runs bench/index_query
+# on it: every posting list is checked against the corpus cut into the
+# same chunks, and lookup and intersection latency are measured. Also
+# reports the bytes the workers shipped and the size of the index next
+# to the corpus. The exit status is 1 if the index is wrong.
+#
+# Run from the repository root after `make bench/zipf_corpus bench/index_query`.
+# USAGE: bench/index_bench.sh [workers] [size] [vocabulary] [chunk_size]
+
+WORKERS=${1:-4}
+SIZE=${2:-32M}
+VOCABULARY=${3:-100000}
+CHUNK=${4:-256K}
+BASE_PORT=9400
+REDUCER_PORT=5800
+TMP=${TMPDIR:-/tmp}/index_bench.$$
+
+. bench/common.sh
+mkdir -p "$TMP"
+./bench/zipf_corpus "$TMP/input.txt" "$SIZE" "$VOCABULARY" 1.0 1 > /dev/null || exit 1
+
+reducers=127.0.0.1:$REDUCER_PORT,127.0.0.1:$((REDUCER_PORT + 1))
+./reducer -o "$TMP/index.0" $REDUCER_PORT > "$TMP/reducer.0.out" 2>&1 &
+rpids=$!
+./reducer -o "$TMP/index.1" $((REDUCER_PORT + 1)) > "$TMP/reducer.1.out" 2>&1 &
+rpids="$rpids $!"
+
+start_workers "$WORKERS" $BASE_PORT -I -r $reducers
+
+start=$(date +%s.%N)
+./driver -c "$CHUNK" -w "$wlist" "$TMP/input.txt" "$WORKERS" > "$TMP/driver.out" 2>&1
+end=$(date +%s.%N)
+kill -TSTP $rpids
+sleep 1
+kill $wpids $rpids 2>/dev/null
+wait 2>/dev/null
+
+bytes=$(wc -c < "$TMP/input.txt")
+index=$(cat "$TMP"/index.* | wc -c)
+shipped=$(cat "$TMP"/worker.*.out | awk '/^Shipped/ { b += $2 } END { print b + 0 }')
+echo "index_bench: $bytes bytes in $CHUNK chunks on $WORKERS workers, $(echo "$start $end" | awk '{ printf "%.2f", $2 - $1 }') s"
+echo "  workers shipped $shipped bytes of posting lists; index is $index bytes (words and lists)"
+
+./bench/index_query -i "$TMP/input.txt" -c "$CHUNK" "$TMP/index.0,$TMP/index.1"
+status=$?
+
+rm -rf "$TMP"
+exit $status
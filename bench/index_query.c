@@ -0,0 +1,369 @@
+/* Queries against the inverted index a job writes (worker -I, reducer -o).
+ *
+ * An index is given as the files of every reducer, in the order the
+ * workers list the reducers: a key is looked for in its own partition
+ * only. With words, prints the chunks each one occurs in and the chunks
+ * all of them occur in.
+ *
+ * Without words it measures the index: bytes per posting, then the
+ * latency of looking up a random word and reading its whole list, and
+ * of intersecting two or three words, drawn either from all the words
+ * or from the 1% with the longest lists, each as mean, p50 and p99 over
+ * many queries. With -i, every list is first checked against the input
+ * file cut into chunks of -c bytes as the driver cuts it, and tokenized
+ * in this process; the exit status is then 1 on any difference. The
+ * memory the lists of that check take is reported too, being what a
+ * worker holds for the same chunks.
+ *
+ * USAGE: index_query [-i input -c chunk_size] [-n queries] index[,index...] [word...] */
+
+#include "../dict.c"
+#include "../proto.c"
+#include "../split.c"
+#include "../tokenize.c"
+#include "../codec.c"
+#include "../table.c"
+#include "../postings.c"
+#include "../index.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <assert.h>
+
+#define MAX_SHARDS 64
+#define DEFAULT_QUERIES 100000
+
+struct word {
+    char *key;
+    unsigned int len;
+    uint32_t count;             /* length of its list */
+};
+
+struct words {
+    struct word *w;
+    size_t n;
+    size_t size;
+    Index shard;
+};
+
+static Index SHARDS[MAX_SHARDS];
+static int NSHARDS;
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t
+next_random(uint64_t *x)
+{
+    *x ^= *x << 13;
+    *x ^= *x >> 7;
+    *x ^= *x << 17;
+    return *x;
+}
+
+static int
+shard_get(const char *key, unsigned int len, struct posting_list *l)
+{
+    return IndexGet(SHARDS[KeyPartition(key, len, NSHARDS)], key, len, l);
+}
+
+static int
+collect_word(const char *key, unsigned int len, int value, void *arg)
+{
+    struct words *ws = arg;
+    struct posting_list l;
+
+    if(ws->n == ws->size) {
+        ws->size = ws->size * 2 + 1024;
+        ws->w = realloc(ws->w, ws->size * sizeof(struct word));
+        assert(ws->w != 0);
+    }
+    if(IndexList(ws->shard, (uint64_t) value, &l) < 0) return 1;
+
+    ws->w[ws->n].key = malloc(len + 1);
+    assert(ws->w[ws->n].key != 0);
+    memcpy(ws->w[ws->n].key, key, len);
+    ws->w[ws->n].key[len] = '\0';
+    ws->w[ws->n].len = len;
+    ws->w[ws->n].count = l.count;
+    ws->n++;
+
+    return 0;
+}
+
+static int
+by_count(const void *a, const void *b)
+{
+    const struct word *x = a, *y = b;
+
+    return (x->count < y->count) - (x->count > y->count);
+}
+
+static int
+by_value(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+static void
+report(const char *label, uint64_t *ns, size_t n, double results)
+{
+    double total = 0;
+    size_t i;
+
+    for(i = 0; i < n; i++) total += ns[i];
+    qsort(ns, n, sizeof(uint64_t), by_value);
+
+    printf("  %-36s %8.0f ns %8llu ns %8llu ns %10.1f\n", label, total / n, (unsigned long long) ns[n / 2],
+           (unsigned long long) ns[n * 99 / 100], results / n);
+}
+
+/* time n queries of k words each drawn from the first pool words */
+static void
+time_intersections(const char *label, struct words *ws, size_t pool, int k, size_t n, uint32_t *out)
+{
+    struct posting_list lists[3];
+    uint64_t *ns = malloc(n * sizeof(uint64_t));
+    uint64_t x = 88172645463325252ULL, start;
+    double found = 0;
+    struct word *w;
+    size_t q;
+    int i;
+
+    assert(ns != 0);
+    for(q = 0; q < n; q++) {
+        start = now_ns();
+        for(i = 0; i < k; i++) {
+            w = &ws->w[next_random(&x) % pool];
+            shard_get(w->key, w->len, &lists[i]);
+        }
+        found += IndexIntersect(lists, k, out);
+        ns[q] = now_ns() - start;
+    }
+    report(label, ns, n, found);
+    free(ns);
+}
+
+struct reference {
+    Postings p;
+    uint32_t chunk;
+};
+
+static void
+add_word(const char *key, unsigned int len, unsigned long hash, void *arg)
+{
+    struct reference *r = arg;
+
+    PostingsAdd(r->p, key, len, r->chunk);
+}
+
+struct check {
+    long bad;
+};
+
+static void
+check_list(const char *key, unsigned int len, struct posting_list *want, void *arg)
+{
+    struct check *c = arg;
+    struct posting_list got;
+    uint32_t a, b;
+    int s;
+
+    if(shard_get(key, len, &got) != 1 || got.count != want->count) {
+        c->bad++;
+        return;
+    }
+    while((s = PostingNext(want, &a)) > 0 && PostingNext(&got, &b) > 0 && a == b);
+    if(s != 0) c->bad++;
+}
+
+/* the lists of input cut like the driver cuts it, against the index */
+static int
+verify(const char *path, size_t chunk_size, uint64_t keys, uint64_t postings)
+{
+    struct input_file in;
+    struct split *splits;
+    struct reference doc;
+    struct check c = { 0 };
+    size_t nsplits, longest = 1, i;
+    char *work;
+
+    if(MapInput(path, &in) < 0) {
+        perror(path);
+        exit(1);
+    }
+    splits = ComputeSplits(in.data, in.size, chunk_size, &nsplits);
+    assert(splits != 0);
+    for(i = 0; i < nsplits; i++) {
+        if(splits[i].length > longest) longest = splits[i].length;
+    }
+    work = malloc(longest);
+    assert(work != 0);
+
+    /* a chunk's sequence number is its split's index */
+    doc.p = PostingsCreate();
+    for(i = 0; i < nsplits; i++) {
+        doc.chunk = i;
+        memcpy(work, in.data + splits[i].offset, splits[i].length);
+        Tokenize(work, splits[i].length, add_word, &doc);
+    }
+
+    PostingsForEach(doc.p, check_list, &c);
+    if(PostingsSize(doc.p) != keys || PostingsCount(doc.p) != postings) c.bad++;
+    printf("  checked %lu words in %lu chunks of %s: %s\n", (unsigned long) PostingsSize(doc.p),
+           (unsigned long) nsplits, path, c.bad == 0 ? "ok" : "MISMATCH");
+    printf("  held in memory (worker -I): %.1f bytes per posting, %.1f per word\n",
+           (double) PostingsMemory(doc.p) / PostingsCount(doc.p), (double) PostingsMemory(doc.p) / PostingsSize(doc.p));
+
+    PostingsDestroy(doc.p);
+    free(work);
+    free(splits);
+    UnmapInput(&in);
+
+    return c.bad == 0;
+}
+
+/* print the chunks of every word, then of all of them */
+static int
+query(char **words, int n, uint32_t *out)
+{
+    struct posting_list lists[64];
+    uint32_t doc;
+    long found;
+    int i;
+
+    if(n > 64) n = 64;
+    for(i = 0; i < n; i++) {
+        if(shard_get(words[i], strlen(words[i]), &lists[i]) != 1) {
+            printf("%s: not found\n", words[i]);
+            return 1;
+        }
+        printf("%s: %u chunks:", words[i], lists[i].count);
+        while(PostingNext(&lists[i], &doc) > 0) printf(" %u", doc);
+        printf("\n");
+        shard_get(words[i], strlen(words[i]), &lists[i]);
+    }
+    if(n > 1) {
+        found = IndexIntersect(lists, n, out);
+        printf("all %d: %ld chunks:", n, found);
+        for(i = 0; i < found; i++) printf(" %u", out[i]);
+        printf("\n");
+    }
+
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *input = 0;
+    size_t chunk_size = 1 << 20;
+    size_t queries = DEFAULT_QUERIES;
+    struct words ws = { 0, 0, 0, 0 };
+    struct posting_list l;
+    uint64_t keys = 0, postings = 0, bytes = 0, x = 2463534242ULL, start, *ns;
+    double decoded = 0;
+    uint32_t *out, doc, longest = 1;
+    char *spec, *path;
+    size_t q, i;
+    int opt, ok = 1;
+
+    while((opt = getopt(argc, argv, "i:c:n:")) != -1) {
+        switch(opt) {
+        case 'i':
+            input = optarg;
+            break;
+        case 'c':
+            if((chunk_size = ParseSize(optarg)) == 0) {
+                fprintf(stderr, "Bad chunk size: %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'n':
+            queries = atol(optarg);
+            break;
+        default:
+            fprintf(stderr, "USAGE: index_query [-i input -c chunk_size] [-n queries] index[,index...] [word...]\n");
+            exit(1);
+        }
+    }
+    if(optind >= argc || queries < 1) {
+        fprintf(stderr, "USAGE: index_query [-i input -c chunk_size] [-n queries] index[,index...] [word...]\n");
+        exit(1);
+    }
+
+    spec = strdup(argv[optind]);
+    for(path = strtok(spec, ","); path != 0 && NSHARDS < MAX_SHARDS; path = strtok(0, ",")) {
+        if((SHARDS[NSHARDS] = IndexOpen(path)) == 0) {
+            perror(path);
+            exit(1);
+        }
+        ws.shard = SHARDS[NSHARDS];
+        if(TableScan(IndexTable(ws.shard), "", 0, 0, 0, collect_word, &ws) < 0 ||
+           ws.n - keys != IndexKeys(ws.shard)) {
+            fprintf(stderr, "%s: corrupt index\n", path);
+            exit(1);
+        }
+        keys += IndexKeys(ws.shard);
+        postings += IndexPostings(ws.shard);
+        bytes += IndexListBytes(ws.shard);
+        NSHARDS++;
+    }
+    for(i = 0; i < ws.n; i++) {
+        if(ws.w[i].count > longest) longest = ws.w[i].count;
+    }
+    out = malloc(longest * sizeof(uint32_t));
+    assert(out != 0);
+
+    if(optind + 1 < argc) return query(argv + optind + 1, argc - optind - 1, out);
+
+    if(keys == 0) {
+        printf("index_query: the index is empty\n");
+        return 1;
+    }
+
+    printf("index_query: %d shards, %llu words, %llu postings, %.2f bytes per posting (lists and counts)\n",
+           NSHARDS, (unsigned long long) keys, (unsigned long long) postings, (double) bytes / postings);
+    if(input != 0) ok = verify(input, chunk_size, keys, postings);
+
+    printf("  %-36s %11s %11s %11s %10s\n", "", "mean", "p50", "p99", "chunks");
+
+    /* a random word, its whole list read */
+    ns = malloc(queries * sizeof(uint64_t));
+    assert(ns != 0);
+    for(q = 0; q < queries; q++) {
+        struct word *w = &ws.w[next_random(&x) % ws.n];
+
+        start = now_ns();
+        shard_get(w->key, w->len, &l);
+        while(PostingNext(&l, &doc) > 0);
+        ns[q] = now_ns() - start;
+        decoded += l.count;
+    }
+    report("lookup a random word, read its list", ns, queries, decoded);
+    free(ns);
+
+    qsort(ws.w, ws.n, sizeof(struct word), by_count);
+    time_intersections("intersect 2 random words", &ws, ws.n, 2, queries, out);
+    time_intersections("intersect 2 of the top 1%", &ws, ws.n / 100 + 1, 2, queries, out);
+    time_intersections("intersect 3 of the top 1%", &ws, ws.n / 100 + 1, 3, queries, out);
+
+    for(i = 0; i < ws.n; i++) free(ws.w[i].key);
+    free(ws.w);
+    free(out);
+    free(spec);
+    for(i = 0; i < (size_t) NSHARDS; i++) IndexClose(SHARDS[i]);
+
+    return ok ? 0 : 1;
+}
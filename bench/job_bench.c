@@ -0,0 +1,225 @@
+/* Cost of running word count as a job.
+ *
+ * Counts the same input, cut into the worker's 64 KB blocks, three ways:
+ * calling Tokenize straight into a Dict as the worker used to, through
+ * the built-in word count job, and through the same job loaded from
+ * jobs/wordcount.so with dlopen. Reports MB/s for each, best of several
+ * rounds, and checks that all three give the same counts. It then runs
+ * jobs/trigrams.so, whose records have no hash, and jobs/longest.so,
+ * which keeps maxima, and checks both against a direct computation.
+ *
+ * Run from the repository root after `make bench/job_bench jobs`.
+ * USAGE: job_bench [text_file] [megabytes] */
+
+#include "../dict.c"
+#include "../split.c"
+#include "../tokenize.c"
+#include "../job.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#define BLOCK (64 * 1024)
+#define ROUNDS 5
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+count_word(const char *key, unsigned int len, unsigned long hash, void *arg)
+{
+    DictIncrementHashed((Dict) arg, key, len, hash, 1);
+}
+
+struct sink {
+    Dict d;
+    int op;
+};
+
+/* the worker's drain */
+static void
+drain(struct emit_batch *b)
+{
+    struct sink *s = b->arg;
+
+    JobDrain(b, s->d, s->op);
+}
+
+/* run job over input block by block, or Tokenize alone if job is 0 */
+static Dict
+run(const struct job *job, const char *input, size_t len, char *work, double *seconds)
+{
+    struct emit_batch out;
+    struct sink s;
+    const char *p = input, *end = input + len, *stop;
+    double t0;
+
+    s.d = DictCreate();
+    s.op = job != 0 ? job->combine : JOB_SUM;
+    out.n = 0;
+    out.unhashed = 0;
+    out.drain = drain;
+    out.arg = &s;
+
+    memcpy(work, input, len);
+    t0 = now_sec();
+    while(p < end) {
+        stop = end - p > BLOCK ? FindDelimiter(p + BLOCK, end) : end;
+        if(job == 0) {
+            Tokenize(work + (p - input), stop - p, count_word, s.d);
+        } else {
+            job->map(work + (p - input), stop - p, &out);
+            EmitFlush(&out);
+        }
+        p = stop;
+    }
+    *seconds = now_sec() - t0;
+
+    return s.d;
+}
+
+struct compare {
+    Dict other;
+    int differ;
+};
+
+static void
+compare_entry(const char *key, unsigned int len, int value, void *arg)
+{
+    struct compare *c = arg;
+
+    if(DictSearch(c->other, key) != value) c->differ = 1;
+}
+
+static int
+same(Dict a, Dict b)
+{
+    struct compare c;
+
+    c.other = b;
+    c.differ = DictSize(a) != DictSize(b);
+    DictForEach(a, compare_entry, &c);
+
+    return !c.differ;
+}
+
+static void
+trigram_word(const char *key, unsigned int len, unsigned long hash, void *arg)
+{
+    unsigned int i;
+
+    if(len <= 3) {
+        DictIncrementLen((Dict) arg, key, len, 1);
+        return;
+    }
+    for(i = 0; i + 3 <= len; i++) DictIncrementLen((Dict) arg, key + i, 3, 1);
+}
+
+static void
+longest_word(const char *key, unsigned int len, unsigned long hash, void *arg)
+{
+    DictCombineLen((Dict) arg, key, 1, (int) len, DICT_MAX);
+}
+
+/* a plugin's result against fn applied by Tokenize to the whole input */
+static int
+check_plugin(const char *path, token_fn fn, const char *input, size_t len, char *work)
+{
+    const struct job *job = JobLoad(path);
+    Dict got, want;
+    double seconds;
+    int ok;
+
+    if(job == 0) return 0;
+    got = run(job, input, len, work, &seconds);
+
+    want = DictCreate();
+    memcpy(work, input, len);
+    Tokenize(work, len, fn, want);
+
+    ok = same(got, want);
+    printf("  %-20s %8d keys %10.1f MB/s  %s\n", path, DictSize(got), len / seconds / 1048576,
+           ok ? "ok" : "MISMATCH");
+    DictDestroy(got);
+    DictDestroy(want);
+
+    return ok;
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *path = argc > 1 ? argv[1] : "data/large_text.txt";
+    size_t megabytes = argc > 2 ? atoi(argv[2]) : 64;
+    const char *names[3] = { "Tokenize into Dict", "built-in job", "jobs/wordcount.so" };
+    const struct job *jobs[3];
+    double best[3] = { 1e9, 1e9, 1e9 }, seconds;
+    Dict result[3] = { 0, 0, 0 }, d;
+    char *text, *big, *work;
+    size_t text_len, big_len, i;
+    int round, k, ok = 1;
+    FILE *fp;
+
+    if((fp = fopen(path, "rb")) == 0) {
+        perror(path);
+        exit(1);
+    }
+    fseek(fp, 0, SEEK_END);
+    text_len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    text = malloc(text_len);
+    assert(text != 0);
+    text_len = fread(text, 1, text_len, fp);
+    fclose(fp);
+
+    /* copies of the text, ending on a delimiter */
+    big_len = megabytes << 20;
+    big = malloc(big_len);
+    work = malloc(big_len);
+    assert(big != 0 && work != 0);
+    for(i = 0; i < big_len; i += text_len) {
+        memcpy(big + i, text, big_len - i < text_len ? big_len - i : text_len);
+    }
+    big[big_len - 1] = '\n';
+
+    jobs[0] = 0;
+    jobs[1] = &WORD_COUNT_JOB;
+    if((jobs[2] = JobLoad("./jobs/wordcount.so")) == 0) exit(1);
+
+    printf("job_bench: %zu MB, Tokenize uses %s, best of %d rounds\n", megabytes, TokenizeKernel(), ROUNDS);
+
+    /* alternate the paths so that none of them gets a warmer machine */
+    for(round = 0; round < ROUNDS; round++) {
+        for(k = 0; k < 3; k++) {
+            d = run(jobs[k], big, big_len, work, &seconds);
+            if(seconds < best[k]) best[k] = seconds;
+            if(result[k] == 0) result[k] = d; else DictDestroy(d);
+        }
+    }
+    for(k = 0; k < 3; k++) {
+        int match = k == 0 || same(result[k], result[0]);
+
+        printf("  %-20s %8d keys %10.1f MB/s  %5.2fx  %s\n", names[k], DictSize(result[k]),
+               big_len / best[k] / 1048576, best[0] / best[k], match ? "ok" : "MISMATCH");
+        ok &= match;
+    }
+    for(k = 0; k < 3; k++) DictDestroy(result[k]);
+
+    ok &= check_plugin("./jobs/trigrams.so", trigram_word, big, big_len, work);
+    ok &= check_plugin("./jobs/longest.so", longest_word, big, big_len, work);
+
+    free(text);
+    free(big);
+    free(work);
+
+    return ok ? 0 : 1;
+}
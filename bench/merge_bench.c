@@ -0,0 +1,138 @@
+/* Reducer merge throughput with a sharded dictionary.
+ *
+ * Builds M encoded worker results (codec.c) drawn from a skewed
+ * vocabulary, then merges all of them into a ShardedDict from T threads
+ * at once, for a range of shard and thread counts. One shard is the old
+ * reducer: every merge holds the only lock for its whole duration.
+ * Reports merged entries per second and checks the merged total.
+ *
+ * USAGE: merge_bench [results] [keys_per_result] [vocabulary] */
+
+#include "../dict.c"
+#include "../codec.c"
+#include "../shard.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+struct result {
+    char *buffer;
+    size_t length;
+};
+
+struct job {
+    ShardedDict sd;
+    struct result *results;
+    int n;
+    int next;       /* next result to merge, taken atomically */
+};
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* xorshift64, so every run builds the same results */
+static unsigned long long
+next_random(unsigned long long *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static void *
+merger(void *arg)
+{
+    struct job *job = arg;
+    int i;
+
+    while((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->n) {
+        if(ShardedDictMerge(job->sd, job->results[i].buffer, job->results[i].length) < 0) {
+            fprintf(stderr, "merge_bench: result %d is malformed\n", i);
+            exit(1);
+        }
+    }
+
+    return 0;
+}
+
+static void
+add_value(const char *key, unsigned int len, int value, void *arg)
+{
+    *(long long *) arg += value;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int results = argc > 1 ? atoi(argv[1]) : 64;
+    int keys = argc > 2 ? atoi(argv[2]) : 20000;
+    int vocabulary = argc > 3 ? atoi(argv[3]) : 200000;
+    static const int shard_counts[] = { 1, 4, 16, 64, 256 };
+    static const int thread_counts[] = { 1, 2, 4, 8 };
+    unsigned long long state = 88172645463325252ULL;
+    struct result *r;
+    struct job job;
+    pthread_t tid[8];
+    long long expected = 0, total, entries = 0;
+    double t0, elapsed;
+    char key[32];
+    int i, j, si, ti, rank;
+    Dict d;
+
+    /* each result counts keys draws, skewed towards low ranks */
+    r = malloc(results * sizeof(struct result));
+    assert(r != 0);
+    for(i = 0; i < results; i++) {
+        d = DictCreate();
+        for(j = 0; j < keys; j++) {
+            rank = (int) ((next_random(&state) % vocabulary) * (next_random(&state) % 1000) / 1000);
+            snprintf(key, sizeof(key), "word%d", rank);
+            DictIncrement(d, key, 1);
+        }
+        entries += DictSize(d);
+        expected += keys;
+        r[i].buffer = DictEncode(d, 0, &r[i].length);
+        assert(r[i].buffer != 0);
+        DictDestroy(d);
+    }
+
+    printf("merge_bench: %d results, %lld entries\n", results, entries);
+    printf("  %6s %7s %10s %14s %s\n", "shards", "threads", "ms", "Mentries/s", "total");
+
+    for(si = 0; si < (int) (sizeof(shard_counts) / sizeof(shard_counts[0])); si++) {
+        for(ti = 0; ti < (int) (sizeof(thread_counts) / sizeof(thread_counts[0])); ti++) {
+            job.sd = ShardedDictCreate(shard_counts[si]);
+            job.results = r;
+            job.n = results;
+            job.next = 0;
+
+            t0 = now_sec();
+            for(i = 0; i < thread_counts[ti]; i++) pthread_create(&tid[i], 0, merger, &job);
+            for(i = 0; i < thread_counts[ti]; i++) pthread_join(tid[i], 0);
+            elapsed = now_sec() - t0;
+
+            total = 0;
+            ShardedDictForEach(job.sd, add_value, &total);
+
+            printf("  %6d %7d %10.1f %14.2f %s\n", shard_counts[si], thread_counts[ti],
+                   elapsed * 1e3, entries / elapsed / 1e6, total == expected ? "ok" : "MISMATCH");
+
+            ShardedDictDestroy(job.sd);
+        }
+    }
+
+    for(i = 0; i < results; i++) free(r[i].buffer);
+    free(r);
+
+    return 0;
+}
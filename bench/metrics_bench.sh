@@ -0,0 +1,73 @@
+#!/bin/sh
+# Per-chunk logging against the default log level, and the per-stage
+# metrics of a job.
+#
+# Runs the same small-chunk job on localhost twice. The first run uses
+# -v on every node, so each chunk and frame logs a line as every node
+# used to. The second uses the default level, which logs once per job.
+# Reports the driver's throughput and the lines each run wrote. It then
+# checks the counts against a reference count, and fetches every node's
+# metrics from its stats port (-M) to show where the time of the second
+# job went.
+#
+# Run from the repository root after `make`.
+# USAGE: bench/metrics_bench.sh [workers] [copies] [chunk_size]
+
+WORKERS=${1:-4}
+COPIES=${2:-100}
+CHUNK=${3:-4K}
+BASE_PORT=9600
+REDUCER_PORT=5800
+STATS_PORT=9700
+TMP=${TMPDIR:-/tmp}/metrics_bench.$$
+
+. bench/common.sh
+mkdir -p "$TMP"
+sample_input "$COPIES" "$TMP/input.txt"
+reference_counts "$TMP/input.txt" "$TMP/expected"
+
+# a node's metrics, as served on its stats port
+stats() {
+  bash -c 'exec 3<>/dev/tcp/127.0.0.1/$1 && cat <&3' _ "$1"
+}
+
+run() {
+  label=$1
+  shift
+  ./reducer -M $STATS_PORT "$@" $REDUCER_PORT > "$TMP/reducer.out" 2>&1 &
+  rpid=$!
+
+  WORKER_STATS_PORT=$((STATS_PORT + 1)) start_workers "$WORKERS" $BASE_PORT -r 127.0.0.1:$REDUCER_PORT "$@"
+
+  ./driver -S -c "$CHUNK" -w "$wlist" "$@" "$TMP/input.txt" "$WORKERS" > "$TMP/driver.out" 2>&1
+  stats $STATS_PORT > "$TMP/reducer.stats"
+  i=0
+  while [ $i -lt "$WORKERS" ]; do
+    stats $((STATS_PORT + 1 + i)) > "$TMP/worker.$i.stats"
+    i=$((i + 1))
+  done
+  kill -TSTP $rpid
+  sleep 0.5
+  kill $wpids 2>/dev/null
+
+  reducer_counts "$TMP/reducer.out" > "$TMP/got"
+  if cmp -s "$TMP/expected" "$TMP/got"; then check=ok; else check=MISMATCH; fi
+
+  kill $rpid 2>/dev/null
+  wait 2>/dev/null
+  lines=$(cat "$TMP"/driver.out "$TMP"/worker.*.out | grep -c .)
+  printf '%-18s %s, %d log lines, counts %s\n' "$label" \
+    "$(grep '^Processed' "$TMP/driver.out" | sed 's/^Processed .* in //')" "$lines" "$check"
+}
+
+echo "metrics_bench: $WORKERS workers, $(wc -c < "$TMP/input.txt") bytes in $CHUNK chunks"
+run "per-chunk logging" -v
+run "default level"
+
+echo
+echo "worker 0 (times in ns):"
+sed 's/^/  /' "$TMP/worker.0.stats"
+echo "reducer:"
+sed 's/^/  /' "$TMP/reducer.stats"
+
+rm -rf "$TMP"
@@ -0,0 +1,147 @@
+/* Load test for the reducer.
+ *
+ * Opens many worker connections to a reducer at once and keeps them all
+ * open, sends a number of result frames on each, round robin, then an
+ * END on each and waits for every acknowledgement. Every frame holds
+ * the keys load0 .. load<keys - 1> with a count of 1, so afterwards the
+ * reducer must hold each of them with a count of connections * frames.
+ * With -P the reducer's thread count is read from /proc while all
+ * connections are open.
+ *
+ * USAGE: reducer_load [-c connections] [-f frames] [-k keys] [-P reducer_pid] ip:port */
+
+#include "../dict.c"
+#include "../proto.c"
+#include "../codec.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/resource.h>
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+threads_of(int pid)
+{
+    char path[64], line[256];
+    int threads = -1;
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    if((fp = fopen(path, "r")) == 0) return -1;
+    while(fgets(line, sizeof(line), fp) != 0) {
+        if(sscanf(line, "Threads: %d", &threads) == 1) break;
+    }
+    fclose(fp);
+
+    return threads;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int connections = 2000, frames = 4, keys = 1000, pid = 0;
+    char *ips[1], *ports[1];
+    char key[32];
+    struct rlimit files;
+    struct frame_header ack;
+    double t0, t_connect, t_send, t_ack;
+    size_t length;
+    char *frame;
+    int *socks;
+    int opt, i, f, acked = 0;
+    Dict d;
+
+    while((opt = getopt(argc, argv, "c:f:k:P:")) != -1) {
+        switch(opt) {
+        case 'c': connections = atoi(optarg); break;
+        case 'f': frames = atoi(optarg); break;
+        case 'k': keys = atoi(optarg); break;
+        case 'P': pid = atoi(optarg); break;
+        default:
+            fprintf(stderr, "USAGE: reducer_load [-c connections] [-f frames] [-k keys] [-P reducer_pid] ip:port\n");
+            exit(1);
+        }
+    }
+    if(argc - optind != 1 || connections < 1 || ParseAddressList(argv[optind], ips, ports, 1) != 1) {
+        fprintf(stderr, "USAGE: reducer_load [-c connections] [-f frames] [-k keys] [-P reducer_pid] ip:port\n");
+        exit(1);
+    }
+
+    if(getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max) {
+        files.rlim_cur = files.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files);
+    }
+
+    /* one result frame, sent again and again */
+    d = DictCreate();
+    for(i = 0; i < keys; i++) {
+        sprintf(key, "load%d", i);
+        DictIncrement(d, key, 1);
+    }
+    frame = DictEncode(d, 0, &length);
+    assert(frame != 0);
+    DictDestroy(d);
+
+    socks = malloc(connections * sizeof(int));
+    assert(socks != 0);
+
+    t0 = now_sec();
+    for(i = 0; i < connections; i++) {
+        if((socks[i] = ConnectTo(ips[0], ports[0])) < 0) {
+            fprintf(stderr, "reducer_load: connection %d of %d failed\n", i + 1, connections);
+            exit(1);
+        }
+    }
+    t_connect = now_sec() - t0;
+
+    t0 = now_sec();
+    for(f = 0; f < frames; f++) {
+        for(i = 0; i < connections; i++) {
+            if(SendFrame(socks[i], FRAME_RESULT, 0, frame, length) < 1) {
+                fprintf(stderr, "reducer_load: sending on connection %d failed\n", i);
+                exit(1);
+            }
+        }
+    }
+    t_send = now_sec() - t0;
+
+    if(pid > 0) {
+        printf("reducer threads with %d connections open: %d\n", connections, threads_of(pid));
+    }
+
+    /* acknowledged only once every frame of the connection is merged */
+    t0 = now_sec();
+    for(i = 0; i < connections; i++) {
+        if(SendFrame(socks[i], FRAME_END, 0, NULL, 0) < 1) {
+            fprintf(stderr, "reducer_load: sending END on connection %d failed\n", i);
+            exit(1);
+        }
+    }
+    for(i = 0; i < connections; i++) {
+        if(RecvFrameHeader(socks[i], &ack) == 1 && ack.type == FRAME_END) acked++;
+        close(socks[i]);
+    }
+    t_ack = now_sec() - t0;
+
+    printf("reducer_load: %d connections, %d frames of %zu bytes each\n", connections, frames, length);
+    printf("  connect %.3f s, send %.3f s (%.0f frames/s, %.1f MB/s), drain %.3f s\n", t_connect, t_send,
+           connections * (double) frames / (t_send + t_ack),
+           connections * (double) frames * length / (t_send + t_ack) / 1e6, t_ack);
+    printf("  acknowledged %d of %d, expect every key at %d\n", acked, connections, connections * frames);
+
+    free(socks);
+    free(frame);
+
+    return acked == connections ? 0 : 1;
+}
@@ -0,0 +1,36 @@
+#!/bin/sh
+# Many concurrent worker connections against one reducer.
+#
+# Starts a reducer with a fixed merge pool and a small buffer budget,
+# points bench/reducer_load at it with thousands of connections held
+# open at once, and checks that every key came out with the expected
+# count.
+#
+# Run from the repository root after `make bench/reducer_load`.
+# USAGE: bench/reducer_load.sh [connections] [frames] [keys]
+
+CONNECTIONS=${1:-2000}
+FRAMES=${2:-4}
+KEYS=${3:-1000}
+PORT=5900
+TMP=${TMPDIR:-/tmp}/reducer_load.$$
+
+mkdir -p "$TMP"
+
+./reducer -t 4 -m 16M $PORT > "$TMP/reducer.out" 2>&1 &
+rpid=$!
+sleep 0.5
+
+./bench/reducer_load -c "$CONNECTIONS" -f "$FRAMES" -k "$KEYS" -P $rpid 127.0.0.1:$PORT
+kill -TSTP $rpid
+sleep 0.5
+
+want=$((CONNECTIONS * FRAMES))
+got=$(sed -n 's/^dict\[load[0-9]*\] = \(.*\)$/\1/p' "$TMP/reducer.out" | awk -v want=$want \
+  '$1 == want { ok++ } END { print ok + 0 }')
+if [ "$got" -eq "$KEYS" ]; then check=ok; else check="MISMATCH ($got of $KEYS keys right)"; fi
+echo "  reducer counts $check"
+
+kill $rpid 2>/dev/null
+wait 2>/dev/null
+rm -rf "$TMP"
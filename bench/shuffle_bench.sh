@@ -0,0 +1,68 @@
+#!/bin/sh
+# Local harness for the hash-partitioned shuffle.
+#
+# Runs the same job against 1, 2 and 4 reducers on localhost. Workers
+# are given the reducer list with -r and send each reducer only its own
+# key partition. For every run the script concatenates the reducers'
+# outputs, checks that no key was sent to two reducers, and compares the
+# combined counts with a single-process reference count of the input.
+#
+# Run from the repository root after `make`.
+# USAGE: bench/shuffle_bench.sh [workers] [copies]
+
+WORKERS=${1:-4}
+COPIES=${2:-20}
+BASE_PORT=9200
+REDUCER_BASE_PORT=5600
+TMP=${TMPDIR:-/tmp}/shuffle_bench.$$
+
+. bench/common.sh
+mkdir -p "$TMP"
+sample_input "$COPIES" "$TMP/input.txt"
+reference_counts "$TMP/input.txt" "$TMP/expected"
+
+run() {
+  reducers=$1
+  rlist=""
+  rpids=""
+  i=0
+  while [ $i -lt "$reducers" ]; do
+    port=$((REDUCER_BASE_PORT + i))
+    ./reducer $port > "$TMP/reducer.$i.out" 2>&1 &
+    rpids="$rpids $!"
+    rlist="$rlist${rlist:+,}127.0.0.1:$port"
+    i=$((i + 1))
+  done
+
+  start_workers "$WORKERS" $BASE_PORT -r "$rlist"
+
+  ./driver -c 64K -w "$wlist" "$TMP/input.txt" "$WORKERS" > "$TMP/driver.out" 2>&1
+  sleep 0.2
+  for pid in $rpids; do kill -TSTP $pid; done
+  sleep 0.5
+
+  # The job's output is the concatenation of every reducer's output
+  i=0
+  sizes=""
+  while [ $i -lt "$reducers" ]; do
+    reducer_counts "$TMP/reducer.$i.out" > "$TMP/got.$i"
+    sizes="$sizes $(wc -l < "$TMP/got.$i")"
+    i=$((i + 1))
+  done
+  cat "$TMP"/got.* | sort > "$TMP/got"
+  dup=$(cut -d' ' -f1 "$TMP/got" | uniq -d | wc -l)
+  if cmp -s "$TMP/expected" "$TMP/got"; then check=ok; else check=MISMATCH; fi
+  printf '%d reducer(s)   %s  keys per reducer:%s  shared keys %d  counts %s\n' "$reducers" \
+    "$(grep '^Processed' "$TMP/driver.out")" "$sizes" "$dup" "$check"
+
+  kill $rpids $wpids 2>/dev/null
+  wait 2>/dev/null
+  rm -f "$TMP"/got.*
+}
+
+echo "shuffle_bench: $WORKERS workers"
+run 1
+run 2
+run 4
+
+rm -rf "$TMP"
@@ -0,0 +1,54 @@
+/* A worker that counts nothing.
+ *
+ * Speaks the driver side of the worker protocol, but throws every chunk
+ * away as soon as it has arrived and reports it done, so a job run
+ * against sink workers measures only how fast the driver reads its
+ * input and sends it out.
+ *
+ * USAGE: sink_worker <port> */
+
+#include "../proto.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SINK_BUFFER (1 << 20)
+
+int
+main(int argc, char *argv[])
+{
+    struct frame_header header;
+    char *buf;
+    size_t left, n;
+    int server, sock, status;
+
+    if(argc != 2) {
+        fprintf(stderr, "USAGE: sink_worker <port>\n");
+        exit(1);
+    }
+    if((server = ListenOn(argv[1], 5)) < 0) {
+        perror("sink_worker: listen");
+        exit(1);
+    }
+    buf = malloc(SINK_BUFFER);
+
+    while((sock = accept(server, NULL, NULL)) >= 0) {
+        while((status = RecvFrameHeader(sock, &header)) > 0) {
+            if(header.type == FRAME_END) {
+                SendFrame(sock, FRAME_END, header.seq, NULL, 0);
+                break;
+            }
+            if(header.type != FRAME_CHUNK) continue;
+
+            for(left = header.length; left > 0; left -= n) {
+                n = left < SINK_BUFFER ? left : SINK_BUFFER;
+                if(RecvAll(sock, buf, n) < 1) break;
+            }
+            if(left > 0 || SendFrame(sock, FRAME_DONE, header.seq, NULL, 0) < 1) break;
+        }
+        close(sock);
+    }
+
+    free(buf);
+    return 0;
+}
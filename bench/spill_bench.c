@@ -0,0 +1,195 @@
+/* Map-side combiner: in-memory counting vs spilling to sorted runs.
+ *
+ * Counts the same token stream once into a plain Dict and then through
+ * a Combiner for a range of memory budgets, the smallest of which force
+ * many spills and repeated folding of runs. Every flush is checked to
+ * come out in key order when runs were spilled, and its counts are
+ * checked to be identical to the in-memory result.
+ *
+ * USAGE: spill_bench [text_file] [synthetic_keys] */
+
+#include "../dict.c"
+#include "../codec.c"
+#include "../combiner.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+struct tokens {
+    char **key;
+    unsigned int *len;
+    size_t n;
+};
+
+struct check {
+    Dict expected;
+    size_t keys;
+    int bad;
+    int unordered;
+    char prev[64];
+    unsigned int prev_len;
+};
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+push(struct tokens *t, char *key, unsigned int len)
+{
+    if((t->n & (t->n - 1)) == 0) {
+        t->key = realloc(t->key, (t->n * 2 + 1) * sizeof(char *));
+        t->len = realloc(t->len, (t->n * 2 + 1) * sizeof(unsigned int));
+        assert(t->key != 0 && t->len != 0);
+    }
+    t->key[t->n] = key;
+    t->len[t->n] = len;
+    t->n++;
+}
+
+/* the words of a file, normalized like the worker does */
+static void
+file_tokens(const char *path, int copies, struct tokens *t)
+{
+    FILE *fp;
+    char *text, *p;
+    long size;
+    int i;
+
+    if((fp = fopen(path, "rb")) == 0) {
+        perror(path);
+        exit(1);
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    text = malloc(size + 1);
+    assert(text != 0);
+    size = fread(text, 1, size, fp);
+    text[size] = '\0';
+    fclose(fp);
+
+    for(p = text; *p; p++) *p = ispunct((unsigned char) *p) ? ' ' : tolower((unsigned char) *p);
+
+    for(i = 0; i < copies; i++) {
+        for(p = text; *p; ) {
+            while(*p && (unsigned char) *p <= ' ') p++;
+            if(!*p) break;
+            char *start = p;
+            while((unsigned char) *p > ' ') p++;
+            push(t, start, p - start);
+        }
+    }
+}
+
+/* high-cardinality keys: n distinct URLs, each seen one to four times */
+static void
+synthetic_tokens(int n, struct tokens *t)
+{
+    char key[48];
+    int i, j;
+
+    for(i = 0; i < n; i++) {
+        snprintf(key, sizeof(key), "www.host%d.com/p/%d", i % 97, i * 7919 % n);
+        for(j = 0; j <= i % 4; j++) push(t, strdup(key), strlen(key));
+    }
+}
+
+static int
+check_entry(const char *key, unsigned int len, int value, void *arg)
+{
+    struct check *c = arg;
+    unsigned int n = len < c->prev_len ? len : c->prev_len;
+    int cmp = memcmp(c->prev, key, n);
+
+    if(c->keys > 0 && (cmp > 0 || (cmp == 0 && c->prev_len >= len))) c->unordered++;
+    if(len < sizeof(c->prev)) {
+        memcpy(c->prev, key, len);
+        c->prev_len = len;
+    }
+
+    if(DictSearch(c->expected, key) != value) c->bad++;
+    c->keys++;
+
+    return 0;
+}
+
+static void
+bench(const char *label, struct tokens *t)
+{
+    static const size_t budgets[] = { 0, 16 << 20, 4 << 20, 1 << 20, 256 << 10 };
+    struct check c;
+    Combiner comb;
+    double t0, t_count, t_flush;
+    size_t i;
+    int b, runs;
+
+    c.expected = DictCreate();
+    t0 = now_sec();
+    for(i = 0; i < t->n; i++) DictIncrementLen(c.expected, t->key[i], t->len[i], 1);
+    t_count = now_sec() - t0;
+
+    printf("%s: %zu tokens, %d keys, %.1f MB in memory (plain Dict %.1f ms)\n", label, t->n,
+           DictSize(c.expected), DictMemory(c.expected) / 1e6, t_count * 1e3);
+    printf("  %10s %8s %10s %10s %s\n", "budget", "spills", "count ms", "flush ms", "result");
+
+    for(b = 0; b < (int) (sizeof(budgets) / sizeof(budgets[0])); b++) {
+        comb = CombinerCreate(budgets[b], 0);
+
+        t0 = now_sec();
+        for(i = 0; i < t->n; i++) {
+            if(CombinerAdd(comb, t->key[i], t->len[i], 1) < 0) {
+                perror("spill");
+                exit(1);
+            }
+        }
+        t_count = now_sec() - t0;
+        runs = CombinerRuns(comb);
+
+        c.keys = 0;
+        c.bad = 0;
+        c.unordered = 0;
+        c.prev_len = 0;
+        t0 = now_sec();
+        if(CombinerFlush(comb, check_entry, &c) != 0) {
+            fprintf(stderr, "spill_bench: flush failed\n");
+            exit(1);
+        }
+        t_flush = now_sec() - t0;
+
+        printf("  %9zuK %8ld %10.1f %10.1f %s\n", budgets[b] >> 10, CombinerSpills(comb),
+               t_count * 1e3, t_flush * 1e3,
+               c.bad == 0 && c.keys == (size_t) DictSize(c.expected) && (runs == 0 || c.unordered == 0) ?
+               "identical" : "MISMATCH");
+
+        CombinerDestroy(comb);
+    }
+
+    DictDestroy(c.expected);
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *path = argc > 1 ? argv[1] : "data/large_text.txt";
+    int keys = argc > 2 ? atoi(argv[2]) : 300000;
+    struct tokens t;
+
+    memset(&t, 0, sizeof(t));
+    file_tokens(path, 20, &t);
+    bench(path, &t);
+
+    memset(&t, 0, sizeof(t));
+    synthetic_tokens(keys, &t);
+    bench("synthetic urls", &t);
+
+    return 0;
+}
@@ -0,0 +1,54 @@
+#!/bin/sh
+# Local straggler harness for the pull scheduler.
+#
+# Runs a reducer and N workers on localhost, one of them slowed down
+# with an artificial per-chunk delay, then runs the same job with
+# speculative backups disabled (-S) and enabled. Prints the driver's
+# wall time for each run and checks that the reducer's counts match a
+# single-process reference count of the input.
+#
+# Run from the repository root after `make`.
+# USAGE: bench/straggler_bench.sh [workers] [delay_ms] [copies]
+
+WORKERS=${1:-4}
+DELAY_MS=${2:-500}
+COPIES=${3:-20}
+BASE_PORT=9100
+REDUCER_PORT=5555
+TMP=${TMPDIR:-/tmp}/straggler_bench.$$
+
+. bench/common.sh
+mkdir -p "$TMP"
+sample_input "$COPIES" "$TMP/input.txt"
+reference_counts "$TMP/input.txt" "$TMP/expected"
+
+./reducer $REDUCER_PORT > "$TMP/reducer.out" 2>&1 &
+REDUCER=$!
+
+# W0 is the slow one, the others follow it on the next ports
+./worker -d "$DELAY_MS" $BASE_PORT > /dev/null 2>&1 &
+start_workers $((WORKERS - 1)) $((BASE_PORT + 1))
+LIST="127.0.0.1:$BASE_PORT${wlist:+,}$wlist"
+
+run() {
+  label=$1
+  shift
+  : > "$TMP/reducer.out"
+  ./driver -c 64K -w "$LIST" "$@" "$TMP/input.txt" "$WORKERS" > "$TMP/driver.out" 2>&1
+  kill -TSTP $REDUCER
+  sleep 0.5
+  reducer_counts "$TMP/reducer.out" > "$TMP/got"
+  if cmp -s "$TMP/expected" "$TMP/got"; then check=ok; else check=MISMATCH; fi
+  printf '%-14s %s  counts %s\n' "$label" \
+    "$(grep '^Processed' "$TMP/driver.out")" "$check"
+  grep -c '^Speculatively' "$TMP/driver.out" | sed 's/^/               backups launched: /'
+}
+
+echo "straggler_bench: $WORKERS workers, W0 delayed ${DELAY_MS}ms per chunk"
+run "no backups" -S
+run "backups"
+
+kill $REDUCER 2>/dev/null
+pkill -P $$ worker 2>/dev/null
+wait 2>/dev/null
+rm -rf "$TMP"
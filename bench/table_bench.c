@@ -0,0 +1,282 @@
+/* Sorted table output vs re-parsing the text output.
+ *
+ * Writes the same word counts both ways the reducer can: as the text
+ * it prints (`dict[word] = n` lines, in hash order) and as a sorted
+ * table file (reducer -o). Then, with the files dropped from the page
+ * cache, compares what a downstream job pays to use them: re-parsing
+ * the text into a Dict against mapping the table, both for opening
+ * and then for a thousand lookups. It also compares warm lookup latency
+ * for hits and misses, and a prefix scan against a filtered walk of the
+ * parsed Dict. Every key is checked to come back with its count, every
+ * miss to miss, and the scans to agree.
+ *
+ * USAGE: table_bench [synthetic_keys] [dir] */
+
+#include "../dict.c"
+#include "../codec.c"
+#include "../table.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <assert.h>
+
+#define COLD_LOOKUPS 1000
+#define PREFIX "www.host7.com/"
+
+struct prefix_count {
+    const char *prefix;
+    size_t len;
+    long n;
+};
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t
+next_random(uint64_t *x)
+{
+    *x ^= *x << 13;
+    *x ^= *x >> 7;
+    *x ^= *x << 17;
+    return *x;
+}
+
+/* evict a file from the page cache, as if read for the first time */
+static void
+drop_cache(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+
+    if(fd >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+static void
+write_text(const char *key, unsigned int len, int value, void *arg)
+{
+    fprintf((FILE *) arg, "dict[%s] = %d\n", key, value);
+}
+
+/* what a downstream job does with the text output: read all of it */
+static Dict
+parse_text(const char *path)
+{
+    FILE *fp;
+    char line[512];
+    char *end;
+    Dict d = DictCreate();
+
+    if((fp = fopen(path, "r")) == 0) {
+        perror(path);
+        exit(1);
+    }
+    while(fgets(line, sizeof(line), fp) != 0) {
+        if(strncmp(line, "dict[", 5) != 0 || (end = strstr(line, "] = ")) == 0) continue;
+
+        DictIncrementLen(d, line + 5, end - line - 5, atoi(end + 4));
+    }
+    fclose(fp);
+
+    return d;
+}
+
+static int
+compare_keys_qsort(const void *a, const void *b)
+{
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+static void
+count_prefix(const char *key, unsigned int len, int value, void *arg)
+{
+    struct prefix_count *pc = arg;
+
+    if(len >= pc->len && memcmp(key, pc->prefix, pc->len) == 0) pc->n++;
+}
+
+struct scan_check {
+    const char *prev;
+    unsigned int prev_len;
+    char prev_key[512];
+    long unordered;
+};
+
+static int
+check_order(const char *key, unsigned int len, int value, void *arg)
+{
+    struct scan_check *sc = arg;
+
+    if(sc->prev != 0 && compare_bytes(sc->prev_key, sc->prev_len, key, len) >= 0) sc->unordered++;
+    if(len < sizeof(sc->prev_key)) {
+        memcpy(sc->prev_key, key, len);
+        sc->prev_len = len;
+        sc->prev = sc->prev_key;
+    }
+
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int nkeys = argc > 1 ? atoi(argv[1]) : 1000000;
+    const char *dir = argc > 2 ? argv[2] : getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    char text_path[512], table_path[512], miss[64];
+    char **keys;
+    int *values;
+    struct table_writer w;
+    struct prefix_count pc;
+    struct scan_check sc;
+    struct stat st_text, st_table;
+    uint64_t x = 88172645463325252ULL;
+    double t0, t_parse, t_open, t_cold_text, t_cold_table, t_dict, t_table, t_scan_dict, t_scan_table;
+    long bad = 0, n, r;
+    FILE *fp;
+    Dict counts, parsed;
+    Table table;
+    int i, v;
+
+    snprintf(text_path, sizeof(text_path), "%s/table_bench.%d.txt", dir, getpid());
+    snprintf(table_path, sizeof(table_path), "%s/table_bench.%d.tab", dir, getpid());
+
+    /* URL-like keys with long shared prefixes, and random counts */
+    keys = malloc(nkeys * sizeof(char *));
+    values = malloc(nkeys * sizeof(int));
+    assert(keys != 0 && values != 0);
+    counts = DictCreate();
+    for(i = 0; i < nkeys; i++) {
+        char key[64];
+
+        snprintf(key, sizeof(key), "www.host%d.com/p/%d", i % 97, (int) (next_random(&x) % (nkeys * 4)));
+        if(DictSearch(counts, key) != 0) {
+            i--;
+            continue;
+        }
+        keys[i] = strdup(key);
+        values[i] = 1 + (int) (next_random(&x) % 1000);
+        DictInsert(counts, keys[i], values[i]);
+    }
+
+    /* the text output, as the reducer prints it */
+    if((fp = fopen(text_path, "w")) == 0) {
+        perror(text_path);
+        exit(1);
+    }
+    DictForEach(counts, write_text, fp);
+    fclose(fp);
+
+    /* the table: sorted, then streamed through the writer */
+    {
+        char **sorted = malloc(nkeys * sizeof(char *));
+
+        memcpy(sorted, keys, nkeys * sizeof(char *));
+        qsort(sorted, nkeys, sizeof(char *), compare_keys_qsort);
+        if(TableWriterOpen(&w, table_path) < 0) {
+            perror(table_path);
+            exit(1);
+        }
+        for(i = 0; i < nkeys; i++) {
+            if(TableWriterAdd(&w, sorted[i], strlen(sorted[i]), DictSearch(counts, sorted[i])) < 0) {
+                perror("table_bench: add");
+                exit(1);
+            }
+        }
+        if(TableWriterClose(&w) < 0) {
+            perror("table_bench: close");
+            exit(1);
+        }
+        free(sorted);
+    }
+    stat(text_path, &st_text);
+    stat(table_path, &st_table);
+
+    /* cold: open and a thousand lookups on a file that is not cached */
+    drop_cache(text_path);
+    t0 = now_sec();
+    parsed = parse_text(text_path);
+    t_parse = now_sec() - t0;
+    for(i = 0; i < COLD_LOOKUPS; i++) {
+        r = next_random(&x) % nkeys;
+        if(DictSearch(parsed, keys[r]) != values[r]) bad++;
+    }
+    t_cold_text = now_sec() - t0;
+
+    drop_cache(table_path);
+    t0 = now_sec();
+    if((table = TableOpen(table_path)) == 0) {
+        perror(table_path);
+        exit(1);
+    }
+    t_open = now_sec() - t0;
+    for(i = 0; i < COLD_LOOKUPS; i++) {
+        r = next_random(&x) % nkeys;
+        if(TableGet(table, keys[r], strlen(keys[r]), &v) != 1 || v != values[r]) bad++;
+    }
+    t_cold_table = now_sec() - t0;
+
+    /* warm lookups: every key once, plus as many misses */
+    t0 = now_sec();
+    for(i = 0; i < nkeys; i++) {
+        if(DictSearch(parsed, keys[i]) != values[i]) bad++;
+    }
+    t_dict = now_sec() - t0;
+
+    t0 = now_sec();
+    for(i = 0; i < nkeys; i++) {
+        if(TableGet(table, keys[i], strlen(keys[i]), &v) != 1 || v != values[i]) bad++;
+    }
+    for(i = 0; i < nkeys; i++) {
+        snprintf(miss, sizeof(miss), "%s#", keys[i]);
+        if(TableGet(table, miss, strlen(miss), &v) != 0) bad++;
+    }
+    t_table = now_sec() - t0;
+
+    /* prefix scan against a filtered walk of the parsed counts */
+    pc.prefix = PREFIX;
+    pc.len = strlen(PREFIX);
+    pc.n = 0;
+    t0 = now_sec();
+    DictForEach(parsed, count_prefix, &pc);
+    t_scan_dict = now_sec() - t0;
+
+    memset(&sc, 0, sizeof(sc));
+    t0 = now_sec();
+    n = TableScanPrefix(table, PREFIX, strlen(PREFIX), check_order, &sc);
+    t_scan_table = now_sec() - t0;
+    if(n != pc.n) bad++;
+
+    /* the whole table, in order, through a range scan */
+    memset(&sc, 0, sizeof(sc));
+    if(TableScan(table, 0, 0, 0, 0, check_order, &sc) != nkeys || sc.unordered != 0) bad++;
+    if(TableEntries(table) != (uint64_t) nkeys) bad++;
+
+    printf("%d keys: text output %.1f MB, table %.1f MB (%d-byte blocks)\n", nkeys, st_text.st_size / 1e6,
+           st_table.st_size / 1e6, TABLE_BLOCK_SIZE);
+    printf("  %-34s %12s %12s\n", "", "text", "table");
+    printf("  %-34s %10.2f ms %10.3f ms\n", "open (cold)", t_parse * 1e3, t_open * 1e3);
+    printf("  %-34s %10.2f ms %10.2f ms\n", "open + 1000 lookups (cold)", t_cold_text * 1e3, t_cold_table * 1e3);
+    printf("  %-34s %10.0f ns %10.0f ns\n", "lookup (warm, hits; misses for table)", t_dict * 1e9 / nkeys,
+           t_table * 1e9 / (2.0 * nkeys));
+    printf("  %-34s %10.2f ms %10.2f ms   (%ld keys)\n", "prefix scan " PREFIX, t_scan_dict * 1e3,
+           t_scan_table * 1e3, pc.n);
+    printf("  lookups, scans and order: %s\n", bad == 0 ? "correct" : "MISMATCH");
+
+    TableClose(table);
+    DictDestroy(parsed);
+    DictDestroy(counts);
+    unlink(text_path);
+    unlink(table_path);
+
+    return bad != 0;
+}
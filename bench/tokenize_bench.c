@@ -0,0 +1,232 @@
+/* Tokenizer throughput and equivalence.
+ *
+ * Checks that the scalar, SSE2 and AVX2 kernels of tokenize.c hand out
+ * exactly the same (word, length, hash) sequence as the worker's old
+ * NormalizeText pass followed by a whitespace split, on the sample text
+ * and on random bytes, then reports single-core GB/s for each, both for
+ * tokenizing alone and for tokenizing into a Dict.
+ *
+ * USAGE: tokenize_bench [text_file] [megabytes] */
+
+#include "../dict.c"
+#include "../split.c"
+#include "../tokenize.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+typedef size_t (*kernel_fn)(char *, size_t, token_fn, void *);
+
+struct kernel {
+    const char *name;
+    kernel_fn fn;
+};
+
+struct record {
+    unsigned long long digest;  /* order-sensitive mix of every word */
+    size_t words;
+    size_t bytes;
+};
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* the worker's former normalizer: drop punctuation, lowercase */
+static void
+normalize_text(char *p)
+{
+    char *src = p, *dst = p;
+
+    for(; *src; src++) {
+        if(ispunct((unsigned char) *src)) continue;
+        *dst++ = tolower((unsigned char) *src);
+    }
+    *dst = '\0';
+}
+
+static void
+record_word(const char *key, unsigned int len, unsigned long hash, void *arg)
+{
+    struct record *r = arg;
+    unsigned int i;
+
+    if(hash != DictHash(key, len)) r->digest ^= 0xdeadbeef;
+    for(i = 0; i < len; i++) r->digest = (r->digest ^ (unsigned char) key[i]) * 0x100000001b3ULL;
+    r->digest = (r->digest ^ len) * 0x100000001b3ULL;
+    r->words++;
+    r->bytes += len;
+}
+
+static size_t
+legacy(char *buf, size_t len, token_fn fn, void *arg)
+{
+    char *p, *word;
+    size_t n = 0;
+
+    buf[len] = '\0';
+    normalize_text(buf);
+    for(p = buf; *p; ) {
+        while(*p && IS_DELIM(*p)) p++;
+        if(!*p) break;
+        for(word = p; *p && !IS_DELIM(*p); p++);
+        fn(word, p - word, DictHash(word, p - word), arg);
+        n++;
+    }
+    return n;
+}
+
+static void
+count_word(const char *key, unsigned int len, unsigned long hash, void *arg)
+{
+    DictIncrementHashed((Dict) arg, key, len, hash, 1);
+}
+
+static void
+sum_hash(const char *key, unsigned int len, unsigned long hash, void *arg)
+{
+    *(unsigned long *) arg += hash + len;
+}
+
+static struct record
+run_once(kernel_fn fn, const char *input, size_t len)
+{
+    struct record r;
+    char *copy = malloc(len + 1);
+
+    assert(copy != 0);
+    memcpy(copy, input, len);
+    memset(&r, 0, sizeof(r));
+    fn(copy, len, record_word, &r);
+    free(copy);
+
+    return r;
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *path = argc > 1 ? argv[1] : "data/large_text.txt";
+    size_t megabytes = argc > 2 ? atoi(argv[2]) : 64;
+    struct kernel kernels[] = {
+        { "legacy", legacy },
+        { "scalar", TokenizeScalar },
+        { "sse2", tokenize_sse2 },
+        { "avx2", tokenize_avx2 },
+    };
+    int nkernels = sizeof(kernels) / sizeof(kernels[0]);
+    struct record want, got;
+    char *text, *big, *work, *random_bytes;
+    size_t text_len, big_len, i;
+    unsigned long long state = 88172645463325252ULL;
+    unsigned long sink = 0;
+    double t0, t_tok, t_dict;
+    int k, ok = 1, first;
+    FILE *fp;
+    Dict d;
+
+    __builtin_cpu_init();
+    if(!__builtin_cpu_supports("avx2")) nkernels--;
+
+    if((fp = fopen(path, "rb")) == 0) {
+        perror(path);
+        exit(1);
+    }
+    fseek(fp, 0, SEEK_END);
+    text_len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    text = malloc(text_len + 1);
+    assert(text != 0);
+    text_len = fread(text, 1, text_len, fp);
+    fclose(fp);
+
+    /* random bytes, without NUL since the legacy path stops there */
+    random_bytes = malloc(1 << 20);
+    assert(random_bytes != 0);
+    for(i = 0; i < (1 << 20); i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        random_bytes[i] = (char) (state % 255 + 1);
+    }
+
+    printf("tokenize_bench: Tokenize uses %s\n", TokenizeKernel());
+
+    /* equivalence */
+    want = run_once(legacy, text, text_len);
+    for(k = 1; k < nkernels; k++) {
+        got = run_once(kernels[k].fn, text, text_len);
+        if(got.digest != want.digest || got.words != want.words) {
+            printf("  %s differs from legacy on %s\n", kernels[k].name, path);
+            ok = 0;
+        }
+    }
+    want = run_once(legacy, random_bytes, 1 << 20);
+    for(k = 1; k < nkernels; k++) {
+        got = run_once(kernels[k].fn, random_bytes, 1 << 20);
+        if(got.digest != want.digest || got.words != want.words) {
+            printf("  %s differs from legacy on random bytes\n", kernels[k].name);
+            ok = 0;
+        }
+    }
+    /* every length and alignment of a short tricky string */
+    for(i = 0; i < 200; i++) {
+        static const char tricky[] = "Hello, World!! it's  A-OK\t\n(NO) ... x\xe9Z\x7f 12:30 ---- END.";
+        size_t n = i % (sizeof(tricky) - 1), off = i / (sizeof(tricky) - 1);
+        char buf[sizeof(tricky) + 8];
+
+        memcpy(buf, tricky + off, n - (n > off ? off : n));
+        want = run_once(legacy, buf, n - (n > off ? off : n));
+        for(k = 1; k < nkernels; k++) {
+            got = run_once(kernels[k].fn, buf, n - (n > off ? off : n));
+            if(got.digest != want.digest || got.words != want.words) ok = 0;
+        }
+    }
+    printf("  equivalence: %s\n", ok ? "identical" : "MISMATCH");
+
+    /* throughput on a large buffer made of copies of the text */
+    big_len = megabytes << 20;
+    big = malloc(big_len + 1);
+    work = malloc(big_len + 1);
+    assert(big != 0 && work != 0);
+    for(i = 0; i < big_len; i += text_len) {
+        memcpy(big + i, text, big_len - i < text_len ? big_len - i : text_len);
+    }
+
+    printf("  %-8s %12s %12s %14s\n", "kernel", "words", "GB/s", "GB/s into Dict");
+    for(k = 0; k < nkernels; k++) {
+        t_tok = t_dict = 0;
+        got.words = 0;
+        for(first = 1; first >= 0; first--) {
+            memcpy(work, big, big_len);
+            t0 = now_sec();
+            got.words = kernels[k].fn(work, big_len, sum_hash, &sink);
+            t_tok = now_sec() - t0;
+        }
+
+        d = DictCreate();
+        memcpy(work, big, big_len);
+        t0 = now_sec();
+        kernels[k].fn(work, big_len, count_word, d);
+        t_dict = now_sec() - t0;
+        DictDestroy(d);
+
+        printf("  %-8s %12zu %12.2f %14.2f\n", kernels[k].name, got.words,
+               big_len / t_tok / 1e9, big_len / t_dict / 1e9);
+    }
+
+    free(text);
+    free(random_bytes);
+    free(big);
+    free(work);
+
+    return ok && sink != 1 ? 0 : 1;
+}
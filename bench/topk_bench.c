@@ -0,0 +1,314 @@
+/* Top-K summaries against exact counts.
+ *
+ * Splits a word stream between simulated workers that count it a chunk
+ * at a time and fold each chunk into a Space-Saving summary, as
+ * `worker -k` does; the summaries are encoded, decoded and merged as
+ * the reducer does. The merged summary is then checked against exact
+ * Dict counts for a range of summary sizes: every held word must lie
+ * within its reported bounds and every other word at or below the
+ * floor. Also reports how many of the exact top K the summary's top K
+ * recovers, the largest overestimate among them, and the bytes shipped
+ * compared with exact results. Runs on the sample text and on a Zipf
+ * stream with a long tail; exits non-zero if a bound is violated.
+ *
+ * USAGE: topk_bench [text_file] [k] [workers] */
+
+#include "../dict.c"
+#include "../split.c"
+#include "../codec.c"
+#include "../tokenize.c"
+#include "../topk.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#define CHUNK_WORDS 16384   /* words a simulated worker counts per chunk */
+#define MAX_KEY 256
+
+struct tokens {
+    const char **key;
+    unsigned int *len;
+    size_t n;
+};
+
+struct check {
+    Dict held;
+    uint64_t floor;
+    int bad;
+};
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+push(const char *key, unsigned int len, unsigned long hash, void *arg)
+{
+    struct tokens *t = arg;
+
+    if((t->n & (t->n - 1)) == 0) {
+        t->key = realloc(t->key, (t->n * 2 + 1) * sizeof(char *));
+        t->len = realloc(t->len, (t->n * 2 + 1) * sizeof(unsigned int));
+        assert(t->key != 0 && t->len != 0);
+    }
+    t->key[t->n] = key;
+    t->len[t->n] = len;
+    t->n++;
+}
+
+/* the words of copies copies of a file, tokenized like the worker does */
+static void
+file_tokens(const char *path, int copies, struct tokens *t)
+{
+    FILE *fp;
+    char *text;
+    long size;
+    int i;
+
+    if((fp = fopen(path, "rb")) == 0) {
+        perror(path);
+        exit(1);
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    text = malloc(size * copies + 1);
+    assert(text != 0);
+    size = fread(text, 1, size, fp);
+    fclose(fp);
+
+    for(i = 1; i < copies; i++) memcpy(text + i * size, text, size);
+    text[size * copies] = '\0';
+
+    /* words are compacted in place and stay valid in text */
+    Tokenize(text, size * copies, push, t);
+}
+
+/* n words drawn from keys distinct ones with Zipf exponent s */
+static void
+zipf_tokens(int keys, size_t n, double s, struct tokens *t)
+{
+    double *cdf = malloc(keys * sizeof(double));
+    char **names = malloc(keys * sizeof(char *));
+    char name[32];
+    uint64_t x = 0x9E3779B97F4A7C15ULL;
+    double sum = 0, u;
+    int lo, hi, mid, i;
+    size_t j;
+
+    assert(cdf != 0 && names != 0);
+    for(i = 0; i < keys; i++) {
+        sum += 1.0 / pow(i + 1, s);
+        cdf[i] = sum;
+        snprintf(name, sizeof(name), "w%07d", i);
+        names[i] = strdup(name);
+    }
+
+    for(j = 0; j < n; j++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        u = (x >> 11) * 0x1.0p-53 * sum;
+
+        for(lo = 0, hi = keys - 1; lo < hi; ) {
+            mid = (lo + hi) / 2;
+            if(cdf[mid] < u) lo = mid + 1; else hi = mid;
+        }
+        push(names[lo], strlen(names[lo]), 0, t);
+    }
+
+    free(cdf);
+}
+
+static void
+fold(const char *key, unsigned int len, int value, void *arg)
+{
+    TopKAdd((TopK) arg, key, len, (uint64_t) value);
+}
+
+/* a word the summary does not hold must be at or below its floor */
+static void
+check_missing(const char *key, unsigned int len, int value, void *arg)
+{
+    struct check *c = arg;
+
+    if(DictSearch(c->held, key) == 0 && (uint64_t) value > c->floor) c->bad++;
+}
+
+static int
+exact_count(Dict exact, const struct topk_item *item)
+{
+    char key[MAX_KEY];
+    unsigned int len = item->len < MAX_KEY - 1 ? item->len : MAX_KEY - 1;
+
+    memcpy(key, item->key, len);
+    key[len] = '\0';
+    return DictSearch(exact, key);
+}
+
+/* exact counts of each worker's share, and the bytes they would ship */
+static size_t
+exact_shipped(struct tokens *t, int workers)
+{
+    size_t from, to, i, length, total = 0;
+    char *buffer;
+    Dict d;
+    int w;
+
+    for(w = 0; w < workers; w++) {
+        from = t->n * w / workers;
+        to = t->n * (w + 1) / workers;
+        d = DictCreate();
+        for(i = from; i < to; i++) DictIncrementLen(d, t->key[i], t->len[i], 1);
+        buffer = DictEncode(d, 0, &length);
+        total += length;
+        free(buffer);
+        DictDestroy(d);
+    }
+
+    return total;
+}
+
+/* run the job with summaries of counters keys and check the result */
+static int
+run(struct tokens *t, Dict exact, uint64_t threshold, int k, int counters, int workers)
+{
+    struct topk_item *items;
+    struct check c;
+    TopK reducer = 0, sketch, part;
+    size_t from, to, i, j, length, shipped = 0;
+    char *buffer;
+    double t0, elapsed, worst = 0, over;
+    int w, n, hits = 0, e;
+
+    t0 = now_sec();
+    for(w = 0; w < workers; w++) {
+        from = t->n * w / workers;
+        to = t->n * (w + 1) / workers;
+        sketch = TopKCreate(counters);
+
+        for(i = from; i < to; i += CHUNK_WORDS) {
+            Dict chunk = DictCreate();
+
+            for(j = i; j < to && j < i + CHUNK_WORDS; j++) DictIncrementLen(chunk, t->key[j], t->len[j], 1);
+            DictForEach(chunk, fold, sketch);
+            DictDestroy(chunk);
+        }
+
+        if(TopKEncodePartitioned(sketch, 1, &buffer, &length) < 0 || (part = TopKDecode(buffer, length)) == 0) {
+            fprintf(stderr, "topk_bench: encoding round trip failed\n");
+            exit(1);
+        }
+        shipped += length;
+        free(buffer);
+        TopKDestroy(sketch);
+
+        if(reducer == 0) {
+            reducer = part;
+        } else {
+            TopKMerge(reducer, part);
+            TopKDestroy(part);
+        }
+    }
+    elapsed = now_sec() - t0;
+
+    /* every held word within its bounds */
+    items = malloc((TopKSize(reducer) + 1) * sizeof(struct topk_item));
+    assert(items != 0);
+    n = TopKList(reducer, items, TopKSize(reducer));
+    c.held = DictCreate();
+    c.floor = TopKFloor(reducer);
+    c.bad = 0;
+    for(i = 0; i < (size_t) n; i++) {
+        e = exact_count(exact, &items[i]);
+        if((uint64_t) e > items[i].count || (uint64_t) e < items[i].count - items[i].error) c.bad++;
+        DictIncrementLen(c.held, items[i].key, items[i].len, 1);
+
+        /* of the summary's top k, those truly in the top k (ties included) */
+        if(i < (size_t) k) {
+            if((uint64_t) e >= threshold) hits++;
+            over = e > 0 ? (double) (items[i].count - e) / e : 0;
+            if(over > worst) worst = over;
+        }
+    }
+    DictForEach(exact, check_missing, &c);
+
+    printf("  %10d %10.1f %9d/%-3d %9.2f%% %10.1f %s\n", counters, shipped / 1024.0, hits, k,
+           worst * 100, elapsed * 1e3, c.bad == 0 ? "hold" : "VIOLATED");
+
+    free(items);
+    DictDestroy(c.held);
+    TopKDestroy(reducer);
+
+    return c.bad;
+}
+
+static int
+bench(const char *label, struct tokens *t, int k, int workers)
+{
+    static const int sizes[] = { 64, 256, 1024, 4096, 16384 };
+    struct topk_item *truth;
+    TopK all;
+    Dict exact;
+    size_t i;
+    int bad = 0, s;
+
+    exact = DictCreate();
+    for(i = 0; i < t->n; i++) DictIncrementLen(exact, t->key[i], t->len[i], 1);
+
+    /* a summary with room for every word is exact */
+    all = TopKCreate(DictSize(exact));
+    DictForEach(exact, fold, all);
+    truth = malloc(k * sizeof(struct topk_item));
+    if(TopKList(all, truth, k) < k) {
+        fprintf(stderr, "topk_bench: fewer than %d distinct words\n", k);
+        exit(1);
+    }
+
+    printf("%s: %zu words, %d distinct, top %d over %d workers\n", label, t->n, DictSize(exact), k, workers);
+    printf("  %10s %10s %13s %10s %10s %s\n", "counters", "shipped KB", "top-k recall", "max over", "ms", "bounds");
+    printf("  %10s %10.1f\n", "exact", exact_shipped(t, workers) / 1024.0);
+
+    for(s = 0; s < (int) (sizeof(sizes) / sizeof(sizes[0])); s++) {
+        if(sizes[s] >= 4 * k) bad += run(t, exact, truth[k - 1].count, k, sizes[s], workers);
+    }
+
+    free(truth);
+    TopKDestroy(all);
+    DictDestroy(exact);
+
+    return bad;
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *path = argc > 1 ? argv[1] : "data/large_text.txt";
+    int k = argc > 2 ? atoi(argv[2]) : 20;
+    int workers = argc > 3 ? atoi(argv[3]) : 4;
+    struct tokens t;
+    int bad = 0;
+
+    if(k < 1 || workers < 1) {
+        fprintf(stderr, "USAGE: topk_bench [text_file] [k] [workers]\n");
+        exit(1);
+    }
+
+    memset(&t, 0, sizeof(t));
+    file_tokens(path, 20, &t);
+    bad += bench(path, &t, k, workers);
+
+    memset(&t, 0, sizeof(t));
+    zipf_tokens(1000000, 8000000, 1.1, &t);
+    bad += bench("zipf 1.1", &t, k, workers);
+
+    return bad > 0;
+}
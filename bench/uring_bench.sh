@@ -0,0 +1,56 @@
+#!/bin/sh
+# Driver input I/O: blocking reads, sendfile and io_uring.
+#
+# Sends a large file to local sink workers (bench/sink_worker, which
+# discard every chunk) with the default blocking pread + send path, with
+# -z (sendfile) and with -u (io_uring read-ahead and sends), and reports
+# the time the driver measured for each. Before every run the file is
+# dropped from the page cache, so each run reads it from disk as it
+# would a file larger than memory.
+#
+# Run from the repository root after `make bench/sink_worker`.
+# USAGE: bench/uring_bench.sh [megabytes] [chunk_size] [workers] [dir]
+
+MEGABYTES=${1:-1024}
+CHUNK=${2:-1M}
+WORKERS=${3:-4}
+DIR=${4:-${TMPDIR:-/tmp}}
+BASE_PORT=9500
+INPUT=$DIR/uring_bench.$$.txt
+
+# Input: copies of the sample text up to the requested size
+: > "$INPUT"
+while [ $(($(wc -c < "$INPUT") >> 20)) -lt "$MEGABYTES" ]; do
+  cat data/large_text.txt data/large_text.txt data/large_text.txt data/large_text.txt >> "$INPUT"
+done
+
+wlist=""
+wpids=""
+i=0
+while [ $i -lt "$WORKERS" ]; do
+  port=$((BASE_PORT + i))
+  ./bench/sink_worker $port > /dev/null 2>&1 &
+  wpids="$wpids $!"
+  wlist="$wlist${wlist:+,}127.0.0.1:$port"
+  i=$((i + 1))
+done
+sleep 0.5
+
+run() {
+  label=$1
+  shift
+  sync
+  dd if="$INPUT" iflag=nocache count=0 status=none 2>/dev/null
+  ./driver -S -c "$CHUNK" -w "$wlist" "$@" "$INPUT" "$WORKERS" > "$DIR/uring_bench.$$.out" 2>&1
+  printf '%-10s %s\n' "$label" \
+    "$(grep -E '^Processed|unavailable' "$DIR/uring_bench.$$.out" | sed 's/^Processed .* in //')"
+}
+
+echo "uring_bench: $(($(wc -c < "$INPUT") >> 20)) MB in $CHUNK chunks to $WORKERS sink workers, cold cache"
+run blocking
+run sendfile -z
+run io_uring -u
+
+kill $wpids 2>/dev/null
+wait 2>/dev/null
+rm -f "$INPUT" "$DIR/uring_bench.$$.out"
@@ -0,0 +1,49 @@
+#!/bin/sh
+# Map-thread scaling of a single worker process.
+#
+# Runs the same job against one local worker started with `-t 1`, 2, 4,
+# 8 and the number of online CPUs, and reports the throughput the driver
+# measured for each. Chunks are large so every one of them is cut into
+# many blocks for the map threads. Checks that every run's counts equal
+# a reference count of the input.
+#
+# Run from the repository root after `make`.
+# USAGE: bench/worker_scaling.sh [copies] [chunk_size]
+
+COPIES=${1:-400}
+CHUNK=${2:-16M}
+WORKER_PORT=9400
+REDUCER_PORT=5800
+TMP=${TMPDIR:-/tmp}/worker_scaling.$$
+CPUS=$(getconf _NPROCESSORS_ONLN)
+
+. bench/common.sh
+mkdir -p "$TMP"
+sample_input "$COPIES" "$TMP/input.txt"
+reference_counts "$TMP/input.txt" "$TMP/expected"
+
+run() {
+  threads=$1
+  ./reducer $REDUCER_PORT > "$TMP/reducer.out" 2>&1 &
+  rpid=$!
+  start_workers 1 $WORKER_PORT -t "$threads" -r 127.0.0.1:$REDUCER_PORT
+
+  ./driver -c "$CHUNK" -w 127.0.0.1:$WORKER_PORT "$TMP/input.txt" 1 > "$TMP/driver.out" 2>&1
+  kill -TSTP $rpid
+  sleep 0.5
+
+  reducer_counts "$TMP/reducer.out" > "$TMP/got"
+  if cmp -s "$TMP/expected" "$TMP/got"; then check=ok; else check=MISMATCH; fi
+  rate=$(sed -n 's/^Processed.*(\(.*\) MB\/s).*/\1/p' "$TMP/driver.out")
+  printf '%4d thread(s)  %8s MB/s  counts %s\n' "$threads" "$rate" "$check"
+
+  kill $rpid $wpids 2>/dev/null
+  wait 2>/dev/null
+}
+
+echo "worker_scaling: $(wc -c < "$TMP/input.txt") bytes in $CHUNK chunks, $CPUS CPUs"
+for t in $(printf '%s\n' 1 2 4 8 "$CPUS" | sort -n | uniq); do
+  run "$t"
+done
+
+rm -rf "$TMP"
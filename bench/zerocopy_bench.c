@@ -0,0 +1,193 @@
+/* Copying vs zero-copy shipping of input splits over loopback.
+ *
+ * Generates a multi-GB text file (warm in the page cache afterwards),
+ * forks a sink that receives chunk frames and discards them, and sends
+ * the whole file to it twice per split size: once the default driver
+ * way (pread into a buffer, then send) and once with `driver -z`
+ * (sendfile straight from the page cache). Reports wall-clock MB/s and
+ * the CPU time the sending process spent per GB.
+ *
+ * USAGE: zerocopy_bench [size_gb] [file] */
+
+#include "../proto.c"
+#include "../split.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define SINK_PORT "9777"
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double
+cpu_sec(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+           ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+/* write size bytes of repeated sample text to path */
+static void
+generate(const char *path, size_t size)
+{
+    static const char sample[] =
+        "Well, Prince, so Genoa and Lucca are now just family estates of the "
+        "Buonapartes. But I warn you, if you don't tell me that this means war,\n";
+    char *block;
+    size_t block_size = 1 << 20, off, n;
+    FILE *fp;
+
+    block = malloc(block_size);
+    assert(block != 0);
+    for(off = 0; off < block_size; off += n) {
+        n = block_size - off < sizeof(sample) - 1 ? block_size - off : sizeof(sample) - 1;
+        memcpy(block + off, sample, n);
+    }
+
+    if((fp = fopen(path, "wb")) == 0) {
+        perror(path);
+        exit(1);
+    }
+    for(off = 0; off < size; off += block_size) {
+        fwrite(block, 1, block_size, fp);
+    }
+    fclose(fp);
+    free(block);
+}
+
+/* accept connections and swallow frames until killed */
+static void
+sink(int listener)
+{
+    struct frame_header header;
+    char *buf = malloc(1 << 20);
+    uint64_t left, n;
+    int sock;
+
+    assert(buf != 0);
+
+    while((sock = accept(listener, 0, 0)) >= 0) {
+        while(RecvFrameHeader(sock, &header) > 0) {
+            for(left = header.length; left > 0; left -= n) {
+                n = left < (1 << 20) ? left : (1 << 20);
+                if(RecvAll(sock, buf, n) < 1) break;
+            }
+            if(header.type == FRAME_END) {
+                SendFrame(sock, FRAME_END, 0, 0, 0);
+                break;
+            }
+        }
+        close(sock);
+    }
+    _exit(0);
+}
+
+static void
+run(const char *label, struct input_file *in, size_t split_size, int zero_copy)
+{
+    struct frame_header header;
+    struct split *splits;
+    size_t nsplits, i, capacity = 0;
+    char *buffer = 0;
+    double t0, c0, t, c;
+    int sock, status;
+
+    splits = ComputeSplits(in->data, in->size, split_size, &nsplits);
+    assert(splits != 0);
+
+    if((sock = ConnectTo("127.0.0.1", SINK_PORT)) < 0) {
+        perror("connect to sink");
+        exit(1);
+    }
+
+    t0 = now_sec();
+    c0 = cpu_sec();
+    for(i = 0; i < nsplits; i++) {
+        if(zero_copy) {
+            status = SendFrameFromFile(sock, FRAME_CHUNK, i, in->fd,
+                                       splits[i].offset, splits[i].length);
+        } else {
+            if(splits[i].length > capacity) {
+                capacity = splits[i].length;
+                buffer = realloc(buffer, capacity);
+                assert(buffer != 0);
+            }
+            if(pread(in->fd, buffer, splits[i].length, splits[i].offset) != (ssize_t) splits[i].length) {
+                perror("pread");
+                exit(1);
+            }
+            status = SendFrame(sock, FRAME_CHUNK, i, buffer, splits[i].length);
+        }
+        if(status < 1) {
+            perror("send");
+            exit(1);
+        }
+    }
+    SendFrame(sock, FRAME_END, 0, 0, 0);
+    RecvFrameHeader(sock, &header);
+    t = now_sec() - t0;
+    c = cpu_sec() - c0;
+    close(sock);
+
+    printf("  %-10s %8zuK %10.1f MB/s %8.3f cpu-s/GB\n", label, split_size >> 10,
+           in->size / 1048576.0 / t, c / (in->size / 1073741824.0));
+
+    free(buffer);
+    free(splits);
+}
+
+int
+main(int argc, char *argv[])
+{
+    size_t size = (size_t) (argc > 1 ? atof(argv[1]) : 2.0) * 1073741824.0;
+    const char *path = argc > 2 ? argv[2] : "/tmp/mapreduce_zerocopy.dat";
+    static const size_t sizes[] = { 1 << 20, 16 << 20 };
+    struct input_file in;
+    int listener;
+    pid_t pid;
+    unsigned i;
+
+    printf("zerocopy_bench: generating %.1f GB in %s\n", size / 1073741824.0, path);
+    generate(path, size);
+
+    if(MapInput(path, &in) < 0) {
+        perror(path);
+        return 1;
+    }
+
+    if((listener = ListenOn(SINK_PORT, 5)) < 0) {
+        perror("listen");
+        return 1;
+    }
+    if((pid = fork()) == 0) sink(listener);
+    close(listener);
+
+    for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        run("pread+send", &in, sizes[i], 0);
+        run("sendfile", &in, sizes[i], 1);
+    }
+
+    kill(pid, SIGTERM);
+    waitpid(pid, 0, 0);
+    UnmapInput(&in);
+    unlink(path);
+
+    return 0;
+}
@@ -0,0 +1,172 @@
+/* Synthetic corpus generator for the end-to-end benchmark.
+ *
+ * Writes about size bytes of text whose words are drawn from a
+ * vocabulary of the given size with Zipf exponent s: the word of rank r
+ * occurs in proportion to 1 / r^s. Words are lowercase letters only, so
+ * every tokenizer splits them the same way. Each word ends in a
+ * fixed-length code for its rank, after a variable-length stem, so all
+ * words are distinct and their lengths spread from 1 + code to 6 + code
+ * letters. Lines hold about twelve words. Ranks are sampled in constant
+ * time with Vose's alias method.
+ *
+ * With a counts file it also writes the exact number of times each
+ * word was written, one `word count` line per word that occurred. This
+ * is the reference the pipeline's output is checked against.
+ *
+ * USAGE: zipf_corpus <out_file> <size> [vocabulary] [exponent] [seed] [counts_file] */
+
+#include "../proto.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <assert.h>
+
+#define STEM_MAX 5
+#define LINE_WORDS 12
+
+static uint64_t
+next_random(uint64_t *x)
+{
+    *x ^= *x << 13;
+    *x ^= *x >> 7;
+    *x ^= *x << 17;
+    return *x;
+}
+
+/* splitmix64, for per-rank stems that do not depend on the seed */
+static uint64_t
+mix(uint64_t x)
+{
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+/* the word of rank r: a stem of 1 to STEM_MAX + 1 letters, then r in */
+/* code base-26 letters; returns its length */
+static int
+make_word(char *out, uint64_t r, int code)
+{
+    uint64_t h = mix(r);
+    int stem = 1 + (int) (h % (STEM_MAX + 1));
+    int i, n = 0;
+
+    for(i = 0; i < stem; i++) {
+        h = mix(h);
+        out[n++] = 'a' + (char) (h % 26);
+    }
+    for(i = 0; i < code; i++) {
+        out[n + code - 1 - i] = 'a' + (char) (r % 26);
+        r /= 26;
+    }
+
+    return n + code;
+}
+
+int
+main(int argc, char *argv[])
+{
+    size_t size, written = 0;
+    long vocabulary = argc > 3 ? atol(argv[3]) : 100000;
+    double s = argc > 4 ? atof(argv[4]) : 1.0;
+    uint64_t x = argc > 5 ? strtoull(argv[5], 0, 10) : 88172645463325252ULL;
+    const char *counts_path = argc > 6 ? argv[6] : 0;
+    double *prob, sum = 0;
+    long *alias, *small, *large, ns = 0, nl = 0, i, r;
+    uint64_t *counts;
+    char **words;
+    int *lengths;
+    char line[LINE_WORDS * 64];
+    int code, n, w;
+    FILE *out;
+
+    if(argc < 3 || (size = ParseSize(argv[2])) == 0 || vocabulary < 1 || s < 0 || x == 0) {
+        fprintf(stderr, "USAGE: zipf_corpus <out_file> <size> [vocabulary] [exponent] [seed] [counts_file]\n");
+        exit(1);
+    }
+
+    prob = malloc(vocabulary * sizeof(double));
+    alias = malloc(vocabulary * sizeof(long));
+    small = malloc(vocabulary * sizeof(long));
+    large = malloc(vocabulary * sizeof(long));
+    counts = calloc(vocabulary, sizeof(uint64_t));
+    words = malloc(vocabulary * sizeof(char *));
+    lengths = malloc(vocabulary * sizeof(int));
+    assert(prob && alias && small && large && counts && words && lengths);
+
+    /* fixed-length code, so that stem + code never repeats */
+    for(code = 1, r = 26; r < vocabulary; code++) r *= 26;
+    for(i = 0; i < vocabulary; i++) {
+        char word[64];
+
+        lengths[i] = make_word(word, i, code);
+        words[i] = malloc(lengths[i]);
+        assert(words[i] != 0);
+        memcpy(words[i], word, lengths[i]);
+    }
+
+    /* alias table: each column holds its own probability and the rest of */
+    /* a column that is over the average */
+    for(i = 0; i < vocabulary; i++) sum += prob[i] = 1.0 / pow(i + 1, s);
+    for(i = 0; i < vocabulary; i++) {
+        prob[i] *= vocabulary / sum;
+        alias[i] = i;
+        if(prob[i] < 1) small[ns++] = i; else large[nl++] = i;
+    }
+    while(ns > 0 && nl > 0) {
+        long l = small[--ns], g = large[nl - 1];
+
+        alias[l] = g;
+        prob[g] -= 1 - prob[l];
+        if(prob[g] < 1) {
+            nl--;
+            small[ns++] = g;
+        }
+    }
+    while(nl > 0) prob[large[--nl]] = 1;
+    while(ns > 0) prob[small[--ns]] = 1;
+
+    if((out = fopen(argv[1], "w")) == 0) {
+        perror(argv[1]);
+        exit(1);
+    }
+    while(written < size) {
+        for(n = 0, w = 0; w < LINE_WORDS; w++) {
+            uint64_t u = next_random(&x);
+
+            r = (long) ((u >> 32) % (uint64_t) vocabulary);
+            if((u & 0xFFFFFFFF) * 0x1.0p-32 >= prob[r]) r = alias[r];
+
+            counts[r]++;
+            memcpy(line + n, words[r], lengths[r]);
+            n += lengths[r];
+            line[n++] = w + 1 < LINE_WORDS ? ' ' : '\n';
+        }
+        if(fwrite(line, 1, n, out) != (size_t) n) {
+            perror(argv[1]);
+            exit(1);
+        }
+        written += n;
+    }
+    if(fclose(out) != 0) {
+        perror(argv[1]);
+        exit(1);
+    }
+
+    if(counts_path != 0) {
+        if((out = fopen(counts_path, "w")) == 0) {
+            perror(counts_path);
+            exit(1);
+        }
+        for(i = 0; i < vocabulary; i++) {
+            if(counts[i] > 0) fprintf(out, "%.*s %llu\n", lengths[i], words[i], (unsigned long long) counts[i]);
+        }
+        fclose(out);
+    }
+
+    return 0;
+}
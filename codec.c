@@ -0,0 +1,425 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "dict.h"
+#include "codec.h"
+
+struct entry {
+    const char *key;
+    unsigned int len;
+    int value;
+    int part;
+};
+
+struct encode_state {
+    int parts;
+    struct entry *entries;  /* collected entries */
+    size_t n;
+};
+
+static size_t
+varint_size(uint64_t v)
+{
+    size_t n = 1;
+
+    while(v >= 0x80) {
+        v >>= 7;
+        n++;
+    }
+
+    return n;
+}
+
+static unsigned char *
+put_varint(unsigned char *p, uint64_t v)
+{
+    while(v >= 0x80) {
+        *p++ = (unsigned char) (v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (unsigned char) v;
+
+    return p;
+}
+
+/* returns 0 if the varint is truncated or longer than 10 bytes */
+static int
+get_varint(const unsigned char **pp, const unsigned char *end, uint64_t *v)
+{
+    const unsigned char *p = *pp;
+    uint64_t result = 0;
+    int shift;
+
+    for(shift = 0; p < end && shift < 64; shift += 7) {
+        result |= (uint64_t) (*p & 0x7f) << shift;
+
+        if((*p++ & 0x80) == 0) {
+            *v = result;
+            *pp = p;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+size_t
+VarintSize(uint64_t v)
+{
+    return varint_size(v);
+}
+
+unsigned char *
+VarintPut(unsigned char *p, uint64_t v)
+{
+    return put_varint(p, v);
+}
+
+int
+VarintGet(const unsigned char **p, const unsigned char *end, uint64_t *v)
+{
+    return get_varint(p, end, v);
+}
+
+int
+KeyPartition(const char *key, unsigned int len, int parts)
+{
+    uint64_t h;
+
+    if(parts == 1) return 0;
+
+    /* the stable hash, since every worker must send a key to the same */
+    /* reducer; remixed differently from the one shard.c uses, so that a */
+    /* reducer holding one partition still spreads its keys over all its shards */
+    h = DictHashStable(key, len);
+    h ^= h >> 31;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 29;
+
+    return (int) (((h & 0xffffffffULL) * (uint64_t) parts) >> 32);
+}
+
+static void
+collect_entry(const char *key, unsigned int len, int value, void *arg)
+{
+    struct encode_state *st = arg;
+    struct entry *e = &st->entries[st->n++];
+
+    e->key = key;
+    e->len = len;
+    e->value = value;
+    e->part = KeyPartition(key, len, st->parts);
+}
+
+static int
+compare_entries(const void *a, const void *b)
+{
+    const struct entry *x = a;
+    const struct entry *y = b;
+    unsigned int len = x->len < y->len ? x->len : y->len;
+    int c = memcmp(x->key, y->key, len);
+
+    if(c != 0) return c;
+
+    return (x->len > y->len) - (x->len < y->len);
+}
+
+static unsigned int
+shared_prefix(const struct entry *a, const struct entry *b)
+{
+    unsigned int len = a->len < b->len ? a->len : b->len;
+    unsigned int i;
+
+    for(i = 0; i < len && a->key[i] == b->key[i]; i++);
+
+    return i;
+}
+
+int
+DictEncodePartitioned(Dict d, int flags, int parts, char *buffers[], size_t lengths[])
+{
+    struct encode_state st;
+    struct entry **prev;
+    size_t *counts;
+    unsigned char **out;
+    unsigned int shared;
+    size_t i;
+    int p;
+
+    for(p = 0; p < parts; p++) buffers[p] = 0;
+
+    st.parts = parts;
+    st.n = 0;
+    st.entries = malloc((DictSize(d) + 1) * sizeof(struct entry));
+    prev = calloc(parts, sizeof(struct entry *));
+    counts = calloc(parts, sizeof(size_t));
+    out = calloc(parts, sizeof(unsigned char *));
+
+    if(st.entries == 0 || prev == 0 || counts == 0 || out == 0) goto fail;
+
+    DictForEach(d, collect_entry, &st);
+
+    if(flags & CODEC_SORTED) {
+        qsort(st.entries, st.n, sizeof(struct entry), compare_entries);
+    }
+
+    /* sizing pass; a sorted partition shares prefixes with the */
+    /* previous key of the same partition, which is still sorted */
+    for(i = 0; i < st.n; i++) {
+        p = st.entries[i].part;
+        counts[p]++;
+    }
+    for(p = 0; p < parts; p++) lengths[p] = 2 + varint_size(counts[p]);
+    for(i = 0; i < st.n; i++) {
+        p = st.entries[i].part;
+        shared = 0;
+        if(flags & CODEC_SORTED) {
+            shared = prev[p] ? shared_prefix(prev[p], &st.entries[i]) : 0;
+            lengths[p] += varint_size(shared);
+            prev[p] = &st.entries[i];
+        }
+        lengths[p] += varint_size(st.entries[i].len - shared) + st.entries[i].len - shared +
+                      varint_size((uint32_t) st.entries[i].value);
+    }
+
+    /* one allocation of exactly the right size per partition */
+    for(p = 0; p < parts; p++) {
+        if((buffers[p] = malloc(lengths[p])) == 0) goto fail;
+
+        out[p] = (unsigned char *) buffers[p];
+        out[p][0] = CODEC_VERSION;
+        out[p][1] = flags & CODEC_SORTED;
+        out[p] = put_varint(out[p] + 2, counts[p]);
+        prev[p] = 0;
+    }
+
+    for(i = 0; i < st.n; i++) {
+        p = st.entries[i].part;
+        shared = 0;
+        if(flags & CODEC_SORTED) {
+            shared = prev[p] ? shared_prefix(prev[p], &st.entries[i]) : 0;
+            out[p] = put_varint(out[p], shared);
+            prev[p] = &st.entries[i];
+        }
+        out[p] = put_varint(out[p], st.entries[i].len - shared);
+        memcpy(out[p], st.entries[i].key + shared, st.entries[i].len - shared);
+        out[p] += st.entries[i].len - shared;
+        out[p] = put_varint(out[p], (uint32_t) st.entries[i].value);
+    }
+
+    free(st.entries);
+    free(prev);
+    free(counts);
+    free(out);
+    return 0;
+
+fail:
+    for(p = 0; p < parts; p++) {
+        free(buffers[p]);
+        buffers[p] = 0;
+    }
+    free(st.entries);
+    free(prev);
+    free(counts);
+    free(out);
+    return -1;
+}
+
+char *
+DictEncode(Dict d, int flags, size_t *length)
+{
+    char *buffer;
+
+    if(DictEncodePartitioned(d, flags, 1, &buffer, length) < 0) return 0;
+
+    return buffer;
+}
+
+/* room left in front of the entries for version, flags and count */
+#define HEADER_ROOM (2 + 10)
+
+void
+DictEncoderInit(struct dict_encoder *enc, int flags)
+{
+    memset(enc, 0, sizeof(*enc));
+    enc->flags = flags & CODEC_SORTED;
+    enc->used = HEADER_ROOM;
+}
+
+int
+DictEncoderAdd(struct dict_encoder *enc, const char *key, unsigned int len, int value)
+{
+    unsigned int shared = 0;
+    unsigned char *p;
+    size_t need;
+
+    need = enc->used + 3 * 10 + len;
+    if(need > enc->capacity) {
+        need = need * 2 > 4096 ? need * 2 : 4096;
+        if((p = realloc(enc->buffer, need)) == 0) return -1;
+        enc->buffer = p;
+        enc->capacity = need;
+    }
+    p = enc->buffer + enc->used;
+
+    if(enc->flags & CODEC_SORTED) {
+        if(enc->count > 0) {
+            unsigned int max = enc->prev_len < len ? enc->prev_len : len;
+            while(shared < max && enc->prev[shared] == key[shared]) shared++;
+        }
+        p = put_varint(p, shared);
+
+        if(len > enc->prev_size) {
+            char *prev = realloc(enc->prev, len * 2 + 16);
+            if(prev == 0) return -1;
+            enc->prev = prev;
+            enc->prev_size = len * 2 + 16;
+        }
+        memcpy(enc->prev + shared, key + shared, len - shared);
+        enc->prev_len = len;
+    }
+
+    p = put_varint(p, len - shared);
+    memcpy(p, key + shared, len - shared);
+    p += len - shared;
+    p = put_varint(p, (uint32_t) value);
+
+    enc->used = p - enc->buffer;
+    enc->count++;
+
+    return 0;
+}
+
+uint64_t
+DictEncoderCount(struct dict_encoder *enc)
+{
+    return enc->count;
+}
+
+size_t
+DictEncoderSize(struct dict_encoder *enc)
+{
+    return enc->used - HEADER_ROOM + 2 + varint_size(enc->count);
+}
+
+const char *
+DictEncoderFinish(struct dict_encoder *enc, size_t *length)
+{
+    size_t start = HEADER_ROOM - 2 - varint_size(enc->count);
+
+    if(enc->buffer == 0) {
+        if((enc->buffer = malloc(HEADER_ROOM)) == 0) return 0;
+        enc->capacity = HEADER_ROOM;
+    }
+
+    /* the header goes right in front of the first entry */
+    enc->buffer[start] = CODEC_VERSION;
+    enc->buffer[start + 1] = enc->flags;
+    put_varint(enc->buffer + start + 2, enc->count);
+
+    *length = enc->used - start;
+    return (const char *) enc->buffer + start;
+}
+
+void
+DictEncoderReset(struct dict_encoder *enc)
+{
+    enc->used = HEADER_ROOM;
+    enc->count = 0;
+    enc->prev_len = 0;
+}
+
+void
+DictEncoderFree(struct dict_encoder *enc)
+{
+    free(enc->buffer);
+    free(enc->prev);
+    memset(enc, 0, sizeof(*enc));
+}
+
+int
+DictDecoderInit(struct dict_decoder *dec, const void *buffer, size_t length)
+{
+    memset(dec, 0, sizeof(*dec));
+    dec->p = buffer;
+    dec->end = dec->p + length;
+
+    if(length < 2 || dec->p[0] != CODEC_VERSION) return -1;
+
+    dec->flags = dec->p[1];
+    dec->p += 2;
+
+    if(!get_varint(&dec->p, dec->end, &dec->remaining)) return -1;
+
+    return 0;
+}
+
+int
+DictDecoderNext(struct dict_decoder *dec, const char **key, unsigned int *len, int *value)
+{
+    uint64_t shared = 0;
+    uint64_t rest;
+    uint64_t v;
+
+    if(dec->remaining == 0) return 0;
+
+    if((dec->flags & CODEC_SORTED) && !get_varint(&dec->p, dec->end, &shared)) return -1;
+
+    if(!get_varint(&dec->p, dec->end, &rest) || rest > (uint64_t) (dec->end - dec->p)) return -1;
+
+    if(dec->flags & CODEC_SORTED) {
+        /* rebuild the key from the previous one plus the new suffix */
+        if(shared > dec->key_len) return -1;
+
+        if(shared + rest > dec->scratch_size) {
+            dec->scratch_size = (shared + rest) * 2 + 16;
+            dec->scratch = realloc(dec->scratch, dec->scratch_size);
+            if(dec->scratch == 0) return -1;
+        }
+        memcpy(dec->scratch + shared, dec->p, rest);
+        dec->key_len = shared + rest;
+        *key = dec->scratch;
+    } else {
+        /* the key is used in place */
+        dec->key_len = rest;
+        *key = (const char *) dec->p;
+    }
+    dec->p += rest;
+
+    if(!get_varint(&dec->p, dec->end, &v)) return -1;
+
+    *len = dec->key_len;
+    *value = (int) (uint32_t) v;
+    dec->remaining--;
+
+    return 1;
+}
+
+void
+DictDecoderFree(struct dict_decoder *dec)
+{
+    free(dec->scratch);
+    dec->scratch = 0;
+}
+
+long
+DictMerge(Dict d, const void *buffer, size_t length)
+{
+    struct dict_decoder dec;
+    const char *key;
+    unsigned int len;
+    int value;
+    int status;
+    long n = 0;
+
+    if(DictDecoderInit(&dec, buffer, length) < 0) return -1;
+
+    while((status = DictDecoderNext(&dec, &key, &len, &value)) > 0) {
+        DictIncrementLen(d, key, len, value);
+        n++;
+    }
+
+    DictDecoderFree(&dec);
+
+    return status < 0 ? -1 : n;
+}
@@ -0,0 +1,102 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dict.h"
+
+/* Binary encoding of a Dict, used for worker -> reducer results.
+ *
+ *   byte     format version (CODEC_VERSION)
+ *   byte     flags (CODEC_SORTED)
+ *   varint   number of entries
+ *   entries:
+ *     varint   bytes shared with the previous key (only if CODEC_SORTED)
+ *     varint   length of the rest of the key
+ *     bytes    rest of the key
+ *     varint   value
+ *
+ * Varints are little-endian base-128. Unsorted entries carry their whole
+ * key, so they decode straight out of the received buffer; sorted
+ * entries trade a sort for shared-prefix compression. */
+
+#define CODEC_VERSION 1
+#define CODEC_SORTED 0x1
+
+/* encode every entry of d into one exactly-sized malloc'd buffer */
+/* flags is 0 or CODEC_SORTED; returns NULL if out of memory */
+char *DictEncode(Dict d, int flags, size_t *length);
+
+/* which of parts partitions a key belongs to; every node of a job */
+/* must agree on this, so it depends only on the key bytes */
+int KeyPartition(const char *key, unsigned int len, int parts);
+
+/* encode d as parts buffers, entry k going to KeyPartition(k, parts); */
+/* each buffer is a complete encoding on its own, possibly empty */
+/* returns 0, or -1 if out of memory (with no buffers left allocated) */
+int DictEncodePartitioned(Dict d, int flags, int parts, char *buffers[], size_t lengths[]);
+
+/* Streaming encoder: entries are appended one at a time into a growing
+ * buffer, for output too large to build as a Dict first. With
+ * CODEC_SORTED the caller must add keys in ascending byte order. */
+struct dict_encoder {
+    unsigned char *buffer;
+    size_t used;            /* entries start after room for the header */
+    size_t capacity;
+    uint64_t count;
+    int flags;
+    char *prev;             /* previous key, for prefix sharing */
+    unsigned int prev_len;
+    size_t prev_size;
+};
+
+void DictEncoderInit(struct dict_encoder *enc, int flags);
+
+/* append an entry; returns 0, or -1 if out of memory */
+int DictEncoderAdd(struct dict_encoder *enc, const char *key, unsigned int len, int value);
+
+/* entries added since the last reset */
+uint64_t DictEncoderCount(struct dict_encoder *enc);
+
+/* bytes the encoding would take if finished now */
+size_t DictEncoderSize(struct dict_encoder *enc);
+
+/* complete the encoding and return it; the result points into the */
+/* encoder and is valid until the next add, reset or free */
+const char *DictEncoderFinish(struct dict_encoder *enc, size_t *length);
+
+/* start a new, empty encoding, keeping the buffer */
+void DictEncoderReset(struct dict_encoder *enc);
+
+void DictEncoderFree(struct dict_encoder *enc);
+
+struct dict_decoder {
+    const unsigned char *p;
+    const unsigned char *end;
+    uint64_t remaining;     /* entries not yet returned */
+    int flags;
+    char *scratch;          /* rebuilt key for sorted input */
+    size_t scratch_size;
+    size_t key_len;         /* length of the previous key */
+};
+
+/* start decoding buffer; returns 0, or -1 if the header is malformed */
+int DictDecoderInit(struct dict_decoder *dec, const void *buffer, size_t length);
+
+/* return the next entry: 1 on success, 0 at the end, -1 if malformed */
+/* *key points into the buffer (or scratch space) and is not terminated */
+int DictDecoderNext(struct dict_decoder *dec, const char **key, unsigned int *len, int *value);
+
+void DictDecoderFree(struct dict_decoder *dec);
+
+/* add every entry of an encoded buffer to d; returns entries or -1 */
+long DictMerge(Dict d, const void *buffer, size_t length);
+
+/* the varints of the format, for other encodings built on them; */
+/* VarintGet returns 0 if the varint is truncated or too long */
+size_t VarintSize(uint64_t v);
+unsigned char *VarintPut(unsigned char *p, uint64_t v);
+int VarintGet(const unsigned char **p, const unsigned char *end, uint64_t *v);
+
+#endif
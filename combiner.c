@@ -0,0 +1,433 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "dict.h"
+#include "codec.h"
+#include "combiner.h"
+
+/* A run file is a sequence of blocks, each a 64-bit length (host order)
+ * followed by a sorted encoding from codec.c of that many bytes. Blocks
+ * keep the encoder's buffer small while writing. */
+
+#define RUN_BLOCK (256 * 1024)
+#define MAX_RUNS 32     /* merge the runs into one when there are this many */
+#define MIN_BUDGET (256 * 1024) /* an empty Dict already takes about 90 KB */
+
+struct run {
+    int fd;
+    size_t size;
+};
+
+struct combiner {
+    Dict dict;
+    size_t budget;
+    char *dir;
+    struct run runs[MAX_RUNS];
+    int nruns;
+    long spills;
+    int op;                 /* how values of the same key combine */
+};
+
+struct run_writer {
+    int fd;
+    size_t size;
+    struct dict_encoder enc;
+    int failed;
+};
+
+/* read position in one run during a merge */
+struct cursor {
+    const char *data;
+    size_t size;
+    size_t pos;             /* start of the next block */
+    struct dict_decoder dec;
+    const char *key;
+    unsigned int len;
+    int value;
+};
+
+Combiner
+CombinerCreate(size_t budget, const char *dir)
+{
+    Combiner c;
+
+    c = calloc(1, sizeof(*c));
+    assert(c != 0);
+
+    if(dir == 0) dir = getenv("TMPDIR");
+    if(dir == 0 || *dir == '\0') dir = "/tmp";
+
+    c->dict = DictCreate();
+    c->budget = budget != 0 && budget < MIN_BUDGET ? MIN_BUDGET : budget;
+    c->dir = strdup(dir);
+    assert(c->dir != 0);
+
+    return c;
+}
+
+static void
+drop_runs(Combiner c)
+{
+    int i;
+
+    for(i = 0; i < c->nruns; i++) close(c->runs[i].fd);
+    c->nruns = 0;
+}
+
+void
+CombinerDestroy(Combiner c)
+{
+    drop_runs(c);
+    DictDestroy(c->dict);
+    free(c->dir);
+    free(c);
+}
+
+void
+CombinerReset(Combiner c)
+{
+    drop_runs(c);
+    DictDestroy(c->dict);
+    c->dict = DictCreate();
+}
+
+int
+CombinerRuns(Combiner c)
+{
+    return c->nruns;
+}
+
+long
+CombinerSpills(Combiner c)
+{
+    return c->spills;
+}
+
+size_t
+CombinerSize(Combiner c)
+{
+    size_t size = DictMemory(c->dict);
+    int i;
+
+    for(i = 0; i < c->nruns; i++) size += c->runs[i].size;
+
+    return size;
+}
+
+Dict
+CombinerDict(Combiner c)
+{
+    return c->dict;
+}
+
+static int
+write_all(int fd, const void *buffer, size_t length)
+{
+    const char *p = buffer;
+    ssize_t n;
+
+    while(length > 0) {
+        if((n = write(fd, p, length)) < 0) return -1;
+        p += n;
+        length -= n;
+    }
+
+    return 0;
+}
+
+static int
+writer_open(Combiner c, struct run_writer *w)
+{
+    char path[4096];
+
+    snprintf(path, sizeof(path), "%s/combiner-run.XXXXXX", c->dir);
+    if((w->fd = mkstemp(path)) < 0) return -1;
+    unlink(path);
+
+    w->size = 0;
+    w->failed = 0;
+    DictEncoderInit(&w->enc, CODEC_SORTED);
+
+    return 0;
+}
+
+static int
+writer_flush(struct run_writer *w)
+{
+    const char *block;
+    uint64_t length;
+    size_t n;
+
+    if(DictEncoderCount(&w->enc) == 0) return 0;
+
+    if((block = DictEncoderFinish(&w->enc, &n)) == 0) return -1;
+    length = n;
+
+    if(write_all(w->fd, &length, sizeof(length)) < 0 || write_all(w->fd, block, n) < 0) return -1;
+
+    w->size += sizeof(length) + n;
+    DictEncoderReset(&w->enc);
+
+    return 0;
+}
+
+static int
+writer_add(const char *key, unsigned int len, int value, void *arg)
+{
+    struct run_writer *w = arg;
+
+    if(w->failed) return -1;
+
+    if(DictEncoderAdd(&w->enc, key, len, value) < 0 ||
+       (DictEncoderSize(&w->enc) >= RUN_BLOCK && writer_flush(w) < 0)) {
+        w->failed = 1;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+writer_add_entry(const char *key, unsigned int len, int value, void *arg)
+{
+    writer_add(key, len, value, arg);
+}
+
+/* finish w and append it to the run list */
+static int
+writer_close(Combiner c, struct run_writer *w)
+{
+    if(w->failed || writer_flush(w) < 0) {
+        DictEncoderFree(&w->enc);
+        close(w->fd);
+        return -1;
+    }
+    DictEncoderFree(&w->enc);
+
+    c->runs[c->nruns].fd = w->fd;
+    c->runs[c->nruns].size = w->size;
+    c->nruns++;
+
+    return 0;
+}
+
+/* step to the next entry of a run: 1, 0 at the end, -1 if malformed */
+static int
+cursor_next(struct cursor *cur)
+{
+    uint64_t length;
+    int status;
+
+    while((status = DictDecoderNext(&cur->dec, &cur->key, &cur->len, &cur->value)) == 0) {
+        if(cur->pos == cur->size) return 0;
+
+        if(cur->size - cur->pos < sizeof(length)) return -1;
+        memcpy(&length, cur->data + cur->pos, sizeof(length));
+        cur->pos += sizeof(length);
+        if(length > cur->size - cur->pos) return -1;
+
+        DictDecoderFree(&cur->dec);
+        if(DictDecoderInit(&cur->dec, cur->data + cur->pos, length) < 0) return -1;
+        cur->pos += length;
+    }
+
+    return status;
+}
+
+static int
+cursor_less(struct cursor *a, struct cursor *b)
+{
+    unsigned int len = a->len < b->len ? a->len : b->len;
+    int c = memcmp(a->key, b->key, len);
+
+    return c < 0 || (c == 0 && a->len < b->len);
+}
+
+static void
+sift_down(struct cursor **heap, int n, int i)
+{
+    struct cursor *tmp;
+    int child;
+
+    while((child = 2 * i + 1) < n) {
+        if(child + 1 < n && cursor_less(heap[child + 1], heap[child])) child++;
+        if(!cursor_less(heap[child], heap[i])) break;
+
+        tmp = heap[i];
+        heap[i] = heap[child];
+        heap[child] = tmp;
+        i = child;
+    }
+}
+
+/* k-way merge of every run, calling fn once per distinct key */
+static int
+merge_runs(Combiner c, int (*fn)(const char *key, unsigned int len, int value, void *arg), void *arg)
+{
+    struct cursor cursors[MAX_RUNS];
+    struct cursor *heap[MAX_RUNS];
+    char *key = 0;
+    size_t key_size = 0;
+    unsigned int key_len = 0;
+    int value = 0, have = 0;
+    int i, n = 0, status = 0;
+
+    memset(cursors, 0, sizeof(cursors));
+
+    for(i = 0; i < c->nruns; i++) {
+        cursors[i].size = c->runs[i].size;
+        if(cursors[i].size == 0) continue;
+
+        cursors[i].data = mmap(0, cursors[i].size, PROT_READ, MAP_PRIVATE, c->runs[i].fd, 0);
+        if(cursors[i].data == MAP_FAILED) {
+            cursors[i].data = 0;
+            status = -1;
+            goto done;
+        }
+        madvise((void *) cursors[i].data, cursors[i].size, MADV_SEQUENTIAL);
+
+        if((status = cursor_next(&cursors[i])) < 0) goto done;
+        if(status > 0) heap[n++] = &cursors[i];
+    }
+    status = 0;
+
+    for(i = n / 2 - 1; i >= 0; i--) sift_down(heap, n, i);
+
+    while(n > 0) {
+        struct cursor *top = heap[0];
+
+        if(have && top->len == key_len && memcmp(top->key, key, key_len) == 0) {
+            value = DictCombineValues(c->op, value, top->value);
+        } else {
+            if(have && (status = fn(key, key_len, value, arg)) != 0) goto done;
+
+            /* keep a terminated copy: the cursor's key moves on */
+            if(top->len + 1 > key_size) {
+                key_size = top->len * 2 + 16;
+                key = realloc(key, key_size);
+                assert(key != 0);
+            }
+            memcpy(key, top->key, top->len);
+            key[top->len] = '\0';
+            key_len = top->len;
+            value = top->value;
+            have = 1;
+        }
+
+        if((status = cursor_next(top)) < 0) goto done;
+        if(status == 0) heap[0] = heap[--n];
+        status = 0;
+        sift_down(heap, n, 0);
+    }
+
+    if(have) status = fn(key, key_len, value, arg);
+
+done:
+    for(i = 0; i < c->nruns; i++) {
+        DictDecoderFree(&cursors[i].dec);
+        if(cursors[i].data != 0) munmap((void *) cursors[i].data, cursors[i].size);
+    }
+    free(key);
+
+    return status;
+}
+
+/* write the in-memory counts out as a sorted run and empty the Dict */
+static int
+spill(Combiner c)
+{
+    struct run_writer w;
+    struct run merged;
+
+    if(writer_open(c, &w) < 0) return -1;
+
+    DictForEachSorted(c->dict, writer_add_entry, &w);
+    if(writer_close(c, &w) < 0) return -1;
+
+    DictDestroy(c->dict);
+    c->dict = DictCreate();
+    c->spills++;
+
+    /* too many runs to merge at once: fold them all into one */
+    if(c->nruns == MAX_RUNS) {
+        if(writer_open(c, &w) < 0) return -1;
+
+        if(merge_runs(c, writer_add, &w) != 0 || w.failed || writer_flush(&w) < 0) {
+            DictEncoderFree(&w.enc);
+            close(w.fd);
+            return -1;
+        }
+        DictEncoderFree(&w.enc);
+
+        merged.fd = w.fd;
+        merged.size = w.size;
+        drop_runs(c);
+        c->runs[0] = merged;
+        c->nruns = 1;
+    }
+
+    return 0;
+}
+
+void
+CombinerSetCombine(Combiner c, int op)
+{
+    c->op = op;
+}
+
+int
+CombinerAdd(Combiner c, const char *key, unsigned int len, int delta)
+{
+    DictCombineLen(c->dict, key, len, delta, c->op);
+
+    if(c->budget != 0 && DictMemory(c->dict) > c->budget) return spill(c);
+
+    return 0;
+}
+
+struct flush_state {
+    int (*fn)(const char *key, unsigned int len, int value, void *arg);
+    void *arg;
+    int status;
+};
+
+static void
+flush_entry(const char *key, unsigned int len, int value, void *arg)
+{
+    struct flush_state *st = arg;
+
+    if(st->status == 0) st->status = st->fn(key, len, value, st->arg);
+}
+
+int
+CombinerFlush(Combiner c, int (*fn)(const char *key, unsigned int len, int value, void *arg), void *arg)
+{
+    struct flush_state st;
+    int status;
+
+    if(c->nruns == 0) {
+        st.fn = fn;
+        st.arg = arg;
+        st.status = 0;
+        DictForEach(c->dict, flush_entry, &st);
+
+        CombinerReset(c);
+        return st.status;
+    }
+
+    /* what is still in memory becomes the last run */
+    if(DictSize(c->dict) > 0 && spill(c) < 0) {
+        CombinerReset(c);
+        return -1;
+    }
+
+    status = merge_runs(c, fn, arg);
+    CombinerReset(c);
+
+    return status;
+}
@@ -0,0 +1,53 @@
+#ifndef COMBINER_H
+#define COMBINER_H
+
+#include <stddef.h>
+
+#include "dict.h"
+
+/* Map-side combiner with a memory budget.
+ *
+ * Counts go into an in-memory Dict. When the Dict grows past the budget
+ * it is written out in key order as a sorted run file and emptied, so
+ * memory stays bounded however many distinct keys there are. Flushing
+ * merges the runs and what is left in memory with a k-way merge,
+ * adding up the counts of equal keys. Run files are unlinked as soon
+ * as they are created and disappear with their descriptors. */
+
+typedef struct combiner *Combiner;
+
+/* budget is in bytes, 0 for no limit, and is raised to 256 KB if */
+/* smaller; run files go in dir, or in $TMPDIR or /tmp if dir is NULL */
+Combiner CombinerCreate(size_t budget, const char *dir);
+
+void CombinerDestroy(Combiner);
+
+/* combine values of the same key by op (DICT_SUM, the default, */
+/* DICT_MAX or DICT_MIN); set before anything is added */
+void CombinerSetCombine(Combiner, int op);
+
+/* combine delta into key; returns 0, or -1 if spilling to disk failed */
+int CombinerAdd(Combiner, const char *key, unsigned int len, int delta);
+
+/* number of runs spilled since the last flush or reset */
+int CombinerRuns(Combiner);
+
+/* total runs spilled over the combiner's lifetime */
+long CombinerSpills(Combiner);
+
+/* bytes held, in memory and in run files */
+size_t CombinerSize(Combiner);
+
+/* the in-memory part; holds everything if CombinerRuns is 0 */
+Dict CombinerDict(Combiner);
+
+/* call fn once per distinct key with its combined value, then empty the */
+/* combiner. Keys come in table order if nothing was spilled and in */
+/* ascending byte order otherwise. If fn returns non-zero the flush */
+/* stops and its value is returned; returns -1 if reading a run failed */
+int CombinerFlush(Combiner, int (*fn)(const char *key, unsigned int len, int value, void *arg), void *arg);
+
+/* drop everything, in memory and on disk */
+void CombinerReset(Combiner);
+
+#endif
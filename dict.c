@@ -1,236 +1,620 @@
 #include <stdlib.h>
+#include <stdint.h>
 #include <assert.h>
 #include <string.h>
-#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
 
 #include "dict.h"
 
-struct elt {
-    struct elt *next;
-    char * key;
+/* Open-addressing hash table with linear probing.
+ *
+ * Slots live in one flat array; each slot caches the full hash and the
+ * length of its key so probes rarely have to touch the key bytes.
+ * Keys are copied once into a bump-allocated arena and never move:
+ * growing the table only moves slots, it does not copy or re-hash keys.
+ * Deletion uses backward shifting, so there are no tombstones. */
+
+struct slot {
+    char *key;              /* interned in the arena, 0 if the slot is empty */
+    unsigned long hash;     /* cached hash_function(key) */
+    unsigned int len;       /* strlen(key) */
     int value;
 };
 
+struct arena_block {
+    struct arena_block *next;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
 struct dict {
-    int size;           /* size of the pointer table */
-    int n;              /* number of elements stored */
-    struct elt **table;
+    int size;               /* number of slots, always a power of two */
+    int shift;              /* 64 - log2(size), used by slot_index */
+    int n;                  /* number of elements stored */
+    unsigned long long salt;    /* per-table mix for slot_index */
+    struct slot *table;
+    struct arena_block *arena;
+    size_t arena_bytes;     /* total size of the arena blocks */
 };
 
 #define INITIAL_SIZE (1024)
 #define GROWTH_FACTOR (2)
-#define MAX_LOAD_FACTOR (1)
+/* grow once the table is 3/4 full */
+#define MAX_LOAD_NUM (3)
+#define MAX_LOAD_DEN (4)
+#define ARENA_BLOCK_SIZE (64 * 1024)
 
-/* dictionary initialization code used in both DictCreate and grow */
-Dict
-internalDictCreate(int size)
-{
-    Dict d;
-    int i;
+static unsigned long long next_salt(void);
 
-    d = malloc(sizeof(*d));
+static struct slot *
+alloc_table(int size)
+{
+    struct slot *t;
 
-    assert(d != 0);
+    t = calloc(size, sizeof(struct slot));
+    assert(t != 0);
 
-    d->size = size;
-    d->n = 0;
-    d->table = malloc(sizeof(struct elt *) * d->size);
+    return t;
+}
 
-    assert(d->table != 0);
+static int
+log2_of(int size)
+{
+    int bits = 0;
 
-    for(i = 0; i < d->size; i++) d->table[i] = 0;
+    while((1 << bits) < size) bits++;
 
-    return d;
+    return bits;
 }
 
 Dict
 DictCreate(void)
 {
-    return internalDictCreate(INITIAL_SIZE);
+    Dict d;
+
+    d = malloc(sizeof(*d));
+
+    assert(d != 0);
+
+    d->size = INITIAL_SIZE;
+    d->shift = 64 - log2_of(INITIAL_SIZE);
+    d->n = 0;
+    d->salt = next_salt();
+    d->table = alloc_table(d->size);
+    d->arena = 0;
+    d->arena_bytes = 0;
+
+    return d;
 }
 
 void
 DictDestroy(Dict d)
 {
-    int i;
-    struct elt *e;
-    struct elt *next;
+    struct arena_block *b;
+    struct arena_block *next;
 
-    for(i = 0; i < d->size; i++) {
-        for(e = d->table[i]; e != 0; e = next) {
-            next = e->next;
-
-            free(e->key);
-            free(e);
-        }
+    for(b = d->arena; b != 0; b = next) {
+        next = b->next;
+        free(b);
     }
 
     free(d->table);
     free(d);
 }
 
+/* copy len bytes of key plus a terminating null into the arena */
+static char *
+arena_intern(Dict d, const char *key, unsigned int len)
+{
+    struct arena_block *b;
+    size_t need;
+    size_t size;
+    char *p;
+
+    need = (size_t) len + 1;
+    b = d->arena;
+
+    if(b == 0 || b->size - b->used < need) {
+        size = need > ARENA_BLOCK_SIZE ? need : ARENA_BLOCK_SIZE;
+
+        b = malloc(sizeof(*b) + size);
+        assert(b != 0);
+
+        b->used = 0;
+        b->size = size;
+        b->next = d->arena;
+        d->arena = b;
+        d->arena_bytes += sizeof(*b) + size;
+    }
+
+    p = b->data + b->used;
+    memcpy(p, key, len);
+    p[len] = '\0';
+    b->used += need;
+
+    return p;
+}
+
+/* Hash functions, all seeded. DICT_HASH picks the one Dict uses at
+ * build time (make HASH=fnv1a); the others stay available to benches. */
+
 #define MULTIPLIER (97)
 
-static unsigned long
-hash_function(const char *s)
+/* the original h * 97 + c, kept for comparison */
+static inline uint64_t
+hash_mult97(const char *s, unsigned int len, uint64_t seed)
 {
     unsigned const char *us;
-    unsigned long h;
+    unsigned const char *end;
+    uint64_t h;
 
-    h = 0;
+    h = seed;
 
-    for(us = (unsigned const char *) s; *us; us++) {
+    for(us = (unsigned const char *) s, end = us + len; us < end; us++) {
         h = h * MULTIPLIER + *us;
     }
 
     return h;
 }
 
+static inline uint64_t
+hash_fnv1a(const char *s, unsigned int len, uint64_t seed)
+{
+    unsigned const char *us;
+    unsigned const char *end;
+    uint64_t h;
+
+    h = 0xcbf29ce484222325ULL ^ seed;
+
+    for(us = (unsigned const char *) s, end = us + len; us < end; us++) {
+        h = (h ^ *us) * 0x100000001b3ULL;
+    }
+
+    return h;
+}
+
+#define WY0 (0x2d358dccaa6c78a5ULL)
+#define WY1 (0x8bb84b93962eacc9ULL)
+#define WY2 (0x4b33a62ed433d4a3ULL)
+#define WY3 (0x4d5a2da51de1aa47ULL)
+
+/* 64x64 -> 128 bit multiply, folded back to 64 bits */
+static inline uint64_t
+wymix(uint64_t a, uint64_t b)
+{
+    __uint128_t r = (__uint128_t) a * b;
+
+    return (uint64_t) r ^ (uint64_t) (r >> 64);
+}
+
+static inline uint64_t
+read64(const unsigned char *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t
+read32(const unsigned char *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, 4);
+    return v;
+}
+
+/* wyhash: 8 or 16 bytes per multiply, and keys of up to 16 bytes, */
+/* most words, take two overlapping loads and two multiplies in all. */
+/* Never reads outside [s, s + len). */
+static inline uint64_t
+hash_wyhash(const char *s, unsigned int len, uint64_t seed)
+{
+    const unsigned char *p = (const unsigned char *) s;
+    uint64_t a, b, see1, see2;
+    size_t i = len;
+
+    seed ^= wymix(seed ^ WY0, WY1);
+
+    if(len <= 16) {
+        if(len >= 4) {
+            a = (read32(p) << 32) | read32(p + ((len >> 3) << 2));
+            b = (read32(p + len - 4) << 32) | read32(p + len - 4 - ((len >> 3) << 2));
+        } else if(len > 0) {
+            a = ((uint64_t) p[0] << 16) | ((uint64_t) p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        if(i > 48) {
+            see1 = see2 = seed;
+            do {
+                seed = wymix(read64(p) ^ WY1, read64(p + 8) ^ seed);
+                see1 = wymix(read64(p + 16) ^ WY2, read64(p + 24) ^ see1);
+                see2 = wymix(read64(p + 32) ^ WY3, read64(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while(i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while(i > 16) {
+            seed = wymix(read64(p) ^ WY1, read64(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        a = read64(p + i - 16);
+        b = read64(p + i - 8);
+    }
+
+    {
+        __uint128_t r = (__uint128_t) (a ^ WY1) * (b ^ seed);
+
+        a = (uint64_t) r;
+        b = (uint64_t) (r >> 64);
+    }
+
+    return wymix(a ^ WY0 ^ len, b ^ WY1);
+}
+
+#ifndef DICT_HASH
+#define DICT_HASH hash_wyhash
+#endif
+
+/* Random per process, so that input we do not control cannot be made */
+/* to collide; set before main runs, so threads never race on it. */
+static uint64_t hash_seed;
+
+__attribute__((constructor))
+static void
+init_hash_seed(void)
+{
+    if(getrandom(&hash_seed, sizeof(hash_seed), GRND_NONBLOCK) != sizeof(hash_seed)) {
+        hash_seed = (uint64_t) time(0) * 0x9E3779B97F4A7C15ULL ^ (uint64_t) getpid();
+    }
+}
+
+static inline unsigned long
+hash_function(const char *s, unsigned int len)
+{
+    return DICT_HASH(s, len, hash_seed);
+}
+
+/* Fibonacci hashing: spread the hash over the table with a multiply */
+/* and keep the top bits, so the index is a shift rather than a modulo. */
+/* Each table xors in its own salt first: otherwise walking one table */
+/* (in slot order) and inserting into another visits the new table's */
+/* slots in order too, and linear probing degrades into one long run. */
+static inline int
+slot_index(Dict d, unsigned long h)
+{
+    return (int) ((((unsigned long long) h ^ d->salt) * 0x9E3779B97F4A7C15ULL) >> d->shift);
+}
+
+/* splitmix64 of a global counter, so every table gets a different salt */
+static unsigned long long
+next_salt(void)
+{
+    static unsigned long long counter;
+    unsigned long long z;
+
+    z = __atomic_add_fetch(&counter, 0x9E3779B97F4A7C15ULL, __ATOMIC_RELAXED);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+    return z ^ (z >> 31);
+}
+
+/* return the slot holding key, or the empty slot where it would go */
+static struct slot *
+find_slot(Dict d, const char *key, unsigned int len, unsigned long h)
+{
+    int mask = d->size - 1;
+    int i = slot_index(d, h);
+    struct slot *s;
+
+    for(;;) {
+        s = &d->table[i];
+
+        if(s->key == 0) return s;
+
+        if(s->hash == h && s->len == len && !memcmp(s->key, key, len)) {
+            return s;
+        }
+
+        i = (i + 1) & mask;
+    }
+}
+
 static void
 grow(Dict d)
 {
-    Dict d2;            /* new dictionary we'll create */
-    struct dict swap;   /* temporary structure for brain transplant */
+    struct slot *old;
+    int old_size;
     int i;
-    struct elt *e;
+    int j;
+    int mask;
 
-    d2 = internalDictCreate(d->size * GROWTH_FACTOR);
+    old = d->table;
+    old_size = d->size;
 
-    for(i = 0; i < d->size; i++) {
-        for(e = d->table[i]; e != 0; e = e->next) {
-            /* note: this recopies everything */
-            /* a more efficient implementation would
-             * patch out the strdups inside DictInsert
-             * to avoid this problem */
-            DictInsert(d2, e->key, e->value);
-        }
+    d->size = old_size * GROWTH_FACTOR;
+    d->shift = 64 - log2_of(d->size);
+    d->table = alloc_table(d->size);
+    mask = d->size - 1;
+
+    /* move the slots across; keys stay where they are in the arena */
+    /* and the cached hash saves calling hash_function again */
+    for(i = 0; i < old_size; i++) {
+        if(old[i].key == 0) continue;
+
+        for(j = slot_index(d, old[i].hash); d->table[j].key != 0; j = (j + 1) & mask);
+
+        d->table[j] = old[i];
     }
 
-    /* the hideous part */
-    /* We'll swap the guts of d and d2 */
-    /* then call DictDestroy on d2 */
-    swap = *d;
-    *d = *d2;
-    *d2 = swap;
+    free(old);
+}
+
+/* fill the empty slot s with a new key, growing the table if needed */
+/* returns the slot now holding the key, which moves if the table grew */
+static struct slot *
+insert_at(Dict d, struct slot *s, const char *key, unsigned int len, unsigned long h, int value)
+{
+    s->key = arena_intern(d, key, len);
+    s->hash = h;
+    s->len = len;
+    s->value = value;
+
+    d->n++;
 
-    DictDestroy(d2);
+    /* grow table if there is not enough room */
+    if(d->n * MAX_LOAD_DEN >= d->size * MAX_LOAD_NUM) {
+        grow(d);
+        s = find_slot(d, key, len, h);
+    }
+
+    return s;
 }
 
 /* insert a new key-value pair into an existing dictionary */
+/* if the key is already present its value is replaced */
 void
 DictInsert(Dict d, const char *key, int value)
 {
-    struct elt *e;
+    struct slot *s;
     unsigned long h;
+    unsigned int len;
 
     if(key != NULL && value != 0) {
-        // assert(value);
+        len = strlen(key);
+        h = hash_function(key, len);
+        s = find_slot(d, key, len, h);
+
+        if(s->key != 0) {
+            s->value = value;
+        } else {
+            insert_at(d, s, key, len, h, value);
+        }
+    }
+}
 
-        e = malloc(sizeof(*e));
+/* add delta to the value associated with key, inserting it if missing */
+int *
+DictIncrement(Dict d, const char *key, int delta)
+{
+    return DictIncrementLen(d, key, strlen(key), delta);
+}
 
-        assert(e);
+/* same, for a key of len bytes that need not be null-terminated */
+int *
+DictIncrementLen(Dict d, const char *key, unsigned int len, int delta)
+{
+    return DictIncrementHashed(d, key, len, hash_function(key, len), delta);
+}
 
-        e->key = strdup(key);
-        e->value = value;
+/* same, for a caller that already has DictHash(key, len) */
+int *
+DictIncrementHashed(Dict d, const char *key, unsigned int len, unsigned long h, int delta)
+{
+    struct slot *s;
 
-        h = hash_function(key) % d->size;
+    s = find_slot(d, key, len, h);
 
-        e->next = d->table[h];
-        d->table[h] = e;
+    if(s->key != 0) {
+        s->value += delta;
+        return &s->value;
+    }
 
-        d->n++;
+    return &insert_at(d, s, key, len, h, delta)->value;
+}
 
-        /* grow table if there is not enough room */
-        if(d->n >= d->size * MAX_LOAD_FACTOR) {
-            grow(d);
-        }
+void
+DictPrefetch(Dict d, unsigned long h)
+{
+    __builtin_prefetch(&d->table[slot_index(d, h)]);
+}
+
+int
+DictCombineValues(int op, int a, int b)
+{
+    switch(op) {
+    case DICT_MAX:
+        return a > b ? a : b;
+    case DICT_MIN:
+        return a < b ? a : b;
+    default:
+        return a + b;
     }
 }
 
+int *
+DictCombineHashed(Dict d, const char *key, unsigned int len, unsigned long h, int value, int op)
+{
+    struct slot *s;
+
+    s = find_slot(d, key, len, h);
+
+    if(s->key != 0) {
+        s->value = DictCombineValues(op, s->value, value);
+        return &s->value;
+    }
+
+    return &insert_at(d, s, key, len, h, value)->value;
+}
+
+int *
+DictCombineLen(Dict d, const char *key, unsigned int len, int value, int op)
+{
+    return DictCombineHashed(d, key, len, hash_function(key, len), value, op);
+}
+
 /* return the most recently inserted value associated with a key */
 /* or 0 if no matching key is present */
 int
 DictSearch(Dict d, const char *key)
 {
-    struct elt *e;
+    struct slot *s;
 
-    for(e = d->table[hash_function(key) % d->size]; e != 0; e = e->next) {
-        if(!strcmp(e->key, key)) {
-            /* got it */
-            return e->value;
-        }
-    }
+    unsigned int len = strlen(key);
 
-    return 0;
+    s = find_slot(d, key, len, hash_function(key, len));
+
+    return s->key != 0 ? s->value : 0;
 }
 
 /* delete the most recently inserted record with the given key */
 /* if there is no such record, has no effect */
+/* the key bytes stay in the arena until the dictionary is destroyed */
 void
 DictDelete(Dict d, const char *key)
 {
-    struct elt **prev;          /* what to change when elt is deleted */
-    struct elt *e;              /* what to delete */
+    struct slot *s;
+    int mask = d->size - 1;
+    int hole;
+    int i;
+    int home;
+    unsigned int len = strlen(key);
+
+    s = find_slot(d, key, len, hash_function(key, len));
 
-    for(prev = &(d->table[hash_function(key) % d->size]); 
-        *prev != 0; 
-        prev = &((*prev)->next)) {
-        if(!strcmp((*prev)->key, key)) {
-            /* got it */
-            e = *prev;
-            *prev = e->next;
+    if(s->key == 0) return;
 
-            free(e->key);
-            free(e);
+    /* backward-shift: pull later members of the probe run into the hole */
+    /* whenever the hole lies between their home slot and where they sit */
+    hole = s - d->table;
 
-            return;
+    for(i = (hole + 1) & mask; d->table[i].key != 0; i = (i + 1) & mask) {
+        home = slot_index(d, d->table[i].hash);
+
+        if(((i - home) & mask) >= ((i - hole) & mask)) {
+            d->table[hole] = d->table[i];
+            hole = i;
         }
     }
+
+    d->table[hole].key = 0;
+    d->n--;
 }
 
-/* Print the dict contents to standard output */
-char *
-DictStringEncode(Dict d)
+/* the hash Dict uses for key, for callers that shard keys */
+unsigned long
+DictHash(const char *key, unsigned int len)
 {
-    struct elt *e;
-    char * dict_str = NULL;
-    int i, item_len;
-    long int current_length = 0;
-    char item_value[15];
+    return hash_function(key, len);
+}
 
-    assert(d != 0);
-    fprintf(stdout, "Encoding dictionary ...\n");
+/* the same hash function with a fixed seed, equal in every process */
+unsigned long
+DictHashStable(const char *key, unsigned int len)
+{
+    return DICT_HASH(key, len, 0);
+}
 
-    for(i = 0; i < d->size; i++) {
-        for(e = d->table[i]; e != 0; e = e->next) {
-            // Convert the dict item value (an integer) to a string (for use in concatenation)
-            sprintf(item_value, "%d", e->value);
+/* count the keys at each probe distance from their home slot into */
+/* counts[0 .. buckets - 1], the last bucket also taking all longer */
+/* distances; returns the longest distance */
+int
+DictProbeHistogram(Dict d, long *counts, int buckets)
+{
+    int mask = d->size - 1;
+    int i, dist, longest = 0;
 
-            // Figure out how many characters this next item concatenation is going to use
-            item_len = strlen(e->key) + strlen(item_value) + 2;
+    memset(counts, 0, buckets * sizeof(long));
 
-            // Allocate memory as needed
-            dict_str = (char *) realloc( dict_str, current_length + item_len + 1);
+    for(i = 0; i < d->size; i++) {
+        if(d->table[i].key == 0) continue;
 
-            // Concatenate a represenation of the current dict item to the buffer
-            current_length += sprintf(dict_str + current_length, "%s:%s,", e->key, item_value);    
-        }
+        dist = (i - slot_index(d, d->table[i].hash)) & mask;
+        if(dist > longest) longest = dist;
+        counts[dist < buckets ? dist : buckets - 1]++;
     }
-    return dict_str;
+
+    return longest;
+}
+
+/* number of keys stored */
+int
+DictSize(Dict d)
+{
+    return d->n;
 }
 
-/* Print the dict contents to standard output */
-void 
-DictPrint(Dict d)
+/* call fn on every entry, in table order */
+void
+DictForEach(Dict d, void (*fn)(const char *key, unsigned int len, int value, void *arg), void *arg)
 {
-    struct elt *e;
+    struct slot *s;
     int i;
 
-    assert(d != 0);
+    for(i = 0; i < d->size; i++) {
+        s = &d->table[i];
+
+        if(s->key != 0) fn(s->key, s->len, s->value, arg);
+    }
+}
+
+static int
+compare_slots(const void *a, const void *b)
+{
+    const struct slot *x = *(const struct slot * const *) a;
+    const struct slot *y = *(const struct slot * const *) b;
+    unsigned int len = x->len < y->len ? x->len : y->len;
+    int c = memcmp(x->key, y->key, len);
+
+    if(c != 0) return c;
+
+    return (x->len > y->len) - (x->len < y->len);
+}
+
+/* call fn on every entry, in ascending byte order of the keys */
+void
+DictForEachSorted(Dict d, void (*fn)(const char *key, unsigned int len, int value, void *arg), void *arg)
+{
+    struct slot **sorted;
+    int i, n = 0;
+
+    sorted = malloc((d->n + 1) * sizeof(struct slot *));
+    assert(sorted != 0);
 
     for(i = 0; i < d->size; i++) {
-        for(e = d->table[i]; e != 0; e = e->next) {
-            fprintf(stdout, "dict[%s] = %d\n", e->key, e->value);
-        }
+        if(d->table[i].key != 0) sorted[n++] = &d->table[i];
     }
+
+    qsort(sorted, n, sizeof(struct slot *), compare_slots);
+
+    for(i = 0; i < n; i++) fn(sorted[i]->key, sorted[i]->len, sorted[i]->value, arg);
+
+    free(sorted);
+}
+
+/* bytes of heap held by the table and its keys */
+size_t
+DictMemory(Dict d)
+{
+    return sizeof(*d) + (size_t) d->size * sizeof(struct slot) + d->arena_bytes;
 }
@@ -1,3 +1,5 @@
+#include <stddef.h>
+
 typedef struct dict *Dict;
 
 /* create a new empty dictionary */
@@ -16,3 +18,59 @@ int DictSearch(Dict, const char *key);
 /* delete the most recently inserted record with the given key */
 /* if there is no such record, has no effect */
 void DictDelete(Dict, const char *key);
+
+/* add delta to the value associated with key, inserting key with */
+/* value delta if it is not present; does a single hash probe */
+/* returns a pointer to the value, valid until the next insertion */
+int *DictIncrement(Dict, const char *key, int delta);
+
+/* same, for a key of len bytes that need not be null-terminated */
+int *DictIncrementLen(Dict, const char *key, unsigned int len, int delta);
+
+/* same, with hash already computed as DictHash(key, len) */
+int *DictIncrementHashed(Dict, const char *key, unsigned int len, unsigned long hash, int delta);
+
+/* how the values of a key combine: added, or the larger or the */
+/* smaller one kept */
+#define DICT_SUM 0
+#define DICT_MAX 1
+#define DICT_MIN 2
+
+/* a and b combined by op */
+int DictCombineValues(int op, int a, int b);
+
+/* combine value into the value of key by op, inserting key with */
+/* value if it is not present; DICT_SUM is DictIncrementHashed */
+int *DictCombineHashed(Dict, const char *key, unsigned int len, unsigned long hash, int value, int op);
+
+/* same, hashing the key */
+int *DictCombineLen(Dict, const char *key, unsigned int len, int value, int op);
+
+/* start loading the slot where a key of this hash would be looked */
+/* up; a hint for a caller about to update many keys */
+void DictPrefetch(Dict, unsigned long hash);
+
+/* the hash Dict uses internally for a key of len bytes; seeded */
+/* randomly per process, so only meaningful within one process */
+unsigned long DictHash(const char *key, unsigned int len);
+
+/* the same hash with a fixed seed, for choosing where a key goes */
+/* when several processes have to agree on it */
+unsigned long DictHashStable(const char *key, unsigned int len);
+
+/* number of keys stored */
+int DictSize(Dict);
+
+/* call fn on every entry, in table order; keys are null-terminated */
+/* the dictionary must not be modified during the walk */
+void DictForEach(Dict, void (*fn)(const char *key, unsigned int len, int value, void *arg), void *arg);
+
+/* same, in ascending byte order of the keys; sorts a temporary index */
+void DictForEachSorted(Dict, void (*fn)(const char *key, unsigned int len, int value, void *arg), void *arg);
+
+/* count keys by distance from their home slot into counts[0 .. buckets - 1]; */
+/* the last bucket also takes longer distances. Returns the longest distance */
+int DictProbeHistogram(Dict, long *counts, int buckets);
+
+/* bytes of heap memory held by the dictionary */
+size_t DictMemory(Dict);
@@ -1,4 +1,11 @@
 #include "dict.c"
+#include "proto.c"
+#include "metrics.c"
+#include "split.c"
+#include "uring.c"
+#include "tokenize.c"
+#include "job.c"
+#include "local.c"
 
 #include <stdio.h>
 #include <sys/socket.h>
@@ -8,222 +15,856 @@
 #include <unistd.h>
 #include <netinet/in.h>
 #include <pthread.h>
-
-#define BUFFSIZE 1024
-#define WORKERS 4
-
-int SendAll(int socket, void *buffer, size_t length);
-void * AssignToWorker(void * arguments);
-void UpdateDictionary(char * encoded_dict);
-void InitializeWorkerList();
-void PrintWorkerList();
-void PrintWorker(int worker_idx);
-void Die(char * mess);
+#include <getopt.h>
+#include <stdint.h>
+#include <time.h>
+#include <signal.h>
+
+#define DEFAULT_CHUNK_SIZE (1 << 20)
+#define MAX_WORKERS 64
+#define MAX_LOCAL_THREADS 256
+#define USAGE "USAGE: driver [-c chunk_size] [-z | -u | -l [-j job]] [-S] [-w ip:port,...] [-v | -q] [-M stats_port] <file_name> <threads>\n"
+
+#define TASK_PENDING 0
+#define TASK_RUNNING 1
+#define TASK_DONE    2
+
+#define SLOT_FREE    0    /* read-ahead buffer states */
+#define SLOT_READING 1
+#define SLOT_READY   2
+#define SLOT_TAKEN   3
+#define SLOT_SENDING 4
+#define SLOT_SENT    5
+#define SLOT_FAILED  6
+#define STOP_TAG     (~0ULL)
 
 struct worker {
   char * ip_addr;
   char * port;
   char * worker_name;
+  int sock;           /* persistent connection, -1 until connected */
+  pthread_mutex_t send_lock;  /* early aborts come from other senders */
+  unsigned long chunks_sent;
+  unsigned long bytes_sent;
+  unsigned long chunks_committed;
+  unsigned long backups_run;
+  size_t * held;      /* splits committed here whose counts the worker has */
+  size_t nheld;       /* not sent yet: rerun if it dies; sender thread only */
+  size_t held_size;
 };
 
 struct arg_struct {
-  char * ip_addr;
-  char * port;
-  char * buf;
+  struct worker * worker;
+  uint32_t seq;
+  char * buf;         /* chunk bytes, or NULL to send straight from fd */
+  int slot;           /* read-ahead slot holding the chunk, or -1 */
   size_t bytes_read;
+  int fd;
+  uint64_t offset;
+};
+
+/* One entry per split; guarded by lock */
+struct task {
+  int state;          /* TASK_PENDING, TASK_RUNNING or TASK_DONE */
+  int attempts;       /* copies currently running, at most 2 */
+  int runners[2];     /* workers running those copies */
+  struct timespec started;
+};
+
+/* Pull-based scheduler: senders ask for work when their worker is free */
+struct scheduler {
+  struct split * splits;
+  struct task * tasks;
+  size_t nsplits;
+  size_t next;        /* first split never handed out */
+  size_t remaining;   /* splits not yet committed */
+  size_t * retry;     /* splits whose only copy died with its worker */
+  size_t nretry;
+  int speculate;      /* re-run stragglers on idle workers */
+  pthread_cond_t changed;
 };
 
-Dict WORD_DICT;
-struct worker * WORKERS_LIST[WORKERS];
-pthread_t tid[WORKERS];
+/* A registered buffer of the io_uring read-ahead. Fresh splits are read
+ * into free slots in order, ahead of the senders asking for them, and
+ * sent from there with the frame header placed just before the bytes.
+ * Guarded by lock. */
+struct buffer_slot {
+  char * buf;         /* FRAME_HEADER_SIZE bytes of header room, then the split */
+  int state;
+  long task;          /* split held */
+  size_t length;      /* bytes to read, then bytes to send */
+  size_t done;
+  int sock;
+};
+
+int AssignToWorker(struct arg_struct * args);
+void * SenderThread(void * arguments);
+long NextTask(int worker_idx);
+int FinishTask(size_t task_idx, int worker_idx);
+void LoseTask(size_t task_idx, int worker_idx);
+void DrainFlushed(struct worker * w);
+int StartReadAhead(int max_workers);
+void StopReadAhead(void);
+void * IoThread(void * arg);
+void RefillReadAhead(void);
+int TakeReadAhead(long task_idx);
+int SendFromSlot(struct worker * w, struct arg_struct * args);
+void InitializeWorkerList(char * worker_spec);
+void ConnectToWorker(int worker_idx);
+void FinishWorker(int worker_idx);
+void PrintWorkerList();
+void PrintWorker(int worker_idx);
+void RunLocally(int nthreads, int dump_metrics);
+void PrintEntry(const char * key, unsigned int len, int value, void * arg);
+void CollectMetrics(void);
+void Die(char * mess);
+
+struct worker * WORKERS_LIST[MAX_WORKERS];
+int NUM_WORKERS;
+struct scheduler SCHED;
+struct input_file INPUT;
+int ZERO_COPY;
+int USE_URING;      /* -u: read ahead and send chunks through io_uring */
+int LOCAL_MODE;     /* -l: run the whole job in this process */
+const struct job * JOB = &WORD_COUNT_JOB;   /* the job local mode runs */
+struct uring RING;
+struct buffer_slot * SLOTS;
+int NUM_SLOTS;
+size_t READ_AHEAD_NEXT;     /* next fresh split to read ahead */
+int FIXED_BUFFERS;          /* slots are registered with the ring */
+pthread_cond_t io_changed;
+pthread_t io_tid;
+pthread_t tid[MAX_WORKERS];
 pthread_mutex_t lock;
 
 int main(int argc, char *argv[]) {
 
-  char buffer[BUFFSIZE];
-  FILE * fp;
+  struct timespec start, end;
+  size_t chunk_size = DEFAULT_CHUNK_SIZE;
+  char * worker_spec = NULL;
+  char * stats_port = NULL;
+  int opt, i;
+
+  SCHED.speculate = 1;
+
+  /* A dead worker shows up as a failed send, not a fatal signal */
+  signal(SIGPIPE, SIG_IGN);
+
+  while ((opt = getopt(argc, argv, "c:zulj:Sw:vqM:")) != -1) {
+    switch (opt) {
+      case 'c':
+        chunk_size = ParseSize(optarg);
+        if (chunk_size == 0 || chunk_size > MAX_FRAME_LENGTH) {
+          fprintf(stderr, "Invalid chunk size: %s\n", optarg);
+          exit(1);
+        }
+        break;
+      case 'z':
+        /* sendfile splits from the page cache instead of copying them */
+        ZERO_COPY = 1;
+        break;
+      case 'u':
+        /* keep reads and sends in flight through io_uring */
+        USE_URING = 1;
+        break;
+      case 'l':
+        /* map and reduce on threads of this process, without workers */
+        LOCAL_MODE = 1;
+        break;
+      case 'j':
+        if ((JOB = JobLoad(optarg)) == NULL) {
+          exit(1);
+        }
+        break;
+      case 'S':
+        /* never launch backup copies of slow splits */
+        SCHED.speculate = 0;
+        break;
+      case 'w':
+        worker_spec = optarg;
+        break;
+      case 'v':
+        LOG_LEVEL++;
+        break;
+      case 'q':
+        LOG_LEVEL = LOG_QUIET;
+        break;
+      case 'M':
+        stats_port = optarg;
+        break;
+      default:
+        fprintf(stderr, USAGE);
+        exit(1);
+    }
+  }
 
-  if (argc != 3) {
-    fprintf(stderr, "USAGE: TCPecho <file_name> <threads>\n");
+  /* distributed, the workers and the reducers are given the job */
+  if (argc - optind != 2 || ZERO_COPY + USE_URING + LOCAL_MODE > 1 || (JOB != &WORD_COUNT_JOB && !LOCAL_MODE)) {
+    fprintf(stderr, USAGE);
     exit(1);
   }
 
-  /* Initialize word count dictionary */
-  WORD_DICT = DictCreate();
+  int max_workers = atoi(argv[optind + 1]);
+  if (LOCAL_MODE) {
+    if (max_workers < 1 || max_workers > MAX_LOCAL_THREADS) {
+      fprintf(stderr, "Number of threads must be between 1 and %d\n", MAX_LOCAL_THREADS);
+      exit(1);
+    }
+  } else {
+    /* Initialize workers */
+    InitializeWorkerList(worker_spec);
+    // PrintWorkerList();
+
+    if (max_workers < 1 || max_workers > NUM_WORKERS) {
+      fprintf(stderr, "Number of threads must be between 1 and %d\n", NUM_WORKERS);
+      exit(1);
+    }
+  }
+
+  /* Map the input and cut it into word-aligned splits */
+  if (MapInput(argv[optind], &INPUT) < 0) {
+    Die("Failed to open input file");
+  }
+  if ((SCHED.splits = ComputeSplits(INPUT.data, INPUT.size, chunk_size, &SCHED.nsplits)) == NULL) {
+    Die("Failed to compute input splits");
+  }
+  Log(LOG_INFO, "Cut %zu bytes into %zu splits\n", INPUT.size, SCHED.nsplits);
 
-  /* Initialize workers */
-  InitializeWorkerList();
-  // PrintWorkerList();
+  if (LOCAL_MODE) {
+    if (stats_port != NULL && MetricsServe(stats_port) < 0) {
+      Die("Failed to listen on stats port");
+    }
+    RunLocally(max_workers, stats_port != NULL);
+  }
 
-  /* Open the file containing the data to be transmitted */
-  size_t bytesRead = 0;
-  fp = fopen(argv[1], "rb");
+  SCHED.tasks = calloc(SCHED.nsplits + 1, sizeof(struct task));
+  SCHED.retry = malloc((SCHED.nsplits + 1) * sizeof(size_t));
+  if (SCHED.tasks == NULL || SCHED.retry == NULL) {
+    Die("Failed to allocate scheduler");
+  }
+  SCHED.remaining = SCHED.nsplits;
+  if (pthread_mutex_init(&lock, NULL) != 0 || pthread_cond_init(&SCHED.changed, NULL) != 0 ||
+      pthread_cond_init(&io_changed, NULL) != 0) {
+    Die("Mutex init failed");
+  }
+  MetricsOnDump(CollectMetrics);
+  if (stats_port != NULL && MetricsServe(stats_port) < 0) {
+    Die("Failed to listen on stats port");
+  }
+
+  /* One persistent connection and one sender thread per worker */
+  for (i = 0; i < max_workers; i++) {
+    ConnectToWorker(i);
+  }
+
+  Log(LOG_INFO, "Reading file ...\n\n");
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  if (USE_URING && StartReadAhead(max_workers) < 0) {
+    fprintf(stderr, "io_uring unavailable (%s); using blocking reads\n", strerror(errno));
+    USE_URING = 0;
+  }
+
+  for (i = 0; i < max_workers; i++) {
+    if (pthread_create(&tid[i], NULL, &SenderThread, (void *) (intptr_t) i) != 0) {
+      Die("Couldn't create thread.");
+    }
+  }
+  for (i = 0; i < max_workers; i++) {
+    pthread_join(tid[i], NULL);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  if (USE_URING) {
+    StopReadAhead();
+  }
+
+  if (SCHED.remaining > 0) {
+    fprintf(stderr, "%zu splits could not be processed: no workers left\n", SCHED.remaining);
+    exit(1);
+  }
 
-  if (fp != NULL)    
-  {
-    fprintf(stdout, "Reading file ...\n\n");
-    int workers_assigned = 0;
-    int max_workers = atoi(argv[2]);
+  double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  for (i = 0; i < max_workers; i++) {
+    Log(LOG_INFO, "Worker %s: %lu chunks sent, %lu committed, %lu backups, %lu bytes\n",
+      WORKERS_LIST[i]->worker_name, WORKERS_LIST[i]->chunks_sent, WORKERS_LIST[i]->chunks_committed,
+      WORKERS_LIST[i]->backups_run, WORKERS_LIST[i]->bytes_sent);
+  }
+  Log(LOG_INFO, "Processed %zu bytes in %zu chunks on %d workers in %.3f s (%.1f MB/s)\n",
+    INPUT.size, SCHED.nsplits, max_workers, elapsed, INPUT.size / 1048576.0 / elapsed);
+  /* the stats port closes with the driver, so with -M the totals are */
+  /* also printed once the job is over */
+  if (LOG_LEVEL >= LOG_DEBUG || stats_port != NULL) {
+    MetricsWrite(stdout);
+  }
 
-    while ((bytesRead = fread(buffer, 1, BUFFSIZE - 1, fp)) > 0)
-    {
-      fprintf(stdout, "Read %zu bytes:\n", bytesRead);
-      // fprintf(stdout, "%s\n", buffer);
-      fprintf(stdout, "Assigning this chunk to: \n");
-      PrintWorker(workers_assigned);
-      fprintf(stdout, "\n");
+  free(SCHED.retry);
+  free(SCHED.tasks);
+  free(SCHED.splits);
+  UnmapInput(&INPUT);
+  exit(0);
+}
 
-      struct arg_struct args;
-      args.ip_addr = WORKERS_LIST[workers_assigned]->ip_addr;
-      args.port = WORKERS_LIST[workers_assigned]->port;
+/* Keep one worker busy: ask the scheduler for a split whenever the
+ * worker reports the previous one done, until no work is left */
+void * SenderThread(void * arguments) {
+  int worker_idx = (int) (intptr_t) arguments;
+  struct worker * w = WORKERS_LIST[worker_idx];
+  struct frame_header header;
+  struct arg_struct args;
+  char * buffer = NULL;
+  size_t capacity = 0;
+  long task_idx;
+  uint64_t start, sent;
+  int status, commit;
+
+  while ((task_idx = NextTask(worker_idx)) >= 0) {
+    struct split * split = &SCHED.splits[task_idx];
+
+    args.worker = w;
+    args.seq = task_idx;
+    args.buf = NULL;
+    args.slot = USE_URING ? TakeReadAhead(task_idx) : -1;
+    args.bytes_read = split->length;
+    args.fd = INPUT.fd;
+    args.offset = split->offset;
+
+    /* Retries and backups were not read ahead */
+    if (!ZERO_COPY && args.slot < 0) {
+      /* A split runs past chunk_size when it has to finish a long word */
+      if (split->length > capacity) {
+        capacity = split->length;
+        if ((buffer = realloc(buffer, capacity)) == NULL) {
+          Die("Failed to allocate chunk buffer");
+        }
+      }
+      if (pread(INPUT.fd, buffer, split->length, split->offset) != (ssize_t) split->length) {
+        Die("Failed to read input split");
+      }
       args.buf = buffer;
-      args.bytes_read = bytesRead;
+    }
 
-      /* Assign this block to the next worker */
-      AssignToWorker((void *) &args);
-      workers_assigned++;
+    Log(LOG_DEBUG, "Assigning chunk %u (%zu bytes) to worker %s at %s:%s\n", args.seq, args.bytes_read,
+      w->worker_name, w->ip_addr, w->port);
 
-      /* If we reach max worker utilization, wait and join all threads, before reading further in the file */
-      if (workers_assigned == max_workers) {
-        workers_assigned = 0;
+    /* Wait for the worker to finish counting; a DONE is its request for more */
+    start = MetricsNow();
+    status = AssignToWorker(&args);
+    sent = MetricsNow();
+    while (status > 0 && (status = RecvFrameHeader(w->sock, &header)) > 0 && header.type == FRAME_FLUSHED) {
+      w->nheld = 0;
+    }
+    if (status < 1 || header.type != FRAME_DONE) {
+      DrainFlushed(w);
+      fprintf(stderr, "Lost worker %s, rescheduling chunk %ld and %zu committed chunks\n", w->worker_name,
+        task_idx, w->nheld);
+      pthread_mutex_lock(&w->send_lock);
+      close(w->sock);
+      w->sock = -1;
+      pthread_mutex_unlock(&w->send_lock);
+      LoseTask(task_idx, worker_idx);
+      break;
+    }
+    w->chunks_sent++;
+    w->bytes_sent += args.bytes_read;
+    MetricsRecord(H_SEND, sent - start);
+    MetricsRecord(H_CHUNK, MetricsNow() - start);
+    MetricsCount(M_BYTES_OUT, args.bytes_read);
+    MetricsCount(M_FRAMES_OUT, 1);
+
+    /* Only the first copy of a split to finish gets shipped to the reducer */
+    commit = FinishTask(task_idx, worker_idx);
+    pthread_mutex_lock(&w->send_lock);
+    SendFrame(w->sock, commit ? FRAME_COMMIT : FRAME_ABORT, args.seq, NULL, 0);
+    pthread_mutex_unlock(&w->send_lock);
+    if (commit) {
+      if (w->nheld == w->held_size) {
+        w->held_size = w->held_size * 2 + 64;
+        if ((w->held = realloc(w->held, w->held_size * sizeof(size_t))) == NULL) {
+          Die("Failed to allocate committed split list");
+        }
       }
+      w->held[w->nheld++] = task_idx;
+      w->chunks_committed++;
+      MetricsCount(M_CHUNKS, 1);
+    } else {
+      MetricsCount(M_CHUNKS_DROPPED, 1);
     }
   }
 
-  fclose(fp);
-  exit(0);
+  free(buffer);
+  if (w->sock >= 0) {
+    FinishWorker(worker_idx);
+  }
+  free(w->held);
+  return NULL;
+}
+
+/* Hand out the next split for an idle worker: a split that lost its
+ * worker, else the next fresh split, else a backup copy of the split
+ * that has been running longest. Returns -1 once every split is done. */
+long NextTask(int worker_idx) {
+  long task_idx = -1;
+  size_t i;
+
+  pthread_mutex_lock(&lock);
+
+  while (SCHED.remaining > 0) {
+    if (SCHED.nretry > 0) {
+      task_idx = SCHED.retry[--SCHED.nretry];
+      break;
+    }
+    if (SCHED.next < SCHED.nsplits) {
+      task_idx = SCHED.next++;
+      break;
+    }
+
+    /* Nothing new to hand out: back up the oldest single-copy straggler */
+    if (SCHED.speculate) {
+      struct task * oldest = NULL;
+      for (i = 0; i < SCHED.nsplits; i++) {
+        struct task * t = &SCHED.tasks[i];
+        if (t->state != TASK_RUNNING || t->attempts != 1 || t->runners[0] == worker_idx) continue;
+        if (oldest == NULL || t->started.tv_sec < oldest->started.tv_sec ||
+            (t->started.tv_sec == oldest->started.tv_sec && t->started.tv_nsec < oldest->started.tv_nsec)) {
+          oldest = t;
+        }
+      }
+      if (oldest != NULL) {
+        task_idx = oldest - SCHED.tasks;
+        Log(LOG_INFO, "Speculatively re-running chunk %ld on %s\n", task_idx, WORKERS_LIST[worker_idx]->worker_name);
+        WORKERS_LIST[worker_idx]->backups_run++;
+        break;
+      }
+    }
+
+    /* Wait until a split finishes or comes back from a dead worker */
+    pthread_cond_wait(&SCHED.changed, &lock);
+  }
+
+  if (task_idx >= 0) {
+    struct task * t = &SCHED.tasks[task_idx];
+    if (t->attempts == 0) {
+      clock_gettime(CLOCK_MONOTONIC, &t->started);
+    }
+    t->state = TASK_RUNNING;
+    t->runners[t->attempts++] = worker_idx;
+  }
+
+  pthread_mutex_unlock(&lock);
+  return task_idx;
+}
+
+/* Whether worker_idx runs a live copy of the split. A copy that was
+ * already cancelled when the split had to be rerun no longer does. */
+static int IsRunner(struct task * t, int worker_idx) {
+  return (t->attempts > 0 && t->runners[0] == worker_idx) || (t->attempts > 1 && t->runners[1] == worker_idx);
+}
+
+/* Record that worker_idx finished a copy of the split; returns 1 if it
+ * was the first copy (commit it), 0 if another copy already won */
+int FinishTask(size_t task_idx, int worker_idx) {
+  struct task * t = &SCHED.tasks[task_idx];
+  int first, other = -1;
+
+  pthread_mutex_lock(&lock);
+
+  if (!IsRunner(t, worker_idx)) {
+    pthread_mutex_unlock(&lock);
+    return 0;
+  }
+
+  first = (t->state != TASK_DONE);
+  if (first) {
+    t->state = TASK_DONE;
+    SCHED.remaining--;
+    pthread_cond_broadcast(&SCHED.changed);
+  }
+  /* drop this copy from the runners */
+  if (t->runners[0] == worker_idx) {
+    t->runners[0] = t->runners[1];
+  }
+  t->attempts--;
+  if (first && t->attempts > 0) {
+    other = t->runners[0];
+  }
+
+  pthread_mutex_unlock(&lock);
+
+  /* Cancel the losing copy early so its worker stops counting */
+  if (other >= 0) {
+    struct worker * w = WORKERS_LIST[other];
+    pthread_mutex_lock(&w->send_lock);
+    if (w->sock >= 0) {
+      SendFrame(w->sock, FRAME_ABORT, task_idx, NULL, 0);
+    }
+    pthread_mutex_unlock(&w->send_lock);
+  }
+
+  return first;
+}
+
+/* The worker running a copy of the split went away; reschedule the
+ * split unless another copy is still running or it already finished.
+ * The worker also took with it the counts of every split it committed
+ * since it last sent to the reducers, so those are rerun too. */
+void LoseTask(size_t task_idx, int worker_idx) {
+  struct worker * w = WORKERS_LIST[worker_idx];
+  struct task * t = &SCHED.tasks[task_idx];
+  size_t i;
+
+  pthread_mutex_lock(&lock);
+
+  if (IsRunner(t, worker_idx)) {
+    if (t->runners[0] == worker_idx) {
+      t->runners[0] = t->runners[1];
+    }
+    t->attempts--;
+    if (t->state != TASK_DONE && t->attempts == 0) {
+      t->state = TASK_PENDING;
+      SCHED.retry[SCHED.nretry++] = task_idx;
+    }
+  }
+
+  /* A losing copy still running elsewhere was cancelled when this one */
+  /* won; it is forgotten, and will be dropped when it finishes */
+  for (i = 0; i < w->nheld; i++) {
+    t = &SCHED.tasks[w->held[i]];
+    t->state = TASK_PENDING;
+    t->attempts = 0;
+    SCHED.remaining++;
+    SCHED.retry[SCHED.nretry++] = w->held[i];
+  }
+  w->nheld = 0;
+  pthread_cond_broadcast(&SCHED.changed);
+
+  pthread_mutex_unlock(&lock);
+}
+
+/* Read the FRAME_FLUSHED frames a lost worker sent before going away,
+ * as when a send to it fails right after it flushed: the splits it had
+ * committed until then are with the reducers and must not run again */
+void DrainFlushed(struct worker * w) {
+  char raw[FRAME_HEADER_SIZE];
+  struct frame_header header;
+
+  while (recv(w->sock, raw, FRAME_HEADER_SIZE, MSG_DONTWAIT) == FRAME_HEADER_SIZE &&
+         DecodeFrameHeader(raw, &header) > 0 && header.type == FRAME_FLUSHED) {
+    w->nheld = 0;
+  }
 }
 
 void PrintWorkerList() {
   int i;
-  for (i = 0; i < WORKERS; i++) {
+  for (i = 0; i < NUM_WORKERS; i++) {
     PrintWorker(i);
   }
 }
 
 void PrintWorker(int worker_idx) {
-  fprintf(stdout, "Worker %s running at %s:%s\n", 
-    WORKERS_LIST[worker_idx]->worker_name, 
-    WORKERS_LIST[worker_idx]->ip_addr, 
+  fprintf(stdout, "Worker %s running at %s:%s\n",
+    WORKERS_LIST[worker_idx]->worker_name,
+    WORKERS_LIST[worker_idx]->ip_addr,
     WORKERS_LIST[worker_idx]->port);
 }
 
-void InitializeWorkerList() {
-  struct worker *w0, *w1, *w2, *w3;
-  
-  w0 = malloc(sizeof(*w0));
-  w1 = malloc(sizeof(*w1));
-  w2 = malloc(sizeof(*w2));
-  w3 = malloc(sizeof(*w3));
+/* Use the workers given with -w, or the four default local workers */
+void InitializeWorkerList(char * worker_spec) {
+  char * ips[MAX_WORKERS];
+  char * ports[MAX_WORKERS];
+  char name[16];
+  int i;
 
-  w0->ip_addr = "127.0.0.1";
-  w0->port = "8888";
-  w0->worker_name = "W0";
+  if (worker_spec == NULL) {
+    worker_spec = "127.0.0.1:8888,127.0.0.1:8889,127.0.0.1:8890,127.0.0.1:8891";
+  }
 
-  w1->ip_addr = "127.0.0.1";
-  w1->port = "8889";
-  w1->worker_name = "W1";
+  if ((NUM_WORKERS = ParseAddressList(worker_spec, ips, ports, MAX_WORKERS)) < 1) {
+    fprintf(stderr, "Invalid worker list: %s\n", worker_spec);
+    exit(1);
+  }
 
-  w2->ip_addr = "127.0.0.1";
-  w2->port = "8890";
-  w2->worker_name = "W2";
+  for (i = 0; i < NUM_WORKERS; i++) {
+    struct worker * w = calloc(1, sizeof(*w));
+    if (w == NULL) {
+      Die("Failed to allocate worker");
+    }
+    snprintf(name, sizeof(name), "W%d", i);
+    w->ip_addr = ips[i];
+    w->port = ports[i];
+    w->worker_name = strdup(name);
+    w->sock = -1;
+    pthread_mutex_init(&w->send_lock, NULL);
+    WORKERS_LIST[i] = w;
+  }
+}
 
-  w3->ip_addr = "127.0.0.1";
-  w3->port = "8891";
-  w3->worker_name = "W3";
+void ConnectToWorker(int worker_idx) {
+  struct worker * w = WORKERS_LIST[worker_idx];
 
-  WORKERS_LIST[0] = w0;
-  WORKERS_LIST[1] = w1;
-  WORKERS_LIST[2] = w2;
-  WORKERS_LIST[3] = w3;
+  if ((w->sock = ConnectTo(w->ip_addr, w->port)) < 0) {
+    Die("Failed to connect with server");
+  }
 }
 
-void * AssignToWorker(void * arguments) {
+void FinishWorker(int worker_idx) {
+  struct worker * w = WORKERS_LIST[worker_idx];
+  struct frame_header header;
+  int status;
 
-  struct arg_struct *args = arguments;
-  char * buffer = args->buf;
-  size_t bytesRead = args->bytes_read;
-  char * ip_addr = args->ip_addr;
-  char * port = args->port;
+  if (SendFrame(w->sock, FRAME_END, 0, NULL, 0) < 1) {
+    Die("Failed to send end of job");
+  }
 
-  int sock;
-  struct sockaddr_in echoserver;
-  char * encoded_dict;
-  int received = 0;
+  /* The worker echoes FRAME_END once all of its chunks have been handled. */
+  /* Past the last chunk there is no one left to rerun what it held */
+  while ((status = RecvFrameHeader(w->sock, &header)) > 0 && header.type == FRAME_FLUSHED);
+  if (status < 1 || header.type != FRAME_END) {
+    fprintf(stderr, "Lost worker %s at the end of the job: the counts of %zu committed chunks are missing\n",
+      w->worker_name, w->nheld);
+    exit(1);
+  }
+
+  close(w->sock);
+  w->sock = -1;
+}
+
+int AssignToWorker(struct arg_struct * args) {
+
+  struct worker * w = args->worker;
+  int status;
 
-  /* Create the TCP socket */
-  if ((sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
-    Die("Failed to create socket");
+  /* Send the chunk as one frame over the worker's persistent connection */
+  pthread_mutex_lock(&w->send_lock);
+  if (args->slot >= 0) {
+    status = SendFromSlot(w, args);
+  } else if (args->buf == NULL) {
+    status = SendFrameFromFile(w->sock, FRAME_CHUNK, args->seq, args->fd, args->offset, args->bytes_read);
+  } else {
+    status = SendFrame(w->sock, FRAME_CHUNK, args->seq, args->buf, args->bytes_read);
   }
+  pthread_mutex_unlock(&w->send_lock);
 
-  /* Construct the server sockaddr_in structure */
-  memset(&echoserver, 0, sizeof(echoserver));       /* Clear struct */
-  echoserver.sin_family = AF_INET;                  /* Internet/IP */
-  echoserver.sin_addr.s_addr = inet_addr(ip_addr);  /* IP address */
-  echoserver.sin_port = htons(atoi(port));       /* server port */
+  return status;
+}
 
-  /* Establish connection */
-  if (connect(sock, (struct sockaddr *) &echoserver, sizeof(echoserver)) < 0) {
-    Die("Failed to connect with server");
+/* Set up the ring and a few registered buffers per worker, start the
+ * completion thread and queue the first reads. Returns -1 if io_uring
+ * cannot be used here. */
+int StartReadAhead(int max_workers) {
+  struct iovec * iov;
+  size_t i, largest = 0;
+
+  if (UringInit(&RING, 64) < 0) {
+    return -1;
   }
 
-  /* Send the payload to the server */
-  if (send(sock, buffer, bytesRead, 0) == 0) {
-    Die("Mismatch in number of sent bytes");
+  for (i = 0; i < SCHED.nsplits; i++) {
+    if (SCHED.splits[i].length > largest) largest = SCHED.splits[i].length;
   }
 
-  close(sock);
-  return NULL;
+  /* Two per worker: one being sent while the next is read */
+  NUM_SLOTS = 2 * max_workers;
+  SLOTS = calloc(NUM_SLOTS, sizeof(struct buffer_slot));
+  iov = calloc(NUM_SLOTS, sizeof(struct iovec));
+  if (SLOTS == NULL || iov == NULL) {
+    Die("Failed to allocate read-ahead slots");
+  }
+  for (i = 0; i < (size_t) NUM_SLOTS; i++) {
+    if ((SLOTS[i].buf = malloc(FRAME_HEADER_SIZE + largest)) == NULL) {
+      Die("Failed to allocate read-ahead buffer");
+    }
+    SLOTS[i].state = SLOT_FREE;
+    iov[i].iov_base = SLOTS[i].buf;
+    iov[i].iov_len = FRAME_HEADER_SIZE + largest;
+  }
+
+  /* Registered buffers are pinned once instead of on every transfer; */
+  /* without them (locked-memory limit) plain reads and writes still work */
+  FIXED_BUFFERS = UringRegisterBuffers(&RING, iov, NUM_SLOTS) == 0;
+  free(iov);
+
+  if (pthread_create(&io_tid, NULL, &IoThread, NULL) != 0) {
+    Die("Couldn't create thread.");
+  }
+
+  pthread_mutex_lock(&lock);
+  RefillReadAhead();
+  pthread_mutex_unlock(&lock);
+  return 0;
 }
 
-void UpdateDictionary(char * encoded_dict) {
-  char * token;
-  char word[100];
-  char word_count[10];
-  int wc = 0;
+void StopReadAhead(void) {
+  int i;
+
+  pthread_mutex_lock(&lock);
+  if (UringPrepNop(&RING, STOP_TAG) < 0 || UringSubmit(&RING) < 0) {
+    Die("Failed to stop read-ahead");
+  }
+  pthread_mutex_unlock(&lock);
+  pthread_join(io_tid, NULL);
+
+  UringExit(&RING);
+  for (i = 0; i < NUM_SLOTS; i++) {
+    free(SLOTS[i].buf);
+  }
+  free(SLOTS);
+}
+
+/* Queue the transfer of what is left of slot i; must hold lock */
+static void QueueSlot(int i) {
+  struct buffer_slot * s = &SLOTS[i];
+  int index = FIXED_BUFFERS ? i : -1;
+  int status;
+
+  if (s->state == SLOT_READING) {
+    status = UringPrepRead(&RING, INPUT.fd, s->buf + FRAME_HEADER_SIZE + s->done, s->length - s->done,
+      SCHED.splits[s->task].offset + s->done, index, i);
+  } else {
+    status = UringPrepWrite(&RING, s->sock, s->buf + s->done, s->length - s->done, (uint64_t) -1, index, i);
+  }
+  if (status < 0 || UringSubmit(&RING) < 0) {
+    Die("Failed to queue input transfer");
+  }
+}
 
-  token = strtok(encoded_dict, ",:");
+/* Start reading the next fresh splits into every free slot; must hold lock */
+void RefillReadAhead(void) {
+  int i;
 
-  while (token != NULL)
-  {
-    /* Extract the word ... */
-    int len = strlen(token);
-    strcpy(word, token);
-    word[len] = '\0';
+  for (i = 0; i < NUM_SLOTS && READ_AHEAD_NEXT < SCHED.nsplits; i++) {
+    if (SLOTS[i].state != SLOT_FREE) continue;
+    SLOTS[i].state = SLOT_READING;
+    SLOTS[i].task = READ_AHEAD_NEXT++;
+    SLOTS[i].length = SCHED.splits[SLOTS[i].task].length;
+    SLOTS[i].done = 0;
+    QueueSlot(i);
+  }
+}
 
-    /* And its count */
-    token = strtok(NULL, ",:");
-    int len2 = strlen(token);
-    strcpy(word_count, token);
-    word_count[len2] = '\0';
-    wc = atoi(word_count);
-    // fprintf(stdout, "The word %s shows up %d times.\n", word, wc);
+/* Reap completions: finish short transfers and wake whoever waits */
+void * IoThread(void * arg) {
+  struct buffer_slot * s;
+  uint64_t tag;
+  int result;
 
-    /* Look up the word in the dict */
-    int word_count_in_dict = DictSearch(WORD_DICT, word);
+  while (UringWait(&RING, &tag, &result) == 0 && tag != STOP_TAG) {
+    pthread_mutex_lock(&lock);
+    s = &SLOTS[tag];
 
-    /* If it's not there, insert it with a the count provided by the worker */
-    if (word_count_in_dict == 0) {
-      DictInsert(WORD_DICT, word, wc);
-    } else { /* Else, get its existing count and add to it the count provided by the worker */
-      DictDelete(WORD_DICT, word);
-      DictInsert(WORD_DICT, word, word_count_in_dict + wc);
+    if (result <= 0) {
+      if (s->state == SLOT_READING) {
+        errno = -result;
+        Die("Failed to read input split");
+      }
+      s->state = SLOT_FAILED;
+    } else if ((s->done += result) < s->length) {
+      QueueSlot(tag);
+    } else {
+      s->state = s->state == SLOT_READING ? SLOT_READY : SLOT_SENT;
     }
 
-    token = strtok(NULL, ",:");
+    pthread_cond_broadcast(&io_changed);
+    pthread_mutex_unlock(&lock);
   }
+  return NULL;
 }
 
-int SendAll(int socket, void *buffer, size_t length) {
-    char *ptr = (char*) buffer;
-    while (length > 0)
-    {
-        int i = send(socket, ptr, length, 0);
-        if (i < 1) return 0;
-        ptr += i;
-        length -= i;
+/* Claim the read-ahead slot holding split task_idx, waiting for its */
+/* read to finish; returns -1 if the split was not read ahead */
+int TakeReadAhead(long task_idx) {
+  int i;
+
+  pthread_mutex_lock(&lock);
+
+  for (i = 0; i < NUM_SLOTS; i++) {
+    if ((SLOTS[i].state == SLOT_READING || SLOTS[i].state == SLOT_READY) && SLOTS[i].task == task_idx) break;
+  }
+  if (i == NUM_SLOTS) {
+    /* The senders overtook the read-ahead; it must not read this one again */
+    if ((size_t) task_idx >= READ_AHEAD_NEXT && (size_t) task_idx < SCHED.nsplits) {
+      READ_AHEAD_NEXT = task_idx + 1;
     }
-    return 1;
+    pthread_mutex_unlock(&lock);
+    return -1;
+  }
+
+  while (SLOTS[i].state == SLOT_READING) {
+    pthread_cond_wait(&io_changed, &lock);
+  }
+  SLOTS[i].state = SLOT_TAKEN;
+
+  pthread_mutex_unlock(&lock);
+  return i;
+}
+
+/* Send a read-ahead chunk as one frame, header and bytes in a single */
+/* write, then hand the slot back to the read-ahead; caller holds the */
+/* worker's send_lock */
+int SendFromSlot(struct worker * w, struct arg_struct * args) {
+  struct buffer_slot * s = &SLOTS[args->slot];
+  int status;
+
+  EncodeFrameHeader(s->buf, FRAME_CHUNK, args->seq, args->bytes_read);
+
+  pthread_mutex_lock(&lock);
+  s->state = SLOT_SENDING;
+  s->sock = w->sock;
+  s->length = FRAME_HEADER_SIZE + args->bytes_read;
+  s->done = 0;
+  QueueSlot(args->slot);
+
+  while (s->state == SLOT_SENDING) {
+    pthread_cond_wait(&io_changed, &lock);
+  }
+  status = s->state == SLOT_SENT ? 1 : -1;
+
+  s->state = SLOT_FREE;
+  RefillReadAhead();
+  pthread_mutex_unlock(&lock);
+
+  return status;
+}
+
+/* Local mode: count the splits on nthreads threads of this process, */
+/* print the counts as the reducer would, and exit */
+void RunLocally(int nthreads, int dump_metrics) {
+  struct timespec start, end;
+  LocalJob job;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if ((job = LocalCount(JOB, INPUT.data, SCHED.splits, SCHED.nsplits, nthreads)) == NULL) {
+    Die("Failed to allocate local job");
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  MetricsGauge(G_DICT_KEYS, LocalSize(job));
+  MetricsGauge(G_DICT_BYTES, LocalMemory(job));
+
+  fprintf(stdout, "\nFinal word count:\n\n");
+  LocalForEach(job, PrintEntry, NULL);
+
+  double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  Log(LOG_INFO, "Processed %zu bytes in %zu chunks on %d local threads in %.3f s (%.1f MB/s)\n",
+    INPUT.size, SCHED.nsplits, nthreads, elapsed, INPUT.size / 1048576.0 / elapsed);
+  if (LOG_LEVEL >= LOG_DEBUG || dump_metrics) {
+    MetricsWrite(stdout);
+  }
+
+  LocalDestroy(job);
+  free(SCHED.splits);
+  UnmapInput(&INPUT);
+  exit(0);
+}
+
+void PrintEntry(const char * key, unsigned int len, int value, void * arg) {
+  fprintf(stdout, "dict[%.*s] = %d\n", (int) len, key, value);
+}
+
+/* Scheduler gauges, read under the lock when metrics are asked for */
+void CollectMetrics(void) {
+  pthread_mutex_lock(&lock);
+  MetricsGauge(G_QUEUE, SCHED.nsplits - SCHED.next + SCHED.nretry);
+  MetricsGauge(G_PENDING, SCHED.remaining);
+  pthread_mutex_unlock(&lock);
 }
 
-void Die(char *mess) { perror(mess); exit(1); }
\ No newline at end of file
+void Die(char *mess) { perror(mess); exit(1); }
@@ -0,0 +1,61 @@
+#ifndef HLL_H
+#define HLL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* HyperLogLog estimate of the number of distinct keys.
+ *
+ * 2^precision one-byte registers, each holding the longest run of
+ * leading zeros seen among the hashes that land in it. Keys are hashed
+ * with DictHashStable, so registers filled by different processes can
+ * be merged by taking the maximum of each register, and adding a key
+ * twice, or in two places, changes nothing. The standard error is
+ * about 1.04 / sqrt(2^precision): 0.8% with 16 KB at precision 14. */
+
+typedef struct hll *HyperLogLog;
+
+#define HLL_MIN_PRECISION 4
+#define HLL_MAX_PRECISION 18
+
+/* registers for precision from HLL_MIN_PRECISION to HLL_MAX_PRECISION */
+HyperLogLog HllCreate(int precision);
+
+void HllDestroy(HyperLogLog);
+
+/* note one occurrence of a key of len bytes */
+void HllAdd(HyperLogLog, const char *key, unsigned int len);
+
+/* take the maximum of every register of dst and src; returns 0, or */
+/* -1 if their precisions differ */
+int HllMerge(HyperLogLog dst, HyperLogLog src);
+
+/* estimated number of distinct keys added */
+double HllEstimate(HyperLogLog);
+
+/* relative standard error of the estimate */
+double HllError(HyperLogLog);
+
+int HllPrecision(HyperLogLog);
+
+/* 1 if nothing has been added since creation or the last reset */
+int HllEmpty(HyperLogLog);
+
+void HllReset(HyperLogLog);
+
+/* Encoding, for worker -> reducer registers:
+ *
+ *   byte     format version (HLL_VERSION)
+ *   byte     precision
+ *   bytes    2^precision registers
+ */
+
+#define HLL_VERSION 1
+
+/* encode into a malloc'd buffer; returns NULL if out of memory */
+char *HllEncode(HyperLogLog, size_t *length);
+
+/* rebuild registers from their encoding, or return NULL if malformed */
+HyperLogLog HllDecode(const void *buffer, size_t length);
+
+#endif
@@ -0,0 +1,392 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "codec.h"
+#include "table.h"
+#include "postings.h"
+#include "index.h"
+
+#define INDEX_WRITE_BUFFER (64 * 1024)
+
+struct index {
+    Table words;
+    const unsigned char *base;  /* the whole list file, mapped read-only */
+    size_t size;
+    uint64_t keys;
+    uint64_t postings;
+    const unsigned char *offsets;   /* keys + 1 of them */
+    uint64_t lists_end;
+};
+
+static void
+put_u64(unsigned char *p, uint64_t v)
+{
+    int i;
+
+    for(i = 0; i < 8; i++) p[i] = (unsigned char) (v >> (8 * i));
+}
+
+static uint64_t
+get_u64(const unsigned char *p)
+{
+    uint64_t v = 0;
+    int i;
+
+    for(i = 0; i < 8; i++) v |= (uint64_t) p[i] << (8 * i);
+
+    return v;
+}
+
+static int
+write_all(int fd, const void *buffer, size_t length)
+{
+    const char *p = buffer;
+    ssize_t n;
+
+    while(length > 0) {
+        if((n = write(fd, p, length)) < 0) {
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        length -= n;
+    }
+
+    return 0;
+}
+
+/* "path" with suffix, in a new allocation */
+static char *
+with_suffix(const char *path, const char *suffix)
+{
+    char *s = malloc(strlen(path) + strlen(suffix) + 1);
+
+    if(s != 0) sprintf(s, "%s%s", path, suffix);
+
+    return s;
+}
+
+int
+IndexWriterOpen(struct index_writer *w, const char *path)
+{
+    char *words, *lists;
+    int status = -1;
+
+    memset(w, 0, sizeof(*w));
+    w->fd = -1;
+
+    words = with_suffix(path, ".tmp");
+    lists = with_suffix(path, ".post.tmp");
+    w->path = with_suffix(path, "");
+    w->buffer = malloc(INDEX_WRITE_BUFFER);
+
+    if(words == 0 || lists == 0 || w->path == 0 || w->buffer == 0) {
+        errno = ENOMEM;
+    } else if((w->fd = open(lists, O_WRONLY | O_CREAT | O_TRUNC, 0644)) >= 0) {
+        if(TableWriterOpen(&w->words, words) == 0) {
+            status = 0;
+        } else {
+            close(w->fd);
+            unlink(lists);
+        }
+    }
+
+    free(words);
+    free(lists);
+    if(status < 0) {
+        free(w->path);
+        free(w->buffer);
+    }
+
+    return status;
+}
+
+static int
+flush_lists(struct index_writer *w)
+{
+    if(write_all(w->fd, w->buffer, w->buffered) < 0) return -1;
+
+    w->buffered = 0;
+
+    return 0;
+}
+
+/* append length bytes to the list file */
+static int
+put_bytes(struct index_writer *w, const void *bytes, size_t length)
+{
+    if(w->buffered + length > INDEX_WRITE_BUFFER) {
+        if(flush_lists(w) < 0) return -1;
+        if(length > INDEX_WRITE_BUFFER) return write_all(w->fd, bytes, length);
+    }
+    memcpy(w->buffer + w->buffered, bytes, length);
+    w->buffered += length;
+
+    return 0;
+}
+
+static int
+note_offset(struct index_writer *w)
+{
+    unsigned char *p;
+    size_t need = w->offsets_used + 8;
+
+    if(need > w->offsets_size) {
+        need = need * 2 > 4096 ? need * 2 : 4096;
+        if((p = realloc(w->offsets, need)) == 0) return -1;
+        w->offsets = p;
+        w->offsets_size = need;
+    }
+    put_u64(w->offsets + w->offsets_used, w->offset);
+    w->offsets_used += 8;
+
+    return 0;
+}
+
+int
+IndexWriterAdd(struct index_writer *w, const char *key, unsigned int len, struct posting_list *l)
+{
+    unsigned char count[10];
+    size_t length = VarintPut(count, l->count) - count;
+
+    if(TableWriterAdd(&w->words, key, len, (int) (w->offsets_used / 8)) < 0) return -1;
+
+    if(note_offset(w) < 0 || put_bytes(w, count, length) < 0 || put_bytes(w, l->p, l->end - l->p) < 0) {
+        return -1;
+    }
+    w->offset += length + (l->end - l->p);
+    w->postings += l->count;
+
+    return 0;
+}
+
+/* put the files in place if status is 0, remove them otherwise, and */
+/* free the writer */
+static int
+finish(struct index_writer *w, int status)
+{
+    char *words, *lists, *post;
+
+    /* the lists first: a table is only ever next to its own lists */
+    words = with_suffix(w->path, ".tmp");
+    lists = with_suffix(w->path, ".post.tmp");
+    post = with_suffix(w->path, ".post");
+    if(words == 0 || lists == 0 || post == 0) status = -1;
+    if(status == 0 && rename(lists, post) < 0) status = -1;
+    if(status == 0 && rename(words, w->path) < 0) status = -1;
+    if(status < 0) {
+        if(lists != 0) unlink(lists);
+        if(words != 0) unlink(words);
+    }
+
+    free(words);
+    free(lists);
+    free(post);
+    free(w->path);
+    free(w->offsets);
+    free(w->buffer);
+    memset(w, 0, sizeof(*w));
+    w->fd = -1;
+
+    return status < 0 ? -1 : 0;
+}
+
+int
+IndexWriterClose(struct index_writer *w)
+{
+    unsigned char footer[INDEX_FOOTER_SIZE];
+    uint64_t keys = w->offsets_used / 8;
+    int status;
+
+    status = note_offset(w);
+    put_u64(footer, keys);
+    put_u64(footer + 8, w->postings);
+    memcpy(footer + 16, INDEX_MAGIC, 8);
+
+    if(status == 0) status = put_bytes(w, w->offsets, w->offsets_used);
+    if(status == 0) status = put_bytes(w, footer, INDEX_FOOTER_SIZE);
+    if(status == 0) status = flush_lists(w);
+    if(status == 0) status = fsync(w->fd);
+    if(close(w->fd) < 0) status = -1;
+    if(TableWriterClose(&w->words) < 0) status = -1;
+
+    return finish(w, status);
+}
+
+void
+IndexWriterAbort(struct index_writer *w)
+{
+    close(w->fd);
+    TableWriterClose(&w->words);
+    finish(w, -1);
+}
+
+Index
+IndexOpen(const char *path)
+{
+    const unsigned char *footer;
+    struct stat st;
+    char *post;
+    void *base;
+    Index x;
+    int fd;
+
+    if((x = calloc(1, sizeof(*x))) == 0) return 0;
+    if((post = with_suffix(path, ".post")) == 0) {
+        free(x);
+        return 0;
+    }
+
+    fd = open(post, O_RDONLY);
+    free(post);
+    if(fd < 0) {
+        free(x);
+        return 0;
+    }
+    if(fstat(fd, &st) < 0) {
+        close(fd);
+        free(x);
+        return 0;
+    }
+    if(st.st_size < INDEX_FOOTER_SIZE + 8) {
+        close(fd);
+        free(x);
+        errno = EINVAL;
+        return 0;
+    }
+
+    base = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED) {
+        free(x);
+        return 0;
+    }
+    x->base = base;
+    x->size = st.st_size;
+
+    footer = x->base + x->size - INDEX_FOOTER_SIZE;
+    x->keys = get_u64(footer);
+    x->postings = get_u64(footer + 8);
+
+    /* the offsets sit between the lists and the footer */
+    if(memcmp(footer + 16, INDEX_MAGIC, 8) != 0 ||
+       x->keys > (x->size - INDEX_FOOTER_SIZE) / 8 - 1) {
+        goto bad;
+    }
+    x->offsets = footer - 8 * (x->keys + 1);
+    x->lists_end = get_u64(x->offsets + 8 * x->keys);
+    if(x->lists_end != (uint64_t) (x->offsets - x->base)) goto bad;
+
+    if((x->words = TableOpen(path)) == 0) goto fail;
+    if(TableEntries(x->words) != x->keys) goto bad;
+
+    return x;
+
+bad:
+    errno = EINVAL;
+fail:
+    IndexClose(x);
+    return 0;
+}
+
+void
+IndexClose(Index x)
+{
+    if(x->words != 0) TableClose(x->words);
+    munmap((void *) x->base, x->size);
+    free(x);
+}
+
+Table
+IndexTable(Index x)
+{
+    return x->words;
+}
+
+uint64_t
+IndexKeys(Index x)
+{
+    return x->keys;
+}
+
+uint64_t
+IndexPostings(Index x)
+{
+    return x->postings;
+}
+
+uint64_t
+IndexListBytes(Index x)
+{
+    return x->lists_end;
+}
+
+int
+IndexList(Index x, uint64_t ordinal, struct posting_list *l)
+{
+    const unsigned char *p, *end;
+    uint64_t from, to, count;
+
+    if(ordinal >= x->keys) return -1;
+
+    from = get_u64(x->offsets + 8 * ordinal);
+    to = get_u64(x->offsets + 8 * (ordinal + 1));
+    if(from > to || to > x->lists_end) return -1;
+
+    p = x->base + from;
+    end = x->base + to;
+    if(!VarintGet(&p, end, &count) || count == 0 || count > UINT32_MAX) return -1;
+    PostingListInit(l, p, end, (uint32_t) count);
+
+    return 0;
+}
+
+int
+IndexGet(Index x, const char *key, unsigned int len, struct posting_list *l)
+{
+    int ordinal;
+    int status;
+
+    if((status = TableGet(x->words, key, len, &ordinal)) <= 0) return status;
+
+    return ordinal < 0 || IndexList(x, (uint64_t) ordinal, l) < 0 ? -1 : 1;
+}
+
+long
+IndexIntersect(struct posting_list *lists, int n, uint32_t *out)
+{
+    long found = 0, kept, k;
+    uint32_t doc;
+    int shortest = 0, status, i;
+
+    if(n < 1) return 0;
+
+    /* every other list only filters the shortest one */
+    for(i = 1; i < n; i++) {
+        if(lists[i].remaining < lists[shortest].remaining) shortest = i;
+    }
+    while((status = PostingNext(&lists[shortest], &out[found])) > 0) found++;
+    if(status < 0) return -1;
+
+    for(i = 0; i < n && found > 0; i++) {
+        if(i == shortest) continue;
+
+        kept = 0;
+        status = PostingNext(&lists[i], &doc);
+        for(k = 0; k < found && status > 0; k++) {
+            while(status > 0 && doc < out[k]) status = PostingNext(&lists[i], &doc);
+            if(status > 0 && doc == out[k]) out[kept++] = out[k];
+        }
+        if(status < 0) return -1;
+        found = kept;
+    }
+
+    return found;
+}
@@ -0,0 +1,90 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "table.h"
+#include "postings.h"
+
+/* Inverted index files, written by the reducer from the posting lists
+ * of a job (worker -I, reducer -o) and read in place through mmap.
+ *
+ *   path        a table (table.h) from every key to its ordinal, the
+ *               number of keys before it in byte order
+ *   path.post   the lists in key order, each:
+ *                 varint   number of documents
+ *                 bytes    the documents, encoded as in postings.h
+ *               then the offset of every list and of the end of the
+ *               last one, then INDEX_FOOTER_SIZE bytes: the number of
+ *               keys, the number of postings, and the 8-byte
+ *               INDEX_MAGIC. Numbers are little-endian 64-bit words.
+ *
+ * A lookup is a table lookup followed by one read of an offset; the
+ * list is then decoded as it is read. */
+
+#define INDEX_FOOTER_SIZE 24
+#define INDEX_MAGIC "WCPOST01"
+
+/* Writer: keys must be added in strictly ascending byte order. The */
+/* files are written under temporary names that replace path and */
+/* path.post once both are complete */
+struct index_writer {
+    struct table_writer words;
+    char *path;
+    int fd;
+    uint64_t offset;            /* bytes of lists written so far */
+    uint64_t postings;
+    unsigned char *offsets;     /* of every list so far */
+    size_t offsets_used;
+    size_t offsets_size;
+    unsigned char *buffer;      /* lists not yet written */
+    size_t buffered;
+};
+
+/* create the temporary files; returns 0, or -1 with errno set */
+int IndexWriterOpen(struct index_writer *w, const char *path);
+
+/* append the list l reads, from its start; returns 0, or -1 if the */
+/* key is out of order (errno EINVAL) or writing failed */
+int IndexWriterAdd(struct index_writer *w, const char *key, unsigned int len, struct posting_list *l);
+
+/* finish, sync and rename both files; returns 0, or -1 if anything */
+/* failed, in which case they are removed. The writer is freed either way */
+int IndexWriterClose(struct index_writer *w);
+
+/* give up: remove the temporary files and free the writer */
+void IndexWriterAbort(struct index_writer *w);
+
+typedef struct index *Index;
+
+/* map both files; returns NULL with errno set if they cannot be opened */
+/* or are not a well-formed index (EINVAL) */
+Index IndexOpen(const char *path);
+
+void IndexClose(Index);
+
+/* the table of keys, whose values are ordinals for IndexList */
+Table IndexTable(Index);
+
+/* number of keys, and of postings over all keys */
+uint64_t IndexKeys(Index);
+uint64_t IndexPostings(Index);
+
+/* bytes taken by the lists, counts included */
+uint64_t IndexListBytes(Index);
+
+/* set l to read the list of the key of the given ordinal; returns 0, */
+/* or -1 if there is no such key or its list is corrupt */
+int IndexList(Index, uint64_t ordinal, struct posting_list *l);
+
+/* look up one key: returns 1 and sets l to read its list if present, */
+/* 0 if not, -1 if the index is corrupt */
+int IndexGet(Index, const char *key, unsigned int len, struct posting_list *l);
+
+/* the documents in all n lists, in ascending order, into out, which has */
+/* room for the shortest list; returns how many, or -1 if a list is */
+/* corrupt. The lists are read from where they are to their end */
+long IndexIntersect(struct posting_list *lists, int n, uint32_t *out);
+
+#endif
@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <string.h>
+#include <dlfcn.h>
+
+#include "dict.h"
+#include "tokenize.h"
+#include "job.h"
+
+#define DRAIN_PREFETCH 8    /* records ahead whose slots are being loaded */
+
+static void emit_word(const char * key, unsigned int len, unsigned long hash, void * arg) {
+  EmitHashed((struct emit_batch *) arg, key, len, hash, 1);
+}
+
+/* Every word counts once; Tokenize has the hash already */
+static void word_count_map(char * buf, size_t len, struct emit_batch * out) {
+  Tokenize(buf, len, emit_word, out);
+}
+
+const struct job WORD_COUNT_JOB = { "wordcount", JOB_SUM, word_count_map };
+
+void JobDrain(struct emit_batch * b, Dict d, int op) {
+  struct record * r = b->records;
+  size_t i, n = b->n;
+
+  EmitHash(b);
+  for (i = 0; i < n && i < DRAIN_PREFETCH; i++) {
+    DictPrefetch(d, r[i].hash);
+  }
+  for (i = 0; i < n; i++) {
+    if (i + DRAIN_PREFETCH < n) DictPrefetch(d, r[i + DRAIN_PREFETCH].hash);
+    if (op == JOB_SUM) {
+      DictIncrementHashed(d, r[i].key, r[i].len, r[i].hash, r[i].value);
+    } else {
+      DictCombineHashed(d, r[i].key, r[i].len, r[i].hash, r[i].value, op);
+    }
+  }
+  b->n = 0;
+}
+
+static const struct job * BUILT_IN[] = { &WORD_COUNT_JOB };
+
+const struct job * JobLoad(const char * name) {
+  const struct job * job;
+  void * handle;
+  size_t i;
+
+  if (strchr(name, '/') == NULL) {
+    for (i = 0; i < sizeof(BUILT_IN) / sizeof(BUILT_IN[0]); i++) {
+      if (strcmp(BUILT_IN[i]->name, name) == 0) return BUILT_IN[i];
+    }
+    fprintf(stderr, "No built-in job %s (a shared object needs a path with a '/')\n", name);
+    return NULL;
+  }
+
+  /* Never unloaded: the job is used until the process exits */
+  if ((handle = dlopen(name, RTLD_NOW)) == NULL) {
+    fprintf(stderr, "%s\n", dlerror());
+    return NULL;
+  }
+  if ((job = dlsym(handle, "JOB")) == NULL) {
+    fprintf(stderr, "%s: no JOB defined\n", name);
+    dlclose(handle);
+    return NULL;
+  }
+  if (job->map == NULL || job->combine < JOB_SUM || job->combine > JOB_MIN) {
+    fprintf(stderr, "%s: JOB has no map function or a bad combine\n", name);
+    dlclose(handle);
+    return NULL;
+  }
+  return job;
+}
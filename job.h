@@ -0,0 +1,102 @@
+#ifndef JOB_H
+#define JOB_H
+
+#include <stddef.h>
+
+#include "dict.h"
+
+/* Pluggable map and reduce functions.
+ *
+ * A job maps a block of input to (key, value) records and says how the
+ * values of one key combine: added, or the largest or the smallest one
+ * kept. Values are ints, as everywhere in the pipeline, and records of
+ * the same key are combined the same way in the map threads' tables,
+ * the combiner, the merge tree and the reducer.
+ *
+ * Records go into a batch that the job fills inline, and that the host
+ * drains when it is full and after every block. A job therefore costs
+ * one indirect call per block and one per EMIT_BATCH records, not one
+ * per record.
+ *
+ * Word count is built in (job.c). Other jobs are shared objects that
+ * define `const struct job JOB`. They may call Tokenize (tokenize.h) and
+ * DictHash, which the binaries export; see jobs/ for examples. */
+
+#define JOB_SUM DICT_SUM
+#define JOB_MAX DICT_MAX
+#define JOB_MIN DICT_MIN
+
+#define EMIT_BATCH 256
+
+struct record {
+  const char * key;
+  unsigned int len;
+  int value;
+  unsigned long hash;   /* DictHash(key, len), once the batch is drained */
+};
+
+struct emit_batch {
+  size_t n;
+  int unhashed;         /* some records were emitted without their hash */
+  void (*drain)(struct emit_batch *);   /* the host's: consumes and empties */
+  void * arg;
+  struct record records[EMIT_BATCH];
+};
+
+struct job {
+  const char * name;
+  int combine;          /* JOB_SUM, JOB_MAX or JOB_MIN */
+  /* Emit the records of len bytes of buf. The block ends on a word */
+  /* delimiter and may be rewritten in place. Emitted keys must stay */
+  /* valid until the batch is drained: a job that builds keys in its */
+  /* own memory calls EmitFlush before reusing it. */
+  void (*map)(char * buf, size_t len, struct emit_batch * out);
+};
+
+/* emit a record whose key hash the job already has, e.g. from Tokenize */
+static inline void EmitHashed(struct emit_batch * b, const char * key, unsigned int len, unsigned long hash, int value) {
+  struct record * r = &b->records[b->n++];
+
+  r->key = key;
+  r->len = len;
+  r->value = value;
+  r->hash = hash;
+  if (b->n == EMIT_BATCH) b->drain(b);
+}
+
+/* emit a record; the host hashes the key when it drains the batch */
+static inline void Emit(struct emit_batch * b, const char * key, unsigned int len, int value) {
+  b->unhashed = 1;
+  EmitHashed(b, key, len, 0, value);
+}
+
+/* hand every pending record to the host */
+static inline void EmitFlush(struct emit_batch * b) {
+  if (b->n > 0) b->drain(b);
+}
+
+/* for the host's drain: fill in the hashes of records emitted without */
+static inline void EmitHash(struct emit_batch * b) {
+  size_t i;
+
+  if (!b->unhashed) return;
+  for (i = 0; i < b->n; i++) {
+    b->records[i].hash = DictHash(b->records[i].key, b->records[i].len);
+  }
+  b->unhashed = 0;
+}
+
+/* for the host's drain: combine every record of b into d by op, and */
+/* empty b. The slots of the next records are prefetched while one is */
+/* stored, which per-record calls could not do. */
+void JobDrain(struct emit_batch * b, Dict d, int op);
+
+/* the built-in word count */
+extern const struct job WORD_COUNT_JOB;
+
+/* the job called name: built in, or loaded from the shared object at */
+/* name if it contains a '/'; returns NULL, with the reason on stderr, */
+/* if there is no such job */
+const struct job * JobLoad(const char * name);
+
+#endif
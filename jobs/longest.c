@@ -0,0 +1,18 @@
+/* The length of the longest word starting with each letter (or other
+ * first byte), combined with JOB_MAX.
+ *
+ * Build: make jobs/longest.so
+ * Run:   worker -j ./jobs/longest.so <port> (and reducer -j ./jobs/longest.so) */
+
+#include "../tokenize.h"
+#include "../job.h"
+
+static void emit_initial(const char * key, unsigned int len, unsigned long hash, void * arg) {
+  Emit((struct emit_batch *) arg, key, 1, (int) len);
+}
+
+static void map(char * buf, size_t len, struct emit_batch * out) {
+  Tokenize(buf, len, emit_initial, out);
+}
+
+const struct job JOB = { "longest", JOB_MAX, map };
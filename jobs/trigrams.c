@@ -0,0 +1,32 @@
+/* Letter trigram counts: every three consecutive letters of every word,
+ * after the worker's lowercasing and punctuation stripping. Words
+ * shorter than three letters count as themselves. The trigrams point
+ * into the tokenized words, so nothing is copied; their hashes are left
+ * to the host.
+ *
+ * Build: make jobs/trigrams.so
+ * Run:   worker -j ./jobs/trigrams.so <port> (and reducer -j ./jobs/trigrams.so) */
+
+#include "../tokenize.h"
+#include "../job.h"
+
+#define N 3
+
+static void emit_grams(const char * key, unsigned int len, unsigned long hash, void * arg) {
+  struct emit_batch * out = arg;
+  unsigned int i;
+
+  if (len <= N) {
+    EmitHashed(out, key, len, hash, 1);
+    return;
+  }
+  for (i = 0; i + N <= len; i++) {
+    Emit(out, key + i, N, 1);
+  }
+}
+
+static void map(char * buf, size_t len, struct emit_batch * out) {
+  Tokenize(buf, len, emit_grams, out);
+}
+
+const struct job JOB = { "trigrams", JOB_SUM, map };
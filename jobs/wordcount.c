@@ -0,0 +1,18 @@
+/* Word count as a shared object: the same job as the built-in one, for
+ * measuring what loading a job with dlopen costs.
+ *
+ * Build: make jobs/wordcount.so
+ * Run:   worker -j ./jobs/wordcount.so <port> (and reducer -j ./jobs/wordcount.so) */
+
+#include "../tokenize.h"
+#include "../job.h"
+
+static void emit_word(const char * key, unsigned int len, unsigned long hash, void * arg) {
+  EmitHashed((struct emit_batch *) arg, key, len, hash, 1);
+}
+
+static void map(char * buf, size_t len, struct emit_batch * out) {
+  Tokenize(buf, len, emit_word, out);
+}
+
+const struct job JOB = { "wordcount.so", JOB_SUM, map };
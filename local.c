@@ -0,0 +1,227 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include "dict.h"
+#include "split.h"
+#include "metrics.h"
+#include "job.h"
+#include "local.h"
+
+#define LOCAL_BLOCK (64 * 1024)   /* bytes tokenized at a time, as in the worker */
+
+struct local_job {
+  const struct job * job;
+  const char * data;
+  const struct split * splits;
+  size_t nsplits;
+  size_t next;          /* next split to take */
+  int nthreads;
+  Dict * counts;        /* counts[t * nthreads + p]: map thread t's partition p, */
+                        /* NULL until used */
+};
+
+struct local_thread {
+  LocalJob job;
+  int id;
+  Dict * counts;        /* this thread's row of job->counts */
+  char * scratch;       /* the tokenizer rewrites words in place, and */
+  size_t capacity;      /* the input is mapped read-only */
+};
+
+/* Drain a batch of records into the thread's partitions */
+static void local_count(struct emit_batch * b) {
+  struct local_thread * t = b->arg;
+  int n = t->job->nthreads, op = t->job->job->combine;
+  struct record * r;
+  Dict * d;
+  size_t i;
+
+  if (n == 1) {
+    JobDrain(b, t->counts[0] != NULL ? t->counts[0] : (t->counts[0] = DictCreate()), op);
+    return;
+  }
+  EmitHash(b);
+  for (i = 0; i < b->n; i++) {
+    r = &b->records[i];
+    d = &t->counts[r->hash % n];
+
+    /* created on first use: most of nthreads^2 tables may never be needed */
+    if (*d == NULL) *d = DictCreate();
+    DictCombineHashed(*d, r->key, r->len, r->hash, r->value, op);
+  }
+  b->n = 0;
+}
+
+struct local_merge {
+  Dict into;
+  int op;
+};
+
+static void local_add(const char * key, unsigned int len, int value, void * arg) {
+  struct local_merge * m = arg;
+
+  DictCombineLen(m->into, key, len, value, m->op);
+}
+
+/* Map: take splits until none are left, counting each a block at a time */
+static void * local_map(void * arg) {
+  struct local_thread * t = arg;
+  LocalJob job = t->job;
+  const char * p, * end, * stop;
+  struct emit_batch out;
+  uint64_t start;
+  size_t s;
+
+  out.n = 0;
+  out.unhashed = 0;
+  out.drain = local_count;
+  out.arg = t;
+
+  while ((s = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->nsplits) {
+    p = job->data + job->splits[s].offset;
+    end = p + job->splits[s].length;
+
+    /* Blocks end on a delimiter, so no word straddles two of them */
+    while (p < end) {
+      stop = end - p > LOCAL_BLOCK ? FindDelimiter(p + LOCAL_BLOCK, end) : end;
+      if ((size_t) (stop - p) > t->capacity) {
+        free(t->scratch);
+        t->capacity = stop - p;
+        t->scratch = malloc(t->capacity);
+        assert(t->scratch != NULL);
+      }
+      start = MetricsNow();
+      memcpy(t->scratch, p, stop - p);
+      job->job->map(t->scratch, stop - p, &out);
+      EmitFlush(&out);
+      MetricsRecord(H_TOKENIZE, MetricsNow() - start);
+      p = stop;
+    }
+    MetricsCount(M_CHUNKS, 1);
+    MetricsCount(M_BYTES_IN, job->splits[s].length);
+  }
+  return NULL;
+}
+
+/* Reduce: fold partition id of every other map thread into thread 0's */
+static void * local_reduce(void * arg) {
+  struct local_thread * t = arg;
+  LocalJob job = t->job;
+  struct local_merge m;
+  Dict from;
+  uint64_t start = MetricsNow();
+  int i;
+
+  if (job->counts[t->id] == NULL) {
+    job->counts[t->id] = DictCreate();
+  }
+  m.into = job->counts[t->id];
+  m.op = job->job->combine;
+  for (i = 1; i < job->nthreads; i++) {
+    if ((from = job->counts[i * job->nthreads + t->id]) == NULL) continue;
+    MetricsCount(M_ENTRIES_MERGED, DictSize(from));
+    DictForEach(from, local_add, &m);
+    DictDestroy(from);
+    job->counts[i * job->nthreads + t->id] = NULL;
+  }
+  MetricsRecord(H_MERGE, MetricsNow() - start);
+  return NULL;
+}
+
+/* Run fn once per thread of the job; thread 0's share runs on the */
+/* calling thread, as does the share of any thread that fails to start */
+static void local_run(struct local_thread * threads, int n, void * (*fn)(void *)) {
+  pthread_t tid[n];
+  int started[n];
+  int i;
+
+  for (i = 1; i < n; i++) {
+    started[i] = pthread_create(&tid[i], NULL, fn, &threads[i]) == 0;
+  }
+  fn(&threads[0]);
+  for (i = 1; i < n; i++) {
+    if (started[i]) {
+      pthread_join(tid[i], NULL);
+    } else {
+      fn(&threads[i]);
+    }
+  }
+}
+
+LocalJob LocalCount(const struct job * map, const char * data, const struct split * splits, size_t nsplits, int nthreads) {
+  struct local_thread * threads;
+  LocalJob job;
+  int i;
+
+  if ((job = calloc(1, sizeof(*job))) == NULL) {
+    return NULL;
+  }
+  job->job = map;
+  job->data = data;
+  job->splits = splits;
+  job->nsplits = nsplits;
+  job->nthreads = nthreads;
+  job->counts = calloc((size_t) nthreads * nthreads, sizeof(Dict));
+  threads = calloc(nthreads, sizeof(*threads));
+  if (job->counts == NULL || threads == NULL) {
+    free(job->counts);
+    free(threads);
+    free(job);
+    return NULL;
+  }
+  for (i = 0; i < nthreads; i++) {
+    threads[i].job = job;
+    threads[i].id = i;
+    threads[i].counts = &job->counts[i * nthreads];
+  }
+
+  local_run(threads, nthreads, local_map);
+  local_run(threads, nthreads, local_reduce);
+
+  for (i = 0; i < nthreads; i++) {
+    free(threads[i].scratch);
+  }
+  free(threads);
+  return job;
+}
+
+void LocalDestroy(LocalJob job) {
+  int i;
+
+  for (i = 0; i < job->nthreads * job->nthreads; i++) {
+    if (job->counts[i] != NULL) DictDestroy(job->counts[i]);
+  }
+  free(job->counts);
+  free(job);
+}
+
+size_t LocalSize(LocalJob job) {
+  size_t n = 0;
+  int p;
+
+  for (p = 0; p < job->nthreads; p++) {
+    n += DictSize(job->counts[p]);
+  }
+  return n;
+}
+
+size_t LocalMemory(LocalJob job) {
+  size_t bytes = 0;
+  int p;
+
+  for (p = 0; p < job->nthreads; p++) {
+    bytes += DictMemory(job->counts[p]);
+  }
+  return bytes;
+}
+
+void LocalForEach(LocalJob job, void (*fn)(const char * key, unsigned int len, int value, void * arg), void * arg) {
+  int p;
+
+  for (p = 0; p < job->nthreads; p++) {
+    DictForEach(job->counts[p], fn, arg);
+  }
+}
@@ -0,0 +1,36 @@
+#ifndef LOCAL_H
+#define LOCAL_H
+
+#include <stddef.h>
+
+#include "split.h"
+#include "job.h"
+
+/* A whole job inside one process, for inputs small enough that the
+ * round trips to workers and reducers cost more than the counting.
+ *
+ * Map threads take splits of the mapped input in turn and run the job's
+ * map on them, 64 KB at a time, as workers do. Each thread keeps one
+ * Dict per key partition (by key hash), so when every split is counted,
+ * reduce thread p merges partition p of all map threads, with no locks
+ * and without encoding anything. The partitions hold disjoint keys; the
+ * job's counts are all of them together. Counts stay in memory: there
+ * is no budget and nothing is spilled. */
+
+typedef struct local_job *LocalJob;
+
+/* run job over nsplits splits of data on nthreads threads; */
+/* returns NULL if out of memory */
+LocalJob LocalCount(const struct job * job, const char * data, const struct split * splits, size_t nsplits, int nthreads);
+void LocalDestroy(LocalJob);
+
+/* number of distinct keys */
+size_t LocalSize(LocalJob);
+
+/* bytes held by the counts */
+size_t LocalMemory(LocalJob);
+
+/* call fn on every key with its combined value, partition by partition */
+void LocalForEach(LocalJob, void (*fn)(const char * key, unsigned int len, int value, void * arg), void * arg);
+
+#endif
@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#include "proto.h"
+#include "metrics.h"
+
+int LOG_LEVEL = LOG_INFO;
+
+struct histogram {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint64_t buckets[METRICS_BUCKETS];
+};
+
+/* One thread's counters and histograms. Only the owning thread writes */
+/* them; dumps read them concurrently, so every access is atomic, but */
+/* relaxed, which costs nothing over a plain load or store. */
+struct metrics_local {
+  uint64_t counters[M_COUNTERS];
+  struct histogram histograms[H_HISTOGRAMS];
+  struct metrics_local *next;
+  struct metrics_local **prev;
+};
+
+static const char *COUNTER_NAMES[M_COUNTERS] = {
+  "bytes_in", "bytes_out", "frames_in", "frames_out", "chunks", "chunks_dropped",
+  "entries_merged", "flushes"
+};
+static const char *HISTOGRAM_NAMES[H_HISTOGRAMS] = {
+  "recv_ns", "tokenize_ns", "count_ns", "commit_ns", "encode_ns", "send_ns",
+  "merge_ns", "chunk_ns"
+};
+static const char *GAUGE_NAMES[G_GAUGES] = {
+  "dict_keys", "dict_bytes", "queue_depth", "parked", "buffered_bytes", "pending_splits",
+  "probe_mean", "probe_max"
+};
+
+static __thread struct metrics_local *LOCAL;
+static struct metrics_local *THREADS;       /* every live thread's copy */
+static struct metrics_local RETIRED;        /* sums of the threads that exited */
+static pthread_mutex_t METRICS_LOCK = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t METRICS_ONCE = PTHREAD_ONCE_INIT;
+static pthread_key_t METRICS_KEY;
+static double GAUGES[G_GAUGES];
+static int GAUGE_SET[G_GAUGES];
+static void (*COLLECT)(void);
+
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+
+/* fold a copy into a sum; called with METRICS_LOCK held */
+static void metrics_add(struct metrics_local *sum, struct metrics_local *m) {
+  int i, b;
+
+  for (i = 0; i < M_COUNTERS; i++) {
+    sum->counters[i] += LOAD(m->counters[i]);
+  }
+  for (i = 0; i < H_HISTOGRAMS; i++) {
+    struct histogram *s = &sum->histograms[i], *h = &m->histograms[i];
+    uint64_t max = LOAD(h->max);
+
+    if (LOAD(h->count) == 0) continue;
+    s->count += LOAD(h->count);
+    s->sum += LOAD(h->sum);
+    if (max > s->max) s->max = max;
+    for (b = 0; b < METRICS_BUCKETS; b++) {
+      s->buckets[b] += LOAD(h->buckets[b]);
+    }
+  }
+}
+
+/* a thread is exiting: keep what it counted */
+static void metrics_retire(void *arg) {
+  struct metrics_local *m = arg;
+
+  pthread_mutex_lock(&METRICS_LOCK);
+  metrics_add(&RETIRED, m);
+  if ((*m->prev = m->next) != NULL) m->next->prev = m->prev;
+  pthread_mutex_unlock(&METRICS_LOCK);
+  free(m);
+}
+
+static void metrics_init(void) {
+  pthread_key_create(&METRICS_KEY, metrics_retire);
+}
+
+static struct metrics_local *metrics_local(void) {
+  struct metrics_local *m;
+
+  if (LOCAL != NULL) return LOCAL;
+
+  pthread_once(&METRICS_ONCE, metrics_init);
+  if ((m = calloc(1, sizeof(*m))) == NULL) {
+    return NULL;
+  }
+  pthread_mutex_lock(&METRICS_LOCK);
+  if ((m->next = THREADS) != NULL) THREADS->prev = &m->next;
+  m->prev = &THREADS;
+  THREADS = m;
+  pthread_mutex_unlock(&METRICS_LOCK);
+  pthread_setspecific(METRICS_KEY, m);
+
+  return LOCAL = m;
+}
+
+/* 0 to 3 have a bucket each; above that, every power of two is split */
+/* into four buckets by the two bits below the leading one */
+static int bucket_of(uint64_t v) {
+  int e;
+
+  if (v < 4) return (int) v;
+  e = 63 - __builtin_clzll(v);
+  return 4 * (e - 1) + (int) ((v >> (e - 2)) & 3);
+}
+
+static uint64_t bucket_low(int b) {
+  int e = b / 4 + 1;
+
+  if (b < 4) return b;
+  return (uint64_t) (4 + b % 4) << (e - 2);
+}
+
+void MetricsCount(int counter, uint64_t n) {
+  struct metrics_local *m = metrics_local();
+
+  if (m == NULL) return;
+  STORE(m->counters[counter], m->counters[counter] + n);
+}
+
+void MetricsRecord(int histogram, uint64_t value) {
+  struct metrics_local *m = metrics_local();
+  struct histogram *h;
+  int b = bucket_of(value);
+
+  if (m == NULL) return;
+  h = &m->histograms[histogram];
+  STORE(h->count, h->count + 1);
+  STORE(h->sum, h->sum + value);
+  STORE(h->buckets[b], h->buckets[b] + 1);
+  if (value > h->max) STORE(h->max, value);
+}
+
+void MetricsGauge(int gauge, double value) {
+  __atomic_store(&GAUGES[gauge], &value, __ATOMIC_RELAXED);
+  STORE(GAUGE_SET[gauge], 1);
+}
+
+uint64_t MetricsNow(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void MetricsOnDump(void (*collect)(void)) {
+  COLLECT = collect;
+}
+
+/* the middle of the bucket holding quantile q; within a bucket's width */
+/* of the true value */
+static uint64_t quantile(struct histogram *h, double q) {
+  uint64_t rank = (uint64_t) (q * (h->count - 1)) + 1;
+  uint64_t seen = 0;
+  int b;
+
+  for (b = 0; b < METRICS_BUCKETS; b++) {
+    if ((seen += h->buckets[b]) >= rank) {
+      uint64_t low = bucket_low(b);
+      uint64_t high = b + 1 < METRICS_BUCKETS ? bucket_low(b + 1) - 1 : h->max;
+      uint64_t mid = low + (high - low) / 2;
+      return mid < h->max ? mid : h->max;
+    }
+  }
+  return h->max;
+}
+
+void MetricsWrite(FILE *out) {
+  struct metrics_local *sum, *m;
+  struct rusage usage;
+  int i;
+
+  if (COLLECT != NULL) COLLECT();
+
+  if ((sum = calloc(1, sizeof(*sum))) == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&METRICS_LOCK);
+  metrics_add(sum, &RETIRED);
+  for (m = THREADS; m != NULL; m = m->next) {
+    metrics_add(sum, m);
+  }
+  pthread_mutex_unlock(&METRICS_LOCK);
+
+  for (i = 0; i < M_COUNTERS; i++) {
+    if (sum->counters[i] > 0) {
+      fprintf(out, "%s %llu\n", COUNTER_NAMES[i], (unsigned long long) sum->counters[i]);
+    }
+  }
+  for (i = 0; i < H_HISTOGRAMS; i++) {
+    struct histogram *h = &sum->histograms[i];
+
+    if (h->count == 0) continue;
+    fprintf(out, "%s count %llu mean %.0f p50 %llu p90 %llu p99 %llu max %llu\n", HISTOGRAM_NAMES[i],
+      (unsigned long long) h->count, (double) h->sum / h->count, (unsigned long long) quantile(h, 0.5),
+      (unsigned long long) quantile(h, 0.9), (unsigned long long) quantile(h, 0.99),
+      (unsigned long long) h->max);
+  }
+  for (i = 0; i < G_GAUGES; i++) {
+    double value;
+
+    if (LOAD(GAUGE_SET[i])) {
+      __atomic_load(&GAUGES[i], &value, __ATOMIC_RELAXED);
+      fprintf(out, "%s %.10g\n", GAUGE_NAMES[i], value);
+    }
+  }
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    fprintf(out, "peak_rss_kb %ld\n", usage.ru_maxrss);
+  }
+  free(sum);
+}
+
+static void *metrics_server(void *arg) {
+  int sock = (int) (intptr_t) arg;
+  int client;
+  char *dump;
+  size_t length;
+  FILE *out;
+
+  while (1) {
+    if ((client = accept(sock, NULL, NULL)) < 0) {
+      /* Out of file descriptors (EMFILE, ENFILE) the connection stays */
+      /* queued and accept fails again at once: wait for some to close */
+      if (errno != EINTR && errno != ECONNABORTED) {
+        usleep(100000);
+      }
+      continue;
+    }
+
+    /* Built in memory and sent whole, so every sum is taken before */
+    /* waiting on a slow client */
+    if ((out = open_memstream(&dump, &length)) != NULL) {
+      MetricsWrite(out);
+      fclose(out);
+      SendAll(client, dump, length);
+      free(dump);
+    }
+    close(client);
+  }
+  return NULL;
+}
+
+int MetricsServe(const char *port) {
+  pthread_t tid;
+  int sock;
+
+  if ((sock = ListenOn(port, 16)) < 0) {
+    return -1;
+  }
+  if (pthread_create(&tid, NULL, metrics_server, (void *) (intptr_t) sock) != 0) {
+    close(sock);
+    return -1;
+  }
+  pthread_detach(tid);
+  return 0;
+}
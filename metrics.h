@@ -0,0 +1,89 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Counters, histograms and gauges for the driver, workers and reducer.
+ *
+ * Counters and histograms are updated in the hot path, so every thread
+ * keeps its own copy and writes it without locks or atomic
+ * read-modify-writes. They are only summed when someone asks, through
+ * MetricsWrite or the stats port; a thread's copy is folded into a
+ * shared total when it exits. Gauges are single values, set by whichever
+ * thread knows the current figure. Each node touches only the metrics
+ * that apply to it and the dump leaves out the others. */
+
+enum {
+  M_BYTES_IN,         /* chunk or result bytes received */
+  M_BYTES_OUT,        /* chunk or result bytes sent */
+  M_FRAMES_IN,
+  M_FRAMES_OUT,
+  M_CHUNKS,           /* chunks counted (worker) or completed (driver) */
+  M_CHUNKS_DROPPED,   /* cancelled or aborted copies */
+  M_ENTRIES_MERGED,   /* result entries added to the reducer's counts */
+  M_FLUSHES,          /* times a worker sent its counts to the reducers */
+  M_COUNTERS
+};
+
+/* histograms; the times are in nanoseconds */
+enum {
+  H_RECV,             /* receiving one chunk or result frame */
+  H_TOKENIZE,         /* tokenizing and counting one map block */
+  H_COUNT,            /* counting one chunk, over all map threads */
+  H_COMMIT,           /* folding a committed chunk into the job counts */
+  H_ENCODE,           /* encoding the results of a flush */
+  H_SEND,             /* sending a chunk or the results of a flush */
+  H_MERGE,            /* merging thread counts (worker) or a frame (reducer) */
+  H_CHUNK,            /* a chunk from assignment to DONE (driver) */
+  H_HISTOGRAMS
+};
+
+enum {
+  G_DICT_KEYS,        /* distinct keys held */
+  G_DICT_BYTES,       /* bytes held by the counts */
+  G_QUEUE,            /* results waiting for a merge thread (reducer), */
+                      /* splits not yet handed out (driver) */
+  G_PARKED,           /* connections waiting for buffer memory */
+  G_BUFFERED,         /* result bytes buffered */
+  G_PENDING,          /* splits not yet committed */
+  G_PROBE_MEAN,       /* mean and longest distance of a key from its home */
+  G_PROBE_MAX,        /* slot, in a sampled table of counts */
+  G_GAUGES
+};
+
+#define METRICS_BUCKETS 256     /* 4 buckets per power of two, ~19% wide */
+
+/* Log levels for what goes to stdout; errors always go to stderr */
+#define LOG_QUIET 0     /* results only */
+#define LOG_INFO  1     /* once per job or connection */
+#define LOG_DEBUG 2     /* once per chunk or frame */
+
+extern int LOG_LEVEL;
+
+#define Log(level, ...) \
+  do { if ((level) <= LOG_LEVEL) fprintf(stdout, __VA_ARGS__); } while (0)
+
+/* add n to a counter */
+void MetricsCount(int counter, uint64_t n);
+
+/* record one value in a histogram */
+void MetricsRecord(int histogram, uint64_t value);
+
+void MetricsGauge(int gauge, double value);
+
+/* monotonic nanoseconds, for timing a stage */
+uint64_t MetricsNow(void);
+
+/* called before every dump, to refresh gauges that are cheaper to */
+/* compute when asked than to keep up to date */
+void MetricsOnDump(void (*collect)(void));
+
+/* write every metric that has been touched, one per line */
+void MetricsWrite(FILE *out);
+
+/* serve MetricsWrite on port from a background thread: each connection */
+/* gets a dump and is closed. Returns 0, or -1 if it cannot listen */
+int MetricsServe(const char *port);
+
+#endif
@@ -0,0 +1,767 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "dict.h"
+#include "codec.h"
+#include "postings.h"
+
+/* One key's documents, encoded as in postings.h */
+struct list {
+    union {
+        unsigned char *heap;
+        unsigned char bytes[POSTINGS_INLINE];
+    } u;
+    uint32_t size;              /* bytes used */
+    uint32_t capacity;          /* bytes allocated, 0 while they fit inline */
+    uint32_t count;
+    uint32_t last;              /* largest document */
+};
+
+struct postings {
+    Dict keys;                  /* key -> its index in lists, plus one */
+    struct list *lists;
+    size_t n;
+    size_t size;
+    uint64_t postings;
+    size_t heap;                /* bytes allocated for lists that left inline */
+};
+
+Postings
+PostingsCreate(void)
+{
+    Postings p = calloc(1, sizeof(*p));
+
+    assert(p != 0);
+    p->keys = DictCreate();
+
+    return p;
+}
+
+static void
+free_lists(Postings p)
+{
+    size_t i;
+
+    for(i = 0; i < p->n; i++) {
+        if(p->lists[i].capacity > 0) free(p->lists[i].u.heap);
+    }
+}
+
+void
+PostingsDestroy(Postings p)
+{
+    free_lists(p);
+    free(p->lists);
+    DictDestroy(p->keys);
+    free(p);
+}
+
+void
+PostingsReset(Postings p)
+{
+    free_lists(p);
+    DictDestroy(p->keys);
+    p->keys = DictCreate();
+    p->n = 0;
+    p->postings = 0;
+    p->heap = 0;
+}
+
+size_t
+PostingsSize(Postings p)
+{
+    return p->n;
+}
+
+uint64_t
+PostingsCount(Postings p)
+{
+    return p->postings;
+}
+
+size_t
+PostingsMemory(Postings p)
+{
+    return sizeof(*p) + DictMemory(p->keys) + p->size * sizeof(struct list) + p->heap;
+}
+
+static unsigned char *
+list_data(struct list *l)
+{
+    return l->capacity > 0 ? l->u.heap : l->u.bytes;
+}
+
+/* the list of key, created empty if there is none */
+static struct list *
+list_of(Postings p, const char *key, unsigned int len)
+{
+    int *index = DictIncrementLen(p->keys, key, len, 0);
+
+    if(*index == 0) {
+        if(p->n == p->size) {
+            p->size = p->size * 2 + 1024;
+            p->lists = realloc(p->lists, p->size * sizeof(struct list));
+            assert(p->lists != 0);
+        }
+        memset(&p->lists[p->n], 0, sizeof(struct list));
+        *index = ++p->n;
+    }
+
+    return &p->lists[*index - 1];
+}
+
+/* make room for extra more bytes, doubling */
+static unsigned char *
+reserve(Postings p, struct list *l, size_t extra)
+{
+    size_t need = l->size + extra;
+    size_t capacity = l->capacity > 0 ? l->capacity : POSTINGS_INLINE;
+    unsigned char *heap;
+
+    if(need <= capacity) return list_data(l) + l->size;
+
+    capacity = capacity * 2 > need ? capacity * 2 : need;
+    if(l->capacity > 0) {
+        heap = realloc(l->u.heap, capacity);
+        assert(heap != 0);
+    } else {
+        heap = malloc(capacity);
+        assert(heap != 0);
+        memcpy(heap, l->u.bytes, l->size);
+    }
+    p->heap += capacity - l->capacity;
+    l->u.heap = heap;
+    l->capacity = capacity;
+
+    return heap + l->size;
+}
+
+/* add a document after every one l holds */
+static void
+append(Postings p, struct list *l, uint32_t doc)
+{
+    uint32_t v = l->count > 0 ? doc - l->last : doc;
+    unsigned char *out = reserve(p, l, VarintSize(v));
+
+    l->size += VarintPut(out, v) - out;
+    l->count++;
+    l->last = doc;
+    p->postings++;
+}
+
+static uint32_t *
+decode(struct posting_list *l)
+{
+    uint32_t *docs = malloc((l->count + 1) * sizeof(uint32_t));
+    uint32_t i;
+
+    assert(docs != 0);
+    for(i = 0; PostingNext(l, &docs[i]) > 0; i++);
+
+    return docs;
+}
+
+/* rebuild l from its documents and count documents of [data, end), */
+/* in order and without repeats; src has been checked */
+static void
+merge(Postings p, struct list *l, const unsigned char *data, const unsigned char *end, uint32_t count)
+{
+    struct posting_list ra, rb;
+    uint32_t *a, *b;
+    uint32_t i = 0, j = 0, na = l->count;
+
+    PostingListInit(&ra, list_data(l), list_data(l) + l->size, l->count);
+    PostingListInit(&rb, data, end, count);
+    a = decode(&ra);
+    b = decode(&rb);
+
+    p->postings -= l->count;
+    l->size = 0;
+    l->count = 0;
+    while(i < na || j < count) {
+        if(j == count || (i < na && a[i] < b[j])) {
+            append(p, l, a[i++]);
+        } else {
+            if(i < na && a[i] == b[j]) i++;
+            append(p, l, b[j++]);
+        }
+    }
+
+    free(a);
+    free(b);
+}
+
+void
+PostingsAdd(Postings p, const char *key, unsigned int len, uint32_t doc)
+{
+    struct list *l = list_of(p, key, len);
+    unsigned char one[10];
+
+    if(l->count == 0 || doc > l->last) {
+        append(p, l, doc);
+    } else if(doc < l->last) {
+        /* out of order, as when a chunk was retried: rare */
+        merge(p, l, one, VarintPut(one, doc), 1);
+    }
+}
+
+/* add count documents of [data, end) ending in last, to the list of key; */
+/* the documents have been checked to be in order */
+static void
+add_list(Postings p, const char *key, unsigned int len, const unsigned char *data, const unsigned char *end,
+         uint32_t count, uint32_t last)
+{
+    struct list *l = list_of(p, key, len);
+    struct posting_list r;
+    uint32_t first, v;
+    unsigned char *out;
+
+    PostingListInit(&r, data, end, count);
+    PostingNext(&r, &first);
+
+    if(l->count > 0 && first <= l->last) {
+        merge(p, l, data, end, count);
+        return;
+    }
+
+    /* the list carries on from l: only its first document is re-encoded */
+    v = l->count > 0 ? first - l->last : first;
+    out = reserve(p, l, VarintSize(v) + (end - r.p));
+    out = VarintPut(out, v);
+    memcpy(out, r.p, end - r.p);
+    l->size = out + (end - r.p) - list_data(l);
+    l->count += count;
+    l->last = last;
+    p->postings += count;
+}
+
+struct absorb {
+    Postings dst;
+    Postings src;
+};
+
+static void
+absorb_entry(const char *key, unsigned int len, int value, void *arg)
+{
+    struct absorb *a = arg;
+    struct list *l = &a->src->lists[value - 1];
+    unsigned char *data = list_data(l);
+
+    add_list(a->dst, key, len, data, data + l->size, l->count, l->last);
+}
+
+void
+PostingsAbsorb(Postings dst, Postings src)
+{
+    struct absorb a;
+
+    a.dst = dst;
+    a.src = src;
+    DictForEach(src->keys, absorb_entry, &a);
+    PostingsReset(src);
+}
+
+void
+PostingListInit(struct posting_list *l, const void *p, const void *end, uint32_t count)
+{
+    l->p = p;
+    l->end = end;
+    l->count = count;
+    l->remaining = count;
+    l->doc = 0;
+}
+
+int
+PostingNext(struct posting_list *l, uint32_t *doc)
+{
+    uint64_t v;
+
+    if(l->remaining == 0) return 0;
+    if(!VarintGet(&l->p, l->end, &v)) return -1;
+
+    /* after the first, documents strictly increase */
+    if(l->remaining < l->count) {
+        if(v == 0 || v > UINT32_MAX - l->doc) return -1;
+        v += l->doc;
+    } else if(v > UINT32_MAX) {
+        return -1;
+    }
+    l->doc = (uint32_t) v;
+    l->remaining--;
+    *doc = l->doc;
+
+    return 1;
+}
+
+struct each {
+    Postings p;
+    void (*fn)(const char *key, unsigned int len, struct posting_list *l, void *arg);
+    void *arg;
+};
+
+static void
+each_entry(const char *key, unsigned int len, int value, void *arg)
+{
+    struct each *e = arg;
+    struct list *l = &e->p->lists[value - 1];
+    struct posting_list r;
+
+    PostingListInit(&r, list_data(l), list_data(l) + l->size, l->count);
+    e->fn(key, len, &r, e->arg);
+}
+
+void
+PostingsForEach(Postings p, void (*fn)(const char *key, unsigned int len, struct posting_list *l, void *arg),
+                void *arg)
+{
+    struct each e = { p, fn, arg };
+
+    DictForEach(p->keys, each_entry, &e);
+}
+
+void
+PostingsForEachSorted(Postings p, void (*fn)(const char *key, unsigned int len, struct posting_list *l, void *arg),
+                      void *arg)
+{
+    struct each e = { p, fn, arg };
+
+    DictForEachSorted(p->keys, each_entry, &e);
+}
+
+struct encoding {
+    Postings p;
+    int parts;
+    int *part;                  /* of each list */
+    size_t *counts;
+    size_t *lengths;
+    unsigned char **out;
+};
+
+static void
+size_entry(const char *key, unsigned int len, int value, void *arg)
+{
+    struct encoding *e = arg;
+    struct list *l = &e->p->lists[value - 1];
+    int part = KeyPartition(key, len, e->parts);
+
+    e->part[value - 1] = part;
+    e->counts[part]++;
+    e->lengths[part] += VarintSize(len) + len + VarintSize(l->count) + VarintSize(l->size) + l->size;
+}
+
+static void
+encode_entry(const char *key, unsigned int len, int value, void *arg)
+{
+    struct encoding *e = arg;
+    struct list *l = &e->p->lists[value - 1];
+    unsigned char **out = &e->out[e->part[value - 1]];
+
+    *out = VarintPut(*out, len);
+    memcpy(*out, key, len);
+    *out += len;
+    *out = VarintPut(*out, l->count);
+    *out = VarintPut(*out, l->size);
+    memcpy(*out, list_data(l), l->size);
+    *out += l->size;
+}
+
+int
+PostingsEncodePartitioned(Postings p, int parts, char *buffers[], size_t lengths[])
+{
+    struct encoding e;
+    int i;
+
+    for(i = 0; i < parts; i++) buffers[i] = 0;
+
+    e.p = p;
+    e.parts = parts;
+    e.part = malloc((p->n + 1) * sizeof(int));
+    e.counts = calloc(parts, sizeof(size_t));
+    e.lengths = lengths;
+    e.out = calloc(parts, sizeof(unsigned char *));
+
+    if(e.part == 0 || e.counts == 0 || e.out == 0) goto fail;
+
+    /* sizing pass, then one allocation of exactly the right size each */
+    for(i = 0; i < parts; i++) lengths[i] = 1;
+    DictForEach(p->keys, size_entry, &e);
+    for(i = 0; i < parts; i++) {
+        lengths[i] += VarintSize(e.counts[i]);
+        if((buffers[i] = malloc(lengths[i])) == 0) goto fail;
+
+        e.out[i] = (unsigned char *) buffers[i];
+        *e.out[i]++ = POSTINGS_VERSION;
+        e.out[i] = VarintPut(e.out[i], e.counts[i]);
+    }
+    DictForEach(p->keys, encode_entry, &e);
+
+    free(e.part);
+    free(e.counts);
+    free(e.out);
+    return 0;
+
+fail:
+    for(i = 0; i < parts; i++) {
+        free(buffers[i]);
+        buffers[i] = 0;
+    }
+    free(e.part);
+    free(e.counts);
+    free(e.out);
+    return -1;
+}
+
+/* One key of an encoding */
+struct encoded_list {
+    const unsigned char *key;
+    uint64_t len;
+    const unsigned char *list;
+    uint64_t size;
+    uint32_t count;
+    uint32_t last;
+};
+
+/* read the entry at *in and check its list; returns 0 if malformed */
+static int
+read_entry(const unsigned char **in, const unsigned char *end, struct encoded_list *e)
+{
+    struct posting_list r;
+    uint64_t count;
+    uint32_t doc;
+    int status;
+
+    if(!VarintGet(in, end, &e->len) || e->len > (uint64_t) (end - *in)) return 0;
+    e->key = *in;
+    *in += e->len;
+    if(!VarintGet(in, end, &count) || !VarintGet(in, end, &e->size) ||
+       count == 0 || count > UINT32_MAX || e->size > (uint64_t) (end - *in)) {
+        return 0;
+    }
+    e->list = *in;
+    e->count = count;
+    *in += e->size;
+
+    PostingListInit(&r, e->list, *in, e->count);
+    while((status = PostingNext(&r, &doc)) > 0);
+    e->last = r.doc;
+
+    return status == 0 && r.p == *in;
+}
+
+/* read and check a whole encoding into a new array of its entries; */
+/* returns their number, or -1 if it is malformed */
+static long
+read_encoding(const void *buffer, size_t length, struct encoded_list **entries)
+{
+    const unsigned char *in = buffer, *end = in + length;
+    uint64_t keys, i;
+
+    *entries = 0;
+    if(length < 1 || *in++ != POSTINGS_VERSION) return -1;
+
+    /* every entry takes at least four bytes, which bounds a bogus count */
+    if(!VarintGet(&in, end, &keys) || keys > length / 4) return -1;
+
+    *entries = malloc((keys + 1) * sizeof(struct encoded_list));
+    assert(*entries != 0);
+    for(i = 0; i < keys; i++) {
+        if(!read_entry(&in, end, &(*entries)[i])) break;
+    }
+    if(i < keys || in != end) {
+        free(*entries);
+        *entries = 0;
+        return -1;
+    }
+
+    return (long) keys;
+}
+
+static void
+add_entries(Postings p, struct encoded_list *e, size_t n)
+{
+    size_t i;
+
+    for(i = 0; i < n; i++) {
+        add_list(p, (const char *) e[i].key, e[i].len, e[i].list, e[i].list + e[i].size, e[i].count, e[i].last);
+    }
+}
+
+long
+PostingsMerge(Postings p, const void *buffer, size_t length)
+{
+    struct encoded_list *entries;
+    long n;
+
+    /* the whole encoding is checked before any of it goes in */
+    if((n = read_encoding(buffer, length, &entries)) < 0) return -1;
+    add_entries(p, entries, n);
+    free(entries);
+
+    return n;
+}
+
+struct postings_shard {
+    pthread_mutex_t lock;
+    Postings p;
+} __attribute__((aligned(64)));   /* keep locks on separate cache lines */
+
+struct sharded_postings {
+    int n;
+    struct postings_shard *shards;
+};
+
+ShardedPostings
+ShardedPostingsCreate(int nshards)
+{
+    ShardedPostings sp;
+    int i;
+
+    assert(nshards >= 1 && nshards <= POSTINGS_MAX_SHARDS);
+
+    sp = malloc(sizeof(*sp));
+    assert(sp != 0);
+
+    sp->n = nshards;
+    if(posix_memalign((void **) &sp->shards, 64, nshards * sizeof(struct postings_shard)) != 0) {
+        assert(0);
+    }
+
+    for(i = 0; i < nshards; i++) {
+        pthread_mutex_init(&sp->shards[i].lock, 0);
+        sp->shards[i].p = PostingsCreate();
+    }
+
+    return sp;
+}
+
+void
+ShardedPostingsDestroy(ShardedPostings sp)
+{
+    int i;
+
+    for(i = 0; i < sp->n; i++) {
+        pthread_mutex_destroy(&sp->shards[i].lock);
+        PostingsDestroy(sp->shards[i].p);
+    }
+
+    free(sp->shards);
+    free(sp);
+}
+
+/* as shard.c picks the shard of a count */
+static int
+postings_shard_of(ShardedPostings sp, const unsigned char *key, unsigned int len)
+{
+    uint64_t h = DictHash((const char *) key, len);
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+
+    return (int) (((h >> 32) * (uint64_t) sp->n) >> 32);
+}
+
+long
+ShardedPostingsMerge(ShardedPostings sp, const void *buffer, size_t length)
+{
+    struct encoded_list *entries, *sorted;
+    unsigned short *which;
+    size_t *start;
+    char *done;
+    long n, i;
+    int s, left, progress;
+    static unsigned int rotor;
+
+    if((n = read_encoding(buffer, length, &entries)) < 0) return -1;
+
+    sorted = malloc((n + 1) * sizeof(struct encoded_list));
+    which = malloc((n + 1) * sizeof(unsigned short));
+    start = calloc(sp->n + 1, sizeof(size_t));
+    done = malloc(sp->n);
+    assert(sorted != 0 && which != 0 && start != 0 && done != 0);
+
+    /* counting sort by shard */
+    for(i = 0; i < n; i++) {
+        which[i] = postings_shard_of(sp, entries[i].key, entries[i].len);
+        start[which[i] + 1]++;
+    }
+    for(s = 0; s < sp->n; s++) start[s + 1] += start[s];
+    for(i = 0; i < n; i++) sorted[start[which[i]]++] = entries[i];
+    for(s = sp->n; s > 0; s--) start[s] = start[s - 1];
+    start[0] = 0;
+
+    /* take each shard's lock once, free shards first, as */
+    /* ShardedDictMerge does */
+    for(left = 0, s = 0; s < sp->n; s++) {
+        done[s] = start[s + 1] == start[s];
+        if(!done[s]) left++;
+    }
+
+    s = __atomic_fetch_add(&rotor, 1, __ATOMIC_RELAXED) % sp->n;
+
+    while(left > 0) {
+        progress = 0;
+
+        for(i = 0; i < sp->n; i++, s = (s + 1) % sp->n) {
+            if(done[s] || pthread_mutex_trylock(&sp->shards[s].lock) != 0) continue;
+
+            add_entries(sp->shards[s].p, sorted + start[s], start[s + 1] - start[s]);
+            pthread_mutex_unlock(&sp->shards[s].lock);
+            done[s] = 1;
+            left--;
+            progress = 1;
+        }
+
+        if(progress || left == 0) continue;
+
+        /* everything left is busy: wait for the next one */
+        while(done[s]) s = (s + 1) % sp->n;
+
+        pthread_mutex_lock(&sp->shards[s].lock);
+        add_entries(sp->shards[s].p, sorted + start[s], start[s + 1] - start[s]);
+        pthread_mutex_unlock(&sp->shards[s].lock);
+
+        done[s] = 1;
+        left--;
+    }
+
+    free(entries);
+    free(sorted);
+    free(which);
+    free(start);
+    free(done);
+
+    return n;
+}
+
+size_t
+ShardedPostingsSize(ShardedPostings sp)
+{
+    size_t total = 0;
+    int i;
+
+    for(i = 0; i < sp->n; i++) {
+        pthread_mutex_lock(&sp->shards[i].lock);
+        total += PostingsSize(sp->shards[i].p);
+        pthread_mutex_unlock(&sp->shards[i].lock);
+    }
+
+    return total;
+}
+
+uint64_t
+ShardedPostingsCount(ShardedPostings sp)
+{
+    uint64_t total = 0;
+    int i;
+
+    for(i = 0; i < sp->n; i++) {
+        pthread_mutex_lock(&sp->shards[i].lock);
+        total += PostingsCount(sp->shards[i].p);
+        pthread_mutex_unlock(&sp->shards[i].lock);
+    }
+
+    return total;
+}
+
+size_t
+ShardedPostingsMemory(ShardedPostings sp)
+{
+    size_t total = sizeof(*sp) + sp->n * sizeof(struct postings_shard);
+    int i;
+
+    for(i = 0; i < sp->n; i++) {
+        pthread_mutex_lock(&sp->shards[i].lock);
+        total += PostingsMemory(sp->shards[i].p);
+        pthread_mutex_unlock(&sp->shards[i].lock);
+    }
+
+    return total;
+}
+
+void
+ShardedPostingsForEach(ShardedPostings sp,
+                       void (*fn)(const char *key, unsigned int len, struct posting_list *l, void *arg), void *arg)
+{
+    int i;
+
+    for(i = 0; i < sp->n; i++) {
+        pthread_mutex_lock(&sp->shards[i].lock);
+        PostingsForEach(sp->shards[i].p, fn, arg);
+        pthread_mutex_unlock(&sp->shards[i].lock);
+    }
+}
+
+struct sorted_list {
+    const char *key;
+    unsigned int len;
+    struct posting_list l;
+};
+
+struct sorted_lists {
+    struct sorted_list *lists;
+    size_t n;
+};
+
+static void
+collect_list(const char *key, unsigned int len, struct posting_list *l, void *arg)
+{
+    struct sorted_lists *sl = arg;
+
+    sl->lists[sl->n].key = key;
+    sl->lists[sl->n].len = len;
+    sl->lists[sl->n].l = *l;
+    sl->n++;
+}
+
+static int
+compare_lists(const void *a, const void *b)
+{
+    const struct sorted_list *x = a, *y = b;
+    int c = memcmp(x->key, y->key, x->len < y->len ? x->len : y->len);
+
+    return c != 0 ? c : (x->len > y->len) - (x->len < y->len);
+}
+
+void
+ShardedPostingsForEachSorted(ShardedPostings sp,
+                             void (*fn)(const char *key, unsigned int len, struct posting_list *l, void *arg),
+                             void *arg)
+{
+    struct sorted_lists sl;
+    size_t total = 0, i;
+    int s;
+
+    /* the shards are hashed: gather every list, with all of them */
+    /* locked so the readers stay valid, and sort */
+    for(s = 0; s < sp->n; s++) {
+        pthread_mutex_lock(&sp->shards[s].lock);
+        total += PostingsSize(sp->shards[s].p);
+    }
+
+    sl.lists = malloc((total + 1) * sizeof(struct sorted_list));
+    assert(sl.lists != 0);
+    sl.n = 0;
+    for(s = 0; s < sp->n; s++) PostingsForEach(sp->shards[s].p, collect_list, &sl);
+    qsort(sl.lists, sl.n, sizeof(struct sorted_list), compare_lists);
+
+    for(i = 0; i < sl.n; i++) fn(sl.lists[i].key, sl.lists[i].len, &sl.lists[i].l, arg);
+
+    for(s = 0; s < sp->n; s++) pthread_mutex_unlock(&sp->shards[s].lock);
+    free(sl.lists);
+}
+
+void
+ShardedPostingsReset(ShardedPostings sp)
+{
+    int i;
+
+    for(i = 0; i < sp->n; i++) {
+        pthread_mutex_lock(&sp->shards[i].lock);
+        PostingsReset(sp->shards[i].p);
+        pthread_mutex_unlock(&sp->shards[i].lock);
+    }
+}
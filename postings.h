@@ -0,0 +1,122 @@
+#ifndef POSTINGS_H
+#define POSTINGS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "codec.h"
+
+/* Posting lists of an inverted index: for every key, the documents it
+ * occurs in.
+ *
+ * A document is a chunk of the job (its sequence number, which is the
+ * index of its split), so the chunk size chosen for the driver is the
+ * granularity of the index. Each list is kept in ascending document
+ * order, without repeats, as the encoding below: the first document,
+ * then the gap to each following one, as varints. A key occurring in
+ * nearby chunks costs one byte per posting, plus its entry: the key, a
+ * Dict slot and a 24-byte list header, 80 to 120 bytes for a short word.
+ * Lists of up to POSTINGS_INLINE bytes need no allocation of their own. */
+
+#define POSTINGS_INLINE 8
+
+typedef struct postings *Postings;
+
+Postings PostingsCreate(void);
+
+void PostingsDestroy(Postings);
+
+/* note that key occurs in document doc */
+void PostingsAdd(Postings, const char *key, unsigned int len, uint32_t doc);
+
+/* move every posting of src into dst, and empty src */
+void PostingsAbsorb(Postings dst, Postings src);
+
+/* number of keys */
+size_t PostingsSize(Postings);
+
+/* number of postings, over all keys */
+uint64_t PostingsCount(Postings);
+
+/* bytes of heap memory held */
+size_t PostingsMemory(Postings);
+
+/* forget everything */
+void PostingsReset(Postings);
+
+/* Reader of one encoded list, in place */
+struct posting_list {
+    const unsigned char *p;     /* next varint */
+    const unsigned char *end;
+    uint32_t count;             /* documents in the list */
+    uint32_t remaining;         /* not yet returned */
+    uint32_t doc;               /* last returned */
+};
+
+/* read count documents encoded in [p, end) */
+void PostingListInit(struct posting_list *l, const void *p, const void *end, uint32_t count);
+
+/* return the next document: 1 on success, 0 at the end, -1 if corrupt */
+int PostingNext(struct posting_list *l, uint32_t *doc);
+
+/* call fn on every key with a reader of its list, in no particular */
+/* order or, for the sorted variant, in ascending byte order of the keys */
+void PostingsForEach(Postings, void (*fn)(const char *key, unsigned int len, struct posting_list *l, void *arg), void *arg);
+void PostingsForEachSorted(Postings, void (*fn)(const char *key, unsigned int len, struct posting_list *l, void *arg), void *arg);
+
+/* Encoding, for worker -> reducer postings:
+ *
+ *   byte     format version (POSTINGS_VERSION)
+ *   varint   number of keys
+ *   entries:
+ *     varint   length of the key
+ *     bytes    key
+ *     varint   number of documents
+ *     varint   length of the list
+ *     bytes    the list
+ *
+ * with varints as in codec.h. A list that starts after the one already
+ * held for its key is appended as it is; others are merged. */
+
+#define POSTINGS_VERSION 1
+
+/* encode the lists as parts buffers, key k going to buffer */
+/* KeyPartition(k, parts); returns 0, or -1 if out of memory (with no */
+/* buffers left allocated) */
+int PostingsEncodePartitioned(Postings, int parts, char *buffers[], size_t lengths[]);
+
+/* add every posting of an encoding; returns the number of keys, or -1 */
+/* if it is malformed, in which case nothing has been added */
+long PostingsMerge(Postings, const void *buffer, size_t length);
+
+/* Posting lists split into independently locked shards by key hash, as
+ * the reducer's counts are (shard.h), so that several merge threads add
+ * workers' lists at once. A merge checks the whole encoding, sorts its
+ * keys by shard and takes every shard lock once, free shards first. */
+
+#define POSTINGS_MAX_SHARDS 1024
+
+typedef struct sharded_postings *ShardedPostings;
+
+/* create nshards (1 to POSTINGS_MAX_SHARDS) empty shards */
+ShardedPostings ShardedPostingsCreate(int nshards);
+
+void ShardedPostingsDestroy(ShardedPostings);
+
+/* as PostingsMerge, into the shards */
+long ShardedPostingsMerge(ShardedPostings, const void *buffer, size_t length);
+
+/* totals over all shards, each locked in turn */
+size_t ShardedPostingsSize(ShardedPostings);
+uint64_t ShardedPostingsCount(ShardedPostings);
+size_t ShardedPostingsMemory(ShardedPostings);
+
+/* call fn on every key, shard by shard with each locked in turn or, for */
+/* the sorted variant, in ascending byte order with all of them locked */
+void ShardedPostingsForEach(ShardedPostings, void (*fn)(const char *key, unsigned int len, struct posting_list *l, void *arg), void *arg);
+void ShardedPostingsForEachSorted(ShardedPostings, void (*fn)(const char *key, unsigned int len, struct posting_list *l, void *arg), void *arg);
+
+/* empty every shard */
+void ShardedPostingsReset(ShardedPostings);
+
+#endif
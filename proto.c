@@ -0,0 +1,194 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/sendfile.h>
+
+#include "proto.h"
+
+int SendAll(int sock, const void *buffer, size_t length) {
+  const char *ptr = buffer;
+
+  while (length > 0) {
+    ssize_t i = send(sock, ptr, length, MSG_NOSIGNAL);
+    if (i < 0 && errno == EINTR) continue;
+    if (i < 1) return -1;
+    ptr += i;
+    length -= i;
+  }
+  return 1;
+}
+
+int RecvAll(int sock, void *buffer, size_t length) {
+  char *ptr = buffer;
+
+  while (length > 0) {
+    ssize_t i = recv(sock, ptr, length, 0);
+    if (i < 0 && errno == EINTR) continue;
+    if (i < 0) return -1;
+    /* EOF is only clean if nothing of this message has arrived yet */
+    if (i == 0) return ptr == buffer ? 0 : -1;
+    ptr += i;
+    length -= i;
+  }
+  return 1;
+}
+
+void EncodeFrameHeader(char *raw, uint32_t type, uint32_t seq, uint64_t length) {
+  uint32_t type_n = htonl(type);
+  uint32_t seq_n = htonl(seq);
+  uint64_t length_n = htobe64(length);
+
+  memcpy(raw, &type_n, 4);
+  memcpy(raw + 4, &seq_n, 4);
+  memcpy(raw + 8, &length_n, 8);
+}
+
+int SendFrameHeader(int sock, uint32_t type, uint32_t seq, uint64_t length) {
+  char raw[FRAME_HEADER_SIZE];
+
+  EncodeFrameHeader(raw, type, seq, length);
+  return SendAll(sock, raw, FRAME_HEADER_SIZE);
+}
+
+int SendFrame(int sock, uint32_t type, uint32_t seq, const void *payload, uint64_t length) {
+  int status;
+
+  if ((status = SendFrameHeader(sock, type, seq, length)) < 1) return status;
+  if (length == 0) return 1;
+  return SendAll(sock, payload, length);
+}
+
+int SendFrameFromFile(int sock, uint32_t type, uint32_t seq, int fd, uint64_t offset, uint64_t length) {
+  off_t pos = offset;
+  int status;
+
+  if ((status = SendFrameHeader(sock, type, seq, length)) < 1) return status;
+
+  while (length > 0) {
+    ssize_t i = sendfile(sock, fd, &pos, length);
+    if (i < 0 && errno == EINTR) continue;
+    if (i < 1) return -1;
+    length -= i;
+  }
+  return 1;
+}
+
+int RecvFrameHeader(int sock, struct frame_header *header) {
+  char raw[FRAME_HEADER_SIZE];
+  int status;
+
+  if ((status = RecvAll(sock, raw, FRAME_HEADER_SIZE)) < 1) return status;
+  return DecodeFrameHeader(raw, header);
+}
+
+int DecodeFrameHeader(const char *raw, struct frame_header *header) {
+  uint32_t type_n, seq_n;
+  uint64_t length_n;
+
+  memcpy(&type_n, raw, 4);
+  memcpy(&seq_n, raw + 4, 4);
+  memcpy(&length_n, raw + 8, 8);
+
+  header->type = ntohl(type_n);
+  header->seq = ntohl(seq_n);
+  header->length = be64toh(length_n);
+
+  if (header->length > MAX_FRAME_LENGTH) return -1;
+  return 1;
+}
+
+int ConnectTo(const char *ip_addr, const char *port) {
+  int sock;
+  int on = 1;
+  struct sockaddr_in server;
+
+  /* Create the TCP socket */
+  if ((sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
+    return -1;
+  }
+
+  /* Construct the server sockaddr_in structure */
+  memset(&server, 0, sizeof(server));           /* Clear struct */
+  server.sin_family = AF_INET;                  /* Internet/IP */
+  server.sin_addr.s_addr = inet_addr(ip_addr);  /* IP address */
+  server.sin_port = htons(atoi(port));          /* server port */
+
+  /* Establish connection */
+  if (connect(sock, (struct sockaddr *) &server, sizeof(server)) < 0) {
+    close(sock);
+    return -1;
+  }
+  /* Frames are often tiny (DONE, COMMIT); don't let Nagle hold them back */
+  setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  return sock;
+}
+
+int ListenOn(const char *port, int backlog) {
+  int sock;
+  int on = 1;
+  struct sockaddr_in server;
+
+  /* Create the TCP socket */
+  if ((sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
+    return -1;
+  }
+  /* Allow restarting on a port that still has connections in TIME_WAIT */
+  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  /* Accepted connections inherit TCP_NODELAY from the listening socket */
+  setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+  /* Construct the server sockaddr_in structure */
+  memset(&server, 0, sizeof(server));           /* Clear struct */
+  server.sin_family = AF_INET;                  /* Internet/IP */
+  server.sin_addr.s_addr = htonl(INADDR_ANY);   /* Incoming addr */
+  server.sin_port = htons(atoi(port));          /* server port */
+
+  /* Bind and listen on the server socket */
+  if (bind(sock, (struct sockaddr *) &server, sizeof(server)) < 0 ||
+      listen(sock, backlog) < 0) {
+    close(sock);
+    return -1;
+  }
+  return sock;
+}
+
+int ParseAddressList(const char *spec, char *ips[], char *ports[], int max) {
+  char *copy = strdup(spec);
+  char *entry, *colon, *saveptr;
+  int n = 0;
+
+  if (copy == NULL) return -1;
+
+  for (entry = strtok_r(copy, ",", &saveptr); entry != NULL; entry = strtok_r(NULL, ",", &saveptr)) {
+    if (n == max || (colon = strchr(entry, ':')) == NULL || colon[1] == '\0') {
+      n = -1;
+      break;
+    }
+    *colon = '\0';
+    ips[n] = strdup(entry);
+    ports[n] = strdup(colon + 1);
+    n++;
+  }
+
+  free(copy);
+  return n;
+}
+
+size_t ParseSize(const char *str) {
+  char *end;
+  unsigned long long size = strtoull(str, &end, 10);
+
+  switch (*end) {
+    case 'k': case 'K': size <<= 10; end++; break;
+    case 'm': case 'M': size <<= 20; end++; break;
+    case 'g': case 'G': size <<= 30; end++; break;
+  }
+  if (end == str || *end != '\0') return 0;
+  return (size_t) size;
+}
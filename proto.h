@@ -0,0 +1,70 @@
+#ifndef PROTO_H
+#define PROTO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Wire protocol shared by the driver, workers and reducer.
+ *
+ * Every message is a frame: a fixed 16-byte header followed by `length`
+ * bytes of payload. Header fields are sent in network byte order.
+ * Connections are persistent and carry any number of frames. */
+
+#define FRAME_CHUNK  1     /* driver -> worker: a split of the input */
+#define FRAME_END    2     /* driver -> worker, worker -> reducer: end of job or */
+                           /* of results; echoed back once everything is handled */
+#define FRAME_RESULT 3     /* worker -> reducer: an encoded dictionary */
+#define FRAME_DONE   4     /* worker -> driver: chunk seq counted, result held */
+#define FRAME_COMMIT 5     /* driver -> worker: ship the held result for seq */
+#define FRAME_ABORT  6     /* driver -> worker: drop the result for seq; may */
+                           /* arrive early to cancel a chunk still being counted */
+#define FRAME_SKETCH 7     /* worker -> reducer: an encoded top-K summary (topk.h) */
+#define FRAME_REGISTERS 8  /* worker -> reducer: HyperLogLog registers (hll.h) */
+#define FRAME_POSTINGS 9   /* worker -> reducer: encoded posting lists (postings.h) */
+#define FRAME_FLUSHED 10   /* worker -> driver: everything committed so far has */
+                           /* reached the reducers */
+
+#define FRAME_HEADER_SIZE 16
+#define MAX_FRAME_LENGTH (1UL << 30)    /* refuse payloads above 1 GB */
+
+struct frame_header {
+  uint32_t type;
+  uint32_t seq;       /* chunk sequence number, 0 when unused */
+  uint64_t length;    /* payload bytes following the header */
+};
+
+/* send or receive exactly length bytes, retrying short transfers */
+/* return 1 on success, 0 if the peer closed the connection, -1 on error */
+int SendAll(int sock, const void *buffer, size_t length);
+int RecvAll(int sock, void *buffer, size_t length);
+
+/* send a frame header, optionally followed by its payload */
+int SendFrameHeader(int sock, uint32_t type, uint32_t seq, uint64_t length);
+int SendFrame(int sock, uint32_t type, uint32_t seq, const void *payload, uint64_t length);
+
+/* send a frame whose payload is length bytes of file fd at offset, */
+/* moved from the page cache to the socket by sendfile(2) */
+int SendFrameFromFile(int sock, uint32_t type, uint32_t seq, int fd, uint64_t offset, uint64_t length);
+
+/* receive and validate a frame header; same return values as RecvAll */
+int RecvFrameHeader(int sock, struct frame_header *header);
+
+/* the FRAME_HEADER_SIZE bytes of a header, for callers doing their own */
+/* I/O; decoding returns 1, or -1 if the header is invalid */
+void EncodeFrameHeader(char *raw, uint32_t type, uint32_t seq, uint64_t length);
+int DecodeFrameHeader(const char *raw, struct frame_header *header);
+
+/* open a TCP connection to ip:port, or return -1 */
+int ConnectTo(const char *ip_addr, const char *port);
+
+/* bind and listen on port with SO_REUSEADDR set, or return -1 */
+int ListenOn(const char *port, int backlog);
+
+/* parse a comma-separated list of ip:port pairs into newly allocated */
+/* strings; returns the number of entries, or -1 if malformed */
+int ParseAddressList(const char *spec, char *ips[], char *ports[], int max);
+
+/* parse a size such as 65536, 512K or 16M; returns 0 if malformed */
+size_t ParseSize(const char *str);
+
+#endif
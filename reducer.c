@@ -1,4 +1,15 @@
 #include "dict.c"
+#include "proto.c"
+#include "metrics.c"
+#include "codec.c"
+#include "shard.c"
+#include "topk.c"
+#include "hll.c"
+#include "table.c"
+#include "postings.c"
+#include "index.c"
+#include "tokenize.c"
+#include "job.c"
 
 #include <stdio.h>
 #include <sys/socket.h>
@@ -13,174 +24,868 @@
 #include <string.h>
 #include <pthread.h>
 #include <signal.h>
-
-#define MAXPENDING 5    /* Max connection requests */
-#define BUFFSIZE 1024
+#include <stdint.h>
+#include <getopt.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+
+#define MAXPENDING 4096 /* Max connection requests */
+#define DEFAULT_SHARDS 64
+#define MAX_MERGE_THREADS 256
+#define DEFAULT_BUFFER_BUDGET (256UL << 20)
+#define MAX_EVENTS 256
+#define PROBE_BUCKETS 64
+#define USAGE "USAGE: reducer [-s shards] [-t merge_threads] [-m budget] [-j job] [-k top] [-o table_file] [-v | -q] [-M stats_port] <port>\n"
+
+/* A worker connection. Frames are read without blocking, a piece at a
+ * time as bytes arrive, and never past the end of the current frame. */
+struct conn {
+	int fd;
+	char raw[FRAME_HEADER_SIZE];    /* header being read */
+	size_t header_got;
+	struct frame_header header;
+	char * payload;                 /* result being read, then merged */
+	size_t payload_got;
+	long entries;                   /* merged from payload, set by the merge thread */
+	int merging;                    /* payload is with a merge thread */
+	int parked;                     /* waiting for buffer memory to read payload */
+	int dead;                       /* hung up while merging */
+	char out[FRAME_HEADER_SIZE];    /* END acknowledgement not yet sent */
+	size_t out_len;
+	uint32_t events;                /* what epoll is watching for */
+	struct conn * next;             /* in the merge queue, done list or wait list */
+};
 
 void Die(char * mess);
-void * HandleClient(void * sock);
-void UpdateDictionary(char * encoded_dict);
-void AddToDict(char * buf);
 void SigHandler(int signo);
-
-Dict WORD_DICT;
-pthread_mutex_t lock;
-
-int main(int argc, char * argv[]) 
+void PrintAndReset(void);
+void AcceptAll(int serversock);
+void ServeConn(struct conn * c, uint32_t events);
+void ReadConn(struct conn * c);
+void FlushOut(struct conn * c);
+void Watch(struct conn * c);
+void CloseConn(struct conn * c);
+int ReservePayload(struct conn * c);
+void ResumeParked(void);
+void StartMerge(struct conn * c);
+void FinishMerges(void);
+void * MergeThread(void * arg);
+long MergeSketch(const char * buffer, size_t length);
+long MergeRegisters(const char * buffer, size_t length);
+long MergePostings(const char * buffer, size_t length);
+void PrintTopK(void);
+void WriteTable(const char * path);
+void WriteIndex(const char * path);
+void CollectMetrics(void);
+
+ShardedDict WORD_DICT;
+int NUM_SHARDS;                 /* of WORD_DICT, and of POSTINGS */
+TopK SKETCH;                    /* merged top-K summaries, NULL until one arrives */
+HyperLogLog REGISTERS;          /* merged distinct-word registers, likewise */
+ShardedPostings POSTINGS;       /* merged posting lists, NULL until they arrive */
+pthread_mutex_t SKETCH_LOCK = PTHREAD_MUTEX_INITIALIZER;    /* guards all three */
+                                /* pointers; the lists have shard locks */
+int TOP_K;                      /* print only the TOP_K most frequent words, 0 = all */
+char * OUTPUT_PATH;             /* write the counts here as a sorted table, or the */
+                                /* posting lists as an index, instead of printing */
+volatile sig_atomic_t PRINT_REQUESTED;
+int EPOLL_FD, DONE_FD, LISTEN_FD;
+int LISTEN_PAUSED;              /* out of descriptors; accept again after a close */
+size_t BUFFER_BUDGET = DEFAULT_BUFFER_BUDGET;
+size_t BUFFERED;                /* payload bytes held; only the event loop touches it */
+struct conn * WAIT_HEAD, * WAIT_TAIL;   /* parked until BUFFERED drops */
+int PARKED;                     /* connections on that list */
+
+/* Results waiting for a merge thread, and merged ones waiting for the */
+/* event loop, which is woken through DONE_FD */
+struct merge_queue {
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+	struct conn * head, * tail;
+	int depth;                      /* results between head and tail */
+	struct conn * done;
+} QUEUE = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, 0, NULL };
+
+/* epoll tags for the two descriptors that are not connections */
+char LISTEN_TAG, DONE_TAG;
+
+int main(int argc, char * argv[])
 {
-	int serversock, clientsock;
-	struct sockaddr_in echoserver, echoclient;
+	struct sigaction sa;
+	struct epoll_event ev, events[MAX_EVENTS];
+	struct rlimit files;
+	sigset_t tstp, old_mask;
+	pthread_t tid;
+	int shards = DEFAULT_SHARDS;
+	int threads = sysconf(_SC_NPROCESSORS_ONLN);
+	char * stats_port = NULL;
+	const struct job * job = &WORD_COUNT_JOB;
+	int opt, n, i;
+
+	/* One merge thread per CPU by default */
+	if (threads > MAX_MERGE_THREADS) threads = MAX_MERGE_THREADS;
+
+	while ((opt = getopt(argc, argv, "s:t:m:j:k:o:vqM:")) != -1) {
+		switch (opt) {
+			case 's':
+				shards = atoi(optarg);
+				break;
+			case 't':
+				threads = atoi(optarg);
+				break;
+			case 'm':
+				if ((BUFFER_BUDGET = ParseSize(optarg)) == 0) {
+					fprintf(stderr, "Bad buffer budget: %s\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'j':
+				/* only for how its values combine */
+				if ((job = JobLoad(optarg)) == NULL) {
+					exit(1);
+				}
+				break;
+			case 'k':
+				if ((TOP_K = atoi(optarg)) < 1) {
+					fprintf(stderr, "Bad top-K size: %s\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'o':
+				OUTPUT_PATH = optarg;
+				break;
+			case 'v':
+				LOG_LEVEL++;
+				break;
+			case 'q':
+				LOG_LEVEL = LOG_QUIET;
+				break;
+			case 'M':
+				stats_port = optarg;
+				break;
+			default:
+				fprintf(stderr, USAGE);
+				exit(1);
+		}
+	}
 
-	if (argc != 2) {
-	  fprintf(stderr, "USAGE: reducer <port>\n");
+	if (argc - optind != 1 || shards < 1 || shards > MAX_SHARDS || threads < 1 || threads > MAX_MERGE_THREADS) {
+	  fprintf(stderr, USAGE);
 	  exit(1);
 	}
 
-	if (signal(SIGTSTP, SigHandler) == SIG_ERR) {
+	/* SIGTSTP only sets a flag. It is blocked everywhere except inside */
+	/* epoll_pwait, so the event loop prints between events, where taking */
+	/* the shard locks is safe; merge threads inherit the blocked mask */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = SigHandler;
+	if (sigaction(SIGTSTP, &sa, NULL) < 0) {
 		fprintf(stdout, "\nCan't catch signal.\n");
 	}
+	sigemptyset(&tstp);
+	sigaddset(&tstp, SIGTSTP);
+	pthread_sigmask(SIG_BLOCK, &tstp, &old_mask);
+
+	/* One descriptor per worker connection */
+	if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max) {
+		files.rlim_cur = files.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &files);
+	}
 
-	if (pthread_mutex_init(&lock, NULL)	!= 0) {
-		fprintf(stdout, "\n	Mutex init failed\n");
-		return 1;
+	/* Bind and listen on the server socket */
+	if ((LISTEN_FD = ListenOn(argv[optind], MAXPENDING)) < 0 ||
+	    fcntl(LISTEN_FD, F_SETFL, O_NONBLOCK) < 0) {
+		Die("Failed to listen on server socket");
 	}
 
-	/* Create the TCP socket */
-	if ((serversock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
-		Die("Failed to create socket");
+	/* Initialize word count dictionary */
+	NUM_SHARDS = shards;
+	WORD_DICT = ShardedDictCreate(shards);
+	ShardedDictSetCombine(WORD_DICT, job->combine);
+
+	/* The stats thread also inherits the blocked SIGTSTP */
+	MetricsOnDump(CollectMetrics);
+	if (stats_port != NULL && MetricsServe(stats_port) < 0) {
+		Die("Failed to listen on stats port");
 	}
-	/* Construct the server sockaddr_in structure */
-	memset(&echoserver, 0, sizeof(echoserver));       /* Clear struct */
-	echoserver.sin_family = AF_INET;                  /* Internet/IP */
-	echoserver.sin_addr.s_addr = htonl(INADDR_ANY);   /* Incoming addr */
-	echoserver.sin_port = htons(atoi(argv[1]));       /* server port */
 
-	/* Bind the server socket */
-	if (bind(serversock, (struct sockaddr *) &echoserver, sizeof(echoserver)) < 0) {
-		Die("Failed to bind the server socket");
+	if ((EPOLL_FD = epoll_create1(0)) < 0 || (DONE_FD = eventfd(0, EFD_NONBLOCK)) < 0) {
+		Die("Failed to create event loop");
 	}
-	/* Listen on the server socket */
-	if (listen(serversock, MAXPENDING) < 0) {
-		Die("Failed to listen on server socket");
+	ev.events = EPOLLIN;
+	ev.data.ptr = &LISTEN_TAG;
+	if (epoll_ctl(EPOLL_FD, EPOLL_CTL_ADD, LISTEN_FD, &ev) < 0) {
+		Die("Failed to watch server socket");
+	}
+	ev.data.ptr = &DONE_TAG;
+	if (epoll_ctl(EPOLL_FD, EPOLL_CTL_ADD, DONE_FD, &ev) < 0) {
+		Die("Failed to watch merge completions");
 	}
 
-	/* Initialize word count dictionary */
-	WORD_DICT = DictCreate();
+	/* A fixed pool merges results, however many workers are connected */
+	for (i = 0; i < threads; i++) {
+		if (pthread_create(&tid, NULL, &MergeThread, NULL) != 0) {
+			Die("Couldn't create thread.");
+		}
+		pthread_detach(tid);
+	}
 
 	/* Run until cancelled */
 	while (1) {
-		pthread_t tid;
-		unsigned int clientlen = sizeof(echoclient);
+		if ((n = epoll_pwait(EPOLL_FD, events, MAX_EVENTS, -1, &old_mask)) < 0) {
+			if (errno == EINTR) {
+				if (PRINT_REQUESTED) PrintAndReset();
+				continue;
+			}
+			Die("Failed to wait for events");
+		}
+
+		for (i = 0; i < n; i++) {
+			if (events[i].data.ptr == &LISTEN_TAG) {
+				AcceptAll(LISTEN_FD);
+			} else if (events[i].data.ptr == &DONE_TAG) {
+				FinishMerges();
+			} else {
+				ServeConn(events[i].data.ptr, events[i].events);
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* Take every pending connection off the listening socket */
+void AcceptAll(int serversock) {
+	struct sockaddr_in echoclient;
+	struct conn * c;
+	int clientsock;
+
+	while (1) {
+		socklen_t clientlen = sizeof(echoclient);
 		/* Wait for client connection */
 		if ((clientsock = accept(serversock, (struct sockaddr *) &echoclient, &clientlen)) < 0) {
-			Die("Failed to accept client connection");
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			if (errno == EMFILE || errno == ENFILE) {
+				/* Stop watching the socket until a connection closes */
+				fprintf(stderr, "Out of file descriptors; pausing accept.\n");
+				epoll_ctl(EPOLL_FD, EPOLL_CTL_DEL, serversock, NULL);
+				LISTEN_PAUSED = 1;
+				return;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				perror("Failed to accept client connection");
+			}
+			return;
 		}
-		fprintf(stdout, "\nClient connected: %s\n", inet_ntoa(echoclient.sin_addr));
 
-		if( pthread_create(&tid, NULL, &HandleClient, (void *) &clientsock) != 0) {
-        	Die("Couldn't create thread.");
-        }
+		if (fcntl(clientsock, F_SETFL, O_NONBLOCK) < 0) {
+			perror("Failed to make client connection non-blocking");
+			close(clientsock);
+			continue;
+		}
+		if ((c = calloc(1, sizeof(*c))) == NULL) {
+			Die("Failed to allocate connection.");
+		}
+		c->fd = clientsock;
+		c->events = EPOLLIN;
+		{
+			struct epoll_event ev = { EPOLLIN, { .ptr = c } };
+
+			if (epoll_ctl(EPOLL_FD, EPOLL_CTL_ADD, clientsock, &ev) < 0) {
+				Die("Failed to watch client connection");
+			}
+		}
+		Log(LOG_DEBUG, "\nClient connected: %s\n", inet_ntoa(echoclient.sin_addr));
+	}
+}
+
+void ServeConn(struct conn * c, uint32_t events) {
+	/* Reset while busy: nothing more can be read, so stop watching it */
+	if ((events & (EPOLLERR | EPOLLHUP)) && (c->merging || c->parked)) {
+		fprintf(stderr, "Connection to worker failed mid-frame.\n");
+		if (c->merging) {
+			epoll_ctl(EPOLL_FD, EPOLL_CTL_DEL, c->fd, NULL);
+			c->dead = 1;
+		} else {
+			CloseConn(c);
+		}
+		return;
+	}
 
-		fprintf(stdout, "Client handled.\n");
+	if (events & EPOLLOUT) {
+		FlushOut(c);
+		return;
 	}
+	ReadConn(c);
+}
 
-	return 0;
+/* Read what has arrived of the current frame. Stops at the end of a */
+/* result, which goes to the merge pool before the next frame is read, */
+/* so an END is only acknowledged once everything before it is merged. */
+void ReadConn(struct conn * c) {
+	ssize_t i;
+
+	while (!c->merging && !c->parked && c->out_len == 0) {
+		if (c->header_got < FRAME_HEADER_SIZE) {
+			i = recv(c->fd, c->raw + c->header_got, FRAME_HEADER_SIZE - c->header_got, 0);
+		} else {
+			i = recv(c->fd, c->payload + c->payload_got, c->header.length - c->payload_got, 0);
+		}
+
+		if (i < 0 && errno == EINTR) continue;
+		if (i < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+		if (i < 1) {
+			/* EOF is only clean between frames */
+			if (i < 0 || c->header_got > 0) {
+				fprintf(stderr, "Connection to worker failed mid-frame.\n");
+			}
+			CloseConn(c);
+			return;
+		}
+
+		if (c->header_got < FRAME_HEADER_SIZE) {
+			if ((c->header_got += i) < FRAME_HEADER_SIZE) continue;
+
+			if (DecodeFrameHeader(c->raw, &c->header) < 0) {
+				fprintf(stderr, "Malformed frame header from worker.\n");
+				CloseConn(c);
+				return;
+			}
+
+			if (c->header.type == FRAME_END) {
+				/* Every result before this frame has been merged */
+				EncodeFrameHeader(c->out, FRAME_END, c->header.seq, 0);
+				c->out_len = FRAME_HEADER_SIZE;
+				c->header_got = 0;
+				FlushOut(c);
+				return;
+			}
+
+			if (c->header.type != FRAME_RESULT && c->header.type != FRAME_SKETCH &&
+			    c->header.type != FRAME_REGISTERS && c->header.type != FRAME_POSTINGS) {
+				fprintf(stderr, "Unexpected frame type %u from worker.\n", c->header.type);
+				CloseConn(c);
+				return;
+			}
+
+			if (!ReservePayload(c)) {
+				/* Too much is buffered already; wait for merges to free some */
+				c->parked = 1;
+				c->next = NULL;
+				if (WAIT_TAIL) WAIT_TAIL->next = c; else WAIT_HEAD = c;
+				WAIT_TAIL = c;
+				MetricsGauge(G_PARKED, ++PARKED);
+				Watch(c);
+				return;
+			}
+		} else {
+			c->payload_got += i;
+		}
+
+		if (c->payload_got == c->header.length) {
+			StartMerge(c);
+			return;
+		}
+	}
 }
 
-void * HandleClient(void * socket) {
+/* Send what is left of the END acknowledgement */
+void FlushOut(struct conn * c) {
+	ssize_t i;
+
+	while (c->out_len > 0) {
+		i = send(c->fd, c->out + FRAME_HEADER_SIZE - c->out_len, c->out_len, MSG_NOSIGNAL);
+		if (i < 0 && errno == EINTR) continue;
+		if (i < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+		if (i < 1) {
+			fprintf(stderr, "Failed to acknowledge results.\n");
+			CloseConn(c);
+			return;
+		}
+		c->out_len -= i;
+	}
+	Watch(c);
+}
 
-	int sock = *(int *)socket;
-	int received = -1;
-	char * encoded_dict;
+/* Point epoll at whatever the connection is waiting for */
+void Watch(struct conn * c) {
+	struct epoll_event ev;
 
-	long int raw_dict_size = 0;
-	long int true_dict_size = 0;
-	int dict_size_bytes = 0;
-	if ((dict_size_bytes = recv(sock, &raw_dict_size, sizeof(raw_dict_size), 0)) < 1) {
-		Die("Failed to receive size of dictionary.");
+	ev.events = 0;
+	if (c->out_len > 0) {
+		ev.events = EPOLLOUT;
+	} else if (!c->merging && !c->parked) {
+		ev.events = EPOLLIN;
 	}
+	ev.data.ptr = c;
 
-	true_dict_size = ntohl(raw_dict_size);
+	if (ev.events != c->events) {
+		c->events = ev.events;
+		if (epoll_ctl(EPOLL_FD, EPOLL_CTL_MOD, c->fd, &ev) < 0) {
+			Die("Failed to watch client connection");
+		}
+	}
+}
 
-	encoded_dict = (char *) malloc(true_dict_size + 1);
-	// Receive the word back from the server 
+void CloseConn(struct conn * c) {
+	struct conn ** p;
+	struct epoll_event ev;
 
-	int bytes = 0;
-	if ((bytes = recv(sock, encoded_dict, true_dict_size, 0)) < 1) {
-	    Die("Failed to receive bytes from server");
+	if (c->parked) {
+		for (p = &WAIT_HEAD; *p != c; p = &(*p)->next);
+		*p = c->next;
+		if (WAIT_TAIL == c) {
+			for (WAIT_TAIL = WAIT_HEAD; WAIT_TAIL && WAIT_TAIL->next; WAIT_TAIL = WAIT_TAIL->next);
+		}
+		MetricsGauge(G_PARKED, --PARKED);
+	}
+
+	close(c->fd);
+	if (c->payload != NULL) {
+		free(c->payload);
+		BUFFERED -= c->header.length;
 	}
-	fprintf(stdout, "Received %d bytes from worker ... \n", bytes);
-	encoded_dict[bytes - 1] = '\0';
-	
-	pthread_mutex_lock(&lock);
+	free(c);
 
-	/* Update the dictionary with the counts received from the worker */
-	UpdateDictionary(encoded_dict);
+	if (LISTEN_PAUSED) {
+		ev.events = EPOLLIN;
+		ev.data.ptr = &LISTEN_TAG;
+		if (epoll_ctl(EPOLL_FD, EPOLL_CTL_ADD, LISTEN_FD, &ev) == 0) {
+			LISTEN_PAUSED = 0;
+		}
+	}
+	ResumeParked();
+}
+
+/* Allocate the payload of c's result frame if the buffer budget allows; */
+/* a frame larger than the whole budget is let in when nothing else is held */
+int ReservePayload(struct conn * c) {
+	if (BUFFERED > 0 && BUFFERED + c->header.length > BUFFER_BUDGET) {
+		return 0;
+	}
+	if ((c->payload = malloc(c->header.length > 0 ? c->header.length : 1)) == NULL) {
+		Die("Failed to allocate dictionary buffer.");
+	}
+	c->payload_got = 0;
+	BUFFERED += c->header.length;
+	MetricsGauge(G_BUFFERED, BUFFERED);
+	return 1;
+}
+
+/* Let parked connections read their payloads, oldest first, while they fit */
+void ResumeParked(void) {
+	struct conn * c;
+
+	MetricsGauge(G_BUFFERED, BUFFERED);
+	while ((c = WAIT_HEAD) != NULL && ReservePayload(c)) {
+		if ((WAIT_HEAD = c->next) == NULL) WAIT_TAIL = NULL;
+		c->parked = 0;
+		MetricsGauge(G_PARKED, --PARKED);
+
+		if (c->header.length == 0) {
+			StartMerge(c);
+		} else {
+			Watch(c);
+		}
+	}
+}
+
+/* Hand a complete result to the merge pool; the connection is not read */
+/* again until it comes back */
+void StartMerge(struct conn * c) {
+	c->merging = 1;
+	Watch(c);
+
+	pthread_mutex_lock(&QUEUE.lock);
+	c->next = NULL;
+	if (QUEUE.tail) QUEUE.tail->next = c; else QUEUE.head = c;
+	QUEUE.tail = c;
+	MetricsGauge(G_QUEUE, ++QUEUE.depth);
+	pthread_cond_signal(&QUEUE.ready);
+	pthread_mutex_unlock(&QUEUE.lock);
+}
+
+/* Take merged results back from the pool and read on */
+void FinishMerges(void) {
+	struct conn * c, * next;
+	uint64_t count;
+
+	if (read(DONE_FD, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+		Die("Failed to read merge completions");
+	}
+
+	pthread_mutex_lock(&QUEUE.lock);
+	c = QUEUE.done;
+	QUEUE.done = NULL;
+	pthread_mutex_unlock(&QUEUE.lock);
+
+	for (; c != NULL; c = next) {
+		next = c->next;
+
+		if (c->entries < 0) {
+			fprintf(stderr, "Malformed result frame from worker.\n");
+		}
+		Log(LOG_DEBUG, "Received %lu bytes (%ld entries) from worker ... \n", (unsigned long) c->header.length, c->entries);
+
+		free(c->payload);
+		c->payload = NULL;
+		BUFFERED -= c->header.length;
+		c->header_got = 0;
+		c->merging = 0;
+
+		if (c->dead) {
+			CloseConn(c);
+		} else {
+			Watch(c);
+		}
+	}
+	ResumeParked();
+}
 
-	free(encoded_dict);
-	pthread_mutex_unlock(&lock);
+void * MergeThread(void * arg) {
+	struct conn * c;
+	uint64_t one = 1;
+	uint64_t start;
 
+	while (1) {
+		pthread_mutex_lock(&QUEUE.lock);
+		while ((c = QUEUE.head) == NULL) {
+			pthread_cond_wait(&QUEUE.ready, &QUEUE.lock);
+		}
+		if ((QUEUE.head = c->next) == NULL) QUEUE.tail = NULL;
+		MetricsGauge(G_QUEUE, --QUEUE.depth);
+		pthread_mutex_unlock(&QUEUE.lock);
+
+		/* Add the counts received from the worker; each shard is locked */
+		/* only while its own share of the entries goes in */
+		start = MetricsNow();
+		if (c->header.type == FRAME_SKETCH) {
+			c->entries = MergeSketch(c->payload, c->header.length);
+		} else if (c->header.type == FRAME_REGISTERS) {
+			c->entries = MergeRegisters(c->payload, c->header.length);
+		} else if (c->header.type == FRAME_POSTINGS) {
+			c->entries = MergePostings(c->payload, c->header.length);
+		} else {
+			c->entries = ShardedDictMerge(WORD_DICT, c->payload, c->header.length);
+		}
+		MetricsRecord(H_MERGE, MetricsNow() - start);
+		MetricsCount(M_BYTES_IN, c->header.length);
+		MetricsCount(M_FRAMES_IN, 1);
+		if (c->entries > 0) MetricsCount(M_ENTRIES_MERGED, c->entries);
+
+		pthread_mutex_lock(&QUEUE.lock);
+		c->next = QUEUE.done;
+		QUEUE.done = c;
+		pthread_mutex_unlock(&QUEUE.lock);
+
+		if (write(DONE_FD, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+			Die("Failed to signal merge completion");
+		}
+	}
 	return NULL;
 }
 
-void UpdateDictionary(char * enc_dict) {
+/* Fold a worker's top-K summary into SKETCH; returns its entries or -1 */
+long MergeSketch(const char * buffer, size_t length) {
+	TopK t;
+	long n;
 
-  char * word_token;
-  char word[BUFFSIZE];
-  char word_count[BUFFSIZE];
-  int wc = 0;
+	if ((t = TopKDecode(buffer, length)) == NULL) {
+		return -1;
+	}
+	n = TopKSize(t);
+
+	pthread_mutex_lock(&SKETCH_LOCK);
+	if (SKETCH == NULL) {
+		SKETCH = t;
+		t = NULL;
+	} else {
+		TopKMerge(SKETCH, t);
+	}
+	pthread_mutex_unlock(&SKETCH_LOCK);
 
-  word_token = strtok(enc_dict, ",:");
+	if (t != NULL) {
+		TopKDestroy(t);
+	}
+	return n;
+}
 
-  while (word_token != NULL)
-  {
-    /* Extract the word ... */
-    int len = strlen(word_token);
-    if (len > BUFFSIZE) {
-    	fprintf(stdout, "This word token is really large!\n");
-    }
-    strcpy(word, word_token);
-    word[len] = '\0';
+/* Fold a worker's registers into REGISTERS; returns the number of */
+/* registers, or -1 if malformed or of another precision */
+long MergeRegisters(const char * buffer, size_t length) {
+	HyperLogLog h;
+	long n = -1;
 
-    /* And its count */
-    word_token = strtok(NULL, ",:");
-    int len2 = strlen(word_token);
-    if (len2 > BUFFSIZE) {
-    	fprintf(stdout, "This word count is really large!\n");
-    }
-    strcpy(word_count, word_token);
-    word_count[len2] = '\0';
-    wc = atoi(word_count);
-    // fprintf(stdout, "The word %s shows up %d times.\n", word, wc);
+	if ((h = HllDecode(buffer, length)) == NULL) {
+		return -1;
+	}
+
+	pthread_mutex_lock(&SKETCH_LOCK);
+	if (REGISTERS == NULL) {
+		REGISTERS = h;
+		h = NULL;
+		n = 1L << HllPrecision(REGISTERS);
+	} else if (HllMerge(REGISTERS, h) == 0) {
+		n = 1L << HllPrecision(REGISTERS);
+	}
+	pthread_mutex_unlock(&SKETCH_LOCK);
 
-    /* Look up the word in the dict */
-    int word_count_in_dict = DictSearch(WORD_DICT, word);
+	if (h != NULL) {
+		HllDestroy(h);
+	}
+	return n;
+}
 
-    /* If it's not there, insert it with a the count provided by the worker */
-    if (word_count_in_dict == 0) {
-      DictInsert(WORD_DICT, word, wc);
-    } else { /* Else, get its existing count and add to it the count provided by the worker */
-      DictDelete(WORD_DICT, word);
-      DictInsert(WORD_DICT, word, word_count_in_dict + wc);
-    }
+/* Add a worker's posting lists to POSTINGS; returns the number of keys, */
+/* or -1 if malformed. Like counts, they merge one shard at a time */
+long MergePostings(const char * buffer, size_t length) {
+	ShardedPostings postings;
 
-    word_token = strtok(NULL, ",:");
-  }
+	pthread_mutex_lock(&SKETCH_LOCK);
+	if (POSTINGS == NULL) {
+		POSTINGS = ShardedPostingsCreate(NUM_SHARDS);
+	}
+	postings = POSTINGS;
+	pthread_mutex_unlock(&SKETCH_LOCK);
+
+	return ShardedPostingsMerge(postings, buffer, length);
 }
 
 void SigHandler(int signo) {
 	if (signo == SIGTSTP) {
+		PRINT_REQUESTED = 1;
+	}
+}
+
+void PrintEntry(const char * key, unsigned int len, int value, void * arg) {
+	fprintf(stdout, "dict[%s] = %d\n", key, value);
+}
+
+void PrintPostingList(const char * key, unsigned int len, struct posting_list * l, void * arg) {
+	uint32_t doc;
+
+	fprintf(stdout, "post[%.*s] =", (int) len, key);
+	while (PostingNext(l, &doc) > 0) {
+		fprintf(stdout, " %u", doc);
+	}
+	fprintf(stdout, "\n");
+}
+
+void AddEntryToSketch(const char * key, unsigned int len, int value, void * arg) {
+	TopKAdd((TopK) arg, key, len, (uint64_t) value);
+}
+
+/* Print the TOP_K most frequent words (or all the summaries hold), */
+/* largest first, each with the range its true count lies in, then */
+/* forget the summaries. Exact results are folded into the summary; if */
+/* no worker sent a summary they go into one with room for every word, */
+/* and the counts are exact. Called with SKETCH_LOCK held. */
+void PrintTopK(void) {
+	struct topk_item * items;
+	uint64_t rest;
+	TopK t;
+	int k, n, i;
+
+	if ((t = SKETCH) == NULL) {
+		t = TopKCreate(ShardedDictSize(WORD_DICT));
+	}
+	ShardedDictForEach(WORD_DICT, AddEntryToSketch, t);
+	k = TOP_K > 0 ? TOP_K : TopKSize(t);
+
+	if ((items = malloc((k + 1) * sizeof(*items))) == NULL) {
+		Die("Failed to allocate top-K list.");
+	}
+	n = TopKList(t, items, k + 1);
+
+	/* Nothing left out can have occurred more often than the first word */
+	/* not listed or than any word the summaries dropped */
+	rest = n > k ? items[k].count : 0;
+	if (TopKFloor(t) > rest) rest = TopKFloor(t);
+
+	fprintf(stdout, "\nTop %d words:\n\n", n < k ? n : k);
+	for (i = 0; i < n && i < k; i++) {
+		fprintf(stdout, "top[%d] %.*s = %llu (at least %llu)\n", i + 1, (int) items[i].len, items[i].key,
+		        (unsigned long long) items[i].count, (unsigned long long) (items[i].count - items[i].error));
+	}
+	fprintf(stdout, "\nAny other word occurred at most %llu times.\n", (unsigned long long) rest);
+
+	free(items);
+	TopKDestroy(t);
+	SKETCH = NULL;
+}
+
+struct table_entry {
+	const char * key;
+	unsigned int len;
+	int value;
+};
+
+struct table_entries {
+	struct table_entry * entries;
+	size_t n, size;
+};
+
+void CollectEntry(const char * key, unsigned int len, int value, void * arg) {
+	struct table_entries * te = arg;
+
+	if (te->n == te->size) {
+		te->size = te->size * 2 + 1024;
+		if ((te->entries = realloc(te->entries, te->size * sizeof(struct table_entry))) == NULL) {
+			Die("Failed to allocate output index.");
+		}
+	}
+	te->entries[te->n].key = key;
+	te->entries[te->n].len = len;
+	te->entries[te->n].value = value;
+	te->n++;
+}
+
+int CompareEntries(const void * a, const void * b) {
+	const struct table_entry * x = a, * y = b;
+	int c = memcmp(x->key, y->key, x->len < y->len ? x->len : y->len);
+
+	return c != 0 ? c : (x->len > y->len) - (x->len < y->len);
+}
+
+/* Write the counts to path as a sorted table (table.h). The shards are */
+/* hashed, so the keys are gathered and sorted first; they are written */
+/* to a temporary file that replaces path only once it is complete. */
+void WriteTable(const char * path) {
+	struct table_entries te = { NULL, 0, 0 };
+	struct table_writer w;
+	char * tmp;
+	size_t i;
+
+	ShardedDictForEach(WORD_DICT, CollectEntry, &te);
+	qsort(te.entries, te.n, sizeof(struct table_entry), CompareEntries);
+
+	if ((tmp = malloc(strlen(path) + 5)) == NULL) {
+		Die("Failed to allocate output path.");
+	}
+	sprintf(tmp, "%s.tmp", path);
+
+	if (TableWriterOpen(&w, tmp) < 0) {
+		perror("Failed to create output table");
+	} else {
+		for (i = 0; i < te.n; i++) {
+			if (TableWriterAdd(&w, te.entries[i].key, te.entries[i].len, te.entries[i].value) < 0) break;
+		}
+		if (TableWriterClose(&w) < 0 || i < te.n || rename(tmp, path) < 0) {
+			perror("Failed to write output table");
+			unlink(tmp);
+		} else {
+			fprintf(stdout, "\nWrote %lu words to %s\n", (unsigned long) te.n, path);
+		}
+	}
+
+	free(tmp);
+	free(te.entries);
+}
+
+struct index_output {
+	struct index_writer w;
+	int failed;
+};
+
+void AddListToIndex(const char * key, unsigned int len, struct posting_list * l, void * arg) {
+	struct index_output * out = arg;
+
+	if (!out->failed && IndexWriterAdd(&out->w, key, len, l) < 0) {
+		out->failed = 1;
+	}
+}
+
+/* Write the posting lists to path as an index (index.h), in key order. */
+/* Like a table, it only replaces what was at path once it is complete. */
+/* Called with SKETCH_LOCK held. */
+void WriteIndex(const char * path) {
+	struct index_output out;
+
+	if (IndexWriterOpen(&out.w, path) < 0) {
+		perror("Failed to create output index");
+		return;
+	}
+	out.failed = 0;
+	ShardedPostingsForEachSorted(POSTINGS, AddListToIndex, &out);
+
+	if (out.failed) {
+		perror("Failed to write output index");
+		IndexWriterAbort(&out.w);
+	} else if (IndexWriterClose(&out.w) < 0) {
+		perror("Failed to write output index");
+	} else {
+		fprintf(stdout, "\nWrote an index of %lu words and %llu postings to %s\n", (unsigned long) ShardedPostingsSize(POSTINGS),
+		        (unsigned long long) ShardedPostingsCount(POSTINGS), path);
+	}
+}
+
+void PrintAndReset(void) {
+	PRINT_REQUESTED = 0;
+
+	pthread_mutex_lock(&SKETCH_LOCK);
+	if (REGISTERS != NULL) {
+		fprintf(stdout, "\nDistinct words: about %.0f (standard error %.1f%%)\n",
+		        HllEstimate(REGISTERS), HllError(REGISTERS) * 100);
+		HllDestroy(REGISTERS);
+		REGISTERS = NULL;
+	} else if (POSTINGS != NULL && ShardedPostingsSize(POSTINGS) > 0) {
+		if (OUTPUT_PATH != NULL) {
+			WriteIndex(OUTPUT_PATH);
+		} else {
+			fprintf(stdout, "\nPostings:\n\n");
+			ShardedPostingsForEach(POSTINGS, PrintPostingList, NULL);
+		}
+		/* kept, not freed: a merge may be holding on to it */
+		ShardedPostingsReset(POSTINGS);
+	} else if (TOP_K > 0 || SKETCH != NULL) {
+		PrintTopK();
+	} else if (OUTPUT_PATH != NULL) {
+		WriteTable(OUTPUT_PATH);
+	} else {
 		/* Print Dict Contents */
 		fprintf(stdout, "\nFinal word count:\n\n");
-		DictPrint(WORD_DICT);
-		DictDestroy(WORD_DICT);
-		WORD_DICT = DictCreate();
-		fprintf(stdout, "\nDictionary reset.\n\n");
-		// exit(0);
+		ShardedDictForEach(WORD_DICT, PrintEntry, NULL);
+	}
+	pthread_mutex_unlock(&SKETCH_LOCK);
+	ShardedDictReset(WORD_DICT);
+	Log(LOG_INFO, "\nDictionary reset.\n\n");
+	fflush(stdout);
+}
+
+/* Gauges of the merged counts, taken when metrics are asked for: the */
+/* shards are locked one at a time, each for a pass over its table */
+void CollectMetrics(void) {
+	long counts[PROBE_BUCKETS];
+	double total = 0;
+	int keys, longest, i;
+
+	/* In index mode the lists are what is held */
+	pthread_mutex_lock(&SKETCH_LOCK);
+	if (POSTINGS != NULL && ShardedPostingsSize(POSTINGS) > 0) {
+		MetricsGauge(G_DICT_KEYS, ShardedPostingsSize(POSTINGS));
+		MetricsGauge(G_DICT_BYTES, ShardedPostingsMemory(POSTINGS));
+		pthread_mutex_unlock(&SKETCH_LOCK);
+		return;
+	}
+	pthread_mutex_unlock(&SKETCH_LOCK);
+
+	keys = ShardedDictSize(WORD_DICT);
+	longest = ShardedDictProbeHistogram(WORD_DICT, counts, PROBE_BUCKETS);
+	for (i = 0; i < PROBE_BUCKETS; i++) {
+		total += (double) i * counts[i];
+	}
+	MetricsGauge(G_DICT_KEYS, keys);
+	MetricsGauge(G_DICT_BYTES, ShardedDictMemory(WORD_DICT));
+	if (keys > 0) {
+		MetricsGauge(G_PROBE_MEAN, total / keys);
+		MetricsGauge(G_PROBE_MAX, longest);
 	}
 }
 
-void Die(char * mess) { 
-	perror(mess); 
-	exit(1); 
+void Die(char * mess) {
+	perror(mess);
+	exit(1);
 }
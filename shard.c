@@ -0,0 +1,301 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "dict.h"
+#include "codec.h"
+#include "shard.h"
+
+struct sharded_dict {
+    int n;
+    int op;                 /* how values of the same key combine */
+    struct shard *shards;
+};
+
+/* one decoded entry; key is at base + offset */
+struct pending {
+    size_t offset;
+    unsigned int len;
+    int value;
+};
+
+ShardedDict
+ShardedDictCreate(int nshards)
+{
+    ShardedDict sd;
+    int i;
+
+    assert(nshards >= 1 && nshards <= MAX_SHARDS);
+
+    sd = malloc(sizeof(*sd));
+    assert(sd != 0);
+
+    sd->n = nshards;
+    sd->op = DICT_SUM;
+    if(posix_memalign((void **) &sd->shards, 64, nshards * sizeof(struct shard)) != 0) {
+        assert(0);
+    }
+
+    for(i = 0; i < nshards; i++) {
+        pthread_mutex_init(&sd->shards[i].lock, 0);
+        sd->shards[i].dict = DictCreate();
+    }
+
+    return sd;
+}
+
+void
+ShardedDictDestroy(ShardedDict sd)
+{
+    int i;
+
+    for(i = 0; i < sd->n; i++) {
+        pthread_mutex_destroy(&sd->shards[i].lock);
+        DictDestroy(sd->shards[i].dict);
+    }
+
+    free(sd->shards);
+    free(sd);
+}
+
+/* pick a shard from the top bits of a remixed hash, so that the */
+/* keys of one shard still spread over all of that shard's slots */
+static int
+shard_of(ShardedDict sd, const char *key, unsigned int len)
+{
+    uint64_t h = DictHash(key, len);
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+
+    return (int) (((h >> 32) * (uint64_t) sd->n) >> 32);
+}
+
+void
+ShardedDictSetCombine(ShardedDict sd, int op)
+{
+    sd->op = op;
+}
+
+void
+ShardedDictIncrement(ShardedDict sd, const char *key, unsigned int len, int delta)
+{
+    struct shard *s = &sd->shards[shard_of(sd, key, len)];
+
+    pthread_mutex_lock(&s->lock);
+    DictCombineLen(s->dict, key, len, delta, sd->op);
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void
+apply(struct shard *s, int op, const char *base, struct pending *p, size_t n)
+{
+    size_t i;
+
+    for(i = 0; i < n; i++) {
+        DictCombineLen(s->dict, base + p[i].offset, p[i].len, p[i].value, op);
+    }
+}
+
+long
+ShardedDictMerge(ShardedDict sd, const void *buffer, size_t length)
+{
+    struct dict_decoder dec;
+    struct pending *entries = 0, *sorted = 0;
+    unsigned short *which = 0;
+    size_t *start = 0;
+    char *done = 0;
+    char *pool = 0;
+    const char *base;
+    size_t pool_used = 0, pool_size = 0;
+    size_t n = 0, cap, i;
+    const char *key;
+    unsigned int len;
+    int value, status, s, left, progress;
+    static unsigned int rotor;
+
+    if(DictDecoderInit(&dec, buffer, length) < 0) return -1;
+
+    /* every entry takes at least two bytes, which bounds a bogus count */
+    cap = dec.remaining < length / 2 ? dec.remaining : length / 2;
+    entries = malloc((cap + 1) * sizeof(struct pending));
+    sorted = malloc((cap + 1) * sizeof(struct pending));
+    which = malloc((cap + 1) * sizeof(unsigned short));
+    start = calloc(sd->n + 1, sizeof(size_t));
+    done = malloc(sd->n);
+    assert(entries != 0 && sorted != 0 && which != 0 && start != 0 && done != 0);
+
+    /* unsorted keys stay in the buffer; sorted keys are rebuilt in */
+    /* scratch space, so copy them to a pool that outlives the decoder */
+    base = (const char *) buffer;
+
+    while((status = DictDecoderNext(&dec, &key, &len, &value)) > 0) {
+        if(n == cap) {
+            status = -1;
+            break;
+        }
+
+        if(dec.flags & CODEC_SORTED) {
+            if(pool_used + len > pool_size) {
+                pool_size = (pool_used + len) * 2 + 4096;
+                pool = realloc(pool, pool_size);
+                assert(pool != 0);
+            }
+            memcpy(pool + pool_used, key, len);
+            entries[n].offset = pool_used;
+            pool_used += len;
+        } else {
+            entries[n].offset = key - base;
+        }
+        entries[n].len = len;
+        entries[n].value = value;
+
+        s = shard_of(sd, key, len);
+        which[n] = s;
+        start[s + 1]++;
+        n++;
+    }
+    DictDecoderFree(&dec);
+
+    if(status < 0) {
+        free(entries);
+        free(sorted);
+        free(which);
+        free(start);
+        free(done);
+        free(pool);
+        return -1;
+    }
+
+    if(dec.flags & CODEC_SORTED) base = pool;
+
+    /* counting sort by shard */
+    for(s = 0; s < sd->n; s++) start[s + 1] += start[s];
+    for(i = 0; i < n; i++) sorted[start[which[i]]++] = entries[i];
+    for(s = sd->n; s > 0; s--) start[s] = start[s - 1];
+    start[0] = 0;
+
+    /* take each shard's lock once; skip shards another merge is */
+    /* holding and come back to them, only blocking when every */
+    /* remaining shard is busy. Start at a different shard each */
+    /* time so that concurrent merges don't all queue on shard 0. */
+    for(left = 0, s = 0; s < sd->n; s++) {
+        done[s] = start[s + 1] == start[s];
+        if(!done[s]) left++;
+    }
+
+    s = __atomic_fetch_add(&rotor, 1, __ATOMIC_RELAXED) % sd->n;
+
+    while(left > 0) {
+        progress = 0;
+
+        for(i = 0; i < (size_t) sd->n; i++, s = (s + 1) % sd->n) {
+            if(done[s] || pthread_mutex_trylock(&sd->shards[s].lock) != 0) continue;
+
+            apply(&sd->shards[s], sd->op, base, sorted + start[s], start[s + 1] - start[s]);
+            pthread_mutex_unlock(&sd->shards[s].lock);
+
+            done[s] = 1;
+            left--;
+            progress = 1;
+        }
+
+        if(progress || left == 0) continue;
+
+        /* everything left is busy: wait for the next one */
+        while(done[s]) s = (s + 1) % sd->n;
+
+        pthread_mutex_lock(&sd->shards[s].lock);
+        apply(&sd->shards[s], sd->op, base, sorted + start[s], start[s + 1] - start[s]);
+        pthread_mutex_unlock(&sd->shards[s].lock);
+
+        done[s] = 1;
+        left--;
+    }
+
+    free(entries);
+    free(sorted);
+    free(which);
+    free(start);
+    free(done);
+    free(pool);
+
+    return n;
+}
+
+int
+ShardedDictSize(ShardedDict sd)
+{
+    int i, total = 0;
+
+    for(i = 0; i < sd->n; i++) {
+        pthread_mutex_lock(&sd->shards[i].lock);
+        total += DictSize(sd->shards[i].dict);
+        pthread_mutex_unlock(&sd->shards[i].lock);
+    }
+
+    return total;
+}
+
+size_t
+ShardedDictMemory(ShardedDict sd)
+{
+    size_t total = 0;
+    int i;
+
+    for(i = 0; i < sd->n; i++) {
+        pthread_mutex_lock(&sd->shards[i].lock);
+        total += DictMemory(sd->shards[i].dict);
+        pthread_mutex_unlock(&sd->shards[i].lock);
+    }
+
+    return total;
+}
+
+int
+ShardedDictProbeHistogram(ShardedDict sd, long *counts, int buckets)
+{
+    long shard[buckets];
+    int i, b, longest = 0, l;
+
+    memset(counts, 0, buckets * sizeof(long));
+
+    for(i = 0; i < sd->n; i++) {
+        pthread_mutex_lock(&sd->shards[i].lock);
+        l = DictProbeHistogram(sd->shards[i].dict, shard, buckets);
+        pthread_mutex_unlock(&sd->shards[i].lock);
+
+        if(l > longest) longest = l;
+        for(b = 0; b < buckets; b++) counts[b] += shard[b];
+    }
+
+    return longest;
+}
+
+void
+ShardedDictForEach(ShardedDict sd, void (*fn)(const char *key, unsigned int len, int value, void *arg), void *arg)
+{
+    int i;
+
+    for(i = 0; i < sd->n; i++) {
+        pthread_mutex_lock(&sd->shards[i].lock);
+        DictForEach(sd->shards[i].dict, fn, arg);
+        pthread_mutex_unlock(&sd->shards[i].lock);
+    }
+}
+
+void
+ShardedDictReset(ShardedDict sd)
+{
+    int i;
+
+    for(i = 0; i < sd->n; i++) {
+        pthread_mutex_lock(&sd->shards[i].lock);
+        DictDestroy(sd->shards[i].dict);
+        sd->shards[i].dict = DictCreate();
+        pthread_mutex_unlock(&sd->shards[i].lock);
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include "dict.h"
+
+/* A Dict split into independently locked shards by key hash, so that
+ * several threads can merge results into it at once. Each merge sorts
+ * its entries by shard and then takes every shard lock once, visiting
+ * free shards first, instead of holding one lock for the whole merge. */
+
+#define MAX_SHARDS 1024
+
+struct shard {
+    pthread_mutex_t lock;
+    Dict dict;
+} __attribute__((aligned(64)));   /* keep locks on separate cache lines */
+
+typedef struct sharded_dict *ShardedDict;
+
+/* create a dictionary of nshards shards (1 to MAX_SHARDS) */
+ShardedDict ShardedDictCreate(int nshards);
+
+void ShardedDictDestroy(ShardedDict);
+
+/* combine every entry of an encoded buffer (see codec.h) */
+/* returns the number of entries, or -1 if the buffer is malformed */
+/* in which case nothing is added */
+long ShardedDictMerge(ShardedDict, const void *buffer, size_t length);
+
+/* combine values of the same key by op (DICT_SUM, the default, */
+/* DICT_MAX or DICT_MIN); set before anything is merged */
+void ShardedDictSetCombine(ShardedDict, int op);
+
+/* combine delta into a single key */
+void ShardedDictIncrement(ShardedDict, const char *key, unsigned int len, int delta);
+
+/* total number of keys over all shards */
+int ShardedDictSize(ShardedDict);
+
+/* bytes held by all shards */
+size_t ShardedDictMemory(ShardedDict);
+
+/* DictProbeHistogram summed over the shards, each locked in turn */
+int ShardedDictProbeHistogram(ShardedDict, long *counts, int buckets);
+
+/* call fn on every entry, shard by shard; takes each shard lock in turn */
+void ShardedDictForEach(ShardedDict, void (*fn)(const char *key, unsigned int len, int value, void *arg), void *arg);
+
+/* empty every shard */
+void ShardedDictReset(ShardedDict);
+
+#endif
@@ -0,0 +1,104 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "split.h"
+
+int MapInput(const char * path, struct input_file * in) {
+  struct stat st;
+
+  in->data = NULL;
+  in->size = 0;
+
+  if ((in->fd = open(path, O_RDONLY)) < 0) {
+    return -1;
+  }
+  if (fstat(in->fd, &st) < 0) {
+    close(in->fd);
+    return -1;
+  }
+
+  in->size = st.st_size;
+  if (in->size == 0) {
+    return 0;
+  }
+
+  in->data = mmap(NULL, in->size, PROT_READ, MAP_SHARED, in->fd, 0);
+  if (in->data == MAP_FAILED) {
+    close(in->fd);
+    return -1;
+  }
+  return 0;
+}
+
+void UnmapInput(struct input_file * in) {
+  if (in->data != NULL) {
+    munmap((void *) in->data, in->size);
+  }
+  close(in->fd);
+}
+
+const char * FindDelimiter(const char * p, const char * end) {
+#ifdef __SSE2__
+  /* 16 bytes at a time: a byte is a delimiter iff min(byte, ' ') == byte */
+  const __m128i space = _mm_set1_epi8(' ');
+
+  while (end - p >= 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) p);
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(v, space), v));
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+    p += 16;
+  }
+#endif
+  while (p < end && !IS_DELIM(*p)) {
+    p++;
+  }
+  return p;
+}
+
+struct split * ComputeSplits(const char * data, size_t size, size_t target, size_t * nsplits) {
+  struct split * splits;
+  size_t n = 0, capacity = 64;
+  size_t start, stop;
+
+  if ((splits = malloc(capacity * sizeof(*splits))) == NULL) {
+    return NULL;
+  }
+
+  for (start = 0; start < size; start = stop) {
+    if (size - start <= target) {
+      stop = size;
+    } else {
+      /* Extend to just past the first delimiter at or after the target */
+      /* boundary; only the pages around that point are touched */
+      stop = FindDelimiter(data + start + target - 1, data + size) - data + 1;
+      if (stop > size) {
+        stop = size;
+      }
+    }
+
+    if (n == capacity) {
+      struct split * grown = realloc(splits, 2 * capacity * sizeof(*splits));
+      if (grown == NULL) {
+        free(splits);
+        return NULL;
+      }
+      splits = grown;
+      capacity *= 2;
+    }
+    splits[n].offset = start;
+    splits[n].length = stop - start;
+    n++;
+  }
+
+  *nsplits = n;
+  return splits;
+}
@@ -0,0 +1,39 @@
+#ifndef SPLIT_H
+#define SPLIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Input splitting for the driver.
+ *
+ * The input file is memory-mapped and cut into splits of roughly the
+ * requested size. Every split ends just after a delimiter byte, so no
+ * word is ever cut in half between two workers. */
+
+/* bytes that separate words: ASCII whitespace and other control bytes */
+/* workers tokenize on exactly this class */
+#define IS_DELIM(c) ((unsigned char) (c) <= ' ')
+
+struct split {
+  uint64_t offset;
+  uint64_t length;
+};
+
+struct input_file {
+  int fd;
+  const char * data;    /* read-only mapping of the whole file, NULL if empty */
+  size_t size;
+};
+
+/* open and map path; returns 0 on success, -1 on error */
+int MapInput(const char * path, struct input_file * in);
+void UnmapInput(struct input_file * in);
+
+/* return a pointer to the first delimiter in [p, end), or end if none */
+const char * FindDelimiter(const char * p, const char * end);
+
+/* cut data into splits of about target bytes, ending on delimiters */
+/* returns a malloc'd array of *nsplits entries, or NULL if out of memory */
+struct split * ComputeSplits(const char * data, size_t size, size_t target, size_t * nsplits);
+
+#endif
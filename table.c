@@ -0,0 +1,432 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "codec.h"
+#include "table.h"
+
+struct table {
+    const unsigned char *base;  /* the whole file, mapped read-only */
+    size_t size;
+    uint64_t entries;
+    uint64_t nblocks;
+    const char **first;         /* first key of each block, in the mapping */
+    unsigned int *first_len;
+    uint64_t *offset;           /* nblocks + 1 boundaries, the last being the index */
+};
+
+static int
+compare_bytes(const char *a, unsigned int a_len, const char *b, unsigned int b_len)
+{
+    unsigned int len = a_len < b_len ? a_len : b_len;
+    int c = len > 0 ? memcmp(a, b, len) : 0;
+
+    if(c != 0) return c;
+
+    return (a_len > b_len) - (a_len < b_len);
+}
+
+static void
+put64(unsigned char *p, uint64_t v)
+{
+    int i;
+
+    for(i = 0; i < 8; i++) p[i] = (unsigned char) (v >> (8 * i));
+}
+
+static uint64_t
+get64(const unsigned char *p)
+{
+    uint64_t v = 0;
+    int i;
+
+    for(i = 0; i < 8; i++) v |= (uint64_t) p[i] << (8 * i);
+
+    return v;
+}
+
+static int
+table_write(int fd, const void *buffer, size_t length)
+{
+    const char *p = buffer;
+    ssize_t n;
+
+    while(length > 0) {
+        if((n = write(fd, p, length)) < 0) {
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        length -= n;
+    }
+
+    return 0;
+}
+
+int
+TableWriterOpen(struct table_writer *w, const char *path)
+{
+    memset(w, 0, sizeof(*w));
+
+    if((w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) return -1;
+
+    DictEncoderInit(&w->block, CODEC_SORTED);
+
+    return 0;
+}
+
+static int
+flush_block(struct table_writer *w)
+{
+    const char *data;
+    size_t length;
+
+    if(DictEncoderCount(&w->block) == 0) return 0;
+
+    if((data = DictEncoderFinish(&w->block, &length)) == 0 || table_write(w->fd, data, length) < 0) return -1;
+
+    w->offset += length;
+    DictEncoderReset(&w->block);
+
+    return 0;
+}
+
+/* note that a block starts at the current offset with this key */
+static int
+index_add(struct table_writer *w, const char *key, unsigned int len)
+{
+    unsigned char *p;
+    size_t need = w->index_used + 2 * 10 + len;
+
+    if(need > w->index_size) {
+        need = need * 2 > 4096 ? need * 2 : 4096;
+        if((p = realloc(w->index, need)) == 0) return -1;
+        w->index = p;
+        w->index_size = need;
+    }
+
+    p = VarintPut(w->index + w->index_used, len);
+    memcpy(p, key, len);
+    p = VarintPut(p + len, w->offset);
+    w->index_used = p - w->index;
+
+    return 0;
+}
+
+int
+TableWriterAdd(struct table_writer *w, const char *key, unsigned int len, int value)
+{
+    char *last;
+
+    if(w->entries > 0 && compare_bytes(w->last, w->last_len, key, len) >= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(DictEncoderCount(&w->block) == 0) {
+        if(index_add(w, key, len) < 0) return -1;
+        w->blocks++;
+    }
+
+    if(DictEncoderAdd(&w->block, key, len, value) < 0) return -1;
+
+    if(len > w->last_size) {
+        if((last = realloc(w->last, len * 2 + 16)) == 0) return -1;
+        w->last = last;
+        w->last_size = len * 2 + 16;
+    }
+    memcpy(w->last, key, len);
+    w->last_len = len;
+    w->entries++;
+
+    if(DictEncoderSize(&w->block) >= TABLE_BLOCK_SIZE) return flush_block(w);
+
+    return 0;
+}
+
+int
+TableWriterClose(struct table_writer *w)
+{
+    unsigned char footer[TABLE_FOOTER_SIZE];
+    int status;
+
+    status = flush_block(w);
+
+    put64(footer, w->offset);
+    put64(footer + 8, w->index_used);
+    put64(footer + 16, w->entries);
+    put64(footer + 24, w->blocks);
+    memcpy(footer + 32, TABLE_MAGIC, 8);
+
+    if(status == 0 && w->index_used > 0) status = table_write(w->fd, w->index, w->index_used);
+    if(status == 0) status = table_write(w->fd, footer, TABLE_FOOTER_SIZE);
+    if(status == 0) status = fsync(w->fd);
+    if(close(w->fd) < 0) status = -1;
+
+    DictEncoderFree(&w->block);
+    free(w->index);
+    free(w->last);
+    memset(w, 0, sizeof(*w));
+    w->fd = -1;
+
+    return status < 0 ? -1 : 0;
+}
+
+Table
+TableOpen(const char *path)
+{
+    const unsigned char *footer, *p, *end;
+    uint64_t index_offset, index_length, len, b;
+    struct stat st;
+    void *base;
+    Table t;
+    int fd;
+
+    if((fd = open(path, O_RDONLY)) < 0) return 0;
+
+    if(fstat(fd, &st) < 0) {
+        close(fd);
+        return 0;
+    }
+    if(st.st_size < TABLE_FOOTER_SIZE) {
+        close(fd);
+        errno = EINVAL;
+        return 0;
+    }
+
+    base = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED) return 0;
+
+    t = calloc(1, sizeof(*t));
+    if(t == 0) {
+        munmap(base, st.st_size);
+        return 0;
+    }
+    t->base = base;
+    t->size = st.st_size;
+
+    footer = t->base + t->size - TABLE_FOOTER_SIZE;
+    index_offset = get64(footer);
+    index_length = get64(footer + 8);
+    t->entries = get64(footer + 16);
+    t->nblocks = get64(footer + 24);
+
+    if(memcmp(footer + 32, TABLE_MAGIC, 8) != 0 || index_offset > t->size - TABLE_FOOTER_SIZE ||
+       index_length != t->size - TABLE_FOOTER_SIZE - index_offset || t->nblocks > index_length) {
+        goto bad;
+    }
+
+    /* only the index is read; the keys stay in the mapping */
+    t->first = malloc((t->nblocks + 1) * sizeof(char *));
+    t->first_len = malloc((t->nblocks + 1) * sizeof(unsigned int));
+    t->offset = malloc((t->nblocks + 1) * sizeof(uint64_t));
+    if(t->first == 0 || t->first_len == 0 || t->offset == 0) goto fail;
+
+    p = t->base + index_offset;
+    end = p + index_length;
+    for(b = 0; b < t->nblocks; b++) {
+        if(!VarintGet(&p, end, &len) || len > (uint64_t) (end - p)) goto bad;
+        t->first[b] = (const char *) p;
+        t->first_len[b] = (unsigned int) len;
+        p += len;
+
+        /* blocks are contiguous, start at 0 and end at the index */
+        if(!VarintGet(&p, end, &t->offset[b]) || t->offset[b] >= index_offset ||
+           (b == 0 ? t->offset[b] != 0 : t->offset[b] <= t->offset[b - 1])) {
+            goto bad;
+        }
+    }
+    t->offset[t->nblocks] = index_offset;
+    if(p != end || (t->nblocks == 0 && index_offset != 0)) goto bad;
+
+    return t;
+
+bad:
+    errno = EINVAL;
+fail:
+    TableClose(t);
+    return 0;
+}
+
+void
+TableClose(Table t)
+{
+    munmap((void *) t->base, t->size);
+    free(t->first);
+    free(t->first_len);
+    free(t->offset);
+    free(t);
+}
+
+uint64_t
+TableEntries(Table t)
+{
+    return t->entries;
+}
+
+/* the last block whose first key is not greater than key, or block 0 */
+static uint64_t
+find_block(Table t, const char *key, unsigned int len)
+{
+    uint64_t lo = 0;
+    uint64_t hi = t->nblocks;
+    uint64_t mid;
+
+    while(hi - lo > 1) {
+        mid = lo + (hi - lo) / 2;
+        if(compare_bytes(t->first[mid], t->first_len[mid], key, len) <= 0) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+static int
+open_block(struct table_iter *it, uint64_t b)
+{
+    Table t = it->table;
+
+    it->block = b;
+    return DictDecoderInit(&it->dec, t->base + t->offset[b], t->offset[b + 1] - t->offset[b]);
+}
+
+int
+TableSeek(Table t, struct table_iter *it, const char *key, unsigned int len)
+{
+    const char *k;
+    unsigned int l;
+    int v;
+    int status;
+
+    memset(it, 0, sizeof(*it));
+    it->table = t;
+
+    if(t->nblocks == 0) return 0;
+
+    if(open_block(it, find_block(t, key, len)) < 0) return -1;
+
+    /* skip the keys of the block that come before key */
+    while((status = DictDecoderNext(&it->dec, &k, &l, &v)) > 0) {
+        if(compare_bytes(k, l, key, len) >= 0) {
+            it->pending = 1;
+            it->key = k;
+            it->len = l;
+            it->value = v;
+            return 0;
+        }
+    }
+
+    /* otherwise the first key of the next block is the one */
+    return status < 0 ? -1 : 0;
+}
+
+int
+TableNext(struct table_iter *it, const char **key, unsigned int *len, int *value)
+{
+    Table t = it->table;
+    int status;
+
+    if(it->pending) {
+        it->pending = 0;
+        *key = it->key;
+        *len = it->len;
+        *value = it->value;
+        return 1;
+    }
+
+    while(it->block < t->nblocks) {
+        if((status = DictDecoderNext(&it->dec, key, len, value)) != 0) return status;
+
+        DictDecoderFree(&it->dec);
+        if(++it->block < t->nblocks && open_block(it, it->block) < 0) return -1;
+    }
+
+    return 0;
+}
+
+void
+TableIterFree(struct table_iter *it)
+{
+    DictDecoderFree(&it->dec);
+}
+
+int
+TableGet(Table t, const char *key, unsigned int len, int *value)
+{
+    struct table_iter it;
+    const char *k;
+    unsigned int l;
+    int v;
+    int status;
+
+    if(TableSeek(t, &it, key, len) < 0) {
+        TableIterFree(&it);
+        return -1;
+    }
+
+    /* the key lives in the iterator, so compare before freeing it */
+    status = TableNext(&it, &k, &l, &v);
+    if(status > 0 && (l != len || memcmp(k, key, len) != 0)) status = 0;
+    TableIterFree(&it);
+
+    if(status > 0) *value = v;
+
+    return status;
+}
+
+long
+TableScan(Table t, const char *from, unsigned int from_len, const char *to, unsigned int to_len,
+          int (*fn)(const char *key, unsigned int len, int value, void *arg), void *arg)
+{
+    struct table_iter it;
+    const char *k;
+    unsigned int l;
+    int v;
+    int status;
+    long n = 0;
+
+    if((status = TableSeek(t, &it, from, from_len)) == 0) {
+        while((status = TableNext(&it, &k, &l, &v)) > 0) {
+            if(to != 0 && compare_bytes(k, l, to, to_len) >= 0) break;
+
+            n++;
+            if(fn(k, l, v, arg) != 0) break;
+        }
+    }
+    TableIterFree(&it);
+
+    return status < 0 ? -1 : n;
+}
+
+long
+TableScanPrefix(Table t, const char *prefix, unsigned int len,
+                int (*fn)(const char *key, unsigned int len, int value, void *arg), void *arg)
+{
+    struct table_iter it;
+    const char *k;
+    unsigned int l;
+    int v;
+    int status;
+    long n = 0;
+
+    if((status = TableSeek(t, &it, prefix, len)) == 0) {
+        while((status = TableNext(&it, &k, &l, &v)) > 0) {
+            if(l < len || memcmp(k, prefix, len) != 0) break;
+
+            n++;
+            if(fn(k, l, v, arg) != 0) break;
+        }
+    }
+    TableIterFree(&it);
+
+    return status < 0 ? -1 : n;
+}
@@ -0,0 +1,106 @@
+#ifndef TABLE_H
+#define TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "codec.h"
+
+/* Sorted word-count table file, written by the reducer (reducer -o) and
+ * read in place through mmap.
+ *
+ *   blocks   entries in ascending key order, cut into blocks of about
+ *            TABLE_BLOCK_SIZE bytes; each block is a complete sorted
+ *            encoding (codec.h), so keys share prefixes with the
+ *            previous key and the first key of a block is whole
+ *   index    one entry per block:
+ *              varint   length of the block's first key
+ *              bytes    first key
+ *              varint   offset of the block in the file
+ *   footer   TABLE_FOOTER_SIZE bytes, little-endian 64-bit words:
+ *              offset of the index, length of the index, number of
+ *              entries, number of blocks, then the 8-byte TABLE_MAGIC
+ *
+ * Opening reads the footer and the index only. A lookup binary-searches
+ * the index and decodes a single block, and a scan decodes blocks in
+ * order, so only the pages actually visited are read from disk. */
+
+/* a lookup decodes one block from its start, so blocks are kept small; */
+/* the index grows as they shrink, and is all that opening reads */
+#define TABLE_BLOCK_SIZE 1024
+#define TABLE_FOOTER_SIZE 40
+#define TABLE_MAGIC "WCTABLE1"
+
+/* Writer: keys must be added in strictly ascending byte order */
+struct table_writer {
+    int fd;
+    uint64_t offset;            /* bytes written so far */
+    uint64_t entries;
+    uint64_t blocks;
+    struct dict_encoder block;  /* the block being filled */
+    unsigned char *index;
+    size_t index_used;
+    size_t index_size;
+    char *last;                 /* previous key, to check the order */
+    unsigned int last_len;
+    size_t last_size;
+};
+
+/* create or truncate path; returns 0, or -1 with errno set */
+int TableWriterOpen(struct table_writer *w, const char *path);
+
+/* append an entry; returns 0, or -1 if the key is out of order (errno */
+/* EINVAL) or writing failed */
+int TableWriterAdd(struct table_writer *w, const char *key, unsigned int len, int value);
+
+/* write the last block, the index and the footer, sync and close the */
+/* file; returns 0, or -1 if anything failed. The writer is freed either way */
+int TableWriterClose(struct table_writer *w);
+
+typedef struct table *Table;
+
+/* map a table file; returns NULL with errno set if it cannot be opened */
+/* or is not a well-formed table (EINVAL) */
+Table TableOpen(const char *path);
+
+void TableClose(Table);
+
+/* number of entries */
+uint64_t TableEntries(Table);
+
+/* look up one key: returns 1 and sets *value if present, 0 if not, */
+/* -1 if the block holding it is corrupt */
+int TableGet(Table, const char *key, unsigned int len, int *value);
+
+/* Iterator over the entries from a given key on, in key order */
+struct table_iter {
+    Table table;
+    uint64_t block;             /* block being decoded */
+    struct dict_decoder dec;
+    int pending;                /* an entry was decoded by the seek but not returned */
+    const char *key;
+    unsigned int len;
+    int value;
+};
+
+/* position it before the first key not less than key (len 0 for the */
+/* first entry of the table); returns 0, or -1 if a block is corrupt */
+int TableSeek(Table, struct table_iter *it, const char *key, unsigned int len);
+
+/* return the next entry: 1 on success, 0 at the end, -1 if corrupt; */
+/* *key is not terminated and is valid until the next call */
+int TableNext(struct table_iter *it, const char **key, unsigned int *len, int *value);
+
+void TableIterFree(struct table_iter *it);
+
+/* call fn on every entry with from <= key < to, or to the end of the */
+/* table if to is NULL. If fn returns non-zero the scan stops. Returns */
+/* the number of entries visited, or -1 if a block is corrupt */
+long TableScan(Table, const char *from, unsigned int from_len, const char *to, unsigned int to_len,
+               int (*fn)(const char *key, unsigned int len, int value, void *arg), void *arg);
+
+/* the same, for every key that starts with prefix */
+long TableScanPrefix(Table, const char *prefix, unsigned int len,
+                     int (*fn)(const char *key, unsigned int len, int value, void *arg), void *arg);
+
+#endif
@@ -0,0 +1,235 @@
+#include <stdint.h>
+#include <string.h>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+#include "dict.h"
+#include "split.h"
+#include "tokenize.h"
+
+/* ASCII punctuation, the bytes ispunct() accepts in the C locale */
+#define IS_PUNCT(c) (((c) >= 0x21 && (c) <= 0x2f) || ((c) >= 0x3a && (c) <= 0x40) || \
+                     ((c) >= 0x5b && (c) <= 0x60) || ((c) >= 0x7b && (c) <= 0x7e))
+
+/* Tokenizer state, carried across blocks. Kept bytes are written at dst,
+ * which trails the read position by the number of punctuation bytes
+ * dropped so far; a word is the kept bytes between two delimiters. */
+struct tok_state {
+  char * dst;
+  char * start;       /* where the current word began in dst */
+  int in_word;
+  size_t words;
+  token_fn fn;
+  void * arg;
+};
+
+static inline void end_word(struct tok_state * st, char * end) {
+  unsigned int len = end - st->start;
+
+  /* a word made only of punctuation leaves nothing behind */
+  if (len > 0) {
+    st->fn(st->start, len, DictHash(st->start, len), st->arg);
+    st->words++;
+  }
+  st->in_word = 0;
+}
+
+static inline void scalar_step(struct tok_state * st, unsigned char c) {
+  if (IS_DELIM(c)) {
+    if (st->in_word) end_word(st, st->dst);
+    *st->dst++ = c;
+    return;
+  }
+  if (!st->in_word) {
+    st->in_word = 1;
+    st->start = st->dst;
+  }
+  if (IS_PUNCT(c)) return;
+  *st->dst++ = (c >= 'A' && c <= 'Z') ? c | 0x20 : c;
+}
+
+static void init_state(struct tok_state * st, char * buf, token_fn fn, void * arg) {
+  st->dst = buf;
+  st->start = buf;
+  st->in_word = 0;
+  st->words = 0;
+  st->fn = fn;
+  st->arg = arg;
+}
+
+size_t TokenizeScalar(char * buf, size_t len, token_fn fn, void * arg) {
+  struct tok_state st;
+  char * src = buf, * end = buf + len;
+
+  init_state(&st, buf, fn, arg);
+  while (src < end) scalar_step(&st, *src++);
+  if (st.in_word) end_word(&st, st.dst);
+
+  return st.words;
+}
+
+/* Walk the word boundaries in bytes [from, to) of a block, whose kept
+ * bytes have just been written at at. Bit i of delim is set if byte i
+ * of the block is a delimiter. Only boundaries cost anything, not bytes. */
+static inline void block_words(struct tok_state * st, char * at, uint32_t delim, int from, int to) {
+  uint32_t range = (to == 32 ? ~0u : (1u << to) - 1) & (~0u << from);
+  uint32_t d = delim & range, w = ~delim & range;
+  int pos;
+
+  for (;;) {
+    if (st->in_word) {
+      if (d == 0) break;                        /* word runs past the range */
+      pos = __builtin_ctz(d);
+      end_word(st, at + pos - from);
+      w &= ~0u << pos;
+    } else {
+      if (w == 0) break;
+      pos = __builtin_ctz(w);
+      st->in_word = 1;
+      st->start = at + pos - from;
+      d &= ~0u << pos;
+    }
+  }
+}
+
+/* A block of width bytes with punctuation in it: copy the lowered runs
+ * between punctuation bytes to dst and walk their boundaries. A dropped
+ * byte still starts a word, as in scalar_step. */
+static inline void block_punct(struct tok_state * st, const char * lowered, uint32_t delim, uint32_t punct,
+                               int width) {
+  int pos = 0, q;
+
+  for (;;) {
+    q = punct ? __builtin_ctz(punct) : width;
+    if (q > pos) {
+      memcpy(st->dst, lowered + pos, q - pos);
+      block_words(st, st->dst, delim, pos, q);
+      st->dst += q - pos;
+    }
+    if (q == width) break;
+    if (!st->in_word) {
+      st->in_word = 1;
+      st->start = st->dst;
+    }
+    pos = q + 1;
+    punct &= punct - 1;
+  }
+}
+
+#ifdef __x86_64__
+
+/* Byte classes, as masks with 0xff in matching lanes. Unsigned range
+ * checks are done as min(v - lo, hi - lo) == v - lo. */
+#define CLASS_MASKS(V, SET1, SUB, MIN, EQ, OR, ANDNOT, AND, delim, punct, lowered)  \
+  do {                                                                          \
+    V t;                                                                        \
+    delim = EQ(MIN(v, SET1(' ')), v);                                           \
+    t = SUB(OR(v, SET1(0x20)), SET1('a'));                                      \
+    V alpha = EQ(MIN(t, SET1(25)), t);                                          \
+    t = SUB(v, SET1('0'));                                                      \
+    V digit = EQ(MIN(t, SET1(9)), t);                                           \
+    t = SUB(v, SET1(0x21));                                                     \
+    V graph = EQ(MIN(t, SET1(0x7e - 0x21)), t);                                 \
+    punct = ANDNOT(OR(alpha, digit), graph);                                    \
+    t = SUB(v, SET1('A'));                                                      \
+    V upper = EQ(MIN(t, SET1(25)), t);                                          \
+    lowered = OR(v, AND(upper, SET1(0x20)));                                    \
+  } while (0)
+
+static size_t tokenize_sse2(char * buf, size_t len, token_fn fn, void * arg) {
+  struct tok_state st;
+  char * src = buf, * end = buf + len;
+  __m128i v, delim, punct, lowered;
+  char tmp[16];
+  int p;
+
+  init_state(&st, buf, fn, arg);
+
+  while (end - src >= 16) {
+    v = _mm_loadu_si128((const __m128i *) src);
+    CLASS_MASKS(__m128i, _mm_set1_epi8, _mm_sub_epi8, _mm_min_epu8, _mm_cmpeq_epi8,
+                _mm_or_si128, _mm_andnot_si128, _mm_and_si128, delim, punct, lowered);
+
+    if ((p = _mm_movemask_epi8(punct)) == 0) {
+      /* dst never passes src, so this only overwrites bytes already loaded */
+      _mm_storeu_si128((__m128i *) st.dst, lowered);
+      block_words(&st, st.dst, (uint32_t) _mm_movemask_epi8(delim), 0, 16);
+      st.dst += 16;
+    } else {
+      _mm_storeu_si128((__m128i *) tmp, lowered);
+      block_punct(&st, tmp, (uint32_t) _mm_movemask_epi8(delim), (uint32_t) p, 16);
+    }
+    src += 16;
+  }
+
+  while (src < end) scalar_step(&st, *src++);
+  if (st.in_word) end_word(&st, st.dst);
+
+  return st.words;
+}
+
+__attribute__((target("avx2")))
+static size_t tokenize_avx2(char * buf, size_t len, token_fn fn, void * arg) {
+  struct tok_state st;
+  char * src = buf, * end = buf + len;
+  __m256i v, delim, punct, lowered;
+  char tmp[32];
+  uint32_t p;
+
+  init_state(&st, buf, fn, arg);
+
+  while (end - src >= 32) {
+    v = _mm256_loadu_si256((const __m256i *) src);
+    CLASS_MASKS(__m256i, _mm256_set1_epi8, _mm256_sub_epi8, _mm256_min_epu8, _mm256_cmpeq_epi8,
+                _mm256_or_si256, _mm256_andnot_si256, _mm256_and_si256, delim, punct, lowered);
+
+    if ((p = (uint32_t) _mm256_movemask_epi8(punct)) == 0) {
+      _mm256_storeu_si256((__m256i *) st.dst, lowered);
+      block_words(&st, st.dst, (uint32_t) _mm256_movemask_epi8(delim), 0, 32);
+      st.dst += 32;
+    } else {
+      _mm256_storeu_si256((__m256i *) tmp, lowered);
+      block_punct(&st, tmp, (uint32_t) _mm256_movemask_epi8(delim), p, 32);
+    }
+    src += 32;
+  }
+
+  while (src < end) scalar_step(&st, *src++);
+  if (st.in_word) end_word(&st, st.dst);
+
+  return st.words;
+}
+
+#endif
+
+static size_t (*tokenize_kernel)(char *, size_t, token_fn, void *);
+static const char * tokenize_name;
+
+/* picked before main runs, so map threads never race on it */
+__attribute__((constructor))
+static void pick_kernel(void) {
+#ifdef __x86_64__
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    tokenize_kernel = tokenize_avx2;
+    tokenize_name = "avx2";
+    return;
+  }
+  tokenize_kernel = tokenize_sse2;
+  tokenize_name = "sse2";
+#else
+  tokenize_kernel = TokenizeScalar;
+  tokenize_name = "scalar";
+#endif
+}
+
+size_t Tokenize(char * buf, size_t len, token_fn fn, void * arg) {
+  if (tokenize_kernel == NULL) pick_kernel();
+  return tokenize_kernel(buf, len, fn, arg);
+}
+
+const char * TokenizeKernel(void) {
+  if (tokenize_kernel == NULL) pick_kernel();
+  return tokenize_name;
+}
@@ -0,0 +1,28 @@
+#ifndef TOKENIZE_H
+#define TOKENIZE_H
+
+#include <stddef.h>
+
+/* Word tokenizer for the worker.
+ *
+ * One pass over a buffer that lowercases ASCII letters, drops ASCII
+ * punctuation and splits words on IS_DELIM bytes, the same words that
+ * NormalizeText followed by a split on whitespace used to produce. Each
+ * word is handed over as (pointer, length, DictHash) without writing a
+ * terminator: words are compacted in place, so the buffer is modified
+ * but never grows. Uses AVX2 or SSE2 when the CPU has them, with a
+ * scalar fallback that produces exactly the same words. */
+
+typedef void (*token_fn)(const char * key, unsigned int len, unsigned long hash, void * arg);
+
+/* tokenize len bytes of buf, calling fn once per word; */
+/* returns the number of words */
+size_t Tokenize(char * buf, size_t len, token_fn fn, void * arg);
+
+/* the same, byte by byte, whatever the CPU */
+size_t TokenizeScalar(char * buf, size_t len, token_fn fn, void * arg);
+
+/* name of the kernel Tokenize uses: "avx2", "sse2" or "scalar" */
+const char * TokenizeKernel(void);
+
+#endif
@@ -0,0 +1,533 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "dict.h"
+#include "codec.h"
+#include "topk.h"
+
+/* Counters sit in a min-heap on count, so the one a new key replaces is
+ * always at the root; an open-addressing index maps keys to their heap
+ * positions and every counter remembers its index slot, so moving a
+ * counter in the heap is one store into the index. Only counters below
+ * n own a key buffer; it is reused when the counter changes hands. */
+
+struct counter {
+    char *key;              /* malloc'd, not terminated */
+    unsigned int len;
+    unsigned int size;      /* bytes allocated for key */
+    unsigned long hash;     /* DictHash(key, len) */
+    unsigned long slot;     /* index entry pointing at this counter */
+    uint64_t count;
+    uint64_t error;
+};
+
+struct topk {
+    int capacity;
+    int n;                  /* counters in use */
+    struct counter *heap;   /* capacity counters, a min-heap on count */
+    int *index;             /* heap position + 1, 0 if the slot is empty */
+    unsigned long mask;     /* index size - 1; at most half the slots are used */
+    int shift;              /* 64 - log2(index size) */
+    uint64_t floor;
+};
+
+TopK
+TopKCreate(int capacity)
+{
+    TopK t;
+    unsigned long size = 2;
+    int shift = 63;
+
+    if(capacity < 1) capacity = 1;
+
+    while(size < 2 * (unsigned long) capacity) {
+        size <<= 1;
+        shift--;
+    }
+
+    t = malloc(sizeof(*t));
+    assert(t != 0);
+
+    t->capacity = capacity;
+    t->n = 0;
+    t->heap = calloc(capacity, sizeof(struct counter));
+    t->index = calloc(size, sizeof(int));
+    assert(t->heap != 0 && t->index != 0);
+    t->mask = size - 1;
+    t->shift = shift;
+    t->floor = 0;
+
+    return t;
+}
+
+void
+TopKDestroy(TopK t)
+{
+    TopKReset(t);
+    free(t->heap);
+    free(t->index);
+    free(t);
+}
+
+void
+TopKReset(TopK t)
+{
+    int i;
+
+    for(i = 0; i < t->n; i++) {
+        free(t->heap[i].key);
+        t->heap[i].key = 0;
+        t->heap[i].size = 0;
+    }
+    memset(t->index, 0, (t->mask + 1) * sizeof(int));
+    t->n = 0;
+    t->floor = 0;
+}
+
+/* Fibonacci hashing, as in dict.c */
+static inline unsigned long
+home_slot(TopK t, unsigned long h)
+{
+    return (unsigned long) (((uint64_t) h * 0x9E3779B97F4A7C15ULL) >> t->shift);
+}
+
+/* return the index slot holding key, or the empty slot where it would go */
+static unsigned long
+index_find(TopK t, const char *key, unsigned int len, unsigned long h)
+{
+    unsigned long i = home_slot(t, h);
+    struct counter *c;
+
+    while(t->index[i] != 0) {
+        c = &t->heap[t->index[i] - 1];
+
+        if(c->hash == h && c->len == len && !memcmp(c->key, key, len)) break;
+
+        i = (i + 1) & t->mask;
+    }
+
+    return i;
+}
+
+/* empty index slot i, shifting back later entries of its probe run */
+static void
+index_remove(TopK t, unsigned long i)
+{
+    unsigned long j = i;
+    unsigned long home;
+
+    for(;;) {
+        t->index[i] = 0;
+
+        for(;;) {
+            j = (j + 1) & t->mask;
+
+            if(t->index[j] == 0) return;
+
+            /* the entry at j can fill the hole unless its home slot */
+            /* lies cyclically in (i, j] */
+            home = home_slot(t, t->heap[t->index[j] - 1].hash);
+            if(i <= j ? (i < home && home <= j) : (i < home || home <= j)) continue;
+
+            break;
+        }
+
+        t->index[i] = t->index[j];
+        t->heap[t->index[i] - 1].slot = i;
+        i = j;
+    }
+}
+
+static void
+swap_counters(TopK t, int a, int b)
+{
+    struct counter tmp;
+
+    tmp = t->heap[a];
+    t->heap[a] = t->heap[b];
+    t->heap[b] = tmp;
+
+    t->index[t->heap[a].slot] = a + 1;
+    t->index[t->heap[b].slot] = b + 1;
+}
+
+static void
+heap_up(TopK t, int i)
+{
+    while(i > 0 && t->heap[i].count < t->heap[(i - 1) / 2].count) {
+        swap_counters(t, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void
+heap_down(TopK t, int i)
+{
+    int child;
+
+    for(;;) {
+        child = 2 * i + 1;
+
+        if(child >= t->n) return;
+
+        if(child + 1 < t->n && t->heap[child + 1].count < t->heap[child].count) child++;
+
+        if(t->heap[i].count <= t->heap[child].count) return;
+
+        swap_counters(t, i, child);
+        i = child;
+    }
+}
+
+static void
+set_key(struct counter *c, const char *key, unsigned int len, unsigned long h)
+{
+    if(c->key == 0 || len > c->size) {
+        free(c->key);
+        c->size = len > 16 ? len : 16;
+        c->key = malloc(c->size);
+        assert(c->key != 0);
+    }
+
+    memcpy(c->key, key, len);
+    c->len = len;
+    c->hash = h;
+}
+
+void
+TopKAdd(TopK t, const char *key, unsigned int len, uint64_t delta)
+{
+    unsigned long h = DictHash(key, len);
+    unsigned long i = index_find(t, key, len, h);
+    struct counter *c;
+    uint64_t base;
+
+    if(t->index[i] != 0) {
+        t->heap[t->index[i] - 1].count += delta;
+        heap_down(t, t->index[i] - 1);
+        return;
+    }
+
+    if(t->n < t->capacity) {
+        /* a key not held may have occurred up to floor times already */
+        c = &t->heap[t->n++];
+        base = t->floor;
+    } else {
+        /* take over the smallest counter; its count bounds both what */
+        /* the new key may have missed and what the old one had */
+        c = &t->heap[0];
+        base = c->count;
+        t->floor = base;
+        index_remove(t, c->slot);
+        i = index_find(t, key, len, h);
+    }
+
+    set_key(c, key, len, h);
+    c->count = base + delta;
+    c->error = base;
+    c->slot = i;
+    t->index[i] = c - t->heap + 1;
+
+    if(c == &t->heap[0]) {
+        heap_down(t, 0);
+    } else {
+        heap_up(t, c - t->heap);
+    }
+}
+
+static int
+compare_keys(const struct counter *x, const struct counter *y)
+{
+    unsigned int len = x->len < y->len ? x->len : y->len;
+    int c = memcmp(x->key, y->key, len);
+
+    if(c != 0) return c;
+
+    return (x->len > y->len) - (x->len < y->len);
+}
+
+/* smallest count first; of equal counts, the largest key first */
+static int
+compare_ascending(const void *a, const void *b)
+{
+    const struct counter *x = a;
+    const struct counter *y = b;
+
+    if(x->count != y->count) return x->count < y->count ? -1 : 1;
+
+    return compare_keys(y, x);
+}
+
+/* largest count first; of equal counts, the smallest key first */
+static int
+compare_descending(const void *a, const void *b)
+{
+    const struct counter *x = *(const struct counter **) a;
+    const struct counter *y = *(const struct counter **) b;
+
+    if(x->count != y->count) return x->count > y->count ? -1 : 1;
+
+    return compare_keys(x, y);
+}
+
+/* point the index at counters 0 .. n - 1 */
+static void
+rebuild_index(TopK t)
+{
+    unsigned long s;
+    int i;
+
+    memset(t->index, 0, (t->mask + 1) * sizeof(int));
+
+    for(i = 0; i < t->n; i++) {
+        s = index_find(t, t->heap[i].key, t->heap[i].len, t->heap[i].hash);
+        t->heap[i].slot = s;
+        t->index[s] = i + 1;
+    }
+}
+
+void
+TopKMerge(TopK dst, TopK src)
+{
+    struct counter *all;
+    struct counter *c;
+    char *matched;
+    uint64_t a = dst->floor;
+    uint64_t b = src->floor;
+    unsigned long s;
+    int n = dst->n;
+    int drop;
+    int i;
+
+    all = malloc((dst->n + src->n + 1) * sizeof(struct counter));
+    matched = calloc(dst->n + 1, 1);
+    assert(all != 0 && matched != 0);
+
+    memcpy(all, dst->heap, dst->n * sizeof(struct counter));
+
+    /* a key held on one side only may have occurred up to the other */
+    /* side's floor times there */
+    for(i = 0; i < src->n; i++) {
+        c = &src->heap[i];
+        s = index_find(dst, c->key, c->len, c->hash);
+
+        if(dst->index[s] != 0) {
+            all[dst->index[s] - 1].count += c->count;
+            all[dst->index[s] - 1].error += c->error;
+            matched[dst->index[s] - 1] = 1;
+        } else {
+            all[n] = *c;
+            all[n].key = 0;
+            set_key(&all[n], c->key, c->len, c->hash);
+            all[n].count += a;
+            all[n].error += a;
+            n++;
+        }
+    }
+    for(i = 0; i < dst->n; i++) {
+        if(!matched[i]) {
+            all[i].count += b;
+            all[i].error += b;
+        }
+    }
+
+    /* keep the largest counts; in ascending order they form a min-heap */
+    qsort(all, n, sizeof(struct counter), compare_ascending);
+
+    dst->floor = a + b;
+    drop = n > dst->capacity ? n - dst->capacity : 0;
+    if(drop > 0 && all[drop - 1].count > dst->floor) dst->floor = all[drop - 1].count;
+    for(i = 0; i < drop; i++) free(all[i].key);
+
+    memcpy(dst->heap, all + drop, (n - drop) * sizeof(struct counter));
+    for(i = n - drop; i < dst->n; i++) {
+        dst->heap[i].key = 0;
+        dst->heap[i].size = 0;
+    }
+    dst->n = n - drop;
+    rebuild_index(dst);
+
+    free(all);
+    free(matched);
+}
+
+int
+TopKList(TopK t, struct topk_item *items, int k)
+{
+    struct counter **order;
+    int i;
+
+    if(k > t->n) k = t->n;
+    if(k <= 0) return 0;
+
+    order = malloc(t->n * sizeof(struct counter *));
+    assert(order != 0);
+
+    for(i = 0; i < t->n; i++) order[i] = &t->heap[i];
+    qsort(order, t->n, sizeof(struct counter *), compare_descending);
+
+    for(i = 0; i < k; i++) {
+        items[i].key = order[i]->key;
+        items[i].len = order[i]->len;
+        items[i].count = order[i]->count;
+        items[i].error = order[i]->error;
+    }
+
+    free(order);
+
+    return k;
+}
+
+int
+TopKSize(TopK t)
+{
+    return t->n;
+}
+
+int
+TopKCapacity(TopK t)
+{
+    return t->capacity;
+}
+
+uint64_t
+TopKFloor(TopK t)
+{
+    return t->floor;
+}
+
+size_t
+TopKMemory(TopK t)
+{
+    size_t size = sizeof(*t) + t->capacity * sizeof(struct counter) + (t->mask + 1) * sizeof(int);
+    int i;
+
+    for(i = 0; i < t->n; i++) size += t->heap[i].size;
+
+    return size;
+}
+
+int
+TopKEncodePartitioned(TopK t, int parts, char *buffers[], size_t lengths[])
+{
+    size_t *counts;
+    unsigned char **out;
+    int *part;
+    struct counter *c;
+    int i;
+    int p;
+
+    for(p = 0; p < parts; p++) buffers[p] = 0;
+
+    counts = calloc(parts, sizeof(size_t));
+    out = calloc(parts, sizeof(unsigned char *));
+    part = malloc((t->n + 1) * sizeof(int));
+
+    if(counts == 0 || out == 0 || part == 0) goto fail;
+
+    /* sizing pass, then one allocation of exactly the right size each */
+    for(i = 0; i < t->n; i++) {
+        part[i] = KeyPartition(t->heap[i].key, t->heap[i].len, parts);
+        counts[part[i]]++;
+    }
+    for(p = 0; p < parts; p++) {
+        lengths[p] = 1 + VarintSize(t->capacity) + VarintSize(t->floor) + VarintSize(counts[p]);
+    }
+    for(i = 0; i < t->n; i++) {
+        c = &t->heap[i];
+        lengths[part[i]] += VarintSize(c->len) + c->len + VarintSize(c->count) + VarintSize(c->error);
+    }
+
+    for(p = 0; p < parts; p++) {
+        if((buffers[p] = malloc(lengths[p])) == 0) goto fail;
+
+        out[p] = (unsigned char *) buffers[p];
+        *out[p]++ = TOPK_VERSION;
+        out[p] = VarintPut(out[p], t->capacity);
+        out[p] = VarintPut(out[p], t->floor);
+        out[p] = VarintPut(out[p], counts[p]);
+    }
+
+    for(i = 0; i < t->n; i++) {
+        c = &t->heap[i];
+        p = part[i];
+        out[p] = VarintPut(out[p], c->len);
+        memcpy(out[p], c->key, c->len);
+        out[p] += c->len;
+        out[p] = VarintPut(out[p], c->count);
+        out[p] = VarintPut(out[p], c->error);
+    }
+
+    free(counts);
+    free(out);
+    free(part);
+    return 0;
+
+fail:
+    for(p = 0; p < parts; p++) {
+        free(buffers[p]);
+        buffers[p] = 0;
+    }
+    free(counts);
+    free(out);
+    free(part);
+    return -1;
+}
+
+TopK
+TopKDecode(const void *buffer, size_t length)
+{
+    const unsigned char *p = buffer;
+    const unsigned char *end = p + length;
+    uint64_t capacity, floor, n, len, count, error;
+    const char *key;
+    struct counter *c;
+    unsigned long h;
+    unsigned long s;
+    TopK t;
+    int i;
+
+    if(length < 1 || *p++ != TOPK_VERSION) return 0;
+
+    if(!VarintGet(&p, end, &capacity) || !VarintGet(&p, end, &floor) || !VarintGet(&p, end, &n) ||
+       capacity < 1 || capacity > TOPK_MAX_CAPACITY || n > capacity) {
+        return 0;
+    }
+
+    t = TopKCreate((int) capacity);
+    t->floor = floor;
+
+    while((uint64_t) t->n < n) {
+        if(!VarintGet(&p, end, &len) || len > (uint64_t) (end - p)) goto fail;
+
+        key = (const char *) p;
+        p += len;
+
+        if(!VarintGet(&p, end, &count) || !VarintGet(&p, end, &error) || error > count) goto fail;
+
+        /* the same key twice would leave the index inconsistent */
+        h = DictHash(key, len);
+        s = index_find(t, key, len, h);
+        if(t->index[s] != 0) goto fail;
+
+        c = &t->heap[t->n];
+        set_key(c, key, len, h);
+        c->count = count;
+        c->error = error;
+        c->slot = s;
+        t->index[s] = ++t->n;
+    }
+
+    if(p != end) goto fail;
+
+    /* entries come in no particular order */
+    for(i = t->n / 2 - 1; i >= 0; i--) heap_down(t, i);
+
+    return t;
+
+fail:
+    TopKDestroy(t);
+    return 0;
+}
@@ -0,0 +1,85 @@
+#ifndef TOPK_H
+#define TOPK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Space-Saving summary of the heaviest keys of a weighted stream.
+ *
+ * At most capacity keys are held, each with a count that is an upper
+ * bound on its true count and an error such that count - error is a
+ * lower bound. A new key takes the place of the key with the smallest
+ * count, inheriting that count as its error, so memory stays fixed
+ * however many distinct keys go by; any key not held occurred at most
+ * TopKFloor times. Summaries merge (Agarwal et al., "Mergeable
+ * summaries") with the same guarantees, so workers can each keep one
+ * and a reducer can combine them. A summary that never filled up is
+ * exact: every error is 0. */
+
+typedef struct topk *TopK;
+
+/* refuse encoded summaries claiming more counters than this */
+#define TOPK_MAX_CAPACITY (1 << 24)
+
+struct topk_item {
+    const char *key;        /* not terminated */
+    unsigned int len;
+    uint64_t count;         /* upper bound on the true count */
+    uint64_t error;         /* count - error is a lower bound */
+};
+
+/* a summary of capacity counters (at least 1) */
+TopK TopKCreate(int capacity);
+
+void TopKDestroy(TopK);
+
+/* add delta occurrences of key */
+void TopKAdd(TopK, const char *key, unsigned int len, uint64_t delta);
+
+/* fold src into dst, keeping dst's capacity; src is unchanged */
+void TopKMerge(TopK dst, TopK src);
+
+/* the k (or fewer) keys with the largest counts, largest first, equal */
+/* counts in byte order of the keys; keys point into the summary and */
+/* are valid until it is next modified. Returns the number of items */
+int TopKList(TopK, struct topk_item *items, int k);
+
+/* keys held */
+int TopKSize(TopK);
+
+int TopKCapacity(TopK);
+
+/* upper bound on the count of any key not held */
+uint64_t TopKFloor(TopK);
+
+/* bytes of heap memory held by the summary */
+size_t TopKMemory(TopK);
+
+/* forget everything */
+void TopKReset(TopK);
+
+/* Encoding, for worker -> reducer sketches:
+ *
+ *   byte     format version (TOPK_VERSION)
+ *   varint   capacity
+ *   varint   floor
+ *   varint   number of entries
+ *   entries:
+ *     varint   length of the key
+ *     bytes    key
+ *     varint   count
+ *     varint   error
+ *
+ * with varints as in codec.h. */
+
+#define TOPK_VERSION 1
+
+/* encode the summary as parts buffers, key k going to buffer */
+/* KeyPartition(k, parts), each with the whole summary's floor; */
+/* returns 0, or -1 if out of memory (with no buffers left allocated) */
+int TopKEncodePartitioned(TopK, int parts, char *buffers[], size_t lengths[]);
+
+/* rebuild a summary from its encoding, or return NULL if malformed */
+TopK TopKDecode(const void *buffer, size_t length);
+
+#endif
@@ -0,0 +1,146 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+static int uring_setup(unsigned entries, struct io_uring_params *p) {
+  return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+int UringInit(struct uring *r, unsigned entries) {
+  struct io_uring_params p;
+  char *sq, *cq;
+
+  memset(r, 0, sizeof(*r));
+  memset(&p, 0, sizeof(p));
+
+  if ((r->fd = uring_setup(entries, &p)) < 0) {
+    return -1;
+  }
+
+  /* The rings and the submission entries are shared with the kernel */
+  r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  r->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+  r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+  r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+  r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+  if (r->sq_ring == MAP_FAILED || r->cq_ring == MAP_FAILED || r->sqes == MAP_FAILED) {
+    UringExit(r);
+    return -1;
+  }
+
+  sq = r->sq_ring;
+  r->sq_head = (unsigned *) (sq + p.sq_off.head);
+  r->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+  r->sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+  r->sq_array = (unsigned *) (sq + p.sq_off.array);
+  r->sq_entries = p.sq_entries;
+  r->sq_local_tail = *r->sq_tail;
+
+  cq = r->cq_ring;
+  r->cq_head = (unsigned *) (cq + p.cq_off.head);
+  r->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+  r->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+  return 0;
+}
+
+void UringExit(struct uring *r) {
+  if (r->sqes != NULL && r->sqes != MAP_FAILED) munmap(r->sqes, r->sqes_size);
+  if (r->cq_ring != NULL && r->cq_ring != MAP_FAILED) munmap(r->cq_ring, r->cq_ring_size);
+  if (r->sq_ring != NULL && r->sq_ring != MAP_FAILED) munmap(r->sq_ring, r->sq_ring_size);
+  if (r->fd >= 0) close(r->fd);
+  r->fd = -1;
+}
+
+int UringRegisterBuffers(struct uring *r, const struct iovec *iov, unsigned n) {
+  return (int) syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_BUFFERS, iov, n) < 0 ? -1 : 0;
+}
+
+/* next free submission entry, or NULL if the ring is full */
+static struct io_uring_sqe *next_sqe(struct uring *r) {
+  unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+  struct io_uring_sqe *sqe;
+
+  if (r->sq_local_tail - head >= r->sq_entries) {
+    return NULL;
+  }
+  sqe = &r->sqes[r->sq_local_tail & *r->sq_mask];
+  memset(sqe, 0, sizeof(*sqe));
+  /* entry i of the ring always uses sqes[i] */
+  r->sq_array[r->sq_local_tail & *r->sq_mask] = r->sq_local_tail & *r->sq_mask;
+  r->sq_local_tail++;
+  return sqe;
+}
+
+static int prep_rw(struct uring *r, int op, int fixed_op, int fd, const void *buf, unsigned len,
+                   uint64_t offset, int buf_index, uint64_t tag) {
+  struct io_uring_sqe *sqe = next_sqe(r);
+
+  if (sqe == NULL) return -1;
+  sqe->opcode = buf_index >= 0 ? fixed_op : op;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t) (uintptr_t) buf;
+  sqe->len = len;
+  sqe->off = offset;
+  if (buf_index >= 0) sqe->buf_index = buf_index;
+  sqe->user_data = tag;
+  return 0;
+}
+
+int UringPrepRead(struct uring *r, int fd, void *buf, unsigned len, uint64_t offset, int buf_index, uint64_t tag) {
+  return prep_rw(r, IORING_OP_READ, IORING_OP_READ_FIXED, fd, buf, len, offset, buf_index, tag);
+}
+
+int UringPrepWrite(struct uring *r, int fd, const void *buf, unsigned len, uint64_t offset, int buf_index, uint64_t tag) {
+  return prep_rw(r, IORING_OP_WRITE, IORING_OP_WRITE_FIXED, fd, buf, len, offset, buf_index, tag);
+}
+
+int UringPrepNop(struct uring *r, uint64_t tag) {
+  struct io_uring_sqe *sqe = next_sqe(r);
+
+  if (sqe == NULL) return -1;
+  sqe->opcode = IORING_OP_NOP;
+  sqe->user_data = tag;
+  return 0;
+}
+
+int UringSubmit(struct uring *r) {
+  unsigned pending = r->sq_local_tail - *r->sq_tail;
+  int i;
+
+  if (pending == 0) return 0;
+  /* publish the entries before the kernel can see the new tail */
+  __atomic_store_n(r->sq_tail, r->sq_local_tail, __ATOMIC_RELEASE);
+
+  while ((i = uring_enter(r->fd, pending, 0, 0)) < 0 && errno == EINTR);
+  return i;
+}
+
+int UringWait(struct uring *r, uint64_t *tag, int *result) {
+  unsigned head;
+  struct io_uring_cqe *cqe;
+
+  for (;;) {
+    head = *r->cq_head;
+    if (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) break;
+    if (uring_enter(r->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) return -1;
+  }
+
+  cqe = &r->cqes[head & *r->cq_mask];
+  *tag = cqe->user_data;
+  *result = cqe->res;
+  __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+  return 0;
+}
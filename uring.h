@@ -0,0 +1,57 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/* Minimal io_uring, driven through the raw system calls.
+ *
+ * One submission and one completion ring. Reads and writes are prepared
+ * on the submission ring, optionally on registered buffers, submitted in
+ * batches, and their completions reaped one at a time, each carrying the
+ * 64-bit tag it was prepared with. Preparing and submitting must be done
+ * by one thread at a time, and so must reaping, but the two sides may
+ * run on different threads at once. */
+
+struct uring {
+  int fd;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  struct io_uring_sqe *sqes;
+  unsigned sq_entries;
+  unsigned sq_local_tail;     /* prepared, including not yet submitted */
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_cqe *cqes;
+  void *sq_ring, *cq_ring;
+  size_t sq_ring_size, cq_ring_size, sqes_size;
+};
+
+/* set up a ring with room for entries submissions; returns 0, or -1 */
+/* with errno set if the kernel has no io_uring or it is disabled */
+int UringInit(struct uring *r, unsigned entries);
+void UringExit(struct uring *r);
+
+/* register n buffers; afterwards buf_index i in a prepared read or */
+/* write refers to iov[i]. Returns 0, or -1 with errno set */
+int UringRegisterBuffers(struct uring *r, const struct iovec *iov, unsigned n);
+
+/* queue a read of len bytes of fd at offset into buf, or a write of */
+/* len bytes of buf at offset (-1 for sockets and pipes); buf_index is */
+/* the registered buffer holding buf, or -1. Return -1 if the */
+/* submission ring is full */
+int UringPrepRead(struct uring *r, int fd, void *buf, unsigned len, uint64_t offset, int buf_index, uint64_t tag);
+int UringPrepWrite(struct uring *r, int fd, const void *buf, unsigned len, uint64_t offset, int buf_index, uint64_t tag);
+
+/* queue an operation that does nothing but complete */
+int UringPrepNop(struct uring *r, uint64_t tag);
+
+/* hand everything prepared so far to the kernel; returns the number */
+/* of entries submitted, or -1 */
+int UringSubmit(struct uring *r);
+
+/* wait for the next completion; its tag goes in *tag and the result */
+/* of the operation (bytes transferred or -errno) in *result */
+int UringWait(struct uring *r, uint64_t *tag, int *result);
+
+#endif
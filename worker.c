@@ -1,4 +1,14 @@
 #include "dict.c"
+#include "proto.c"
+#include "metrics.c"
+#include "split.c"
+#include "codec.c"
+#include "combiner.c"
+#include "tokenize.c"
+#include "job.c"
+#include "topk.c"
+#include "hll.c"
+#include "postings.c"
 
 #include <stdio.h>
 #include <sys/socket.h>
@@ -11,194 +21,772 @@
 #include <ctype.h>
 #include <assert.h>
 #include <string.h>
+#include <getopt.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdint.h>
 
 #define MAXPENDING 5    /* Max connection requests */
-#define BUFFSIZE 1024
-#define REDUCER_IP "127.0.0.1"
-#define REDUCER_PORT "5555"
-
-Dict WORD_DICT;
+#define DEFAULT_REDUCERS "127.0.0.1:5555"
+#define MAX_REDUCERS 64
+#define DEFAULT_MEMORY_BUDGET (512UL << 20)
+#define RESULT_FRAME_SIZE (1 << 20)  /* split merged spill output into frames this big */
+#define MAP_BLOCK (64 * 1024)   /* unit of work a map thread takes from a chunk */
+#define MAX_THREADS 256
+#define PROBE_SAMPLE 16         /* measure the probe lengths of every 16th chunk */
+#define PROBE_BUCKETS 64
+#define USAGE "USAGE: worker [-d delay_ms] [-s] [-r ip:port,...] [-m budget] [-F threshold] [-t threads] [-j job] [-k counters | -H precision | -I] [-v | -q] [-M stats_port] <port>\n"
+
+/* Map thread i counts into CHUNK_COUNTS[i] and JOB_COUNTS[i], so the */
+/* threads never share a table and take no locks */
+Dict CHUNK_COUNTS[MAX_THREADS];     /* counts of the chunk being held */
+Combiner JOB_COUNTS[MAX_THREADS];   /* committed counts not yet sent to the reducers */
+TopK JOB_SKETCH[MAX_THREADS];       /* the same, summarized, in top-K mode */
+int TOPK_COUNTERS;      /* keep a top-K summary of this many keys instead of exact counts */
+HyperLogLog REGISTERS[MAX_THREADS]; /* distinct-word mode: only these, no counts */
+int HLL_PRECISION;      /* 2^HLL_PRECISION registers, 0 = count words */
+Postings JOB_INDEX[MAX_THREADS];    /* index mode: the chunks each key occurs in, not counts */
+int INDEX_MODE;
+int NUM_THREADS = 1;
+const struct job * JOB = &WORD_COUNT_JOB;  /* what the map threads emit, and how it combines */
+size_t MEMORY_BUDGET = DEFAULT_MEMORY_BUDGET;
+size_t FLUSH_THRESHOLD; /* send early once JOB_COUNTS holds this much, 0 = only at end */
+unsigned long long SHIPPED_BYTES, SHIPPED_FRAMES;
+uint64_t SEND_NS;       /* time spent sending during the current flush */
+int DELAY_MS;           /* artificial per-chunk delay, for straggler testing */
+int CODEC_FLAGS;        /* CODEC_SORTED to prefix-compress results */
+char * REDUCER_IPS[MAX_REDUCERS];   /* reducer r owns key partition r */
+char * REDUCER_PORTS[MAX_REDUCERS];
+int NUM_REDUCERS;
+
+/* The chunk being counted, cut into blocks that map threads take in turn */
+struct count_task {
+	char * start;
+	char ** stops;          /* block b is [stops[b - 1], stops[b]), block 0 starts at start */
+	size_t nblocks;
+	size_t capacity;
+	size_t next;            /* next block to take */
+	int cancelled;
+	int sock;
+	uint32_t seq;
+} TASK;
+int MERGE_STEP;         /* distance between the combiners merged in this round */
 
 void Die(char * mess);
 void HandleClient(int sock);
-void NormalizeText(char *p);
-void AddToDict(char * buf);
+int CountChunk(int sock, uint32_t seq, char * buf, size_t len);
+int WaitForAbort(int sock, uint32_t seq, int timeout_ms);
+void SendToReducer();
+void RunOnThreads(int n, void * (*fn)(void *));
+void * MapThread(void * arg);
+void * FoldThread(void * arg);
+void * MergeThread(void * arg);
+void CommitChunk();
+void DropChunk();
+size_t JobSize();
+void NoteJobSize();
+void NoteProbeLengths(Dict d);
+int ShipFrame(int sock, uint32_t type, const void * payload, size_t length);
+void CountRecords(struct emit_batch * b);
+void NoteRecords(struct emit_batch * b);
+void AddToJob(const char * key, unsigned int len, int value, void * arg);
+void AddToSketch(const char * key, unsigned int len, int value, void * arg);
+void AddToIndex(const char * key, unsigned int len, int value, void * arg);
+int MergeEntry(const char * key, unsigned int len, int value, void * arg);
 
 int main(int argc, char * argv[]) 
 {
 	int serversock, clientsock;
-	struct sockaddr_in echoserver, echoclient;
+	struct sockaddr_in echoclient;
+	char * reducer_spec = DEFAULT_REDUCERS;
+	char * stats_port = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:sr:m:F:t:j:k:H:IvqM:")) != -1) {
+		switch (opt) {
+			case 'd':
+				DELAY_MS = atoi(optarg);
+				break;
+			case 's':
+				CODEC_FLAGS = CODEC_SORTED;
+				break;
+			case 'r':
+				reducer_spec = optarg;
+				break;
+			case 'm':
+				if ((MEMORY_BUDGET = ParseSize(optarg)) == 0) {
+					fprintf(stderr, "Bad memory budget: %s\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'F':
+				if ((FLUSH_THRESHOLD = ParseSize(optarg)) == 0) {
+					fprintf(stderr, "Bad flush threshold: %s\n", optarg);
+					exit(1);
+				}
+				break;
+			case 't':
+				NUM_THREADS = atoi(optarg);
+				if (NUM_THREADS < 1 || NUM_THREADS > MAX_THREADS) {
+					fprintf(stderr, "Bad thread count: %s\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'j':
+				if ((JOB = JobLoad(optarg)) == NULL) {
+					exit(1);
+				}
+				break;
+			case 'k':
+				TOPK_COUNTERS = atoi(optarg);
+				if (TOPK_COUNTERS < 1 || TOPK_COUNTERS > TOPK_MAX_CAPACITY) {
+					fprintf(stderr, "Bad number of top-K counters: %s\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'H':
+				HLL_PRECISION = atoi(optarg);
+				if (HLL_PRECISION < HLL_MIN_PRECISION || HLL_PRECISION > HLL_MAX_PRECISION) {
+					fprintf(stderr, "Bad HyperLogLog precision: %s (%d to %d)\n", optarg, HLL_MIN_PRECISION, HLL_MAX_PRECISION);
+					exit(1);
+				}
+				break;
+			case 'I':
+				INDEX_MODE = 1;
+				break;
+			case 'v':
+				LOG_LEVEL++;
+				break;
+			case 'q':
+				LOG_LEVEL = LOG_QUIET;
+				break;
+			case 'M':
+				stats_port = optarg;
+				break;
+			default:
+				fprintf(stderr, USAGE);
+				exit(1);
+		}
+	}
 
-	if (argc != 2) {
-	  fprintf(stderr, "USAGE: echoserver <port>\n");
+	/* Space-Saving adds counts up */
+	if (argc - optind != 1 || (TOPK_COUNTERS > 0) + (HLL_PRECISION > 0) + INDEX_MODE > 1 ||
+	    (TOPK_COUNTERS > 0 && JOB->combine != JOB_SUM)) {
+	  fprintf(stderr, USAGE);
 	  exit(1);
 	}
-	/* Create the TCP socket */
-	if ((serversock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
-		Die("Failed to create socket");
+	/* Every worker of a job must list the reducers in the same order */
+	if ((NUM_REDUCERS = ParseAddressList(reducer_spec, REDUCER_IPS, REDUCER_PORTS, MAX_REDUCERS)) < 1) {
+		fprintf(stderr, "Bad reducer list: %s\n", reducer_spec);
+		exit(1);
 	}
-	/* Construct the server sockaddr_in structure */
-	memset(&echoserver, 0, sizeof(echoserver));       /* Clear struct */
-	echoserver.sin_family = AF_INET;                  /* Internet/IP */
-	echoserver.sin_addr.s_addr = htonl(INADDR_ANY);   /* Incoming addr */
-	echoserver.sin_port = htons(atoi(argv[1]));       /* server port */
 
-	/* Bind the server socket */
-	if (bind(serversock, (struct sockaddr *) &echoserver, sizeof(echoserver)) < 0) {
-		Die("Failed to bind the server socket");
-	}
-	/* Listen on the server socket */
-	if (listen(serversock, MAXPENDING) < 0) {
+	/* Bind and listen on the server socket */
+	if ((serversock = ListenOn(argv[optind], MAXPENDING)) < 0) {
 		Die("Failed to listen on server socket");
 	}
+	if (stats_port != NULL && MetricsServe(stats_port) < 0) {
+		Die("Failed to listen on stats port");
+	}
 
 	/* Run until cancelled */
 	while (1) {
-		/* Initialize word count dictionary */
-		WORD_DICT = DictCreate();
-
 		unsigned int clientlen = sizeof(echoclient);
 		/* Wait for client connection */
 		if ((clientsock = accept(serversock, (struct sockaddr *) &echoclient, &clientlen)) < 0) {
 			Die("Failed to accept client connection");
 		}
-		fprintf(stdout, "\nClient connected: %s\n", inet_ntoa(echoclient.sin_addr));
+		Log(LOG_INFO, "\nClient connected: %s\n", inet_ntoa(echoclient.sin_addr));
 		HandleClient(clientsock);
-		fprintf(stdout, "Client handled.\n");
-
-		/* Destroy word count dictionary and free up memory */
-		DictDestroy(WORD_DICT);
+		Log(LOG_INFO, "Client handled.\n");
 	}
 }
 
+/* Handle one driver connection. For every chunk frame the worker counts
+ * the words, reports FRAME_DONE and holds the result until the driver
+ * says whether to keep it (FRAME_COMMIT) or drop it (FRAME_ABORT), since
+ * a backup copy of the same chunk may have finished first elsewhere.
+ * Kept counts are added up across all chunks of the job and sent to the
+ * reducers at the end of the job, or earlier past FLUSH_THRESHOLD.
+ * Chunks are counted by NUM_THREADS map threads, each into its own tables.
+ * In top-K mode (TOPK_COUNTERS) kept counts go into fixed-size summaries
+ * instead, and only the summaries' candidates are sent. In distinct-word
+ * mode (HLL_PRECISION) words only update HyperLogLog registers. In
+ * index mode (INDEX_MODE) a kept chunk adds its sequence number to the
+ * posting list of every key it holds, and the lists are sent instead. */
 void HandleClient(int sock) {
-	char buffer[BUFFSIZE];
-	int received = -1;
-	char * dict_rep;
-
-	/* Receive message */
-	if ((received = recv(sock, buffer, BUFFSIZE - 1, 0)) < 0) {
-		Die("Failed to receive initial bytes from Driver.");
+	struct frame_header header;
+	char * buffer = NULL;
+	size_t capacity = 0;
+	int status;
+	int holding = 0;        /* a counted, undecided chunk is in CHUNK_COUNTS */
+	uint32_t held_seq = 0;
+	uint64_t start;
+	int i;
+
+	/* Job counts beyond the memory budget spill to sorted run files; */
+	/* the threads share the budget */
+	for (i = 0; i < NUM_THREADS; i++) {
+		CHUNK_COUNTS[i] = DictCreate();
+		JOB_COUNTS[i] = CombinerCreate(MEMORY_BUDGET / NUM_THREADS, NULL);
+		CombinerSetCombine(JOB_COUNTS[i], JOB->combine);
+		JOB_SKETCH[i] = TOPK_COUNTERS > 0 ? TopKCreate(TOPK_COUNTERS) : NULL;
+		REGISTERS[i] = HLL_PRECISION > 0 ? HllCreate(HLL_PRECISION) : NULL;
+		JOB_INDEX[i] = INDEX_MODE ? PostingsCreate() : NULL;
 	}
+	SHIPPED_BYTES = SHIPPED_FRAMES = 0;
+
+	while ((status = RecvFrameHeader(sock, &header)) > 0) {
+
+		if (header.type == FRAME_END) {
+			/* Everything before this frame has been handled; the reducers */
+			/* have merged our counts by the time SendToReducer returns */
+			SendToReducer();
+			Log(LOG_INFO, "Shipped %llu bytes in %llu result frames.\n", SHIPPED_BYTES, SHIPPED_FRAMES);
+			if (LOG_LEVEL >= LOG_DEBUG) MetricsWrite(stdout);
+			fflush(stdout);
+			if (SendFrame(sock, FRAME_END, header.seq, NULL, 0) < 1) {
+				fprintf(stderr, "Failed to acknowledge end of job.\n");
+			}
+			break;
+		}
+
+		if (header.type == FRAME_COMMIT || header.type == FRAME_ABORT) {
+			/* Decisions for chunks we no longer hold are stale early aborts */
+			if (holding && header.seq == held_seq) {
+				if (header.type == FRAME_COMMIT) {
+					CommitChunk();
+					if (FLUSH_THRESHOLD > 0 && JobSize() >= FLUSH_THRESHOLD) {
+						SendToReducer();
+						/* so the driver need not rerun those chunks if we die */
+						SendFrame(sock, FRAME_FLUSHED, 0, NULL, 0);
+					}
+				} else {
+					DropChunk();
+					MetricsCount(M_CHUNKS_DROPPED, 1);
+				}
+				holding = 0;
+			}
+			continue;
+		}
 
-	/* Do the following while data is still coming in */
-	if (received > 0) {
+		if (header.type != FRAME_CHUNK) {
+			fprintf(stderr, "Unexpected frame type %u from Driver.\n", header.type);
+			break;
+		}
 
-		/* Gets the bytes received, add a terminating null byte */
-		fprintf(stdout, "Received %d bytes from Driver ...\n", received);		
-		buffer[received] = '\0';
-	
-		// fprintf(stdout, "Received this: \n");
-		// fprintf(stdout, "%s\n", buffer);
+		/* Grow the receive buffer to fit the chunk plus a terminating null byte */
+		if (header.length + 1 > capacity) {
+			capacity = header.length + 1;
+			if ((buffer = realloc(buffer, capacity)) == NULL) {
+				Die("Failed to allocate receive buffer.");
+			}
+		}
 
-		fprintf(stdout, "Normalize data and counting words ...\n");
-		/* Normalizer string by removing punctuation and lower casing */
-		NormalizeText(buffer);
+		/* Keep receiving until the whole chunk has arrived */
+		start = MetricsNow();
+		if ((status = RecvAll(sock, buffer, header.length)) < 1) {
+			break;
+		}
+		MetricsRecord(H_RECV, MetricsNow() - start);
+		MetricsCount(M_BYTES_IN, header.length);
+		MetricsCount(M_FRAMES_IN, 1);
+		buffer[header.length] = '\0';
+		Log(LOG_DEBUG, "Received chunk %u (%lu bytes) from Driver ...\n", header.seq, (unsigned long) header.length);
+
+		Log(LOG_DEBUG, "Normalize data and counting words ...\n");
+		holding = CountChunk(sock, header.seq, buffer, header.length);
+		held_seq = header.seq;
+		if (!holding) {
+			Log(LOG_DEBUG, "Chunk %u cancelled by Driver.\n", header.seq);
+			MetricsCount(M_CHUNKS_DROPPED, 1);
+			DropChunk();
+		}
 
-		/* and then send off for insertion into word count */
-		AddToDict(buffer);
-		// fprintf(stdout, "Added to dictionary. Checking if more data is received...\n");
+		/* Report back; this is also the request for the next chunk */
+		if (SendFrame(sock, FRAME_DONE, header.seq, NULL, 0) < 1) {
+			status = -1;
+			break;
+		}
 	}
 
+	if (status < 0) {
+		fprintf(stderr, "Connection to Driver failed mid-frame.\n");
+	}
+
+	/* Counts not sent by now are dropped with the tables below: once the */
+	/* driver loses us, it reruns every chunk we committed since our last */
+	/* send, so sending them as well would count those chunks twice */
 	close(sock);
+	free(buffer);
+
+	/* Destroy word counts and free up memory and run files */
+	for (i = 0; i < NUM_THREADS; i++) {
+		DictDestroy(CHUNK_COUNTS[i]);
+		CombinerDestroy(JOB_COUNTS[i]);
+		if (JOB_SKETCH[i] != NULL) TopKDestroy(JOB_SKETCH[i]);
+		if (REGISTERS[i] != NULL) HllDestroy(REGISTERS[i]);
+		if (JOB_INDEX[i] != NULL) PostingsDestroy(JOB_INDEX[i]);
+	}
+}
 
-	dict_rep = DictStringEncode(WORD_DICT);
+/* Count the words of a chunk into CHUNK_COUNTS. The chunk is cut into
+ * blocks that map threads take one at a time; between blocks the calling
+ * thread checks whether the driver has cancelled the chunk because a
+ * backup copy already finished. Returns 0 if cancelled. */
+int CountChunk(int sock, uint32_t seq, char * buf, size_t len) {
+	char * p = buf, * end = buf + len;
+	uint64_t start;
 
-	int reducer_sock;  
-	struct sockaddr_in reducer;
+	if (DELAY_MS > 0 && WaitForAbort(sock, seq, DELAY_MS)) {
+		return 0;
+	}
 
-	/* Create the TCP socket */
-	if ((reducer_sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
-		Die("Failed to create socket");
+	if (len / MAP_BLOCK + 1 > TASK.capacity) {
+		TASK.capacity = len / MAP_BLOCK + 1;
+		if ((TASK.stops = realloc(TASK.stops, TASK.capacity * sizeof(char *))) == NULL) {
+			Die("Failed to allocate block list.");
+		}
 	}
 
-	/* Construct the server sockaddr_in structure */
-	memset(&reducer, 0, sizeof(reducer));       /* Clear struct */
-	reducer.sin_family = AF_INET;                  /* Internet/IP */
-	reducer.sin_addr.s_addr = inet_addr(REDUCER_IP);  /* IP address */
-	reducer.sin_port = htons(atoi(REDUCER_PORT));       /* server port */
+	/* Blocks end on a delimiter, so no word straddles two of them */
+	TASK.nblocks = 0;
+	while (p < end) {
+		p = end - p > MAP_BLOCK ? (char *) FindDelimiter(p + MAP_BLOCK, end) : end;
+		TASK.stops[TASK.nblocks++] = p;
+	}
+	TASK.start = buf;
+	TASK.next = 0;
+	TASK.cancelled = 0;
+	TASK.sock = sock;
+	TASK.seq = seq;
+
+	start = MetricsNow();
+	RunOnThreads(TASK.nblocks < (size_t) NUM_THREADS ? (int) TASK.nblocks : NUM_THREADS, MapThread);
+	MetricsRecord(H_COUNT, MetricsNow() - start);
+	if (!TASK.cancelled) MetricsCount(M_CHUNKS, 1);
+
+	return !TASK.cancelled;
+}
 
-	/* Establish connection */
-	if (connect(reducer_sock, (struct sockaddr *) &reducer, sizeof(reducer)) < 0) {
-		Die("Failed to connect with server");
+/* Run fn on n threads, passing each its index; index 0 runs on the */
+/* calling thread. Returns once all of them have returned. */
+void RunOnThreads(int n, void * (*fn)(void *)) {
+	pthread_t tid[MAX_THREADS];
+	int i;
+
+	for (i = 1; i < n; i++) {
+		if (pthread_create(&tid[i], NULL, fn, (void *) (intptr_t) i) != 0) {
+			Die("Failed to start map thread");
+		}
 	}
+	fn((void *) 0);
+	for (i = 1; i < n; i++) {
+		pthread_join(tid[i], NULL);
+	}
+}
+
+/* Take blocks of TASK until there are none left or the chunk is cancelled */
+void * MapThread(void * arg) {
+	int id = (int) (intptr_t) arg;
+	struct emit_batch out;
+	size_t b;
+	char * from;
+	uint64_t start;
+
+	/* Registers go straight into the job: taking a maximum is */
+	/* idempotent, so a chunk that is later aborted (its other copy */
+	/* having been committed) or counted twice changes nothing */
+	out.n = 0;
+	out.unhashed = 0;
+	if (HLL_PRECISION > 0) {
+		out.drain = NoteRecords;
+		out.arg = REGISTERS[id];
+	} else {
+		out.drain = CountRecords;
+		out.arg = CHUNK_COUNTS[id];
+	}
+
+	while (!__atomic_load_n(&TASK.cancelled, __ATOMIC_RELAXED) &&
+	       (b = __atomic_fetch_add(&TASK.next, 1, __ATOMIC_RELAXED)) < TASK.nblocks) {
+		from = b == 0 ? TASK.start : TASK.stops[b - 1];
+		start = MetricsNow();
 
-	/* Tell the driver the size of the encoded dict that we are going to send it */
-	long int encoded_dict_length = strlen(dict_rep);
+		/* For word count: lowercase, strip punctuation and count the */
+		/* words in one pass */
+		JOB->map(from, TASK.stops[b] - from, &out);
+		EmitFlush(&out);
+		MetricsRecord(H_TOKENIZE, MetricsNow() - start);
 
-	int converted_length = htonl(encoded_dict_length);
-	if (send(reducer_sock, &converted_length, sizeof(converted_length), 0) == 0) {
-		Die("Failed to send size of encoded dict.");
+		/* Only the calling thread reads from the driver */
+		if (id == 0 && b + 1 < TASK.nblocks && WaitForAbort(TASK.sock, TASK.seq, 0)) {
+			__atomic_store_n(&TASK.cancelled, 1, __ATOMIC_RELAXED);
+		}
 	}
-	fprintf(stdout, "Sending a dict string of size %lu\n", encoded_dict_length);
+	return NULL;
+}
 
-	/* Now send the actual encoded dict */
-	if (send(reducer_sock, dict_rep, encoded_dict_length, 0) == 0) {
-		Die("Failed to send bytes to client");
+/* Fold every map thread's counts of the held chunk into its job counts */
+void CommitChunk() {
+	uint64_t start = MetricsNow();
+	int i, used = 0;
+
+	for (i = 0; i < NUM_THREADS; i++) {
+		if (DictSize(CHUNK_COUNTS[i]) > 0) used = i + 1;
 	}
+	RunOnThreads(used, FoldThread);
+	MetricsRecord(H_COMMIT, MetricsNow() - start);
+	NoteJobSize();
+}
 
-	free(dict_rep);
+void * FoldThread(void * arg) {
+	int id = (int) (intptr_t) arg;
+
+	if (DictSize(CHUNK_COUNTS[id]) > 0) {
+		if (id == 0 && TASK.seq % PROBE_SAMPLE == 0) {
+			NoteProbeLengths(CHUNK_COUNTS[id]);
+		}
+		if (TOPK_COUNTERS > 0) {
+			DictForEach(CHUNK_COUNTS[id], AddToSketch, JOB_SKETCH[id]);
+		} else if (INDEX_MODE) {
+			DictForEach(CHUNK_COUNTS[id], AddToIndex, JOB_INDEX[id]);
+		} else {
+			DictForEach(CHUNK_COUNTS[id], AddToJob, JOB_COUNTS[id]);
+		}
+		DictDestroy(CHUNK_COUNTS[id]);
+		CHUNK_COUNTS[id] = DictCreate();
+	}
+	return NULL;
 }
 
-void AddToDict(char * buf) {
-	char * token, * cp;
+/* Forget the held chunk */
+void DropChunk() {
+	int i;
 
-	token = strtok(buf, " \n");
-	while (token != NULL)
-	{
-		int len = strlen(token);
-		token[len] = '\0';
+	for (i = 0; i < NUM_THREADS; i++) {
+		if (DictSize(CHUNK_COUNTS[i]) > 0) {
+			DictDestroy(CHUNK_COUNTS[i]);
+			CHUNK_COUNTS[i] = DictCreate();
+		}
+	}
+}
+
+/* Bytes held by the job counts (or posting lists) of all map threads */
+size_t JobSize() {
+	size_t size = 0;
+	int i;
+
+	for (i = 0; i < NUM_THREADS; i++) {
+		size += INDEX_MODE ? PostingsMemory(JOB_INDEX[i]) : CombinerSize(JOB_COUNTS[i]);
+	}
+	return size;
+}
 
-		// printf ("%s is a string of length %d\n", token, len);
-		int token_value = DictSearch(WORD_DICT, token);
-		if (token_value == 0) {
-			// fprintf(stdout, "Word is not in dictionary. Adding it. \n");
-			DictInsert(WORD_DICT, token, 1);
+/* Report the size of the job counts held, as gauges */
+void NoteJobSize() {
+	size_t keys = 0, bytes = 0;
+	int i;
+
+	for (i = 0; i < NUM_THREADS; i++) {
+		if (TOPK_COUNTERS > 0) {
+			keys += TopKSize(JOB_SKETCH[i]);
+			bytes += TopKMemory(JOB_SKETCH[i]);
+		} else if (INDEX_MODE) {
+			keys += PostingsSize(JOB_INDEX[i]);
+			bytes += PostingsMemory(JOB_INDEX[i]);
 		} else {
-			// fprintf(stdout, "Word already exists!\n");
-			DictDelete(WORD_DICT, token);
-			DictInsert(WORD_DICT, token, token_value + 1);
-		}
-		token = strtok (NULL, " \n");
-	}
-}
-
-void NormalizeText(char * p) {
-
-    char *src = p, *dst = p;
-
-    while (*src)
-    {
-       if (ispunct((unsigned char)*src))
-       {
-          /* Skip this character */
-          src++;
-       }
-       else if (isupper((unsigned char)*src))
-       {
-          /* Make it lowercase */
-          *dst++ = tolower((unsigned char)*src);
-          src++;
-       }
-       else if (src == dst)
-       {
-          /* Increment both pointers without copying */
-          src++;
-          dst++;
-       }
-       else if ((unsigned char)*src == '\n')
-       {
-       	  *dst++ = ' ';
-       	  src++;
-       }
-       else
-       {
-          /* Copy character */
-          *dst++ = *src++;
-       }
-    }
-
-    *dst = 0;
+			keys += DictSize(CombinerDict(JOB_COUNTS[i]));
+			bytes += CombinerSize(JOB_COUNTS[i]);
+		}
+	}
+	MetricsGauge(G_DICT_KEYS, keys);
+	MetricsGauge(G_DICT_BYTES, bytes);
+}
+
+/* Report how far keys of a chunk's counts sit from their home slots; */
+/* longer distances than PROBE_BUCKETS count as the last bucket */
+void NoteProbeLengths(Dict d) {
+	long counts[PROBE_BUCKETS];
+	double total = 0;
+	int longest, i;
+
+	longest = DictProbeHistogram(d, counts, PROBE_BUCKETS);
+	for (i = 0; i < PROBE_BUCKETS; i++) {
+		total += (double) i * counts[i];
+	}
+	MetricsGauge(G_PROBE_MEAN, total / DictSize(d));
+	MetricsGauge(G_PROBE_MAX, longest);
+}
+
+/* Merge JOB_COUNTS[i + MERGE_STEP] into JOB_COUNTS[i] (or the sketches, */
+/* or the posting lists) */
+/* for the i this thread owns in the current round of the tree */
+void * MergeThread(void * arg) {
+	int dst = (int) (intptr_t) arg * 2 * MERGE_STEP;
+	int src = dst + MERGE_STEP;
+
+	if (src < NUM_THREADS && HLL_PRECISION > 0) {
+		HllMerge(REGISTERS[dst], REGISTERS[src]);
+		HllReset(REGISTERS[src]);
+	} else if (src < NUM_THREADS && TOPK_COUNTERS > 0) {
+		TopKMerge(JOB_SKETCH[dst], JOB_SKETCH[src]);
+		TopKReset(JOB_SKETCH[src]);
+	} else if (src < NUM_THREADS && INDEX_MODE) {
+		PostingsAbsorb(JOB_INDEX[dst], JOB_INDEX[src]);
+	} else if (src < NUM_THREADS && CombinerFlush(JOB_COUNTS[src], MergeEntry, JOB_COUNTS[dst]) != 0) {
+		Die("Failed to merge thread counts");
+	}
+	return NULL;
+}
+
+/* Wait up to timeout_ms for the driver to cancel chunk seq; returns 1 if
+ * it did (or the connection broke), 0 once the time is up */
+int WaitForAbort(int sock, uint32_t seq, int timeout_ms) {
+	struct pollfd pfd;
+	struct frame_header header;
+	struct timespec now, deadline;
+	int left = timeout_ms;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+
+	pfd.fd = sock;
+	pfd.events = POLLIN;
+
+	while (poll(&pfd, 1, left) > 0) {
+		/* While a chunk is being counted the driver only sends aborts */
+		if (RecvFrameHeader(sock, &header) < 1 || header.type != FRAME_ABORT) {
+			return 1;
+		}
+		if (header.seq == seq) {
+			return 1;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		left = (deadline.tv_sec - now.tv_sec) * 1000 + (deadline.tv_nsec - now.tv_nsec) / 1000000;
+		if (left <= 0) break;
+	}
+	return 0;
+}
+
+struct result_stream {
+	int socks[MAX_REDUCERS];
+	struct dict_encoder enc[MAX_REDUCERS];
+};
+
+/* Send one frame of results, accounting for its bytes and the time */
+/* spent sending it; returns 0, or -1 if the reducer went away */
+int ShipFrame(int sock, uint32_t type, const void * payload, size_t length) {
+	uint64_t start = MetricsNow();
+
+	if (SendFrame(sock, type, 0, payload, length) < 1) {
+		return -1;
+	}
+	SEND_NS += MetricsNow() - start;
+	SHIPPED_BYTES += length;
+	SHIPPED_FRAMES++;
+	MetricsCount(M_BYTES_OUT, length);
+	MetricsCount(M_FRAMES_OUT, 1);
+	return 0;
+}
+
+/* Send what partition r has gathered so far as one result frame */
+int SendResultFrame(struct result_stream * rs, int r) {
+	const char * frame;
+	size_t length;
+
+	if ((frame = DictEncoderFinish(&rs->enc[r], &length)) == NULL ||
+	    ShipFrame(rs->socks[r], FRAME_RESULT, frame, length) < 0) {
+		return -1;
+	}
+	Log(LOG_DEBUG, "Sent an encoded dict of size %lu to reducer %d\n", (unsigned long) length, r);
+	DictEncoderReset(&rs->enc[r]);
+	return 0;
+}
+
+/* Called by the combiner for each merged key, in key order */
+int StreamEntry(const char * key, unsigned int len, int value, void * arg) {
+	struct result_stream * rs = arg;
+	int r = KeyPartition(key, len, NUM_REDUCERS);
+
+	if (DictEncoderAdd(&rs->enc[r], key, len, value) < 0) {
+		return -1;
+	}
+	if (DictEncoderSize(&rs->enc[r]) >= RESULT_FRAME_SIZE) {
+		return SendResultFrame(rs, r);
+	}
+	return 0;
+}
+
+/* Partition the job's counts by key hash and send each partition to */
+/* the reducer that owns it, then start afresh. Returns once every */
+/* reducer has acknowledged merging what it was sent. */
+void SendToReducer() {
+	struct result_stream rs;
+	struct frame_header ack;
+	char * parts[MAX_REDUCERS];
+	size_t lengths[MAX_REDUCERS];
+	Combiner job = JOB_COUNTS[0];
+	uint64_t start, end;
+	int r;
+
+	/* Gather all threads' counts into JOB_COUNTS[0], halving the number */
+	/* of combiners each round with the merges of a round running in parallel */
+	start = MetricsNow();
+	for (MERGE_STEP = 1; MERGE_STEP < NUM_THREADS; MERGE_STEP *= 2) {
+		RunOnThreads((NUM_THREADS + 2 * MERGE_STEP - 1) / (2 * MERGE_STEP), MergeThread);
+	}
+	MetricsRecord(H_MERGE, MetricsNow() - start);
+
+	if (HLL_PRECISION > 0 ? HllEmpty(REGISTERS[0]) :
+	    TOPK_COUNTERS > 0 ? TopKSize(JOB_SKETCH[0]) == 0 :
+	    INDEX_MODE ? PostingsSize(JOB_INDEX[0]) == 0 :
+	    CombinerRuns(job) == 0 && DictSize(CombinerDict(job)) == 0) {
+		return;
+	}
+
+	/* Establish connections */
+	for (r = 0; r < NUM_REDUCERS; r++) {
+		if ((rs.socks[r] = ConnectTo(REDUCER_IPS[r], REDUCER_PORTS[r])) < 0) {
+			Die("Failed to connect with server");
+		}
+	}
+
+	/* What is not spent sending, below, goes to encoding (and merging */
+	/* spilled runs, which is interleaved with it) */
+	MetricsCount(M_FLUSHES, 1);
+	start = MetricsNow();
+	SEND_NS = 0;
+
+	if (HLL_PRECISION > 0) {
+		/* Distinct-word mode: the registers cover every partition and are */
+		/* small, so they all go to the first reducer */
+		if ((parts[0] = HllEncode(REGISTERS[0], &lengths[0])) == NULL) {
+			Die("Failed to encode registers.");
+		}
+		Log(LOG_DEBUG, "Sending %lu bytes of registers to reducer 0\n", (unsigned long) lengths[0]);
+		if (ShipFrame(rs.socks[0], FRAME_REGISTERS, parts[0], lengths[0]) < 0) {
+			Die("Failed to send bytes to client");
+		}
+		free(parts[0]);
+		HllReset(REGISTERS[0]);
+	} else if (TOPK_COUNTERS > 0) {
+		/* Top-K mode: each reducer gets the candidates of its partition */
+		if (TopKEncodePartitioned(JOB_SKETCH[0], NUM_REDUCERS, parts, lengths) < 0) {
+			Die("Failed to encode top-K summary.");
+		}
+
+		for (r = 0; r < NUM_REDUCERS; r++) {
+			Log(LOG_DEBUG, "Sending a top-K summary of size %lu to reducer %d\n", (unsigned long) lengths[r], r);
+			if (ShipFrame(rs.socks[r], FRAME_SKETCH, parts[r], lengths[r]) < 0) {
+				Die("Failed to send bytes to client");
+			}
+			free(parts[r]);
+		}
+		TopKReset(JOB_SKETCH[0]);
+	} else if (INDEX_MODE) {
+		/* Index mode: each reducer gets the posting lists of its partition */
+		if (PostingsEncodePartitioned(JOB_INDEX[0], NUM_REDUCERS, parts, lengths) < 0) {
+			Die("Failed to encode posting lists.");
+		}
+
+		for (r = 0; r < NUM_REDUCERS; r++) {
+			Log(LOG_DEBUG, "Sending posting lists of size %lu to reducer %d\n", (unsigned long) lengths[r], r);
+			if (ShipFrame(rs.socks[r], FRAME_POSTINGS, parts[r], lengths[r]) < 0) {
+				Die("Failed to send bytes to client");
+			}
+			free(parts[r]);
+		}
+		PostingsReset(JOB_INDEX[0]);
+	} else if (CombinerRuns(job) == 0) {
+		/* Everything is in memory: encode each partition in one piece */
+		if (DictEncodePartitioned(CombinerDict(job), CODEC_FLAGS, NUM_REDUCERS, parts, lengths) < 0) {
+			Die("Failed to encode dictionary.");
+		}
+
+		for (r = 0; r < NUM_REDUCERS; r++) {
+			Log(LOG_DEBUG, "Sending an encoded dict of size %lu to reducer %d\n", (unsigned long) lengths[r], r);
+
+			/* Send the encoded partition as a single frame */
+			if (ShipFrame(rs.socks[r], FRAME_RESULT, parts[r], lengths[r]) < 0) {
+				Die("Failed to send bytes to client");
+			}
+			free(parts[r]);
+		}
+		CombinerReset(job);
+	} else {
+		/* Counts were spilled: stream the merged runs out in bounded frames */
+		Log(LOG_DEBUG, "Merging %d spilled runs\n", CombinerRuns(job));
+		for (r = 0; r < NUM_REDUCERS; r++) {
+			DictEncoderInit(&rs.enc[r], CODEC_FLAGS);
+		}
+
+		if (CombinerFlush(job, StreamEntry, &rs) != 0) {
+			Die("Failed to merge and send spilled counts");
+		}
+
+		for (r = 0; r < NUM_REDUCERS; r++) {
+			if (DictEncoderCount(&rs.enc[r]) > 0 && SendResultFrame(&rs, r) < 0) {
+				Die("Failed to send bytes to client");
+			}
+			DictEncoderFree(&rs.enc[r]);
+		}
+	}
+
+	/* The reducer echoes END once it has merged everything before it */
+	end = MetricsNow();
+	for (r = 0; r < NUM_REDUCERS; r++) {
+		if (SendFrame(rs.socks[r], FRAME_END, 0, NULL, 0) < 1 ||
+		    RecvFrameHeader(rs.socks[r], &ack) < 1 || ack.type != FRAME_END) {
+			Die("Reducer did not acknowledge results");
+		}
+		close(rs.socks[r]);
+	}
+	MetricsRecord(H_ENCODE, end - start - SEND_NS);
+	MetricsRecord(H_SEND, SEND_NS + MetricsNow() - end);
+	NoteJobSize();
+}
+
+/* Fold a committed chunk's count into a thread's job counts */
+void AddToJob(const char * key, unsigned int len, int value, void * arg) {
+	if (CombinerAdd((Combiner) arg, key, len, value) < 0) {
+		Die("Failed to spill word counts to disk.");
+	}
+}
+
+/* Same, into a thread's top-K summary */
+void AddToSketch(const char * key, unsigned int len, int value, void * arg) {
+	TopKAdd((TopK) arg, key, len, (uint64_t) value);
+}
+
+/* Same, for one merged entry of another thread's job counts */
+int MergeEntry(const char * key, unsigned int len, int value, void * arg) {
+	return CombinerAdd((Combiner) arg, key, len, value);
+}
+
+/* Note that a key of the committed chunk occurs in it; its count is */
+/* not kept */
+void AddToIndex(const char * key, unsigned int len, int value, void * arg) {
+	PostingsAdd((Postings) arg, key, len, TASK.seq);
+}
+
+/* Combine a batch of a chunk's records into the map thread's own Dict */
+void CountRecords(struct emit_batch * b) {
+	JobDrain(b, (Dict) b->arg, JOB->combine);
+}
+
+/* Note the keys of a batch in the map thread's own registers; they need */
+/* the stable hash rather than this process's */
+void NoteRecords(struct emit_batch * b) {
+	size_t i;
+
+	for (i = 0; i < b->n; i++) {
+		HllAdd((HyperLogLog) b->arg, b->records[i].key, b->records[i].len);
+	}
+	b->n = 0;
+	b->unhashed = 0;
 }
 
 void Die(char * mess) { 